@@ -0,0 +1,270 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <thread>
+
+#include <json/json.h>
+
+#include "fmt/format.h"
+
+#include "common/logger.hpp"
+#include "common/pcap_file.hpp"
+
+#include "analyzer.hpp"
+
+using fmt::literals::operator""_format;
+
+namespace pca {
+
+namespace analyze {
+
+analyzer::analyzer(unsigned jobs, uint64_t chunk_size)
+    : jobs_(jobs > 0 ? jobs : 1)
+    , chunk_size_(chunk_size)
+    , flows_(jobs_)
+    , elapsed_(0)
+{
+}
+
+/**
+ * Split the files into chunks at record boundaries.
+ */
+bool analyzer::plan()
+{
+    tasks_.clear();
+
+    for (unsigned i = 0; i < files_.size(); i++) {
+        pcap::reader reader;
+
+        if (!reader.open(files_[i]))
+            continue;
+
+        size_t begin = reader.offset();
+        while (begin < reader.size()) {
+            size_t end = reader.size();
+            if (end - begin > chunk_size_)
+                end = reader.resync(begin + chunk_size_);
+
+            task t;
+            t.file = i;
+            t.begin = begin;
+            t.end = end;
+            tasks_.push_back(std::move(t));
+
+            begin = end;
+        }
+    }
+
+    // biggest first, so the tail of the run is made of small tasks
+    std::stable_sort(tasks_.begin(), tasks_.end(), [](const task& a, const task& b) {
+        return (a.end - a.begin) > (b.end - b.begin);
+    });
+
+    return !tasks_.empty();
+}
+
+void analyzer::process(task& t, context& ctx)
+{
+    pcap::reader reader;
+    packet pkt;
+    flow_key key;
+    uint64_t next_index = 0;
+
+    if (!reader.open(files_[t.file]) || !reader.seek(t.begin))
+        return;
+
+    for (;;) {
+        size_t offset = reader.offset();
+        if (offset >= t.end || !reader.next(&pkt))
+            break;
+
+        if (offset >= next_index) {
+            segment::index_entry entry = { pkt.ts, offset };
+            t.index.push_back(entry);
+            next_index = offset + segment::INDEX_INTERVAL;
+        }
+
+        bool ip = decode::flow_key_of(pkt, &key, reader.linktype());
+        ctx.stats.add(pkt, key);
+        if (ip)
+            ctx.flows.update(key, pkt);
+    }
+}
+
+/**
+ * Analyze pcap files.
+ *
+ * @param input_path the input directory, for naming the indexes.
+ * @param files     pcap files.
+ * @return true on success, false if there is nothing to analyze.
+ */
+bool analyzer::run(const std::string& input_path, const std::vector<std::string>& files)
+{
+    auto begin = std::chrono::steady_clock::now();
+
+    input_path_ = input_path;
+    files_ = files;
+    if (!plan())
+        return false;
+
+    std::vector<std::unique_ptr<context>> contexts;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next(0);
+
+    for (unsigned i = 0; i < jobs_; i++) {
+        contexts.push_back(std::unique_ptr<context>(new context(jobs_)));
+    }
+
+    // decode chunks
+    for (unsigned i = 0; i < jobs_; i++) {
+        threads.push_back(std::thread([this, &contexts, &next, i]() {
+            for (size_t k = next++; k < tasks_.size(); k = next++) {
+                process(tasks_[k], *contexts[i]);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    // merge flows, one partition per thread
+    for (unsigned p = 0; p < jobs_; p++) {
+        threads.push_back(std::thread([this, &contexts, p]() {
+            for (const auto& ctx : contexts) {
+                flows_.merge(ctx->flows, p);
+            }
+        }));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (const auto& ctx : contexts) {
+        stats_.merge(ctx->stats);
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    elapsed_ = elapsed.count();
+
+    return true;
+}
+
+bool analyzer::write_flows(const std::string& filename) const
+{
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr) {
+        logger::error("can't create {}: {}"_format(filename, strerror(errno)));
+        return false;
+    }
+
+    fmt::print(fp, "first_ts,last_ts,protocol,src_addr,src_port,dst_addr,dst_port,"
+               "packets_fwd,packets_rev,bytes_fwd,bytes_rev\n");
+    for (const auto& rec : flows_.records()) {
+        fmt::print(fp, "{},{},{},{},{},{},{},{},{},{},{}\n",
+                   rec.first_ts, rec.last_ts, rec.key.protocol,
+                   address_to_string(rec.key, rec.key.src_addr), rec.key.src_port,
+                   address_to_string(rec.key, rec.key.dst_addr), rec.key.dst_port,
+                   rec.packets[0], rec.packets[1], rec.bytes[0], rec.bytes[1]);
+    }
+
+    return fclose(fp) == 0;
+}
+
+bool analyzer::write_stats(const std::string& filename) const
+{
+    Json::Value root(Json::objectValue);
+    Json::StyledWriter writer;
+
+    root["files"] = static_cast<Json::UInt64>(files_.size());
+    root["tasks"] = static_cast<Json::UInt64>(tasks_.size());
+    root["jobs"] = jobs_;
+    root["elapsed"] = elapsed_;
+    root["packets"] = static_cast<Json::UInt64>(stats_.packets);
+    root["bytes"] = static_cast<Json::UInt64>(stats_.bytes);
+    root["ipv4"] = static_cast<Json::UInt64>(stats_.ipv4);
+    root["ipv6"] = static_cast<Json::UInt64>(stats_.ipv6);
+    root["tcp"] = static_cast<Json::UInt64>(stats_.tcp);
+    root["udp"] = static_cast<Json::UInt64>(stats_.udp);
+    root["non_ip"] = static_cast<Json::UInt64>(stats_.non_ip);
+    root["flows"] = static_cast<Json::UInt64>(flows_.size());
+    if (stats_.packets > 0) {
+        root["first_ts"] = static_cast<Json::UInt64>(stats_.first_ts);
+        root["last_ts"] = static_cast<Json::UInt64>(stats_.last_ts);
+    }
+
+    std::ofstream out(filename);
+    out << writer.write(root);
+
+    return out.good();
+}
+
+bool analyzer::write_indexes(const std::string& dir) const
+{
+    std::vector<std::vector<segment::index_entry>> indexes(files_.size());
+
+    for (const auto& t : tasks_) {
+        indexes[t.file].insert(indexes[t.file].end(), t.index.begin(), t.index.end());
+    }
+
+    for (unsigned i = 0; i < files_.size(); i++) {
+        auto& index = indexes[i];
+        std::sort(index.begin(), index.end(), [](const segment::index_entry& a, const segment::index_entry& b) {
+            return a.offset < b.offset;
+        });
+
+        // name after the path relative to the input directory
+        std::string name = files_[i].substr(std::min(files_[i].size(), input_path_.size()));
+        name.erase(0, name.find_first_not_of('/'));
+        std::replace(name.begin(), name.end(), '/', '_');
+
+        std::string filename = dir + "/" + segment::index_path_of(name);
+        FILE* fp = fopen(filename.c_str(), "wb");
+        if (fp == nullptr) {
+            logger::error("can't create {}: {}"_format(filename, strerror(errno)));
+            return false;
+        }
+        fwrite(index.data(), sizeof(segment::index_entry), index.size(), fp);
+        fclose(fp);
+    }
+
+    return true;
+}
+
+/**
+ * Write flow records (flows.csv), statistics (stats.json) and the timestamp
+ * indexes of the files (index/).
+ *
+ * @param output_path an output directory.
+ * @return true on success, false otherwise.
+ */
+bool analyzer::write(const std::string& output_path) const
+{
+    std::string index_dir = output_path + "/index";
+
+    mkdir(output_path.c_str(), 0755);
+    if (mkdir(index_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        logger::error("can't create {}: {}"_format(index_dir, strerror(errno)));
+        return false;
+    }
+
+    return write_flows(output_path + "/flows.csv")
+        && write_stats(output_path + "/stats.json")
+        && write_indexes(index_dir);
+}
+
+}  // namespace analyze
+
+}  // namespace pca
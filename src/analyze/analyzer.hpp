@@ -0,0 +1,85 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/flow.hpp"
+#include "common/segment.hpp"
+
+namespace pca {
+
+namespace analyze {
+
+/**
+ * Batch analysis of archived pcap files.
+ *
+ * The files are split into chunks at record boundaries, the chunks are
+ * decoded by a pool of threads into per-thread flow tables, and the tables
+ * are merged one hash partition per thread.
+ */
+class analyzer {
+public:
+    analyzer(unsigned jobs, uint64_t chunk_size);
+
+    bool run(const std::string& input_path, const std::vector<std::string>& files);
+    bool write(const std::string& output_path) const;
+
+    const traffic_stats& stats() const;
+    const flow_table& flows() const;
+    size_t tasks() const;
+
+private:
+    struct task {
+        unsigned file;
+        size_t begin;
+        size_t end;
+        std::vector<segment::index_entry> index;
+    };
+
+    struct context {
+        flow_table flows;
+        traffic_stats stats;
+
+        explicit context(unsigned partitions) : flows(partitions) {}
+    };
+
+    bool plan();
+    void process(task& t, context& ctx);
+    bool write_flows(const std::string& filename) const;
+    bool write_stats(const std::string& filename) const;
+    bool write_indexes(const std::string& dir) const;
+
+    unsigned jobs_;
+    uint64_t chunk_size_;
+    std::string input_path_;
+    std::vector<std::string> files_;
+    std::vector<task> tasks_;
+    flow_table flows_;
+    traffic_stats stats_;
+    double elapsed_;
+};
+
+inline const traffic_stats& analyzer::stats() const
+{
+    return stats_;
+}
+
+inline const flow_table& analyzer::flows() const
+{
+    return flows_;
+}
+
+inline size_t analyzer::tasks() const
+{
+    return tasks_.size();
+}
+
+}  // namespace analyze
+
+}  // namespace pca
@@ -0,0 +1,51 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/logger.hpp"
+#include "common/replay.hpp"
+
+#include "fmt/format.h"
+
+#include "analyzer.hpp"
+#include "options.hpp"
+
+using fmt::literals::operator""_format;
+
+int main(int argc, char *argv[])
+{
+    using namespace pca;
+    using pca::analyze::options;
+
+    setenv("TZ", "UTC", 1);
+
+    if (!options::parse_cmdline(argc, argv))
+        return 1;
+
+    std::vector<std::string> files;
+    if (!replay::list_files(options::input_path, &files) || files.empty()) {
+        logger::fatal("No pcap file in {}"_format(options::input_path));
+        return 1;
+    }
+
+    analyze::analyzer analyzer(options::analyze_jobs,
+                               static_cast<uint64_t>(options::analyze_chunk_size_mb) * 1024 * 1024);
+    if (!analyzer.run(options::input_path, files)) {
+        logger::fatal("Nothing to analyze in {}"_format(options::input_path));
+        return 1;
+    }
+
+    if (!analyzer.write(options::output_path)) {
+        logger::fatal("Can't write results to {}"_format(options::output_path));
+        return 1;
+    }
+
+    logger::info("analyzed {} files in {} tasks: {} packets, {} bytes, {} flows"_format(
+        files.size(), analyzer.tasks(), analyzer.stats().packets, analyzer.stats().bytes,
+        analyzer.flows().size()));
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#include "fmt/format.h"
+
+#include "common/cmdline.hpp"
+#include "common/logger.hpp"
+
+#include "options.hpp"
+
+using fmt::literals::operator""_format;
+
+namespace pca {
+
+namespace analyze {
+
+static void show_help(const char *progname);
+
+std::vector<std::string> options::args;
+
+unsigned options::debug_level = 0;
+
+int options::analyze_jobs = std::max(1U, std::thread::hardware_concurrency());
+int options::analyze_chunk_size_mb = 256;
+std::string options::input_path;
+std::string options::output_path;
+
+bool options::parse_cmdline(int argc, char *argv[])
+{
+    const char* progname = argv[0];
+
+    MAKE_CLI_PARSER_WITH_ANALYZE();
+
+    if (argc != 3) {
+        show_help(progname);
+        return false;
+    }
+
+    input_path = argv[1];
+    output_path = argv[2];
+
+    return true;
+}
+
+bool options::parse_config(const char* filename)
+{
+    static std::map<std::string, xa::yaml::fn_body> yaml_settings = {
+        DEBUG_COMMON_ENUM()
+    };
+
+    xa::yaml::node config;
+
+    return config.load_settings(filename, yaml_settings);
+}
+
+static void show_help(const char *progname)
+{
+    printf("Usage: %s [OPTIONS...] INPUT_DIR OUTPUT_DIR\n\n", progname);
+    printf("Analyze archived pcap files in parallel\n\n");
+
+    MAKE_CLI_HELP_WITH_ANALYZE();
+}
+
+}  // namespace analyze
+
+}  // namespace pca
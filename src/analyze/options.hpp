@@ -0,0 +1,38 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+
+#include "common/yaml.hpp"
+
+namespace pca {
+
+namespace analyze {
+
+class options {
+public:
+    static std::vector<std::string> args;
+
+    // debug
+    static unsigned debug_level;
+
+    // analyze
+    static int analyze_jobs;
+    static int analyze_chunk_size_mb;
+    static std::string input_path;
+    static std::string output_path;
+
+public:
+    static bool parse_cmdline(int argc, char *argv[]);
+
+protected:
+    static bool parse_config(const char* filename);
+};
+
+}  // namespace analyze
+
+}  // namespace pca
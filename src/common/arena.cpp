@@ -0,0 +1,87 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Arena Allocator API documentation.
+ */
+
+/**
+ * @file arena.cpp
+ *
+ * @brief      Xabyss's Arena Allocator library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+
+#include "arena.hpp"
+
+namespace xa {
+
+arena::arena(size_t block_size)
+    : current_(0)
+    , pos_(nullptr)
+    , end_(nullptr)
+    , block_size_(std::max<size_t>(block_size, 256))
+    , used_(0)
+{
+}
+
+// the next block kept that fits, a new one otherwise
+void* arena::allocate_slow(size_t size, size_t align)
+{
+    size_t next = pos_ == nullptr ? 0 : current_ + 1;
+
+    for (; next < blocks_.size(); next++) {
+        if (blocks_[next].size >= size + align)
+            break;
+    }
+
+    if (next == blocks_.size()) {
+        block b;
+
+        // the blocks double up to a point, big requests get a block of their own
+        b.size = std::max(size + align, blocks_.empty() ? block_size_
+                          : std::min(blocks_.back().size * 2, block_size_ * 64));
+        b.data = std::unique_ptr<uint8_t[]>(new uint8_t[b.size]);
+        blocks_.push_back(std::move(b));
+    } else if (next != current_ + 1 && pos_ != nullptr) {
+        // keep the blocks in the order they are used
+        std::swap(blocks_[next], blocks_[current_ + 1]);
+        next = current_ + 1;
+    }
+
+    current_ = next;
+    pos_ = blocks_[current_].data.get();
+    end_ = pos_ + blocks_[current_].size;
+
+    return allocate(size, align);
+}
+
+/**
+ * Free everything at once, the blocks are kept for what comes next.
+ */
+void arena::reset()
+{
+    current_ = 0;
+    pos_ = blocks_.empty() ? nullptr : blocks_[0].data.get();
+    end_ = blocks_.empty() ? nullptr : pos_ + blocks_[0].size;
+    used_ = 0;
+}
+
+size_t arena::capacity() const
+{
+    size_t n = 0;
+
+    for (const auto& b : blocks_) {
+        n += b.size;
+    }
+
+    return n;
+}
+
+}  // namespace xa
@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Arena Allocator API documentation.
+ */
+
+/**
+ * @file arena.hpp
+ *
+ * @brief      Xabyss's Arena Allocator library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xa {
+
+/**
+ * A monotonic allocator: allocations are bumped out of blocks and freed all
+ * at once by reset(), which keeps the blocks for the next round.
+ */
+class arena {
+public:
+    explicit arena(size_t block_size = 16384);
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+    void reset();
+
+    template <class T>
+    T* allocate_array(size_t n);
+
+    size_t used() const;        // bytes handed out since the last reset
+    size_t capacity() const;    // bytes of the blocks kept
+    size_t blocks() const;
+
+private:
+    struct block {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    void* allocate_slow(size_t size, size_t align);
+
+    std::vector<block> blocks_;
+    size_t current_;            // the block allocated from
+    uint8_t* pos_;
+    uint8_t* end_;
+    size_t block_size_;
+    size_t used_;
+};
+
+/**
+ * A standard allocator over an arena, for containers whose memory goes with
+ * the arena: deallocate() does nothing, reset() frees it all.
+ */
+template <class T>
+class arena_allocator {
+public:
+    typedef T value_type;
+
+    explicit arena_allocator(arena* a) : arena_(a) {}
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other) : arena_(other.get()) {}
+
+    T* allocate(size_t n) { return arena_->allocate_array<T>(n); }
+    void deallocate(T*, size_t) {}
+
+    arena* get() const { return arena_; }
+
+private:
+    arena* arena_;
+};
+
+template <class T, class U>
+inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+    return a.get() == b.get();
+}
+
+template <class T, class U>
+inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b)
+{
+    return a.get() != b.get();
+}
+
+inline void* arena::allocate(size_t size, size_t align)
+{
+    uintptr_t p = (reinterpret_cast<uintptr_t>(pos_) + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+
+    if (pos_ == nullptr || p + size > reinterpret_cast<uintptr_t>(end_))
+        return allocate_slow(size, align);
+
+    pos_ = reinterpret_cast<uint8_t*>(p + size);
+    used_ += size;
+
+    return reinterpret_cast<void*>(p);
+}
+
+template <class T>
+inline T* arena::allocate_array(size_t n)
+{
+    return static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+}
+
+inline size_t arena::used() const
+{
+    return used_;
+}
+
+inline size_t arena::blocks() const
+{
+    return blocks_.size();
+}
+
+}  // namespace xa
@@ -0,0 +1,945 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Binary JSON API documentation.
+ */
+
+/**
+ * @file binary_json.cpp
+ *
+ * @brief      Xabyss's Binary JSON library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <cmath>
+#include <limits>
+
+#include "binary_json.hpp"
+
+namespace xa {
+
+namespace json {
+
+constexpr static const int MAX_DEPTH = 64;
+
+/**
+ * Tell the format of a media type, parameters and all.
+ *
+ * @param media_type    a Content-Type or an item of Accept, say.
+ * @param n             its length.
+ * @param f             the format to be filled.
+ * @return true if it is one of ours, false otherwise.
+ */
+bool format_of(const char* media_type, size_t n, format* f)
+{
+    static const struct {
+        const char* name;
+        format f;
+    } types[] = {
+        { "application/json", FORMAT_JSON },
+        { "application/cbor", FORMAT_CBOR },
+        { "application/msgpack", FORMAT_MSGPACK },
+        { "application/x-msgpack", FORMAT_MSGPACK },
+        { "application/vnd.msgpack", FORMAT_MSGPACK },
+    };
+    const char* end = static_cast<const char*>(memchr(media_type, ';', n));
+
+    if (end == nullptr)
+        end = media_type + n;
+    while (media_type < end && (*media_type == ' ' || *media_type == '\t')) {
+        media_type++;
+    }
+    while (end > media_type && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+
+    size_t len = end - media_type;
+    for (const auto& type : types) {
+        if (strlen(type.name) == len && strncasecmp(type.name, media_type, len) == 0) {
+            *f = type.f;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char* media_type(format f)
+{
+    switch (f) {
+    case FORMAT_CBOR:
+        return "application/cbor";
+    case FORMAT_MSGPACK:
+        return "application/msgpack";
+    default:
+        return "application/json";
+    }
+}
+
+// IEEE 754 half precision, RFC 8949 Appendix D
+static double half_to_double(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    double d;
+
+    if (exponent == 0)
+        d = std::ldexp(mantissa, -24);
+    else if (exponent != 31)
+        d = std::ldexp(mantissa + 1024, exponent - 25);
+    else
+        d = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+
+    return half & 0x8000 ? -d : d;
+}
+
+decoder::decoder()
+    : arena_(&own_)
+    , p_(nullptr)
+    , end_(nullptr)
+{
+}
+
+decoder::decoder(xa::arena* arena)
+    : arena_(arena)
+    , p_(nullptr)
+    , end_(nullptr)
+{
+}
+
+/**
+ * Decode a CBOR or MessagePack item.
+ *
+ * @param f         the format of the data.
+ * @param data      the data, kept as long as the values.
+ * @param n         its length.
+ * @return the root value, nullptr if the data is not a valid item.
+ */
+const value* decoder::decode(format f, const char* data, size_t n)
+{
+    reset();
+    p_ = reinterpret_cast<const uint8_t*>(data);
+    end_ = p_ + n;
+
+    value* root = arena_->allocate_array<value>(1);
+    bool ok;
+    if (f == FORMAT_CBOR)
+        ok = decode_cbor(root, 0);
+    else if (f == FORMAT_MSGPACK)
+        ok = decode_msgpack(root, 0);
+    else
+        ok = fail("not a binary format");
+    if (!ok)
+        return nullptr;
+
+    if (p_ != end_) {
+        fail("trailing bytes");
+        return nullptr;
+    }
+
+    return root;
+}
+
+/**
+ * Forget the values of the last decode, keeping the memory.
+ */
+void decoder::reset()
+{
+    if (arena_ == &own_)
+        arena_->reset();
+    stack_.clear();
+    error_.clear();
+}
+
+bool decoder::fail(const char* message)
+{
+    if (error_.empty())
+        error_ = message;
+
+    return false;
+}
+
+inline bool decoder::take(size_t n, const uint8_t** p)
+{
+    if (static_cast<size_t>(end_ - p_) < n)
+        return fail("unexpected end");
+
+    *p = p_;
+    p_ += n;
+
+    return true;
+}
+
+// a big-endian unsigned integer of n bytes
+bool decoder::take_uint(size_t n, uint64_t* out)
+{
+    const uint8_t* p = nullptr;
+
+    if (!take(n, &p))
+        return false;
+
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) {
+        v = (v << 8) | p[i];
+    }
+    *out = v;
+
+    return true;
+}
+
+// numbers are kept as text, in the arena along with the values
+static void set_integer(xa::arena* arena, value* v, bool negative, uint64_t n)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    if (negative)
+        *--p = '-';
+
+    uint32_t len = static_cast<uint32_t>(buf + sizeof(buf) - p);
+    char* text = static_cast<char*>(arena->allocate(len, 1));
+    memcpy(text, p, len);
+
+    v->kind = TYPE_NUMBER;
+    v->text = text;
+    v->len = len;
+}
+
+static void set_double(xa::arena* arena, value* v, double d)
+{
+    char buf[32];
+
+    // JSON has no NaN nor infinities
+    if (!std::isfinite(d)) {
+        v->kind = TYPE_NULL;
+        return;
+    }
+
+    // the shortest text that reads back the same
+    int len = snprintf(buf, sizeof(buf), "%.15g", d);
+    if (strtod(buf, nullptr) != d)
+        len = snprintf(buf, sizeof(buf), "%.17g", d);
+    char* text = static_cast<char*>(arena->allocate(len, 1));
+    memcpy(text, buf, len);
+
+    v->kind = TYPE_NUMBER;
+    v->text = text;
+    v->len = static_cast<uint32_t>(len);
+}
+
+/**
+ * Decode the items of an array or a map, as many as given or up to a break.
+ */
+bool decoder::decode_items(format f, value* v, bool object, uint64_t count, bool indefinite, int depth)
+{
+    bool (decoder::*item)(value*, int) = f == FORMAT_CBOR ? &decoder::decode_cbor : &decoder::decode_msgpack;
+    size_t base = stack_.size();
+
+    // every item takes a byte at least, so a count too big runs out of data
+    for (uint64_t i = 0; indefinite || i < count; i++) {
+        value member, key;
+
+        if (indefinite) {
+            if (p_ >= end_)
+                return fail("unexpected end");
+            if (*p_ == 0xff) {
+                p_++;
+                break;
+            }
+        }
+
+        if (object) {
+            if (!(this->*item)(&key, depth + 1))
+                return false;
+            if (key.kind != TYPE_STRING)
+                return fail("map keys must be strings");
+        }
+        if (!(this->*item)(&member, depth + 1))
+            return false;
+        member.key = object ? key.text : nullptr;
+        member.key_len = object ? key.len : 0;
+        stack_.push_back(member);
+    }
+
+    // as the parser does, the items of nested values went to the arena already
+    size_t n = stack_.size() - base;
+    value* items = arena_->allocate_array<value>(n > 0 ? n : 1);
+    if (n > 0)
+        memcpy(items, &stack_[base], n * sizeof(value));
+    stack_.resize(base);
+
+    v->kind = object ? TYPE_OBJECT : TYPE_ARRAY;
+    v->len = static_cast<uint32_t>(n);
+    v->items = items;
+
+    return true;
+}
+
+// the argument of an initial byte: a value, a length or a count
+bool decoder::cbor_argument(uint8_t info, uint64_t* n)
+{
+    if (info < 24) {
+        *n = info;
+        return true;
+    }
+    if (info > 27)
+        return fail("invalid additional information");
+
+    return take_uint(static_cast<size_t>(1) << (info - 24), n);
+}
+
+bool decoder::cbor_string(uint8_t major, uint8_t info, const char** out, uint32_t* len)
+{
+    uint64_t n;
+    const uint8_t* p = nullptr;
+
+    if (info != 31) {
+        if (!cbor_argument(info, &n))
+            return false;
+        if (n > UINT32_MAX || !take(static_cast<size_t>(n), &p))
+            return fail("unexpected end");
+        *out = reinterpret_cast<const char*>(p);
+        *len = static_cast<uint32_t>(n);
+        return true;
+    }
+
+    // chunks of the same major type up to a break, put together
+    std::vector<std::pair<const uint8_t*, size_t>> chunks;
+    size_t total = 0;
+    for (;;) {
+        if (!take(1, &p))
+            return false;
+        if (*p == 0xff)
+            break;
+        if ((*p >> 5) != major || (*p & 31) == 31)
+            return fail("invalid string chunk");
+        if (!cbor_argument(*p & 31, &n))
+            return false;
+        if (n > UINT32_MAX || !take(static_cast<size_t>(n), &p))
+            return fail("unexpected end");
+        chunks.emplace_back(p, static_cast<size_t>(n));
+        total += n;
+    }
+    if (total > UINT32_MAX)
+        return fail("string too long");
+
+    char* text = static_cast<char*>(arena_->allocate(total > 0 ? total : 1, 1));
+    size_t pos = 0;
+    for (const auto& chunk : chunks) {
+        memcpy(text + pos, chunk.first, chunk.second);
+        pos += chunk.second;
+    }
+    *out = text;
+    *len = static_cast<uint32_t>(total);
+
+    return true;
+}
+
+bool decoder::decode_cbor(value* v, int depth)
+{
+    const uint8_t* p = nullptr;
+    uint64_t n;
+
+    if (depth > MAX_DEPTH)
+        return fail("too deep");
+    if (!take(1, &p))
+        return false;
+
+    uint8_t major = *p >> 5;
+    uint8_t info = *p & 31;
+
+    v->key = nullptr;
+    v->key_len = 0;
+    v->boolean = false;
+    v->len = 0;
+    v->text = nullptr;
+
+    switch (major) {
+    case 0:
+        if (!cbor_argument(info, &n))
+            return false;
+        set_integer(arena_, v, false, n);
+        return true;
+    case 1:
+        // -1 - n, one more than a uint64_t can hold at the end
+        if (!cbor_argument(info, &n))
+            return false;
+        if (n == UINT64_MAX) {
+            v->kind = TYPE_NUMBER;
+            v->text = "-18446744073709551616";
+            v->len = 21;
+        } else {
+            set_integer(arena_, v, true, n + 1);
+        }
+        return true;
+    case 2:
+    case 3:
+        v->kind = TYPE_STRING;
+        return cbor_string(major, info, &v->text, &v->len);
+    case 4:
+    case 5:
+        if (info != 31 && !cbor_argument(info, &n))
+            return false;
+        return decode_items(FORMAT_CBOR, v, major == 5, info == 31 ? 0 : n, info == 31, depth);
+    case 6:
+        // a tag, the item tagged stands for itself
+        if (!cbor_argument(info, &n))
+            return false;
+        return decode_cbor(v, depth + 1);
+    default:
+        break;
+    }
+
+    switch (info) {
+    case 20:
+    case 21:
+        v->kind = TYPE_BOOLEAN;
+        v->boolean = info == 21;
+        return true;
+    case 22:
+    case 23:
+        v->kind = TYPE_NULL;
+        return true;
+    case 25:
+        if (!take_uint(2, &n))
+            return false;
+        set_double(arena_, v, half_to_double(static_cast<uint16_t>(n)));
+        return true;
+    case 26: {
+        float f;
+        uint32_t bits;
+        if (!take_uint(4, &n))
+            return false;
+        bits = static_cast<uint32_t>(n);
+        memcpy(&f, &bits, sizeof(f));
+        set_double(arena_, v, f);
+        return true;
+    }
+    case 27: {
+        double d;
+        if (!take_uint(8, &n))
+            return false;
+        memcpy(&d, &n, sizeof(d));
+        set_double(arena_, v, d);
+        return true;
+    }
+    default:
+        return fail("unsupported simple value");
+    }
+}
+
+bool decoder::decode_msgpack(value* v, int depth)
+{
+    const uint8_t* p = nullptr;
+    uint64_t n;
+
+    if (depth > MAX_DEPTH)
+        return fail("too deep");
+    if (!take(1, &p))
+        return false;
+
+    uint8_t b = *p;
+
+    v->key = nullptr;
+    v->key_len = 0;
+    v->boolean = false;
+    v->len = 0;
+    v->text = nullptr;
+
+    if (b <= 0x7f) {
+        set_integer(arena_, v, false, b);
+        return true;
+    }
+    if (b >= 0xe0) {
+        set_integer(arena_, v, true, 0x100 - b);
+        return true;
+    }
+    if (b <= 0x8f)
+        return decode_items(FORMAT_MSGPACK, v, true, b & 0x0f, false, depth);
+    if (b <= 0x9f)
+        return decode_items(FORMAT_MSGPACK, v, false, b & 0x0f, false, depth);
+    if (b <= 0xbf) {
+        n = b & 0x1f;
+        v->kind = TYPE_STRING;
+        if (!take(n, &p))
+            return false;
+        v->text = reinterpret_cast<const char*>(p);
+        v->len = static_cast<uint32_t>(n);
+        return true;
+    }
+
+    switch (b) {
+    case 0xc0:
+        v->kind = TYPE_NULL;
+        return true;
+    case 0xc2:
+    case 0xc3:
+        v->kind = TYPE_BOOLEAN;
+        v->boolean = b == 0xc3;
+        return true;
+    case 0xc4:      // bin 8, 16, 32
+    case 0xc5:
+    case 0xc6:
+    case 0xd9:      // str 8, 16, 32
+    case 0xda:
+    case 0xdb: {
+        size_t size = static_cast<size_t>(1) << (b <= 0xc6 ? b - 0xc4 : b - 0xd9);
+        if (!take_uint(size, &n) || !take(static_cast<size_t>(n), &p))
+            return false;
+        v->kind = TYPE_STRING;
+        v->text = reinterpret_cast<const char*>(p);
+        v->len = static_cast<uint32_t>(n);
+        return true;
+    }
+    case 0xca: {
+        float f;
+        uint32_t bits;
+        if (!take_uint(4, &n))
+            return false;
+        bits = static_cast<uint32_t>(n);
+        memcpy(&f, &bits, sizeof(f));
+        set_double(arena_, v, f);
+        return true;
+    }
+    case 0xcb: {
+        double d;
+        if (!take_uint(8, &n))
+            return false;
+        memcpy(&d, &n, sizeof(d));
+        set_double(arena_, v, d);
+        return true;
+    }
+    case 0xcc:      // uint 8, 16, 32, 64
+    case 0xcd:
+    case 0xce:
+    case 0xcf:
+        if (!take_uint(static_cast<size_t>(1) << (b - 0xcc), &n))
+            return false;
+        set_integer(arena_, v, false, n);
+        return true;
+    case 0xd0:      // int 8, 16, 32, 64
+    case 0xd1:
+    case 0xd2:
+    case 0xd3: {
+        size_t size = static_cast<size_t>(1) << (b - 0xd0);
+        if (!take_uint(size, &n))
+            return false;
+        // sign-extended from its size
+        int64_t i = size == 8 ? static_cast<int64_t>(n)
+            : static_cast<int64_t>(n << (64 - size * 8)) >> (64 - size * 8);
+        if (i < 0)
+            set_integer(arena_, v, true, static_cast<uint64_t>(0) - static_cast<uint64_t>(i));
+        else
+            set_integer(arena_, v, false, static_cast<uint64_t>(i));
+        return true;
+    }
+    case 0xdc:      // array 16, 32
+    case 0xdd:
+        if (!take_uint(b == 0xdc ? 2 : 4, &n))
+            return false;
+        return decode_items(FORMAT_MSGPACK, v, false, n, false, depth);
+    case 0xde:      // map 16, 32
+    case 0xdf:
+        if (!take_uint(b == 0xde ? 2 : 4, &n))
+            return false;
+        return decode_items(FORMAT_MSGPACK, v, true, n, false, depth);
+    default:
+        return fail("unsupported type");
+    }
+}
+
+namespace {
+
+/**
+ * Writes the items of the value model in CBOR or MessagePack, the smallest
+ * form of each: integers in as few bytes as they fit, floating point numbers
+ * in single precision when nothing is lost.
+ */
+class emitter {
+public:
+    emitter(format f, std::string* out) : cbor_(f == FORMAT_CBOR), out_(out) {}
+
+    void null()
+    {
+        out_->push_back(static_cast<char>(cbor_ ? 0xf6 : 0xc0));
+    }
+
+    void boolean(bool b)
+    {
+        if (cbor_)
+            out_->push_back(static_cast<char>(b ? 0xf5 : 0xf4));
+        else
+            out_->push_back(static_cast<char>(b ? 0xc3 : 0xc2));
+    }
+
+    void integer(bool negative, uint64_t magnitude)
+    {
+        if (magnitude == 0)
+            negative = false;
+        if (cbor_) {
+            head(negative ? 1 : 0, negative ? magnitude - 1 : magnitude);
+        } else if (!negative) {
+            if (magnitude <= 0x7f)
+                out_->push_back(static_cast<char>(magnitude));
+            else
+                sized(0xcc, magnitude, magnitude);
+        } else if (magnitude <= 32) {
+            out_->push_back(static_cast<char>(0x100 - magnitude));
+        } else if (magnitude <= (static_cast<uint64_t>(1) << 63)) {
+            // as small as the two's complement fits, a bit more than the magnitude
+            sized(0xd0, (magnitude - 1) << 1, static_cast<uint64_t>(0) - magnitude);
+        } else {
+            real(-static_cast<double>(magnitude));
+        }
+    }
+
+    void real(double d)
+    {
+        if (!std::isfinite(d)) {
+            null();
+            return;
+        }
+
+        float f = static_cast<float>(d);
+        if (static_cast<double>(f) == d) {
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(bits));
+            put(cbor_ ? 0xfa : 0xca, bits, 4);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            put(cbor_ ? 0xfb : 0xcb, bits, 8);
+        }
+    }
+
+    void string(const char* s, size_t n)
+    {
+        if (cbor_)
+            head(3, n);
+        else if (n < 32)
+            out_->push_back(static_cast<char>(0xa0 | n));
+        else
+            sized(0xd9, n, n);
+        out_->append(s, n);
+    }
+
+    void array(size_t n)
+    {
+        if (cbor_)
+            head(4, n);
+        else if (n < 16)
+            out_->push_back(static_cast<char>(0x90 | n));
+        else
+            put(n <= 0xffff ? 0xdc : 0xdd, n, n <= 0xffff ? 2 : 4);
+    }
+
+    void object(size_t n)
+    {
+        if (cbor_)
+            head(5, n);
+        else if (n < 16)
+            out_->push_back(static_cast<char>(0x80 | n));
+        else
+            put(n <= 0xffff ? 0xde : 0xdf, n, n <= 0xffff ? 2 : 4);
+    }
+
+private:
+    // a CBOR initial byte and its argument
+    void head(uint8_t major, uint64_t n)
+    {
+        uint8_t initial = static_cast<uint8_t>(major << 5);
+
+        if (n < 24)
+            out_->push_back(static_cast<char>(initial | n));
+        else
+            sized(initial | 24, n, n);
+    }
+
+    // of the types for 1, 2, 4 and 8 bytes that follow first, the one range fits
+    void sized(uint8_t first, uint64_t range, uint64_t n)
+    {
+        if (range <= 0xff)
+            put(first, n, 1);
+        else if (range <= 0xffff)
+            put(first + 1, n, 2);
+        else if (range <= 0xffffffff)
+            put(first + 2, n, 4);
+        else
+            put(first + 3, n, 8);
+    }
+
+    // a type byte and n, big-endian in size bytes
+    void put(uint8_t type, uint64_t n, size_t size)
+    {
+        char buf[9];
+
+        buf[0] = static_cast<char>(type);
+        for (size_t i = 0; i < size; i++) {
+            buf[size - i] = static_cast<char>(n >> (i * 8));
+        }
+        out_->append(buf, size + 1);
+    }
+
+    bool cbor_;
+    std::string* out_;
+};
+
+// the integer of a number without a fraction or an exponent, if it fits
+bool integral(const value& v, bool* negative, uint64_t* n)
+{
+    const char* p = v.text;
+    const char* end = v.text + v.len;
+    uint64_t r = 0;
+
+    if (!v.is_integral())
+        return false;
+
+    *negative = *p == '-';
+    if (*negative)
+        p++;
+    for (; p < end; p++) {
+        unsigned digit = *p - '0';
+        if (r > (UINT64_MAX - digit) / 10)
+            return false;
+        r = r * 10 + digit;
+    }
+    *n = r;
+
+    return true;
+}
+
+void emit(emitter* e, const value& v)
+{
+    bool negative;
+    uint64_t n;
+
+    switch (v.kind) {
+    case TYPE_BOOLEAN:
+        e->boolean(v.boolean);
+        break;
+    case TYPE_NUMBER:
+        if (integral(v, &negative, &n))
+            e->integer(negative, n);
+        else
+            e->real(v.as_double());
+        break;
+    case TYPE_STRING:
+        e->string(v.text, v.len);
+        break;
+    case TYPE_ARRAY:
+        e->array(v.len);
+        for (const value& item : v) {
+            emit(e, item);
+        }
+        break;
+    case TYPE_OBJECT:
+        e->object(v.len);
+        for (const value& item : v) {
+            e->string(item.key, item.key_len);
+            emit(e, item);
+        }
+        break;
+    default:
+        e->null();
+        break;
+    }
+}
+
+void emit(emitter* e, const Json::Value& v)
+{
+    switch (v.type()) {
+    case Json::intValue: {
+        Json::Int64 i = v.asInt64();
+        if (i < 0)
+            e->integer(true, static_cast<uint64_t>(0) - static_cast<uint64_t>(i));
+        else
+            e->integer(false, static_cast<uint64_t>(i));
+        break;
+    }
+    case Json::uintValue:
+        e->integer(false, v.asUInt64());
+        break;
+    case Json::realValue:
+        e->real(v.asDouble());
+        break;
+    case Json::stringValue: {
+        const char *begin, *end;
+        v.getString(&begin, &end);
+        e->string(begin, end - begin);
+        break;
+    }
+    case Json::booleanValue:
+        e->boolean(v.asBool());
+        break;
+    case Json::arrayValue:
+        e->array(v.size());
+        for (const Json::Value& item : v) {
+            emit(e, item);
+        }
+        break;
+    case Json::objectValue:
+        e->object(v.size());
+        for (auto it = v.begin(); it != v.end(); ++it) {
+            const char* end;
+            const char* name = it.memberName(&end);
+            e->string(name, end - name);
+            emit(e, *it);
+        }
+        break;
+    default:
+        e->null();
+        break;
+    }
+}
+
+}  // namespace
+
+/**
+ * Encode a value in CBOR or MessagePack.
+ *
+ * @param f         the format.
+ * @param v         the value.
+ * @param out       the buffer the encoding is appended to.
+ */
+void encode(format f, const value& v, std::string* out)
+{
+    emitter e(f, out);
+
+    emit(&e, v);
+}
+
+/**
+ * Encode a Json::Value in CBOR or MessagePack, as from its text.
+ */
+void encode(format f, const Json::Value& v, std::string* out)
+{
+    emitter e(f, out);
+
+    emit(&e, v);
+}
+
+/**
+ * Convert a value into a Json::Value, numbers as Json::Reader reads them.
+ */
+void convert(const value& v, Json::Value* out)
+{
+    bool negative;
+    uint64_t n;
+
+    switch (v.kind) {
+    case TYPE_BOOLEAN:
+        *out = v.boolean;
+        break;
+    case TYPE_NUMBER:
+        if (!integral(v, &negative, &n))
+            *out = v.as_double();
+        else if (!negative && n <= static_cast<uint64_t>(Json::Value::maxInt))
+            *out = static_cast<Json::Int64>(n);
+        else if (!negative)
+            *out = static_cast<Json::UInt64>(n);
+        else if (n <= static_cast<uint64_t>(INT64_MAX) + 1)
+            *out = -static_cast<Json::Int64>(n - 1) - 1;
+        else
+            *out = v.as_double();
+        break;
+    case TYPE_STRING:
+        *out = Json::Value(v.text, v.text + v.len);
+        break;
+    case TYPE_ARRAY:
+        *out = Json::Value(Json::arrayValue);
+        out->resize(v.len);
+        for (uint32_t i = 0; i < v.len; i++) {
+            convert(v[i], &(*out)[i]);
+        }
+        break;
+    case TYPE_OBJECT:
+        *out = Json::Value(Json::objectValue);
+        for (const value& item : v) {
+            convert(item, &(*out)[std::string(item.key, item.key_len)]);
+        }
+        break;
+    default:
+        *out = Json::Value();
+        break;
+    }
+}
+
+/**
+ * Convert a Json::Value into a value, without going through its text.
+ *
+ * @param v         the Json::Value, kept as long as the value: strings and
+ *                  member names point into it.
+ * @param out       the value.
+ * @param arena     the arena the items and numbers go to.
+ */
+void convert(const Json::Value& v, value* out, xa::arena* arena)
+{
+    *out = value();
+
+    switch (v.type()) {
+    case Json::intValue: {
+        Json::Int64 i = v.asInt64();
+        if (i < 0)
+            set_integer(arena, out, true, static_cast<uint64_t>(0) - static_cast<uint64_t>(i));
+        else
+            set_integer(arena, out, false, static_cast<uint64_t>(i));
+        break;
+    }
+    case Json::uintValue:
+        set_integer(arena, out, false, v.asUInt64());
+        break;
+    case Json::realValue:
+        set_double(arena, out, v.asDouble());
+        break;
+    case Json::stringValue: {
+        const char *begin = "", *end = begin;
+        v.getString(&begin, &end);
+        out->kind = TYPE_STRING;
+        out->text = begin;
+        out->len = static_cast<uint32_t>(end - begin);
+        break;
+    }
+    case Json::booleanValue:
+        out->kind = TYPE_BOOLEAN;
+        out->boolean = v.asBool();
+        break;
+    case Json::arrayValue:
+    case Json::objectValue: {
+        uint32_t n = v.size();
+        value* items = arena->allocate_array<value>(n > 0 ? n : 1);
+        uint32_t i = 0;
+
+        for (auto it = v.begin(); it != v.end(); ++it, ++i) {
+            convert(*it, &items[i], arena);
+            if (v.isObject()) {
+                const char* end;
+                items[i].key = it.memberName(&end);
+                items[i].key_len = static_cast<uint32_t>(end - items[i].key);
+            }
+        }
+        out->kind = v.isObject() ? TYPE_OBJECT : TYPE_ARRAY;
+        out->len = n;
+        out->items = items;
+        break;
+    }
+    default:
+        out->kind = TYPE_NULL;
+        break;
+    }
+}
+
+}  // namespace json
+
+}  // namespace xa
@@ -0,0 +1,101 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Binary JSON API documentation.
+ */
+
+/**
+ * @file binary_json.hpp
+ *
+ * @brief      Xabyss's Binary JSON library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <json/json.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "fast_json.hpp"
+
+namespace xa {
+
+namespace json {
+
+/**
+ * The encodings of the JSON value model: text, CBOR (RFC 8949) or
+ * MessagePack.
+ */
+enum format : uint8_t {
+    FORMAT_JSON,
+    FORMAT_CBOR,
+    FORMAT_MSGPACK,
+};
+
+bool format_of(const char* media_type, size_t n, format* f);
+const char* media_type(format f);
+
+/**
+ * A decoder of CBOR and MessagePack into values, as the parser does JSON:
+ * strings point into the data decoded, numbers are written out as text into
+ * the arena along with arrays and objects.
+ *
+ * Byte strings are taken as strings, tags are skipped and map keys must be
+ * strings, the JSON model has nothing else.
+ */
+class decoder {
+public:
+    decoder();
+    explicit decoder(xa::arena* arena);
+
+    const value* decode(format f, const char* data, size_t n);
+    void reset();
+
+    const std::string& error() const;
+    xa::arena& arena();
+
+private:
+    bool decode_cbor(value* v, int depth);
+    bool decode_msgpack(value* v, int depth);
+    bool cbor_argument(uint8_t info, uint64_t* n);
+    bool cbor_string(uint8_t major, uint8_t info, const char** out, uint32_t* len);
+    bool take(size_t n, const uint8_t** p);
+    bool decode_items(format f, value* v, bool object, uint64_t count, bool indefinite, int depth);
+    bool take_uint(size_t n, uint64_t* out);
+    bool fail(const char* message);
+
+    xa::arena own_;
+    xa::arena* arena_;
+    std::vector<value> stack_;
+    const uint8_t* p_;
+    const uint8_t* end_;
+    std::string error_;
+};
+
+void encode(format f, const value& v, std::string* out);
+void encode(format f, const Json::Value& v, std::string* out);
+void convert(const value& v, Json::Value* out);
+void convert(const Json::Value& v, value* out, xa::arena* arena);
+
+inline const std::string& decoder::error() const
+{
+    return error_;
+}
+
+inline xa::arena& decoder::arena()
+{
+    return *arena_;
+}
+
+}  // namespace json
+
+}  // namespace xa
@@ -0,0 +1,396 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Compressed bitmap API documentation.
+ */
+
+/**
+ * @file bitmap.cpp
+ *
+ * @brief      Xabyss's Compressed bitmap library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "bitmap.hpp"
+
+namespace pca {
+
+constexpr const size_t bitmap::ARRAY_MAX;
+constexpr const size_t bitmap::BITSET_WORDS;
+
+bool bitmap::container::contains(uint16_t low) const
+{
+    if (is_bitset())
+        return (bits[low >> 6] >> (low & 63)) & 1;
+
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+void bitmap::container::to_bitset()
+{
+    if (is_bitset())
+        return;
+
+    bits.assign(BITSET_WORDS, 0);
+    for (uint16_t low : array) {
+        bits[low >> 6] |= 1ULL << (low & 63);
+    }
+    array.clear();
+    array.shrink_to_fit();
+}
+
+/**
+ * Recount, and go back to an array if the bitset has become sparse.
+ */
+void bitmap::container::normalize()
+{
+    if (!is_bitset()) {
+        cardinality = array.size();
+        return;
+    }
+
+    cardinality = 0;
+    for (uint64_t word : bits) {
+        cardinality += __builtin_popcountll(word);
+    }
+
+    if (cardinality > ARRAY_MAX)
+        return;
+
+    array.clear();
+    array.reserve(cardinality);
+    for (size_t i = 0; i < BITSET_WORDS; i++) {
+        for (uint64_t word = bits[i]; word != 0; word &= word - 1) {
+            array.push_back(static_cast<uint16_t>(i * 64 + __builtin_ctzll(word)));
+        }
+    }
+    bits.clear();
+    bits.shrink_to_fit();
+}
+
+bitmap::container* bitmap::find(uint16_t key)
+{
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const container& c, uint16_t k) { return c.key < k; });
+
+    return (it != containers_.end() && it->key == key) ? &*it : nullptr;
+}
+
+/**
+ * Build a bitmap of [begin, end).
+ */
+bitmap bitmap::range(uint32_t begin, uint32_t end)
+{
+    bitmap b;
+
+    for (uint64_t v = begin; v < end; v++) {
+        b.add(static_cast<uint32_t>(v));
+    }
+
+    return b;
+}
+
+void bitmap::add(uint32_t value)
+{
+    uint16_t key = value >> 16;
+    uint16_t low = value & 0xffff;
+
+    // values mostly come in order, check the last container first
+    container* c = (!containers_.empty() && containers_.back().key == key) ? &containers_.back() : find(key);
+    if (c == nullptr) {
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                                   [](const container& x, uint16_t k) { return x.key < k; });
+        container n;
+        n.key = key;
+        n.cardinality = 0;
+        c = &*containers_.insert(it, n);
+    }
+
+    if (c->is_bitset()) {
+        uint64_t& word = c->bits[low >> 6];
+        uint64_t bit = 1ULL << (low & 63);
+        if (!(word & bit)) {
+            word |= bit;
+            c->cardinality++;
+        }
+        return;
+    }
+
+    if (c->array.empty() || c->array.back() < low) {
+        c->array.push_back(low);
+    } else {
+        auto it = std::lower_bound(c->array.begin(), c->array.end(), low);
+        if (it != c->array.end() && *it == low)
+            return;
+        c->array.insert(it, low);
+    }
+    c->cardinality++;
+
+    if (c->cardinality > ARRAY_MAX)
+        c->to_bitset();
+}
+
+bool bitmap::contains(uint32_t value) const
+{
+    uint16_t key = value >> 16;
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                               [](const container& c, uint16_t k) { return c.key < k; });
+
+    return it != containers_.end() && it->key == key && it->contains(value & 0xffff);
+}
+
+uint64_t bitmap::cardinality() const
+{
+    uint64_t sum = 0;
+
+    for (const auto& c : containers_) {
+        sum += c.cardinality;
+    }
+
+    return sum;
+}
+
+bool bitmap::empty() const
+{
+    return containers_.empty();
+}
+
+std::vector<uint32_t> bitmap::values() const
+{
+    std::vector<uint32_t> out;
+
+    out.reserve(cardinality());
+    for (const auto& c : containers_) {
+        uint32_t high = static_cast<uint32_t>(c.key) << 16;
+        if (c.is_bitset()) {
+            for (size_t i = 0; i < BITSET_WORDS; i++) {
+                for (uint64_t word = c.bits[i]; word != 0; word &= word - 1) {
+                    out.push_back(high | (i * 64 + __builtin_ctzll(word)));
+                }
+            }
+        } else {
+            for (uint16_t low : c.array) {
+                out.push_back(high | low);
+            }
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Combine two containers with the same key into the first one.
+ */
+void bitmap::combine(container& a, const container& b, op o)
+{
+    if (!a.is_bitset() && !b.is_bitset()) {
+        std::vector<uint16_t> out;
+        switch (o) {
+        case AND:
+            std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                                  std::back_inserter(out));
+            break;
+        case OR:
+            std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                           std::back_inserter(out));
+            break;
+        case ANDNOT:
+            std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                                std::back_inserter(out));
+            break;
+        }
+        a.array.swap(out);
+        a.cardinality = a.array.size();
+        if (a.cardinality > ARRAY_MAX) {
+            a.to_bitset();
+            a.normalize();
+        }
+        return;
+    }
+
+    if (!a.is_bitset() && o != OR) {
+        // probe the bitset with the array
+        std::vector<uint16_t> out;
+        for (uint16_t low : a.array) {
+            if (b.contains(low) == (o == AND))
+                out.push_back(low);
+        }
+        a.array.swap(out);
+        a.cardinality = a.array.size();
+        return;
+    }
+
+    a.to_bitset();
+    if (b.is_bitset()) {
+        for (size_t i = 0; i < BITSET_WORDS; i++) {
+            switch (o) {
+            case AND:
+                a.bits[i] &= b.bits[i];
+                break;
+            case OR:
+                a.bits[i] |= b.bits[i];
+                break;
+            case ANDNOT:
+                a.bits[i] &= ~b.bits[i];
+                break;
+            }
+        }
+    } else if (o == AND) {
+        std::vector<uint16_t> out;
+        for (uint16_t low : b.array) {
+            if (a.contains(low))
+                out.push_back(low);
+        }
+        a.bits.clear();
+        a.array.swap(out);
+    } else {
+        for (uint16_t low : b.array) {
+            if (o == OR)
+                a.bits[low >> 6] |= 1ULL << (low & 63);
+            else
+                a.bits[low >> 6] &= ~(1ULL << (low & 63));
+        }
+    }
+    a.normalize();
+}
+
+bitmap& bitmap::operator&=(const bitmap& other)
+{
+    std::vector<container> out;
+
+    for (auto& c : containers_) {
+        auto it = std::lower_bound(other.containers_.begin(), other.containers_.end(), c.key,
+                                   [](const container& x, uint16_t k) { return x.key < k; });
+        if (it == other.containers_.end() || it->key != c.key)
+            continue;
+        combine(c, *it, AND);
+        if (c.cardinality > 0)
+            out.push_back(std::move(c));
+    }
+    containers_.swap(out);
+
+    return *this;
+}
+
+bitmap& bitmap::operator|=(const bitmap& other)
+{
+    for (const auto& oc : other.containers_) {
+        container* c = find(oc.key);
+        if (c == nullptr) {
+            auto it = std::lower_bound(containers_.begin(), containers_.end(), oc.key,
+                                       [](const container& x, uint16_t k) { return x.key < k; });
+            containers_.insert(it, oc);
+        } else {
+            combine(*c, oc, OR);
+        }
+    }
+
+    return *this;
+}
+
+bitmap& bitmap::operator-=(const bitmap& other)
+{
+    std::vector<container> out;
+
+    for (auto& c : containers_) {
+        auto it = std::lower_bound(other.containers_.begin(), other.containers_.end(), c.key,
+                                   [](const container& x, uint16_t k) { return x.key < k; });
+        if (it != other.containers_.end() && it->key == c.key)
+            combine(c, *it, ANDNOT);
+        if (c.cardinality > 0)
+            out.push_back(std::move(c));
+    }
+    containers_.swap(out);
+
+    return *this;
+}
+
+bool bitmap::operator==(const bitmap& other) const
+{
+    return values() == other.values();
+}
+
+/**
+ * Append the bitmap in its portable form: the number of containers, then the
+ * key, the cardinality and the array or the bitset words of each.
+ */
+void bitmap::serialize(std::string* out) const
+{
+    uint32_t n = containers_.size();
+
+    out->append(reinterpret_cast<const char*>(&n), sizeof(n));
+    for (const auto& c : containers_) {
+        out->append(reinterpret_cast<const char*>(&c.key), sizeof(c.key));
+        out->append(reinterpret_cast<const char*>(&c.cardinality), sizeof(c.cardinality));
+        if (c.is_bitset())
+            out->append(reinterpret_cast<const char*>(c.bits.data()), BITSET_WORDS * sizeof(uint64_t));
+        else
+            out->append(reinterpret_cast<const char*>(c.array.data()), c.array.size() * sizeof(uint16_t));
+    }
+}
+
+/**
+ * Read a bitmap written by serialize().
+ *
+ * @param data      serialized data.
+ * @param size      the size of the data.
+ * @param used      the number of bytes read to be filled.
+ * @return true on success, false if the data is corrupted.
+ */
+bool bitmap::deserialize(const uint8_t* data, size_t size, size_t* used)
+{
+    size_t pos = 0;
+    uint32_t n;
+
+    containers_.clear();
+    if (size < sizeof(n))
+        return false;
+    memcpy(&n, data, sizeof(n));
+    pos += sizeof(n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        container c;
+
+        if (size - pos < sizeof(c.key) + sizeof(c.cardinality))
+            return false;
+        memcpy(&c.key, data + pos, sizeof(c.key));
+        memcpy(&c.cardinality, data + pos + sizeof(c.key), sizeof(c.cardinality));
+        pos += sizeof(c.key) + sizeof(c.cardinality);
+
+        if (c.cardinality > 65536 || (!containers_.empty() && containers_.back().key >= c.key))
+            return false;
+
+        if (c.cardinality > ARRAY_MAX) {
+            size_t bytes = BITSET_WORDS * sizeof(uint64_t);
+            if (size - pos < bytes)
+                return false;
+            c.bits.resize(BITSET_WORDS);
+            memcpy(c.bits.data(), data + pos, bytes);
+            pos += bytes;
+        } else {
+            size_t bytes = c.cardinality * sizeof(uint16_t);
+            if (size - pos < bytes)
+                return false;
+            c.array.resize(c.cardinality);
+            memcpy(c.array.data(), data + pos, bytes);
+            pos += bytes;
+        }
+        containers_.push_back(std::move(c));
+    }
+
+    *used = pos;
+
+    return true;
+}
+
+}  // namespace pca
@@ -0,0 +1,93 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Compressed bitmap API documentation.
+ */
+
+/**
+ * @file bitmap.hpp
+ *
+ * @brief      Xabyss's Compressed bitmap library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pca {
+
+/**
+ * Compressed bitmap of 32-bit integers in the roaring layout: the values are
+ * grouped by their upper 16 bits, and each group is a sorted array of the
+ * lower 16 bits while it's sparse, or a 65536-bit bitset once it's dense.
+ */
+class bitmap {
+public:
+    bitmap() = default;
+
+    static bitmap range(uint32_t begin, uint32_t end);
+
+    void add(uint32_t value);
+    bool contains(uint32_t value) const;
+    uint64_t cardinality() const;
+    bool empty() const;
+    std::vector<uint32_t> values() const;
+
+    bitmap& operator&=(const bitmap& other);
+    bitmap& operator|=(const bitmap& other);
+    bitmap& operator-=(const bitmap& other);
+
+    bool operator==(const bitmap& other) const;
+
+    void serialize(std::string* out) const;
+    bool deserialize(const uint8_t* data, size_t size, size_t* used);
+
+private:
+    constexpr static const size_t ARRAY_MAX = 4096;
+    constexpr static const size_t BITSET_WORDS = 65536 / 64;
+
+    struct container {
+        uint16_t key;
+        uint32_t cardinality;
+        std::vector<uint16_t> array;    // sorted, while sparse
+        std::vector<uint64_t> bits;     // BITSET_WORDS words, once dense
+
+        bool is_bitset() const { return !bits.empty(); }
+        bool contains(uint16_t low) const;
+        void to_bitset();
+        void normalize();
+    };
+
+    enum op { AND, OR, ANDNOT };
+
+    static void combine(container& a, const container& b, op o);
+    container* find(uint16_t key);
+
+    std::vector<container> containers_;     // sorted by key
+};
+
+inline bitmap operator&(bitmap a, const bitmap& b)
+{
+    return a &= b;
+}
+
+inline bitmap operator|(bitmap a, const bitmap& b)
+{
+    return a |= b;
+}
+
+inline bitmap operator-(bitmap a, const bitmap& b)
+{
+    return a -= b;
+}
+
+}  // namespace pca
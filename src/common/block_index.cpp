@@ -0,0 +1,465 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Block index API documentation.
+ */
+
+/**
+ * @file block_index.cpp
+ *
+ * @brief      Xabyss's Block index library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "block_index.hpp"
+#include "logger.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace segment {
+
+constexpr const uint32_t block_index::MAGIC;
+constexpr const uint32_t block_index::VERSION;
+
+term term::host(uint8_t version, const uint8_t* addr)
+{
+    term t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = HOST;
+    t.version = version;
+    memcpy(t.addr, addr, version == 4 ? 4 : 16);
+
+    return t;
+}
+
+term term::port(uint16_t port)
+{
+    term t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = PORT;
+    t.value = port;
+
+    return t;
+}
+
+term term::protocol(uint8_t protocol)
+{
+    term t;
+
+    memset(&t, 0, sizeof(t));
+    t.type = PROTOCOL;
+    t.value = protocol;
+
+    return t;
+}
+
+size_t term_hash::operator()(const term& t) const
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&t);
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < sizeof(t); i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+bool term_equal::operator()(const term& a, const term& b) const
+{
+    return memcmp(&a, &b, sizeof(term)) == 0;
+}
+
+void block_index::add(uint32_t block, const term& t)
+{
+    terms_[t].add(block);
+    if (block >= blocks_)
+        blocks_ = block + 1;
+}
+
+/**
+ * Index the 5-tuple of a packet in a block.
+ *
+ * @param block     the block of the packet.
+ * @param key       the 5-tuple of the packet.
+ */
+void block_index::add(uint32_t block, const flow_key& key)
+{
+    add(block, term::host(key.version, key.src_addr));
+    add(block, term::host(key.version, key.dst_addr));
+    add(block, term::protocol(key.protocol));
+    if (key.src_port != 0 || key.dst_port != 0) {
+        add(block, term::port(key.src_port));
+        add(block, term::port(key.dst_port));
+    }
+}
+
+void block_index::set_blocks(uint32_t blocks)
+{
+    blocks_ = blocks;
+}
+
+void block_index::clear()
+{
+    terms_.clear();
+    blocks_ = 0;
+}
+
+const bitmap* block_index::find(const term& t) const
+{
+    auto it = terms_.find(t);
+
+    return it != terms_.end() ? &it->second : nullptr;
+}
+
+bitmap block_index::all() const
+{
+    return bitmap::range(0, blocks_);
+}
+
+/**
+ * Count the terms of each type and the blocks they appear in, and find the
+ * terms in the most blocks.
+ *
+ * @return the statistics, but the file size.
+ */
+filter_stats block_index::stats() const
+{
+    filter_stats st;
+    std::vector<std::pair<uint32_t, const term*>> counts;
+
+    memset(&st, 0, sizeof(st));
+    st.blocks = blocks_;
+    for (const auto& it : terms_) {
+        uint32_t n = static_cast<uint32_t>(it.second.cardinality());
+        st.terms[it.first.type & 3]++;
+        st.postings[it.first.type & 3] += n;
+        counts.push_back(std::make_pair(n, &it.first));
+    }
+
+    size_t common = std::min<size_t>(counts.size(), filter_stats::COMMON_TERMS);
+    std::partial_sort(counts.begin(), counts.begin() + common, counts.end(),
+                      [](const std::pair<uint32_t, const term*>& a, const std::pair<uint32_t, const term*>& b) {
+        return a.first > b.first;
+    });
+    for (size_t i = 0; i < common; i++) {
+        st.common[i].hash = term_hash()(*counts[i].second);
+        st.common[i].type = counts[i].second->type;
+        st.common[i].blocks = counts[i].first;
+    }
+
+    return st;
+}
+
+/**
+ * Write the index: a header with the statistics, then each term followed by
+ * its bitmap.
+ *
+ * @param path      the pcap file path of the segment.
+ * @param stats     the statistics to be filled, may be null.
+ * @return true on success, false otherwise.
+ */
+bool block_index::save(const std::string& path, filter_stats* stats) const
+{
+    std::string data;
+    file_header header;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.terms = static_cast<uint32_t>(terms_.size());
+    header.stats = this->stats();
+
+    data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& it : terms_) {
+        data.append(reinterpret_cast<const char*>(&it.first), sizeof(term));
+        it.second.serialize(&data);
+    }
+
+    std::string filename = filter_path_of(path);
+    int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        XA_LOGGER(error) << "can't create " << filename << ": " << strerror(errno);
+        return false;
+    }
+
+    bool ok = ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ::close(fd);
+    if (!ok) {
+        XA_LOGGER(error) << "can't write " << filename << ": " << strerror(errno);
+        return false;
+    }
+
+    if (stats != nullptr) {
+        *stats = header.stats;
+        stats->bytes = data.size();
+    }
+
+    return true;
+}
+
+/**
+ * Read the index of a segment.
+ *
+ * @param path      the pcap file path of the segment.
+ * @return true on success, false otherwise.
+ */
+bool block_index::load(const std::string& path)
+{
+    std::string filename = filter_path_of(path);
+    struct stat st;
+
+    clear();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    std::vector<uint8_t> data(st.st_size);
+    bool ok = ::read(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    ::close(fd);
+
+    file_header header;
+    if (!ok || data.size() < sizeof(header))
+        return false;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.magic != MAGIC || header.version != VERSION)
+        return false;
+
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; i < header.terms; i++) {
+        term t;
+        bitmap b;
+        size_t used;
+
+        if (data.size() - pos < sizeof(t))
+            return false;
+        memcpy(&t, &data[pos], sizeof(t));
+        pos += sizeof(t);
+
+        if (!b.deserialize(&data[pos], data.size() - pos, &used)) {
+            XA_LOGGER(error) << "corrupted block index: " << filename;
+            clear();
+            return false;
+        }
+        pos += used;
+        terms_.emplace(t, std::move(b));
+    }
+    blocks_ = header.stats.blocks;
+
+    return true;
+}
+
+/**
+ * Read the statistics of the index of a segment without loading it.
+ *
+ * @param path      the pcap file path of the segment.
+ * @param stats     the statistics to be filled.
+ * @return true on success, false otherwise.
+ */
+bool block_index::read_stats(const std::string& path, filter_stats* stats)
+{
+    std::string filename = filter_path_of(path);
+    file_header header;
+    struct stat st;
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    bool ok = fstat(fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header);
+    ::close(fd);
+    if (!ok || header.magic != MAGIC || header.version != VERSION)
+        return false;
+
+    *stats = header.stats;
+    stats->bytes = st.st_size;
+
+    return true;
+}
+
+/**
+ * Build the block index path of a segment.
+ *
+ * @param path      the pcap file path.
+ * @return the block index file path.
+ */
+std::string filter_path_of(const std::string& path)
+{
+    return path.substr(0, path.rfind('.')) + ".flt";
+}
+
+/**
+ * Format a query in infix notation, e.g. "(host 10.0.0.1 and port 443)".
+ *
+ * @param query     a query in postfix order.
+ * @return the query, or an empty string if it's malformed.
+ */
+std::string to_string(const index_query& query)
+{
+    std::vector<std::string> stack;
+
+    for (const auto& op : query) {
+        switch (op.code) {
+        case index_op::TERM: {
+            char addr[INET6_ADDRSTRLEN] = "";
+            if (op.t.type == term::HOST) {
+                inet_ntop(op.t.version == 4 ? AF_INET : AF_INET6, op.t.addr, addr, sizeof(addr));
+                stack.push_back(std::string("host ") + addr);
+            } else {
+                stack.push_back((op.t.type == term::PORT ? "port " : "proto ") + std::to_string(op.t.value));
+            }
+            break;
+        }
+        case index_op::ALL:
+            stack.push_back("all");
+            break;
+        case index_op::NOT:
+            if (stack.empty())
+                return "";
+            stack.back() = "not " + stack.back();
+            break;
+        case index_op::AND:
+        case index_op::OR: {
+            if (stack.size() < 2)
+                return "";
+            std::string b = stack.back();
+            stack.pop_back();
+            stack.back() = "(" + stack.back() + (op.code == index_op::AND ? " and " : " or ") + b + ")";
+            break;
+        }
+        }
+    }
+
+    return stack.size() == 1 ? stack.back() : "";
+}
+
+/**
+ * Evaluate a query to the blocks that may hold matching packets.
+ *
+ * @param index     a block index.
+ * @param query     a query in postfix order.
+ * @param blocks    matching blocks to be filled.
+ * @return true on success, false if the query is malformed.
+ */
+bool evaluate(const block_index& index, const index_query& query, bitmap* blocks)
+{
+    std::vector<bitmap> stack;
+
+    for (const auto& op : query) {
+        switch (op.code) {
+        case index_op::TERM: {
+            const bitmap* b = index.find(op.t);
+            stack.push_back(b != nullptr ? *b : bitmap());
+            break;
+        }
+        case index_op::ALL:
+            stack.push_back(index.all());
+            break;
+        case index_op::NOT:
+            if (stack.empty())
+                return false;
+            stack.back() = index.all() - stack.back();
+            break;
+        case index_op::AND:
+        case index_op::OR: {
+            if (stack.size() < 2)
+                return false;
+            bitmap b = std::move(stack.back());
+            stack.pop_back();
+            if (op.code == index_op::AND)
+                stack.back() &= b;
+            else
+                stack.back() |= b;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    if (stack.size() != 1)
+        return false;
+
+    *blocks = std::move(stack.back());
+
+    return true;
+}
+
+/**
+ * Read the packets of some blocks of a segment only.
+ *
+ * @param path      the pcap file path.
+ * @param index     the timestamp index of the segment.
+ * @param blocks    blocks to read.
+ * @param fn        called for each packet, stops the reading by returning false.
+ * @return true on success, false otherwise.
+ */
+bool read_blocks(const std::string& path, const std::vector<index_entry>& index, const bitmap& blocks,
+                 const std::function<bool(const packet&)>& fn)
+{
+    pcap::reader reader;
+
+    if (!reader.open(path))
+        return false;
+
+    return read_blocks(&reader, index, blocks, fn);
+}
+
+/**
+ * Read the packets of some blocks of an open segment, the packets stay valid
+ * until the reader is closed.
+ *
+ * @param reader    a reader of the pcap file.
+ * @param index     the timestamp index of the segment.
+ * @param blocks    blocks to read.
+ * @param fn        called for each packet, stops the reading by returning false.
+ * @return true on success, false otherwise.
+ */
+bool read_blocks(pcap::reader* reader, const std::vector<index_entry>& index, const bitmap& blocks,
+                 const std::function<bool(const packet&)>& fn)
+{
+    packet pkt;
+
+    for (uint32_t block : blocks.values()) {
+        if (block >= index.size())
+            break;
+
+        uint64_t end = block + 1 < index.size() ? index[block + 1].offset : reader->size();
+
+        // consecutive blocks are read through
+        if (reader->offset() != index[block].offset && !reader->seek(index[block].offset))
+            return false;
+
+        while (reader->offset() < end && reader->next(&pkt)) {
+            if (!fn(pkt))
+                return true;
+        }
+    }
+
+    return true;
+}
+
+}  // namespace segment
+
+}  // namespace pca
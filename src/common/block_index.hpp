@@ -0,0 +1,148 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Block index API documentation.
+ */
+
+/**
+ * @file block_index.hpp
+ *
+ * @brief      Xabyss's Block index library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bitmap.hpp"
+#include "packet.hpp"
+#include "pcap_file.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+namespace segment {
+
+/**
+ * An indexed value: a host address, a port or an IP protocol.
+ */
+struct term {
+    enum term_type : uint8_t {
+        HOST = 1,
+        PORT = 2,
+        PROTOCOL = 3,
+    };
+
+    uint8_t type;
+    uint8_t version;            // of a host
+    uint16_t value;             // a port or a protocol
+    uint8_t addr[16];           // a host
+
+    static term host(uint8_t version, const uint8_t* addr);
+    static term port(uint16_t port);
+    static term protocol(uint8_t protocol);
+};
+
+struct term_hash {
+    size_t operator()(const term& t) const;
+};
+
+struct term_equal {
+    bool operator()(const term& a, const term& b) const;
+};
+
+/**
+ * Inverted index of a segment from the hosts, ports and protocols to the
+ * blocks they appear in, a block being the packets between two entries of
+ * the timestamp index.
+ *
+ * It's stored next to the segment as <first ts>-<worker>.flt, whose header
+ * holds the statistics of the index so that they can be read alone.
+ */
+class block_index {
+public:
+    constexpr static const uint32_t MAGIC = 0x4c464158;     // "XAFL"
+    constexpr static const uint32_t VERSION = 2;
+
+    struct file_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t terms;
+        uint32_t reserved;
+        filter_stats stats;     // but the file size
+    };
+
+    void add(uint32_t block, const flow_key& key);
+    void set_blocks(uint32_t blocks);
+    void clear();
+
+    const bitmap* find(const term& t) const;
+    bitmap all() const;
+
+    uint32_t blocks() const;
+    size_t terms() const;
+
+    filter_stats stats() const;
+
+    bool save(const std::string& path, filter_stats* stats = nullptr) const;
+    bool load(const std::string& path);
+
+    static bool read_stats(const std::string& path, filter_stats* stats);
+
+private:
+    void add(uint32_t block, const term& t);
+
+    std::unordered_map<term, bitmap, term_hash, term_equal> terms_;
+    uint32_t blocks_ = 0;
+};
+
+/**
+ * A boolean query over the index in postfix order, e.g.
+ * host A, port 443, AND, host B, NOT, AND.
+ */
+struct index_op {
+    enum op_code : uint8_t {
+        TERM,
+        AND,
+        OR,
+        NOT,
+        ALL,
+    };
+
+    op_code code;
+    term t;
+};
+
+typedef std::vector<index_op> index_query;
+
+std::string filter_path_of(const std::string& path);
+std::string to_string(const index_query& query);
+bool evaluate(const block_index& index, const index_query& query, bitmap* blocks);
+bool read_blocks(const std::string& path, const std::vector<index_entry>& index, const bitmap& blocks,
+                 const std::function<bool(const packet&)>& fn);
+bool read_blocks(pcap::reader* reader, const std::vector<index_entry>& index, const bitmap& blocks,
+                 const std::function<bool(const packet&)>& fn);
+
+inline uint32_t block_index::blocks() const
+{
+    return blocks_;
+}
+
+inline size_t block_index::terms() const
+{
+    return terms_.size();
+}
+
+}  // namespace segment
+
+}  // namespace pca
@@ -0,0 +1,363 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Segment catalog API documentation.
+ */
+
+/**
+ * @file catalog.cpp
+ *
+ * @brief      Xabyss's Segment catalog library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "catalog.hpp"
+#include "logger.hpp"
+
+namespace pca {
+
+namespace segment {
+
+constexpr const uint32_t catalog::MAGIC;
+constexpr const uint32_t catalog::VERSION;
+
+catalog::catalog()
+    : fd_(-1)
+    , records_(0)
+    , deleted_(0)
+{
+}
+
+catalog::~catalog()
+{
+    close();
+}
+
+uint32_t catalog::checksum_of(const record& rec)
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&rec);
+    uint32_t hash = 2166136261U;
+
+    // FNV-1a over everything but the checksum itself
+    for (size_t i = 0; i < offsetof(record, checksum); i++) {
+        hash = (hash ^ p[i]) * 16777619U;
+    }
+
+    return hash;
+}
+
+catalog::record catalog::make_record(uint32_t type, const info& segment)
+{
+    record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.worker = segment.worker;
+    rec.first_ts = segment.first_ts;
+    rec.last_ts = segment.last_ts;
+    rec.bytes = segment.bytes;
+    rec.packets = segment.packets;
+    rec.flags = segment.flags;
+    rec.checksum = checksum_of(rec);
+
+    return rec;
+}
+
+/**
+ * Open a catalog, creating it if it doesn't exist.
+ *
+ * @param filename  the catalog filename.
+ * @param root      the data directory the segment paths are built from.
+ * @param segments  the live segments to be filled, ordered as sealed.
+ * @return true on success, false otherwise.
+ */
+bool catalog::open(const std::string& filename, const std::string& root, std::vector<info>* segments)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    filename_ = filename;
+    root_ = root;
+    records_ = 0;
+    deleted_ = 0;
+    segments->clear();
+
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+        XA_LOGGER(error) << "can't open " << filename << ": " << strerror(errno);
+        return false;
+    }
+
+    if (!load(segments)) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Map the file, collect the live segments, and cut off a torn tail. A
+ * damaged record is skipped alone: records are all of a size, so the next
+ * one starts at the next slot.
+ */
+bool catalog::load(std::vector<info>* segments)
+{
+    struct stat st;
+
+    if (fstat(fd_, &st) < 0)
+        return false;
+
+    size_t size = st.st_size;
+    if (size < sizeof(file_header)) {
+        // a new or empty catalog
+        file_header hdr = { MAGIC, VERSION };
+        if (ftruncate(fd_, 0) < 0 || pwrite(fd_, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+            XA_LOGGER(error) << "can't write " << filename_ << ": " << strerror(errno);
+            return false;
+        }
+        lseek(fd_, 0, SEEK_END);
+        return true;
+    }
+
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        XA_LOGGER(error) << "can't map " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    const file_header* hdr = static_cast<const file_header*>(addr);
+    if (hdr->magic != MAGIC || hdr->version != VERSION) {
+        XA_LOGGER(error) << "not a segment catalog: " << filename_;
+        munmap(addr, size);
+        return false;
+    }
+
+    const record* recs = reinterpret_cast<const record*>(static_cast<const uint8_t*>(addr) + sizeof(file_header));
+    size_t count = (size - sizeof(file_header)) / sizeof(record);
+    std::map<std::pair<uint64_t, uint32_t>, size_t> live;     // (first_ts, worker) -> segments
+    size_t n = 0, damaged = 0;
+
+    segments->reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const record& rec = recs[i];
+
+        if (rec.checksum != checksum_of(rec) || (rec.type != RECORD_SEALED && rec.type != RECORD_DELETED)) {
+            damaged++;
+            continue;
+        }
+        n = i + 1;
+
+        // a worker never seals two segments with the same first timestamp
+        auto key = std::make_pair(rec.first_ts, rec.worker);
+
+        if (rec.type == RECORD_SEALED) {
+            info segment = info();
+            segment.path = path_of(root_, rec.first_ts, rec.worker);
+            segment.worker = rec.worker;
+            segment.first_ts = rec.first_ts;
+            segment.last_ts = rec.last_ts;
+            segment.bytes = rec.bytes;
+            segment.packets = rec.packets;
+            segment.flags = rec.flags;
+            live[key] = segments->size();
+            segments->push_back(std::move(segment));
+        } else {
+            auto it = live.find(key);
+            if (it != live.end()) {
+                (*segments)[it->second].bytes = UINT64_MAX;
+                live.erase(it);
+            }
+            deleted_++;
+        }
+    }
+    munmap(addr, size);
+
+    // those past the last good record are the torn tail, the others are
+    // dead weight for the next compaction
+    damaged -= count - n;
+    if (damaged > 0)
+        XA_LOGGER(warning) << "catalog " << filename_ << " has " << damaged << " damaged records, skipped";
+    records_ = n;
+    deleted_ += damaged;
+    segments->erase(std::remove_if(segments->begin(), segments->end(), [](const info& segment) {
+        return segment.bytes == UINT64_MAX;
+    }), segments->end());
+
+    size_t valid = sizeof(file_header) + n * sizeof(record);
+    if (valid < size) {
+        XA_LOGGER(warning) << "catalog " << filename_ << " is cut off at record " << n;
+        if (ftruncate(fd_, valid) < 0)
+            return false;
+    }
+    lseek(fd_, valid, SEEK_SET);
+
+    return true;
+}
+
+void catalog::close()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool catalog::write_records(const std::vector<record>& recs)
+{
+    if (fd_ < 0)
+        return false;
+
+    size_t n = recs.size() * sizeof(record);
+    if (::write(fd_, recs.data(), n) != static_cast<ssize_t>(n)) {
+        XA_LOGGER(error) << "can't write " << filename_ << ": " << strerror(errno);
+        return false;
+    }
+    records_ += recs.size();
+
+    return true;
+}
+
+/**
+ * Record a sealed segment.
+ *
+ * @param segment   a sealed segment.
+ * @return true on success, false otherwise.
+ */
+bool catalog::append(const info& segment)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return write_records(std::vector<record>(1, make_record(RECORD_SEALED, segment)));
+}
+
+/**
+ * Record deleted segments.
+ *
+ * @param segments  deleted segments.
+ * @return true on success, false otherwise.
+ */
+bool catalog::remove(const std::vector<info>& segments)
+{
+    std::vector<record> recs;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (const auto& segment : segments) {
+        recs.push_back(make_record(RECORD_DELETED, segment));
+    }
+    if (!write_records(recs))
+        return false;
+    deleted_ += segments.size();
+
+    return true;
+}
+
+/**
+ * Rewrite the catalog with the live segments only, dropping the deleted ones.
+ * The new file is written and synced without holding up the records of the
+ * segments sealed and deleted meanwhile, which are carried over to it.
+ *
+ * @param segments  the live segments, as of the first records of the file.
+ * @param records   the count of those records, records() as they were taken.
+ * @return true on success, false otherwise.
+ */
+// the entry of a file renamed into its directory, to the disk along with it
+static bool sync_dir_of(const std::string& filename)
+{
+    size_t slash = filename.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash > 0 ? slash : 1);
+
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+
+    return ok;
+}
+
+bool catalog::compact(const std::vector<info>& segments, uint64_t records)
+{
+    std::string tmp = filename_ + ".tmp";
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        XA_LOGGER(error) << "can't create " << tmp << ": " << strerror(errno);
+        return false;
+    }
+
+    std::vector<record> recs;
+    recs.reserve(segments.size());
+    for (const auto& segment : segments) {
+        recs.push_back(make_record(RECORD_SEALED, segment));
+    }
+
+    file_header hdr = { MAGIC, VERSION };
+    size_t n = recs.size() * sizeof(record);
+    bool ok = ::write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+        && ::write(fd, recs.data(), n) == static_cast<ssize_t>(n)
+        && fsync(fd) == 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // the records since, as they were appended
+    std::vector<record> tail(fd_ >= 0 && records_ > records ? records_ - records : 0);
+    uint64_t deleted = 0;
+    if (ok && !tail.empty()) {
+        n = tail.size() * sizeof(record);
+        ok = pread(fd_, tail.data(), n, sizeof(file_header) + records * sizeof(record)) == static_cast<ssize_t>(n)
+            && ::write(fd, tail.data(), n) == static_cast<ssize_t>(n)
+            && fsync(fd) == 0;
+        for (const auto& rec : tail) {
+            if (rec.type == RECORD_DELETED)
+                deleted++;
+        }
+    }
+    ::close(fd);
+
+    if (!ok || fd_ < 0 || rename(tmp.c_str(), filename_.c_str()) < 0) {
+        XA_LOGGER(error) << "can't compact " << filename_ << ": " << strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    // the old catalog may come back after a crash otherwise, harmless but stale
+    if (!sync_dir_of(filename_))
+        XA_LOGGER(warning) << "can't sync the directory of " << filename_ << ": " << strerror(errno);
+
+    ::close(fd_);
+    fd_ = ::open(filename_.c_str(), O_RDWR | O_APPEND);
+    records_ = recs.size() + tail.size();
+    deleted_ = deleted;
+
+    return fd_ >= 0;
+}
+
+}  // namespace segment
+
+}  // namespace pca
@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Segment catalog API documentation.
+ */
+
+/**
+ * @file catalog.hpp
+ *
+ * @brief      Xabyss's Segment catalog library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "segment.hpp"
+
+namespace pca {
+
+namespace segment {
+
+/**
+ * Persistent catalog of the sealed segments, so that a restart doesn't have
+ * to scan the data directory.
+ *
+ * The file is a header followed by fixed size records, appended as segments
+ * are sealed or deleted. Paths are not stored, they follow from the first
+ * timestamp and the worker of a segment.
+ *
+ * A torn record at the end of the file, e.g. after a crash, is cut off when
+ * the catalog is opened.
+ */
+class catalog {
+public:
+    constexpr static const uint32_t MAGIC = 0x54434158;     // "XACT"
+    constexpr static const uint32_t VERSION = 1;
+
+    enum record_type : uint32_t {
+        RECORD_SEALED = 1,
+        RECORD_DELETED = 2,
+    };
+
+    struct file_header {
+        uint32_t magic;
+        uint32_t version;
+    };
+
+    struct record {
+        uint32_t type;
+        uint32_t worker;
+        uint64_t first_ts;
+        uint64_t last_ts;
+        uint64_t bytes;
+        uint64_t packets;
+        uint32_t flags;
+        uint32_t checksum;
+    };
+
+    catalog();
+    ~catalog();
+
+    catalog(const catalog&) = delete;
+    catalog& operator=(const catalog&) = delete;
+
+    bool open(const std::string& filename, const std::string& root, std::vector<info>* segments);
+    void close();
+
+    bool append(const info& segment);
+    bool remove(const std::vector<info>& segments);
+    bool compact(const std::vector<info>& segments, uint64_t records);
+
+    bool is_open() const;
+    uint64_t records() const;
+    uint64_t deleted() const;
+
+private:
+    static uint32_t checksum_of(const record& rec);
+    static record make_record(uint32_t type, const info& segment);
+
+    bool load(std::vector<info>* segments);
+    bool write_records(const std::vector<record>& recs);
+
+    std::string filename_;
+    std::string root_;
+    int fd_;
+    mutable std::mutex mutex_;
+    uint64_t records_;
+    uint64_t deleted_;
+};
+
+inline bool catalog::is_open() const
+{
+    return fd_ >= 0;
+}
+
+inline uint64_t catalog::records() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return records_;
+}
+
+inline uint64_t catalog::deleted() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return deleted_;
+}
+
+}  // namespace segment
+
+}  // namespace pca
@@ -31,6 +31,18 @@ namespace pca {
 #define TEST_ENUM(n) \
     { "test", 0, NULL, 't' },
 
+#define REPLAY_ENUM(n) \
+    { "replay", required_argument, NULL, 'r' },         \
+    { "replay-speed", required_argument, NULL, 's' },
+
+#define ANALYZE_ENUM(n) \
+    { "jobs", required_argument, NULL, 'j' },           \
+    { "chunk-size", required_argument, NULL, 'k' },
+
+#define MERGE_ENUM(n) \
+    { "begin", required_argument, NULL, 'b' },          \
+    { "end", required_argument, NULL, 'e' },
+
 #define END_ENUM(n) \
     { NULL, 0, NULL, 0 },
 
@@ -61,6 +73,45 @@ namespace pca {
         test_mode = true;                       \
         break;
 
+#define REPLAY_PARSER(n) \
+    case 'r':                                   \
+        replay_path = optarg;                   \
+        break;                                  \
+    case 's':                                   \
+        if (!pca::replay::parse_speed(optarg, &replay_speed)) {                     \
+            logger::fatal(fmt::format("Invalid replay speed {}", optarg));          \
+            ::exit(1);                                                              \
+        }                                                                           \
+        break;
+
+#define ANALYZE_PARSER(n) \
+    case 'j':                                   \
+        analyze_jobs = atoi(optarg);            \
+        if (analyze_jobs <= 0) {                \
+            logger::fatal(fmt::format("Invalid jobs {}", optarg));                  \
+            ::exit(1);                                                              \
+        }                                                                           \
+        break;                                  \
+    case 'k':                                   \
+        analyze_chunk_size_mb = atoi(optarg);   \
+        if (analyze_chunk_size_mb <= 0) {       \
+            logger::fatal(fmt::format("Invalid chunk size {}", optarg));            \
+            ::exit(1);                                                              \
+        }                                                                           \
+        break;
+
+#define MERGE_PARSER(n) \
+    case 'b':                                   \
+        merge_begin_sec = strtoull(optarg, NULL, 10);                               \
+        break;                                  \
+    case 'e':                                   \
+        merge_end_sec = strtoull(optarg, NULL, 10);                                 \
+        if (merge_end_sec == 0) {               \
+            logger::fatal(fmt::format("Invalid end time {}", optarg));              \
+            ::exit(1);                                                              \
+        }                                                                           \
+        break;
+
 #define END_PARSER(n) \
     default:                                    \
         logger::fatal("Use --help for usage");  \
@@ -86,6 +137,19 @@ namespace pca {
 #define HELP_TEST() \
     printf("  -t, --test            Test mode\n");
 
+#define HELP_REPLAY() \
+    printf("  -r, --replay=FILE|DIR Replay pcap files instead of capturing\n");    \
+    printf("  -s, --replay-speed=SPEED\n");                                     \
+    printf("                        Replay speed: original, N (times) or max\n");
+
+#define HELP_ANALYZE() \
+    printf("  -j, --jobs=N          Run N analysis threads\n");                  \
+    printf("  -k, --chunk-size=MB   Split files into chunks of MB\n");
+
+#define HELP_MERGE() \
+    printf("  -b, --begin=SEC       Skip packets before SEC (epoch)\n");        \
+    printf("  -e, --end=SEC         Stop at packets from SEC (epoch)\n");
+
 #define MAKE_CLI_PARSER()   \
 do {                        \
     ENUM_BEGIN(long)        \
@@ -114,6 +178,51 @@ do {                        \
     PARSER_END("c:D?Ht")    \
 } while (0)
 
+#define MAKE_CLI_PARSER_WITH_REPLAY()  \
+do {                        \
+    ENUM_BEGIN(long)        \
+        START_ENUM(3)       \
+        REPLAY_ENUM(2)      \
+        END_ENUM(1)         \
+    ENUM_END(long)          \
+                            \
+    PARSER_BEGIN("c:D?Hr:s:")   \
+        START_PARSER(3)     \
+        REPLAY_PARSER(2)    \
+        END_PARSER(1)       \
+    PARSER_END("c:D?Hr:s:")     \
+} while (0)
+
+#define MAKE_CLI_PARSER_WITH_ANALYZE()  \
+do {                        \
+    ENUM_BEGIN(long)        \
+        START_ENUM(3)       \
+        ANALYZE_ENUM(2)     \
+        END_ENUM(1)         \
+    ENUM_END(long)          \
+                            \
+    PARSER_BEGIN("c:D?Hj:k:")   \
+        START_PARSER(3)     \
+        ANALYZE_PARSER(2)   \
+        END_PARSER(1)       \
+    PARSER_END("c:D?Hj:k:")     \
+} while (0)
+
+#define MAKE_CLI_PARSER_WITH_MERGE()  \
+do {                        \
+    ENUM_BEGIN(long)        \
+        START_ENUM(3)       \
+        MERGE_ENUM(2)       \
+        END_ENUM(1)         \
+    ENUM_END(long)          \
+                            \
+    PARSER_BEGIN("c:D?Hb:e:")   \
+        START_PARSER(3)     \
+        MERGE_PARSER(2)     \
+        END_PARSER(1)       \
+    PARSER_END("c:D?Hb:e:")     \
+} while (0)
+
 #define MAKE_CLI_HELP()     \
 do {                        \
     HELP_BASE()             \
@@ -125,4 +234,22 @@ do {                        \
     HELP_TEST()             \
 } while (0)
 
+#define MAKE_CLI_HELP_WITH_REPLAY()     \
+do {                        \
+    HELP_BASE()             \
+    HELP_REPLAY()           \
+} while (0)
+
+#define MAKE_CLI_HELP_WITH_ANALYZE()    \
+do {                        \
+    HELP_BASE()             \
+    HELP_ANALYZE()          \
+} while (0)
+
+#define MAKE_CLI_HELP_WITH_MERGE()      \
+do {                        \
+    HELP_BASE()             \
+    HELP_MERGE()            \
+} while (0)
+
 }  // namespace pca
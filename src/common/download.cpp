@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet download API documentation.
+ */
+
+/**
+ * @file download.cpp
+ *
+ * @brief      Xabyss's Packet download library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+
+#include "download.hpp"
+#include "merge.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace download {
+
+/**
+ * Write the packets in [begin_ts, end_ts) into a pcap file, ordered by
+ * timestamp. The recent buffer is read first, the stored segments only for
+ * the part of the range it doesn't hold.
+ *
+ * @param filename  an output filename.
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param storage   the stored segments, may be null.
+ * @param recent    the recent buffer, may be null.
+ * @param res       the result to be filled.
+ * @return true on success, false otherwise.
+ */
+bool write(const std::string& filename, uint64_t begin_ts, uint64_t end_ts,
+           const retention* storage, const recent_buffer* recent, result* res)
+{
+    *res = result();
+
+    // the recent buffer holds everything from cut on
+    uint64_t cut = recent != nullptr ? std::max(begin_ts, recent->oldest_ts()) : end_ts;
+    cut = std::min(cut, end_ts);
+
+    merge::merger disk(4 << 20);
+    if (storage != nullptr && begin_ts < cut) {
+        for (const auto& info : storage->find(begin_ts, cut)) {
+            disk.add(info.path);
+        }
+        disk.set_range(begin_ts, cut);
+        if (!disk.start())
+            return false;
+        res->segments = disk.sources();
+    }
+
+    int linktype = res->segments > 0 ? disk.linktype()
+        : (recent != nullptr ? recent->linktype() : LINKTYPE_ETHERNET);
+    pcap::writer out(4 << 20);
+    packet pkt;
+
+    if (!out.open(filename, linktype))
+        return false;
+
+    while (res->segments > 0 && disk.next(&pkt)) {
+        if (!out.write(pkt))
+            return false;
+        res->packets++;
+        res->bytes += pkt.caplen;
+    }
+
+    if (recent != nullptr && cut < end_ts) {
+        recent_buffer::snapshot snap;
+
+        recent->read(cut, end_ts, &snap);
+        for (const auto& p : snap.packets) {
+            if (!out.write(p))
+                return false;
+            res->packets++;
+            res->bytes += p.caplen;
+        }
+        res->memory = true;
+    }
+
+    return out.close();
+}
+
+}  // namespace download
+
+}  // namespace pca
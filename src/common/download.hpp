@@ -0,0 +1,43 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet download API documentation.
+ */
+
+/**
+ * @file download.hpp
+ *
+ * @brief      Xabyss's Packet download library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "packet_ring.hpp"
+#include "retention.hpp"
+
+namespace pca {
+
+namespace download {
+
+struct result {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    size_t segments = 0;        // segments read from disk
+    bool memory = false;        // read from the recent buffer
+};
+
+bool write(const std::string& filename, uint64_t begin_ts, uint64_t end_ts,
+           const retention* storage, const recent_buffer* recent, result* res);
+
+}  // namespace download
+
+}  // namespace pca
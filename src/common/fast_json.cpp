@@ -0,0 +1,618 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Fast JSON API documentation.
+ */
+
+/**
+ * @file fast_json.cpp
+ *
+ * @brief      Xabyss's Fast JSON library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+
+#include "fast_json.hpp"
+
+namespace xa {
+
+namespace json {
+
+constexpr static const int MAX_DEPTH = 64;
+constexpr static const size_t MAX_NUMBER = 64;
+
+bool value::is_integral() const
+{
+    return kind == TYPE_NUMBER && memchr(text, '.', len) == nullptr && memchr(text, 'e', len) == nullptr
+        && memchr(text, 'E', len) == nullptr;
+}
+
+double value::as_double() const
+{
+    char buf[MAX_NUMBER + 1];
+
+    if (kind != TYPE_NUMBER || len > MAX_NUMBER)
+        return kind == TYPE_NUMBER ? strtod(std::string(text, len).c_str(), nullptr) : 0;
+
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    return strtod(buf, nullptr);
+}
+
+int64_t value::as_int64() const
+{
+    if (!is_integral())
+        return static_cast<int64_t>(as_double());
+
+    bool negative = text[0] == '-';
+    uint64_t n = 0;
+    for (uint32_t i = negative ? 1 : 0; i < len; i++) {
+        n = n * 10 + (text[i] - '0');
+    }
+
+    return negative ? -static_cast<int64_t>(n) : static_cast<int64_t>(n);
+}
+
+uint64_t value::as_uint64() const
+{
+    if (!is_integral() || text[0] == '-')
+        return static_cast<uint64_t>(std::max(as_double(), 0.0));
+
+    uint64_t n = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        n = n * 10 + (text[i] - '0');
+    }
+
+    return n;
+}
+
+std::string value::as_string() const
+{
+    return kind == TYPE_STRING || kind == TYPE_NUMBER ? std::string(text, len) : std::string();
+}
+
+bool value::equals(const char* s) const
+{
+    size_t n = strlen(s);
+
+    return kind == TYPE_STRING && len == n && memcmp(text, s, n) == 0;
+}
+
+const value* value::find(const char* name, size_t n) const
+{
+    if (kind != TYPE_OBJECT)
+        return nullptr;
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (items[i].key_equals(name, n))
+            return &items[i];
+    }
+
+    return nullptr;
+}
+
+parser::parser()
+    : arena_(&own_)
+    , p_(nullptr)
+    , end_(nullptr)
+{
+}
+
+parser::parser(xa::arena* arena)
+    : arena_(arena)
+    , p_(nullptr)
+    , end_(nullptr)
+{
+}
+
+/**
+ * Parse a text, in place: escaped strings are decoded over their own text.
+ *
+ * @param text      the text, changed by the parse.
+ * @param n         its length.
+ * @return the root value, nullptr if the text is not valid JSON.
+ */
+const value* parser::parse(char* text, size_t n)
+{
+    reset();
+    p_ = text;
+    end_ = text + n;
+
+    value* root = arena_->allocate_array<value>(1);
+    if (!parse_value(root, 0))
+        return nullptr;
+
+    skip_space();
+    if (p_ != end_) {
+        fail("trailing characters");
+        return nullptr;
+    }
+
+    return root;
+}
+
+/**
+ * Forget the values of the last parse, keeping the memory.
+ */
+void parser::reset()
+{
+    if (arena_ == &own_)
+        arena_->reset();
+    stack_.clear();
+    error_.clear();
+}
+
+bool parser::fail(const char* message)
+{
+    if (error_.empty())
+        error_ = message;
+
+    return false;
+}
+
+inline void parser::skip_space()
+{
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+        p_++;
+    }
+}
+
+bool parser::parse_value(value* v, int depth)
+{
+    skip_space();
+    if (p_ >= end_)
+        return fail("unexpected end");
+
+    v->key = nullptr;
+    v->key_len = 0;
+    v->boolean = false;
+    v->len = 0;
+    v->text = nullptr;
+
+    switch (*p_) {
+    case '{':
+    case '[': {
+        bool object = *p_ == '{';
+        char close = object ? '}' : ']';
+        size_t base = stack_.size();
+
+        if (depth >= MAX_DEPTH)
+            return fail("too deep");
+        p_++;
+        skip_space();
+
+        if (p_ < end_ && *p_ == close) {
+            p_++;
+        } else {
+            for (;;) {
+                value item;
+                const char* key = nullptr;
+                uint32_t key_len = 0;
+
+                if (object) {
+                    skip_space();
+                    if (p_ >= end_ || *p_ != '"')
+                        return fail("member name expected");
+                    if (!parse_string(&key, &key_len))
+                        return false;
+                    skip_space();
+                    if (p_ >= end_ || *p_ != ':')
+                        return fail("':' expected");
+                    p_++;
+                }
+                if (!parse_value(&item, depth + 1))
+                    return false;
+                item.key = key;
+                item.key_len = key_len;
+                stack_.push_back(item);
+
+                skip_space();
+                if (p_ < end_ && *p_ == ',') {
+                    p_++;
+                } else if (p_ < end_ && *p_ == close) {
+                    p_++;
+                    break;
+                } else {
+                    return fail(object ? "',' or '}' expected" : "',' or ']' expected");
+                }
+            }
+        }
+
+        // the items of nested values went to the arena already, these follow
+        size_t n = stack_.size() - base;
+        value* items = arena_->allocate_array<value>(n > 0 ? n : 1);
+        if (n > 0)
+            memcpy(items, &stack_[base], n * sizeof(value));
+        stack_.resize(base);
+
+        v->kind = object ? TYPE_OBJECT : TYPE_ARRAY;
+        v->len = static_cast<uint32_t>(n);
+        v->items = items;
+        return true;
+    }
+    case '"':
+        v->kind = TYPE_STRING;
+        return parse_string(&v->text, &v->len);
+    case 't':
+        v->kind = TYPE_BOOLEAN;
+        v->boolean = true;
+        return parse_literal("true", 4);
+    case 'f':
+        v->kind = TYPE_BOOLEAN;
+        return parse_literal("false", 5);
+    case 'n':
+        v->kind = TYPE_NULL;
+        return parse_literal("null", 4);
+    default:
+        v->kind = TYPE_NUMBER;
+        return parse_number(v);
+    }
+}
+
+bool parser::parse_literal(const char* word, size_t n)
+{
+    if (static_cast<size_t>(end_ - p_) < n || memcmp(p_, word, n) != 0)
+        return fail("invalid literal");
+    p_ += n;
+
+    return true;
+}
+
+bool parser::parse_number(value* v)
+{
+    const char* start = p_;
+    auto digits = [this]() -> size_t {
+        const char* s = p_;
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+            p_++;
+        }
+        return p_ - s;
+    };
+
+    if (p_ < end_ && *p_ == '-')
+        p_++;
+    if (p_ < end_ && *p_ == '0')
+        p_++;
+    else if (digits() == 0)
+        return fail("invalid number");
+
+    if (p_ < end_ && *p_ == '.') {
+        p_++;
+        if (digits() == 0)
+            return fail("invalid number");
+    }
+    if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+        p_++;
+        if (p_ < end_ && (*p_ == '+' || *p_ == '-'))
+            p_++;
+        if (digits() == 0)
+            return fail("invalid number");
+    }
+
+    v->text = start;
+    v->len = static_cast<uint32_t>(p_ - start);
+
+    return true;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static char* put_utf8(char* w, uint32_t cp)
+{
+    if (cp < 0x80) {
+        *w++ = static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        *w++ = static_cast<char>(0xc0 | (cp >> 6));
+        *w++ = static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        *w++ = static_cast<char>(0xe0 | (cp >> 12));
+        *w++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        *w++ = static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        *w++ = static_cast<char>(0xf0 | (cp >> 18));
+        *w++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        *w++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        *w++ = static_cast<char>(0x80 | (cp & 0x3f));
+    }
+
+    return w;
+}
+
+// a string from its opening quote, decoded over itself if it has escapes
+bool parser::parse_string(const char** out, uint32_t* len)
+{
+    char* start = ++p_;
+
+    while (p_ < end_ && *p_ != '"' && *p_ != '\\' && static_cast<unsigned char>(*p_) >= 0x20) {
+        p_++;
+    }
+
+    char* w = p_;
+    while (p_ < end_ && *p_ != '"') {
+        unsigned char c = *p_;
+
+        if (c < 0x20)
+            return fail("control character in string");
+        if (c != '\\') {
+            *w++ = *p_++;
+            continue;
+        }
+
+        if (end_ - p_ < 2)
+            return fail("unexpected end");
+        p_ += 2;
+        switch (p_[-1]) {
+        case '"':  *w++ = '"'; break;
+        case '\\': *w++ = '\\'; break;
+        case '/':  *w++ = '/'; break;
+        case 'b':  *w++ = '\b'; break;
+        case 'f':  *w++ = '\f'; break;
+        case 'n':  *w++ = '\n'; break;
+        case 'r':  *w++ = '\r'; break;
+        case 't':  *w++ = '\t'; break;
+        case 'u': {
+            auto hex4 = [this](uint32_t* cp) -> bool {
+                if (end_ - p_ < 4)
+                    return false;
+                *cp = 0;
+                for (int i = 0; i < 4; i++) {
+                    int h = hex_value(p_[i]);
+                    if (h < 0)
+                        return false;
+                    *cp = *cp << 4 | h;
+                }
+                p_ += 4;
+                return true;
+            };
+            uint32_t cp, low;
+
+            if (!hex4(&cp))
+                return fail("invalid \\u escape");
+            if (cp >= 0xd800 && cp < 0xdc00) {
+                if (end_ - p_ < 6 || p_[0] != '\\' || p_[1] != 'u')
+                    return fail("invalid surrogate pair");
+                p_ += 2;
+                if (!hex4(&low) || low < 0xdc00 || low >= 0xe000)
+                    return fail("invalid surrogate pair");
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            } else if (cp >= 0xdc00 && cp < 0xe000) {
+                return fail("invalid surrogate pair");
+            }
+            w = put_utf8(w, cp);
+            break;
+        }
+        default:
+            return fail("invalid escape");
+        }
+    }
+    if (p_ >= end_)
+        return fail("unterminated string");
+
+    *out = start;
+    *len = static_cast<uint32_t>(w - start);
+    p_++;
+
+    return true;
+}
+
+writer::writer(std::string* out)
+    : out_(out)
+    , first_(0)
+    , depth_(0)
+    , after_key_(false)
+    , error_code_(0)
+{
+}
+
+inline void writer::separate()
+{
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0)
+        return;
+
+    uint64_t bit = 1ULL << ((depth_ - 1) & 63);
+    if (first_ & bit)
+        first_ &= ~bit;
+    else
+        out_->push_back(',');
+}
+
+writer& writer::begin_object()
+{
+    separate();
+    out_->push_back('{');
+    first_ |= 1ULL << (depth_++ & 63);
+    return *this;
+}
+
+writer& writer::end_object()
+{
+    depth_--;
+    out_->push_back('}');
+    return *this;
+}
+
+writer& writer::begin_array()
+{
+    separate();
+    out_->push_back('[');
+    first_ |= 1ULL << (depth_++ & 63);
+    return *this;
+}
+
+writer& writer::end_array()
+{
+    depth_--;
+    out_->push_back(']');
+    return *this;
+}
+
+writer& writer::key(const char* name, size_t n)
+{
+    string(name, n);
+    out_->push_back(':');
+    after_key_ = true;
+    return *this;
+}
+
+writer& writer::null()
+{
+    separate();
+    out_->append("null", 4);
+    return *this;
+}
+
+writer& writer::boolean(bool b)
+{
+    separate();
+    if (b)
+        out_->append("true", 4);
+    else
+        out_->append("false", 5);
+    return *this;
+}
+
+writer& writer::number(uint64_t n)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+
+    separate();
+    do {
+        *--p = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    out_->append(p, buf + sizeof(buf) - p);
+
+    return *this;
+}
+
+writer& writer::number(int64_t n)
+{
+    if (n >= 0)
+        return number(static_cast<uint64_t>(n));
+
+    separate();
+    out_->push_back('-');
+    // no separator again for the digits
+    after_key_ = true;
+
+    return number(static_cast<uint64_t>(0) - static_cast<uint64_t>(n));
+}
+
+writer& writer::number(double d)
+{
+    char buf[32];
+
+    if (!std::isfinite(d))
+        return null();
+
+    separate();
+    int n = snprintf(buf, sizeof(buf), "%.17g", d);
+    out_->append(buf, n);
+
+    return *this;
+}
+
+writer& writer::string(const char* s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char* end = s + n;
+
+    separate();
+    out_->push_back('"');
+    while (s < end) {
+        const char* run = s;
+        while (s < end && *s != '"' && *s != '\\' && static_cast<unsigned char>(*s) >= 0x20) {
+            s++;
+        }
+        out_->append(run, s - run);
+        if (s == end)
+            break;
+
+        unsigned char c = *s++;
+        switch (c) {
+        case '"':  out_->append("\\\"", 2); break;
+        case '\\': out_->append("\\\\", 2); break;
+        case '\b': out_->append("\\b", 2); break;
+        case '\f': out_->append("\\f", 2); break;
+        case '\n': out_->append("\\n", 2); break;
+        case '\r': out_->append("\\r", 2); break;
+        case '\t': out_->append("\\t", 2); break;
+        default: {
+            char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            out_->append(u, 6);
+            break;
+        }
+        }
+    }
+    out_->push_back('"');
+
+    return *this;
+}
+
+/**
+ * Write a parsed value back, keys in their order.
+ */
+writer& writer::write(const value& v)
+{
+    switch (v.kind) {
+    case TYPE_BOOLEAN:
+        return boolean(v.boolean);
+    case TYPE_NUMBER:
+        return raw(v.text, v.len);
+    case TYPE_STRING:
+        return string(v.text, v.len);
+    case TYPE_ARRAY:
+        begin_array();
+        for (const value& item : v) {
+            write(item);
+        }
+        return end_array();
+    case TYPE_OBJECT:
+        begin_object();
+        for (const value& item : v) {
+            key(item.key, item.key_len);
+            write(item);
+        }
+        return end_object();
+    default:
+        return null();
+    }
+}
+
+/**
+ * Write a value already in JSON.
+ */
+writer& writer::raw(const char* text, size_t n)
+{
+    separate();
+    out_->append(text, n);
+    return *this;
+}
+
+}  // namespace json
+
+}  // namespace xa
@@ -0,0 +1,277 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Fast JSON API documentation.
+ */
+
+/**
+ * @file fast_json.hpp
+ *
+ * @brief      Xabyss's Fast JSON library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+
+namespace xa {
+
+namespace json {
+
+enum type : uint8_t {
+    TYPE_NULL,
+    TYPE_BOOLEAN,
+    TYPE_NUMBER,
+    TYPE_STRING,
+    TYPE_ARRAY,
+    TYPE_OBJECT,
+};
+
+/**
+ * A parsed value. Strings and numbers point into the text parsed, which is
+ * unescaped in place, and arrays and objects into the arena of the parser,
+ * so a value lives as long as both.
+ */
+struct value {
+    type kind;
+    bool boolean;
+    uint32_t len;           // bytes of a string or number, items of an array or object
+    const char* key;        // the member name in an object, nullptr otherwise
+    uint32_t key_len;
+    union {
+        const char* text;
+        const value* items;
+    };
+
+    bool is_null() const;
+    bool is_bool() const;
+    bool is_number() const;
+    bool is_integral() const;
+    bool is_string() const;
+    bool is_array() const;
+    bool is_object() const;
+
+    bool as_bool() const;
+    double as_double() const;
+    int64_t as_int64() const;
+    uint64_t as_uint64() const;
+    std::string as_string() const;
+
+    bool equals(const char* s) const;
+    bool key_equals(const char* s, size_t n) const;
+
+    size_t size() const;
+    const value& operator[](size_t i) const;
+    const value* find(const char* name) const;
+    const value* find(const char* name, size_t n) const;
+
+    const value* begin() const;
+    const value* end() const;
+};
+
+/**
+ * A parser reused from request to request: the arena and the stack keep
+ * their memory, so parsing allocates nothing once warmed up.
+ *
+ * Given an arena, say the one of a request, it parses into that instead and
+ * leaves freeing it to its owner.
+ */
+class parser {
+public:
+    parser();
+    explicit parser(xa::arena* arena);
+
+    const value* parse(char* text, size_t n);
+    void reset();
+
+    const std::string& error() const;
+    xa::arena& arena();
+
+private:
+    bool parse_value(value* v, int depth);
+    bool parse_string(const char** out, uint32_t* len);
+    bool parse_number(value* v);
+    bool parse_literal(const char* word, size_t n);
+    void skip_space();
+    bool fail(const char* message);
+
+    xa::arena own_;
+    xa::arena* arena_;
+    std::vector<value> stack_;
+    char* p_;
+    char* end_;
+    std::string error_;
+};
+
+/**
+ * A JSON writer appending to a string, commas put in by itself.
+ */
+class writer {
+public:
+    explicit writer(std::string* out);
+
+    writer& begin_object();
+    writer& end_object();
+    writer& begin_array();
+    writer& end_array();
+    writer& key(const char* name);
+    writer& key(const char* name, size_t n);
+
+    writer& null();
+    writer& boolean(bool b);
+    writer& number(int64_t n);
+    writer& number(uint64_t n);
+    writer& number(int n);
+    writer& number(unsigned n);
+    writer& number(double d);
+    writer& string(const char* s);
+    writer& string(const char* s, size_t n);
+    writer& string(const std::string& s);
+    writer& write(const value& v);
+    writer& raw(const char* text, size_t n);
+
+    std::string* out() const;
+    // the code of the JSON-RPC error written, 0 if none
+    int error_code() const;
+    void set_error_code(int code);
+
+private:
+    void separate();
+
+    std::string* out_;
+    uint64_t first_;        // a bit per level, set until its first item
+    unsigned depth_;
+    bool after_key_;
+    int error_code_;
+};
+
+inline bool value::is_null() const
+{
+    return kind == TYPE_NULL;
+}
+
+inline bool value::is_bool() const
+{
+    return kind == TYPE_BOOLEAN;
+}
+
+inline bool value::is_number() const
+{
+    return kind == TYPE_NUMBER;
+}
+
+inline bool value::is_string() const
+{
+    return kind == TYPE_STRING;
+}
+
+inline bool value::is_array() const
+{
+    return kind == TYPE_ARRAY;
+}
+
+inline bool value::is_object() const
+{
+    return kind == TYPE_OBJECT;
+}
+
+inline bool value::as_bool() const
+{
+    return kind == TYPE_BOOLEAN && boolean;
+}
+
+inline bool value::key_equals(const char* s, size_t n) const
+{
+    return key != nullptr && key_len == n && memcmp(key, s, n) == 0;
+}
+
+inline size_t value::size() const
+{
+    return kind == TYPE_ARRAY || kind == TYPE_OBJECT ? len : 0;
+}
+
+inline const value& value::operator[](size_t i) const
+{
+    return items[i];
+}
+
+inline const value* value::find(const char* name) const
+{
+    return find(name, strlen(name));
+}
+
+inline const value* value::begin() const
+{
+    return size() > 0 ? items : nullptr;
+}
+
+inline const value* value::end() const
+{
+    return size() > 0 ? items + len : nullptr;
+}
+
+inline const std::string& parser::error() const
+{
+    return error_;
+}
+
+inline xa::arena& parser::arena()
+{
+    return *arena_;
+}
+
+inline writer& writer::key(const char* name)
+{
+    return key(name, strlen(name));
+}
+
+inline writer& writer::string(const char* s)
+{
+    return string(s, strlen(s));
+}
+
+inline writer& writer::string(const std::string& s)
+{
+    return string(s.data(), s.size());
+}
+
+inline writer& writer::number(int n)
+{
+    return number(static_cast<int64_t>(n));
+}
+
+inline writer& writer::number(unsigned n)
+{
+    return number(static_cast<uint64_t>(n));
+}
+
+inline std::string* writer::out() const
+{
+    return out_;
+}
+
+inline int writer::error_code() const
+{
+    return error_code_;
+}
+
+inline void writer::set_error_code(int code)
+{
+    error_code_ = code;
+}
+
+}  // namespace json
+
+}  // namespace xa
@@ -0,0 +1,254 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Federated search API documentation.
+ */
+
+/**
+ * @file federation.cpp
+ *
+ * @brief      Xabyss's Federated search library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <thread>
+
+#include "federation.hpp"
+
+namespace pca {
+
+namespace federation {
+
+/**
+ * Call a method of this node. A call in process can't be cut off once it
+ * runs, but the search methods return at once, the search running in the
+ * background, so the deadline is only held before it starts.
+ */
+bool local_node::call(const std::string& method, const Json::Value& params, Json::Value* result,
+                      std::string* error, time_point deadline)
+{
+    Json::Value req(Json::objectValue);
+    Json::Value res(Json::objectValue);
+
+    if (std::chrono::steady_clock::now() >= deadline) {
+        *error = "timed out";
+        return false;
+    }
+
+    req["jsonrpc"] = "2.0";
+    req["method"] = method;
+    req["params"] = params;
+    req["id"] = 0;
+
+    if (!serve_(req, &res)) {
+        *error = res["error"]["message"].asString();
+        return false;
+    }
+    *result = res["result"];
+
+    return true;
+}
+
+bool peer_node::call(const std::string& method, const Json::Value& params, Json::Value* result,
+                     std::string* error, time_point deadline)
+{
+    return client_.call(method, params, result, error, deadline);
+}
+
+namespace {
+
+// the search of a node and the packets read from it, not merged yet
+struct stream {
+    node* n;
+    node_status* status;
+    int id = -1;
+    std::deque<Json::Value> records;
+    uint64_t cursor = 0;
+    bool more = false;          // pages left on the node
+
+    void fail(const std::string& error, time_point deadline)
+    {
+        status->error = error;
+        status->timed_out = std::chrono::steady_clock::now() >= deadline;
+        more = false;
+    }
+
+    // a page, in the time a node has for every call
+    bool fetch(std::chrono::milliseconds timeout)
+    {
+        time_point deadline = std::chrono::steady_clock::now() + timeout;
+        Json::Value params(Json::objectValue);
+        Json::Value page;
+        std::string error;
+
+        params["id"] = id;
+        params["cursor"] = static_cast<Json::UInt64>(cursor);
+        params["limit"] = PAGE_SIZE;
+        if (!n->call("search_fetch", params, &page, &error, deadline)) {
+            fail(error, deadline);
+            return false;
+        }
+
+        for (auto& record : page["packets"]) {
+            record["node"] = n->name();
+            records.push_back(std::move(record));
+        }
+        more = page["next"].isIntegral();
+        cursor = more ? page["next"].asUInt64() : 0;
+
+        return true;
+    }
+
+    // run the search on the node, in the time it has from now, and read the
+    // first page
+    void prepare(const Json::Value& params, std::chrono::milliseconds timeout)
+    {
+        time_point deadline = std::chrono::steady_clock::now() + timeout;
+        Json::Value result;
+        std::string error;
+
+        if (!n->call("search_start", params, &result, &error, deadline)) {
+            fail(error, deadline);
+            return;
+        }
+        id = result["id"].asInt();
+
+        // polled quickly at first, the small searches are the most common
+        auto delay = std::chrono::milliseconds(5);
+        for (;;) {
+            Json::Value poll(Json::objectValue);
+
+            poll["id"] = id;
+            if (!n->call("search_poll", poll, &result, &error, deadline)) {
+                fail(error, deadline);
+                return;
+            }
+
+            std::string state = result["state"].asString();
+            if (state == "done")
+                break;
+            if (state != "queued" && state != "running") {
+                fail("search " + state, deadline);
+                return;
+            }
+
+            if (std::chrono::steady_clock::now() + delay >= deadline) {
+                fail("timed out", deadline);
+                status->timed_out = true;
+                return;
+            }
+            std::this_thread::sleep_for(delay);
+            delay = std::min(2 * delay, std::chrono::milliseconds(100));
+        }
+        status->truncated = result["truncated"].asBool();
+
+        fetch(timeout);
+    }
+
+    double head_ts() const
+    {
+        return records.front()["ts"].asDouble();
+    }
+};
+
+void for_each_stream(std::vector<stream>* streams, const std::function<void(stream&)>& fn)
+{
+    std::vector<std::thread> threads;
+
+    for (auto& s : *streams) {
+        threads.emplace_back([&fn, &s] { fn(s); });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+}  // namespace
+
+/**
+ * Search several nodes at once and merge their packets by timestamp.
+ *
+ * Each node runs the search in the background and its packets are read a
+ * page at a time as the merge takes them. A node has the timeout to finish
+ * its search, and again for every page, however slow the merge is taken; one
+ * that doesn't make it, or fails, is left out from then on and the merge goes
+ * on with the others. Its status says why.
+ *
+ * @param nodes     the nodes.
+ * @param params    the params of search_start.
+ * @param limit     the maximum number of packets to merge.
+ * @param timeout   how long each node has to search, and to answer a fetch.
+ * @param fn        called on each packet record, in timestamp order.
+ * @param status    the status of each node to be filled.
+ * @return true if every node answered in time, false if the result is partial.
+ */
+bool search(const std::vector<node*>& nodes, const Json::Value& params, size_t limit,
+            std::chrono::milliseconds timeout, const record_func& fn, std::vector<node_status>* status)
+{
+    std::vector<stream> streams(nodes.size());
+
+    status->assign(nodes.size(), node_status());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        streams[i].n = nodes[i];
+        streams[i].status = &(*status)[i];
+        (*status)[i].name = nodes[i]->name();
+    }
+
+    for_each_stream(&streams, [&](stream& s) { s.prepare(params, timeout); });
+
+    auto later = [&streams](size_t a, size_t b) { return streams[a].head_ts() > streams[b].head_ts(); };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+
+    for (size_t i = 0; i < streams.size(); i++) {
+        if (!streams[i].records.empty())
+            heap.push(i);
+    }
+
+    for (size_t merged = 0; !heap.empty() && merged < limit; merged++) {
+        stream& s = streams[heap.top()];
+        heap.pop();
+
+        Json::Value record = std::move(s.records.front());
+        s.records.pop_front();
+        s.status->packets++;
+        if (!fn(record))
+            break;
+
+        if (s.records.empty() && s.more)
+            s.fetch(timeout);
+        if (!s.records.empty())
+            heap.push(&s - streams.data());
+    }
+
+    bool complete = true;
+    for (auto& s : streams) {
+        s.status->complete = s.status->error.empty() && s.records.empty() && !s.more;
+        complete = complete && s.status->error.empty();
+    }
+
+    // the results stay on the nodes until cancelled, even past the deadline
+    for_each_stream(&streams, [](stream& s) {
+        Json::Value params(Json::objectValue);
+        Json::Value result;
+        std::string error;
+
+        params["id"] = s.id;
+        if (s.id >= 0)
+            s.n->call("search_cancel", params, &result, &error, std::chrono::steady_clock::now()
+                      + std::chrono::seconds(1));
+    });
+
+    return complete;
+}
+
+}  // namespace federation
+
+}  // namespace pca
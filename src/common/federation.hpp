@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Federated search API documentation.
+ */
+
+/**
+ * @file federation.hpp
+ *
+ * @brief      Xabyss's Federated search library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <json/json.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "rpc_client.hpp"
+
+namespace pca {
+
+namespace federation {
+
+typedef std::chrono::steady_clock::time_point time_point;
+
+/**
+ * A node searched, this one or a peer, through the background search
+ * methods of its RPC: search_start, search_poll, search_fetch and
+ * search_cancel.
+ */
+class node {
+public:
+    explicit node(const std::string& name) : name_(name) {}
+    virtual ~node() {}
+
+    virtual bool call(const std::string& method, const Json::Value& params, Json::Value* result,
+                      std::string* error, time_point deadline) = 0;
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+private:
+    std::string name_;
+};
+
+// this node, served in process
+class local_node : public node {
+public:
+    typedef std::function<bool(const Json::Value& req, Json::Value* res)> serve_func;
+
+    local_node(const std::string& name, const serve_func& serve) : node(name), serve_(serve) {}
+
+    virtual bool call(const std::string& method, const Json::Value& params, Json::Value* result,
+                      std::string* error, time_point deadline);
+
+private:
+    serve_func serve_;
+};
+
+class peer_node : public node {
+public:
+    peer_node(const std::string& name, const std::string& host, unsigned short port)
+        : node(name), client_(host, port) {}
+
+    virtual bool call(const std::string& method, const Json::Value& params, Json::Value* result,
+                      std::string* error, time_point deadline);
+
+private:
+    xa::rpc_client client_;
+};
+
+struct node_status {
+    std::string name;
+    bool complete = false;      // every packet the node found was merged
+    bool truncated = false;     // the node found more than the limit
+    bool timed_out = false;
+    uint64_t packets = 0;       // merged
+    std::string error;
+};
+
+/**
+ * A packet record of search_fetch along with the name of its node, false to
+ * stop the search.
+ */
+typedef std::function<bool(const Json::Value& record)> record_func;
+
+constexpr static const unsigned PAGE_SIZE = 1000;
+
+bool search(const std::vector<node*>& nodes, const Json::Value& params, size_t limit,
+            std::chrono::milliseconds timeout, const record_func& fn, std::vector<node_status>* status);
+
+}  // namespace federation
+
+}  // namespace pca
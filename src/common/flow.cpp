@@ -0,0 +1,293 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Flow table API documentation.
+ */
+
+/**
+ * @file flow.cpp
+ *
+ * @brief      Xabyss's Flow table library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "flow.hpp"
+
+namespace pca {
+
+#define IPPROTO_TCP_        6
+#define IPPROTO_UDP_        17
+
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+size_t flow_key_hash::operator()(const flow_key& key) const
+{
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&key);
+    uint64_t h = sizeof(key);
+    uint64_t w;
+    size_t i = 0;
+
+    for (; i + 8 <= sizeof(key); i += 8) {
+        memcpy(&w, p + i, 8);
+        h = mix64(h ^ w);
+    }
+    w = 0;
+    memcpy(&w, p + i, sizeof(key) - i);
+
+    return mix64(h ^ w);
+}
+
+bool flow_key_equal::operator()(const flow_key& a, const flow_key& b) const
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/**
+ * Count a packet.
+ *
+ * @param pkt       a packet.
+ * @param key       the flow key of the packet, version 0 if it's not IP.
+ */
+void traffic_stats::add(const packet& pkt, const flow_key& key)
+{
+    packets++;
+    bytes += pkt.len;
+
+    if (key.version == 4) {
+        ipv4++;
+    } else if (key.version == 6) {
+        ipv6++;
+    } else {
+        non_ip++;
+    }
+
+    if (key.protocol == IPPROTO_TCP_ && key.version != 0) {
+        tcp++;
+    } else if (key.protocol == IPPROTO_UDP_ && key.version != 0) {
+        udp++;
+    }
+
+    first_ts = std::min(first_ts, pkt.ts);
+    last_ts = std::max(last_ts, pkt.ts);
+}
+
+void traffic_stats::merge(const traffic_stats& other)
+{
+    packets += other.packets;
+    bytes += other.bytes;
+    ipv4 += other.ipv4;
+    ipv6 += other.ipv6;
+    tcp += other.tcp;
+    udp += other.udp;
+    non_ip += other.non_ip;
+    first_ts = std::min(first_ts, other.first_ts);
+    last_ts = std::max(last_ts, other.last_ts);
+}
+
+/**
+ * Create a flow table.
+ *
+ * @param partitions flows are split by hash, so tables built in parallel can
+ *                  be merged in parallel one partition per thread.
+ */
+flow_table::flow_table(unsigned partitions)
+    : maps_(partitions > 0 ? partitions : 1)
+{
+}
+
+/**
+ * Make the key direction-independent.
+ *
+ * @param key       a flow key.
+ * @return true if the key was swapped (the packet goes in reverse direction).
+ */
+bool flow_table::canonicalize(flow_key* key)
+{
+    int c = memcmp(key->src_addr, key->dst_addr, sizeof(key->src_addr));
+    if (c < 0 || (c == 0 && key->src_port <= key->dst_port))
+        return false;
+
+    uint8_t addr[sizeof(key->src_addr)];
+    memcpy(addr, key->src_addr, sizeof(addr));
+    memcpy(key->src_addr, key->dst_addr, sizeof(addr));
+    memcpy(key->dst_addr, addr, sizeof(addr));
+    std::swap(key->src_port, key->dst_port);
+
+    return true;
+}
+
+unsigned flow_table::partition_of(const flow_key& key) const
+{
+    if (maps_.size() == 1)
+        return 0;
+
+    // the high bits, the maps use the low bits for buckets
+    return static_cast<unsigned>((hash_(key) >> 32) % maps_.size());
+}
+
+/**
+ * Account a packet to its flow.
+ *
+ * @param key       the flow key of the packet as decoded.
+ * @param pkt       the packet.
+ */
+void flow_table::update(const flow_key& key, const packet& pkt)
+{
+    flow_key canonical = key;
+    int dir = canonicalize(&canonical) ? 1 : 0;
+
+    map_type& map = maps_[partition_of(canonical)];
+    auto it = map.find(canonical);
+    if (it == map.end()) {
+        flow_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.key = canonical;
+        rec.first_ts = pkt.ts;
+        it = map.insert(std::make_pair(canonical, rec)).first;
+    }
+
+    flow_record& rec = it->second;
+    rec.packets[dir]++;
+    rec.bytes[dir] += pkt.len;
+    if (pkt.ts < rec.first_ts)
+        rec.first_ts = pkt.ts;
+    if (pkt.ts > rec.last_ts)
+        rec.last_ts = pkt.ts;
+}
+
+/**
+ * Merge a partition of another table, both tables must have the same number
+ * of partitions.
+ *
+ * @param other     a table.
+ * @param partition the partition to merge.
+ */
+void flow_table::merge(const flow_table& other, unsigned partition)
+{
+    map_type& map = maps_[partition];
+
+    for (const auto& it : other.maps_[partition]) {
+        auto found = map.find(it.first);
+        if (found == map.end()) {
+            map.insert(it);
+            continue;
+        }
+
+        flow_record& rec = found->second;
+        const flow_record& o = it.second;
+        for (int dir = 0; dir < 2; dir++) {
+            rec.packets[dir] += o.packets[dir];
+            rec.bytes[dir] += o.bytes[dir];
+        }
+        rec.first_ts = std::min(rec.first_ts, o.first_ts);
+        rec.last_ts = std::max(rec.last_ts, o.last_ts);
+    }
+}
+
+/**
+ * Remove idle flows.
+ *
+ * @param idle_before flows without packets since this timestamp are removed.
+ * @param fn        called with each removed flow, may be empty.
+ * @return the number of removed flows.
+ */
+size_t flow_table::expire(uint64_t idle_before, expired_fn fn)
+{
+    size_t n = 0;
+
+    for (auto& map : maps_) {
+        for (auto it = map.begin(); it != map.end(); ) {
+            if (it->second.last_ts < idle_before) {
+                if (fn)
+                    fn(it->second);
+                it = map.erase(it);
+                n++;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    return n;
+}
+
+void flow_table::clear()
+{
+    for (auto& map : maps_) {
+        map.clear();
+    }
+}
+
+size_t flow_table::size() const
+{
+    size_t n = 0;
+
+    for (const auto& map : maps_) {
+        n += map.size();
+    }
+
+    return n;
+}
+
+/**
+ * Collect the flows ordered by their first packet.
+ *
+ * @return flow records.
+ */
+std::vector<flow_record> flow_table::records() const
+{
+    std::vector<flow_record> records;
+
+    records.reserve(size());
+    for (const auto& map : maps_) {
+        for (const auto& it : map) {
+            records.push_back(it.second);
+        }
+    }
+
+    std::sort(records.begin(), records.end(), [](const flow_record& a, const flow_record& b) {
+        return a.first_ts < b.first_ts;
+    });
+
+    return records;
+}
+
+/**
+ * Format an address of a flow key.
+ *
+ * @param key       a flow key.
+ * @param addr      key.src_addr or key.dst_addr.
+ * @return the address in presentation format.
+ */
+std::string address_to_string(const flow_key& key, const uint8_t* addr)
+{
+    char buf[INET6_ADDRSTRLEN];
+
+    if (key.version == 0)
+        return "-";
+
+    inet_ntop(key.version == 6 ? AF_INET6 : AF_INET, addr, buf, sizeof(buf));
+
+    return std::string(buf);
+}
+
+}  // namespace pca
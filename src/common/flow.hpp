@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Flow table API documentation.
+ */
+
+/**
+ * @file flow.hpp
+ *
+ * @brief      Xabyss's Flow table library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace pca {
+
+/**
+ * A bidirectional flow, the key is canonical: the endpoint with the lower
+ * (address, port) is the source, index 0 of the counters is that direction.
+ */
+struct flow_record {
+    flow_key key;
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint64_t packets[2];
+    uint64_t bytes[2];
+};
+
+struct flow_key_hash {
+    size_t operator()(const flow_key& key) const;
+};
+
+struct flow_key_equal {
+    bool operator()(const flow_key& a, const flow_key& b) const;
+};
+
+/**
+ * Traffic counters by protocol.
+ */
+struct traffic_stats {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t ipv4 = 0;
+    uint64_t ipv6 = 0;
+    uint64_t tcp = 0;
+    uint64_t udp = 0;
+    uint64_t non_ip = 0;
+    uint64_t first_ts = UINT64_MAX;
+    uint64_t last_ts = 0;
+
+    void add(const packet& pkt, const flow_key& key);
+    void merge(const traffic_stats& other);
+};
+
+class flow_table {
+public:
+    typedef std::unordered_map<flow_key, flow_record, flow_key_hash, flow_key_equal> map_type;
+    using expired_fn = std::function<void(const flow_record&)>;
+
+    explicit flow_table(unsigned partitions = 1);
+
+    static bool canonicalize(flow_key* key);
+
+    void update(const flow_key& key, const packet& pkt);
+    void merge(const flow_table& other, unsigned partition);
+    size_t expire(uint64_t idle_before, expired_fn fn);
+    void clear();
+
+    size_t size() const;
+    unsigned partitions() const;
+    const map_type& partition(unsigned index) const;
+    std::vector<flow_record> records() const;
+
+private:
+    unsigned partition_of(const flow_key& key) const;
+
+    flow_key_hash hash_;
+    std::vector<map_type> maps_;
+};
+
+std::string address_to_string(const flow_key& key, const uint8_t* addr);
+
+inline unsigned flow_table::partitions() const
+{
+    return maps_.size();
+}
+
+inline const flow_table::map_type& flow_table::partition(unsigned index) const
+{
+    return maps_[index];
+}
+
+}  // namespace pca
@@ -0,0 +1,888 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet forwarding API documentation.
+ */
+
+/**
+ * @file forward.cpp
+ *
+ * @brief      Xabyss's Packet forwarding library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "forward.hpp"
+
+namespace pca {
+
+namespace forward {
+
+/*
+ * LZ4 block format, greedy matching on a small hash table: it's meant to
+ * keep up with the link rather than to compress well.
+ */
+namespace {
+
+constexpr static const unsigned HASH_LOG = 12;
+constexpr static const size_t MIN_MATCH = 4;
+constexpr static const size_t LAST_LITERALS = 5;    // the block ends with literals
+constexpr static const size_t MF_LIMIT = 12;        // and no match starts in its last bytes
+constexpr static const size_t MAX_OFFSET = 65535;
+constexpr static const unsigned SKIP_TRIGGER = 6;   // search faster through incompressible data
+
+// a batch saving less than 1/MIN_SAVING of it has the next ones sent as is
+constexpr static const size_t MIN_SAVING = 16;
+constexpr static const unsigned AS_IS_BATCHES = 15;
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+inline uint8_t* put_length(uint8_t* op, size_t n)
+{
+    for (; n >= 255; n -= 255) {
+        *op++ = 255;
+    }
+    *op++ = static_cast<uint8_t>(n);
+    return op;
+}
+
+uint8_t* put_sequence(uint8_t* op, const uint8_t* literals, size_t nliterals, size_t offset, size_t match)
+{
+    uint8_t* token = op++;
+    size_t extra = match - MIN_MATCH;
+
+    *token = static_cast<uint8_t>((std::min<size_t>(nliterals, 15) << 4) | std::min<size_t>(extra, 15));
+    if (nliterals >= 15)
+        op = put_length(op, nliterals - 15);
+    memcpy(op, literals, nliterals);
+    op += nliterals;
+
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    if (extra >= 15)
+        op = put_length(op, extra - 15);
+
+    return op;
+}
+
+// bytes src and ref have in common, without reading past the limit
+inline size_t match_length(const uint8_t* src, size_t ip, size_t ref, size_t limit)
+{
+    size_t len = MIN_MATCH;
+
+    while (ip + len + 8 <= limit) {
+        uint64_t diff = read64(src + ip + len) ^ read64(src + ref + len);
+        if (diff != 0)
+            return len + (__builtin_ctzll(diff) >> 3);
+        len += 8;
+    }
+    while (ip + len < limit && src[ip + len] == src[ref + len]) {
+        len++;
+    }
+
+    return len;
+}
+
+bool set_send_timeout(int fd, unsigned ms)
+{
+    struct timeval tv = { static_cast<time_t>(ms / 1000), static_cast<suseconds_t>(ms % 1000 * 1000) };
+
+    return setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+bool read_all(int fd, void* data, size_t n)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+
+    while (n > 0) {
+        ssize_t r = recv(fd, p, n, 0);
+        if (r > 0) {
+            p += r;
+            n -= r;
+        } else if (r == 0 || errno != EINTR) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}  // namespace
+
+/**
+ * The most bytes compress() can write for n bytes.
+ */
+size_t compress_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+/**
+ * Compress a block.
+ *
+ * @param src       the data.
+ * @param n         its length.
+ * @param dst       the compressed data to be filled.
+ * @param capacity  the size of dst, at least compress_bound(n).
+ * @return the compressed length, 0 if dst is too small.
+ */
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity)
+{
+    if (capacity < compress_bound(n))
+        return 0;
+
+    uint8_t* op = dst;
+    size_t anchor = 0;
+
+    if (n > MF_LIMIT) {
+        uint32_t table[1 << HASH_LOG] = {};
+        const size_t limit = n - MF_LIMIT;
+        const size_t match_limit = n - LAST_LITERALS;
+
+        for (size_t ip = 0; ip < limit; ) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash32(seq);
+            size_t ref = table[h];
+
+            table[h] = static_cast<uint32_t>(ip);
+            if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                ip += 1 + ((ip - anchor) >> SKIP_TRIGGER);
+                continue;
+            }
+
+            // the match may start before the bytes hashed
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                ip--;
+                ref--;
+            }
+
+            size_t len = match_length(src, ip, ref, match_limit);
+            op = put_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    size_t nliterals = n - anchor;
+    *op++ = static_cast<uint8_t>(std::min<size_t>(nliterals, 15) << 4);
+    if (nliterals >= 15)
+        op = put_length(op, nliterals - 15);
+    memcpy(op, src + anchor, nliterals);
+    op += nliterals;
+
+    return op - dst;
+}
+
+/**
+ * Decompress a block, checking every length and offset of it.
+ *
+ * @param src       the compressed data.
+ * @param n         its length.
+ * @param dst       the data to be filled.
+ * @param capacity  the size of dst.
+ * @param written   the length of the data to be filled.
+ * @return true on success, false if the block is corrupted or too big.
+ */
+bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity, size_t* written)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    auto read_length = [&](size_t* len) -> bool {
+        uint8_t b;
+        do {
+            if (ip >= n)
+                return false;
+            b = src[ip++];
+            *len += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < n) {
+        uint8_t token = src[ip++];
+
+        size_t nliterals = token >> 4;
+        if (nliterals == 15 && !read_length(&nliterals))
+            return false;
+        if (nliterals > n - ip || nliterals > capacity - op)
+            return false;
+        memcpy(dst + op, src + ip, nliterals);
+        ip += nliterals;
+        op += nliterals;
+
+        // the last sequence has no match
+        if (ip == n)
+            break;
+
+        if (n - ip < 2)
+            return false;
+        size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return false;
+
+        size_t len = token & 15;
+        if (len == 15 && !read_length(&len))
+            return false;
+        len += MIN_MATCH;
+        if (len > capacity - op)
+            return false;
+
+        if (offset >= len) {
+            memcpy(dst + op, dst + op - offset, len);
+            op += len;
+        } else {
+            for (size_t end = op + len; op < end; op++) {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+    *written = op;
+
+    return true;
+}
+
+sender::sender(const sender_config& config)
+    : config_(config)
+    , fd_(-1)
+    , running_(false)
+    , stopping_(false)
+    , as_is_(0)
+    , connected_(false)
+    , packets_(0)
+    , bytes_(0)
+    , wire_bytes_(0)
+    , dropped_(0)
+    , reconnects_(0)
+{
+    // a batch goes past the limit by up to a packet
+    config_.batch_bytes = std::max<size_t>(std::min<size_t>(config_.batch_bytes, MAX_FRAME / 2), 4096);
+    config_.max_batches = std::max<size_t>(config_.max_batches, 1);
+}
+
+sender::~sender()
+{
+    stop();
+}
+
+void sender::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (running_)
+        return;
+
+    running_ = true;
+    stopping_ = false;
+    thread_ = std::thread(&sender::run, this);
+}
+
+/**
+ * Send what's batched and stop. Packets still queued are dropped if the
+ * collector can't be reached.
+ */
+void sender::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (!running_ || stopping_)
+            return;
+
+        if (current_.packets > 0) {
+            queue_.push_back(std::move(current_));
+            current_ = batch();
+        }
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    room_.notify_all();
+
+    thread_.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+}
+
+/**
+ * Add packets to the batch, cut to the snaplen. Once the collector falls
+ * behind by max_batches, packets are dropped, or the caller waits if
+ * lossless.
+ *
+ * @param pkts      the packets.
+ * @param n         the number of packets.
+ * @param lossless  wait for room instead of dropping.
+ * @return the number of packets taken.
+ */
+size_t sender::send(const packet* pkts, size_t n, bool lossless)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (!running_ || stopping_) {
+        dropped_ += n;
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (current_.data.size() >= config_.batch_bytes)
+            enqueue(lock, lossless);
+        if (current_.data.size() >= config_.batch_bytes) {
+            dropped_ += n - i;
+            return i;
+        }
+
+        const packet& pkt = pkts[i];
+        uint32_t caplen = config_.snaplen > 0 ? std::min(pkt.caplen, config_.snaplen) : pkt.caplen;
+        char header[RECORD_HEADER_SIZE];
+
+        memcpy(header, &pkt.ts, 8);
+        memcpy(header + 8, &caplen, 4);
+        memcpy(header + 12, &pkt.len, 4);
+
+        if (current_.packets == 0)
+            current_since_ = std::chrono::steady_clock::now();
+        current_.data.append(header, sizeof(header));
+        current_.data.append(reinterpret_cast<const char*>(pkt.data), caplen);
+        current_.packets++;
+    }
+
+    return n;
+}
+
+// queue the current batch if there is room for it
+void sender::enqueue(std::unique_lock<std::mutex>& lock, bool lossless)
+{
+    if (queue_.size() >= config_.max_batches && lossless) {
+        room_.wait(lock, [this] { return queue_.size() < config_.max_batches || stopping_; });
+    }
+    if (queue_.size() >= config_.max_batches || stopping_)
+        return;
+
+    queue_.push_back(std::move(current_));
+    current_ = batch();
+    if (!spare_.empty()) {
+        current_.data.swap(spare_.back());
+        spare_.pop_back();
+    } else {
+        current_.data.reserve(config_.batch_bytes + 65536);
+    }
+    ready_.notify_one();
+}
+
+/**
+ * Send the batch now rather than when it's full or old enough.
+ */
+void sender::flush()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (current_.packets == 0)
+            return;
+
+        queue_.push_back(std::move(current_));
+        current_ = batch();
+    }
+    ready_.notify_one();
+}
+
+std::string sender::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return error_;
+}
+
+void sender::run()
+{
+    const auto max_backoff = std::chrono::milliseconds(5000);
+    auto backoff = std::chrono::milliseconds(100);
+    auto flush_interval = std::chrono::milliseconds(std::max(config_.flush_ms, 1U));
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        // wait for a full batch, or for the current one to be old enough
+        while (queue_.empty()) {
+            if (stopping_) {
+                lock.unlock();
+                disconnect(std::string());
+                return;
+            }
+
+            if (current_.packets > 0 && std::chrono::steady_clock::now() >= current_since_ + flush_interval) {
+                queue_.push_back(std::move(current_));
+                current_ = batch();
+            } else if (current_.packets > 0) {
+                ready_.wait_until(lock, current_since_ + flush_interval);
+            } else {
+                ready_.wait_for(lock, flush_interval);
+            }
+        }
+
+        batch b = std::move(queue_.front());
+        queue_.pop_front();
+        room_.notify_all();
+        lock.unlock();
+
+        // a frame cut by a lost connection is sent again in whole on the next one
+        for (;;) {
+            if (fd_ >= 0 || connect()) {
+                backoff = std::chrono::milliseconds(100);
+                if (write_frame(b))
+                    break;
+                continue;
+            }
+
+            lock.lock();
+            if (stopping_) {
+                dropped_ += b.packets;
+                for (auto& q : queue_) {
+                    dropped_ += q.packets;
+                }
+                queue_.clear();
+                lock.unlock();
+                break;
+            }
+            ready_.wait_for(lock, backoff, [this] { return stopping_; });
+            lock.unlock();
+            backoff = std::min(2 * backoff, max_backoff);
+        }
+
+        // the buffers are reused, they're big enough to be costly to fault in
+        lock.lock();
+        if (spare_.size() < config_.max_batches) {
+            b.data.clear();
+            spare_.push_back(std::move(b.data));
+        }
+    }
+}
+
+bool sender::connect()
+{
+    struct addrinfo hints = {};
+    struct addrinfo* addrs;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo(config_.host.c_str(), std::to_string(config_.port).c_str(), &hints, &addrs);
+    if (rc != 0) {
+        disconnect(std::string("can't resolve ") + config_.host + ": " + gai_strerror(rc));
+        return false;
+    }
+
+    std::string error;
+    for (struct addrinfo* ai = addrs; ai != nullptr; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        int err = ::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 ? 0 : errno;
+        if (err == EINPROGRESS) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            socklen_t len = sizeof(err);
+
+            if (poll(&pfd, 1, 3000) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+                err = ETIMEDOUT;
+        }
+        if (err != 0) {
+            error = strerror(err);
+            ::close(fd);
+            continue;
+        }
+
+        // blocking from now on, a full socket buffer is the backpressure
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) != 0) {
+            error = strerror(errno);
+            ::close(fd);
+            continue;
+        }
+        fd_ = fd;
+        break;
+    }
+    freeaddrinfo(addrs);
+
+    if (fd_ < 0) {
+        disconnect(error);
+        return false;
+    }
+
+    // an idle or stuck collector is noticed when stopping
+    set_send_timeout(fd_, 1000);
+
+    bool again = wire_bytes_ > 0;
+    struct hello h = {};
+    h.magic = MAGIC;
+    h.version = VERSION;
+    h.linktype = config_.linktype;
+    h.snaplen = config_.snaplen;
+    if (!write_all(&h, sizeof(h)))
+        return false;
+
+    connected_ = true;
+    if (again)
+        reconnects_++;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_.clear();
+
+    return true;
+}
+
+void sender::disconnect(const std::string& error)
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    connected_ = false;
+
+    if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = error;
+    }
+}
+
+bool sender::write_all(const void* data, size_t n)
+{
+    const char* p = static_cast<const char*>(data);
+
+    while (n > 0) {
+        ssize_t r = ::send(fd_, p, n, MSG_NOSIGNAL);
+        if (r > 0) {
+            p += r;
+            n -= r;
+            wire_bytes_ += r;
+            continue;
+        }
+
+        int err = r < 0 ? errno : EPIPE;
+        if (err == EINTR)
+            continue;
+        // the send timeout, wait on unless stopping
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!stopping_)
+                continue;
+        }
+
+        disconnect(err == EAGAIN || err == EWOULDBLOCK ? "collector not reading" : strerror(err));
+        return false;
+    }
+
+    return true;
+}
+
+bool sender::write_frame(const batch& b)
+{
+    frame_header h = {};
+    const char* payload = b.data.data();
+
+    h.length = static_cast<uint32_t>(b.data.size());
+    h.raw_length = h.length;
+    h.packets = b.packets;
+    h.codec = CODEC_NONE;
+
+    // stored as is if it doesn't get smaller; traffic that hardly does, such
+    // as encrypted payloads, isn't tried on every batch
+    if (config_.compress && as_is_ > 0) {
+        as_is_--;
+    } else if (config_.compress) {
+        compressed_.resize(compress_bound(b.data.size()));
+
+        size_t n = compress(reinterpret_cast<const uint8_t*>(b.data.data()), b.data.size(),
+                            reinterpret_cast<uint8_t*>(&compressed_[0]), compressed_.size());
+        if (n > 0 && n < b.data.size()) {
+            payload = compressed_.data();
+            h.length = static_cast<uint32_t>(n);
+            h.codec = CODEC_LZ4;
+        }
+        if (n == 0 || n > b.data.size() - b.data.size() / MIN_SAVING)
+            as_is_ = AS_IS_BATCHES;
+    }
+
+    if (!write_all(&h, sizeof(h)) || !write_all(payload, h.length))
+        return false;
+
+    packets_ += b.packets;
+    bytes_ += b.data.size() - static_cast<size_t>(b.packets) * RECORD_HEADER_SIZE;
+
+    return true;
+}
+
+receiver::receiver(const std::string& address, unsigned short port, int linktype, packet_fn fn)
+    : address_(address)
+    , port_(port)
+    , linktype_(linktype)
+    , fn_(fn)
+    , listen_fd_(-1)
+    , running_(false)
+    , packets_(0)
+    , bytes_(0)
+{
+}
+
+receiver::~receiver()
+{
+    stop();
+}
+
+/**
+ * Listen for sensors, on an ephemeral port if the port is 0.
+ *
+ * @return true on success, false otherwise.
+ */
+bool receiver::start()
+{
+    struct addrinfo hints = {};
+    struct addrinfo* addrs;
+
+    if (running_)
+        return true;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int rc = getaddrinfo(address_.empty() ? nullptr : address_.c_str(), std::to_string(port_).c_str(),
+                         &hints, &addrs);
+    if (rc != 0) {
+        fail(std::string("can't resolve ") + address_ + ": " + gai_strerror(rc));
+        return false;
+    }
+
+    for (struct addrinfo* ai = addrs; ai != nullptr && listen_fd_ < 0; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        int on = 1;
+
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            fail(strerror(errno));
+            ::close(fd);
+            continue;
+        }
+        listen_fd_ = fd;
+    }
+    freeaddrinfo(addrs);
+
+    if (listen_fd_ < 0)
+        return false;
+
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0) {
+        port_ = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port
+                      : reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+    }
+
+    running_ = true;
+    thread_ = std::thread(&receiver::accept_loop, this);
+
+    return true;
+}
+
+void receiver::stop()
+{
+    if (!running_.exchange(false))
+        return;
+
+    thread_.join();
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& conn : connections_) {
+            shutdown(conn.fd, SHUT_RDWR);
+        }
+    }
+    reap(true);
+}
+
+std::string receiver::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return error_;
+}
+
+unsigned receiver::connections() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return static_cast<unsigned>(std::count_if(connections_.begin(), connections_.end(),
+                                               [](const connection& c) { return !c.done; }));
+}
+
+void receiver::fail(const std::string& error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    error_ = error;
+}
+
+void receiver::accept_loop()
+{
+    while (running_) {
+        struct pollfd pfd = { listen_fd_, POLLIN, 0 };
+
+        reap(false);
+        if (poll(&pfd, 1, 200) != 1)
+            continue;
+
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.emplace_back(fd);
+        connection* conn = &connections_.back();
+        conn->thread = std::thread(&receiver::serve, this, conn);
+    }
+}
+
+// join the connections done, or all of them
+void receiver::reap(bool all)
+{
+    std::list<connection> done;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto it = connections_.begin(); it != connections_.end(); ) {
+            auto next = std::next(it);
+            if (all || it->done)
+                done.splice(done.end(), connections_, it);
+            it = next;
+        }
+    }
+
+    for (auto& conn : done) {
+        conn.thread.join();
+        ::close(conn.fd);
+    }
+}
+
+void receiver::serve(connection* conn)
+{
+    struct hello h;
+    std::vector<uint8_t> wire;
+    std::vector<uint8_t> raw;
+    std::vector<packet> pkts;
+
+    if (!read_all(conn->fd, &h, sizeof(h))) {
+        conn->done = true;
+        return;
+    }
+    if (h.magic != MAGIC || h.version != VERSION) {
+        fail("not a sensor, or an unknown version");
+        conn->done = true;
+        return;
+    }
+    if (h.linktype != linktype_) {
+        fail("linktype " + std::to_string(h.linktype) + " of a sensor, expected " + std::to_string(linktype_));
+        conn->done = true;
+        return;
+    }
+
+    for (;;) {
+        frame_header fh;
+
+        if (!read_all(conn->fd, &fh, sizeof(fh)))
+            break;
+        if (fh.length > MAX_FRAME || fh.raw_length > MAX_FRAME) {
+            fail("frame too big");
+            break;
+        }
+
+        wire.resize(fh.length);
+        if (!read_all(conn->fd, wire.data(), wire.size()))
+            break;
+
+        const uint8_t* data = wire.data();
+        size_t size = wire.size();
+        if (fh.codec == CODEC_LZ4) {
+            raw.resize(fh.raw_length);
+            if (!decompress(wire.data(), wire.size(), raw.data(), raw.size(), &size) || size != raw.size()) {
+                fail("corrupted frame");
+                break;
+            }
+            data = raw.data();
+        } else if (fh.codec != CODEC_NONE || fh.length != fh.raw_length) {
+            fail("unknown codec " + std::to_string(fh.codec));
+            break;
+        }
+
+        pkts.clear();
+        uint64_t bytes = 0;
+        size_t pos = 0;
+        while (pos < size) {
+            packet pkt;
+
+            if (size - pos < RECORD_HEADER_SIZE)
+                break;
+            memcpy(&pkt.ts, data + pos, 8);
+            memcpy(&pkt.caplen, data + pos + 8, 4);
+            memcpy(&pkt.len, data + pos + 12, 4);
+            pos += RECORD_HEADER_SIZE;
+            if (pkt.caplen > size - pos)
+                break;
+            pkt.data = data + pos;
+            pos += pkt.caplen;
+
+            pkts.push_back(pkt);
+            bytes += pkt.caplen;
+        }
+        if (pos != size || pkts.size() != fh.packets) {
+            fail("corrupted frame");
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(feed_mutex_);
+            fn_(pkts.data(), pkts.size());
+        }
+        packets_ += pkts.size();
+        bytes_ += bytes;
+    }
+
+    conn->done = true;
+}
+
+}  // namespace forward
+
+}  // namespace pca
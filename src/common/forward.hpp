@@ -0,0 +1,271 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet forwarding API documentation.
+ */
+
+/**
+ * @file forward.hpp
+ *
+ * @brief      Xabyss's Packet forwarding library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace pca {
+
+namespace forward {
+
+/*
+ * The stream of a sensor starts with a hello and goes on with frames, each
+ * one a batch of packet records, compressed or not:
+ *
+ *   hello:  magic, version, linktype, snaplen
+ *   frame:  header, then `length` bytes
+ *   record: u64 ts, u32 caplen, u32 len, caplen bytes of data
+ *
+ * Integers are little-endian.
+ */
+constexpr static const uint32_t MAGIC = 0x57464158;     // "XAFW"
+constexpr static const uint16_t VERSION = 1;
+constexpr static const uint32_t MAX_FRAME = 64U << 20;
+
+enum codec : uint8_t {
+    CODEC_NONE = 0,
+    CODEC_LZ4 = 1,      // LZ4 block format
+};
+
+struct hello {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    int32_t linktype;
+    uint32_t snaplen;
+};
+
+struct frame_header {
+    uint32_t length;        // bytes that follow
+    uint32_t raw_length;    // bytes of records once decompressed
+    uint32_t packets;
+    uint8_t codec;
+    uint8_t reserved[3];
+};
+
+constexpr static const size_t RECORD_HEADER_SIZE = 16;
+
+size_t compress_bound(size_t n);
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity);
+bool decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t capacity, size_t* written);
+
+struct sender_config {
+    std::string host;
+    unsigned short port = 0;
+    int linktype = LINKTYPE_ETHERNET;
+
+    // bytes kept of each packet, 0 for whole packets
+    uint32_t snaplen = 0;
+    bool compress = true;
+
+    // a batch is sent once this big, or this old
+    size_t batch_bytes = 1 << 20;
+    unsigned flush_ms = 100;
+
+    // batches waiting for the collector before packets are dropped
+    size_t max_batches = 16;
+};
+
+/**
+ * Sends packets to a collector: packets are batched by the caller's thread
+ * and a sender thread compresses and writes the batches, reconnecting with
+ * backoff whenever the connection is lost.
+ */
+class sender {
+public:
+    explicit sender(const sender_config& config);
+    ~sender();
+
+    sender(const sender&) = delete;
+    sender& operator=(const sender&) = delete;
+
+    void start();
+    void stop();
+
+    size_t send(const packet* pkts, size_t n, bool lossless = false);
+    void flush();
+
+    const sender_config& config() const;
+    bool connected() const;
+    std::string error() const;
+    uint64_t packets() const;       // written to the collector
+    uint64_t bytes() const;         // of packet data written
+    uint64_t wire_bytes() const;    // written to the socket
+    uint64_t dropped() const;
+    uint64_t reconnects() const;
+
+private:
+    struct batch {
+        std::string data;
+        uint32_t packets = 0;
+    };
+
+    void run();
+    void enqueue(std::unique_lock<std::mutex>& lock, bool lossless);
+    bool connect();
+    void disconnect(const std::string& error);
+    bool write_all(const void* data, size_t n);
+    bool write_frame(const batch& b);
+
+    sender_config config_;
+    std::thread thread_;
+    int fd_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;     // to the sender thread
+    std::condition_variable room_;      // to lossless callers
+    batch current_;
+    std::chrono::steady_clock::time_point current_since_;
+    std::deque<batch> queue_;
+    std::vector<std::string> spare_;
+    bool running_;
+    bool stopping_;
+    std::string error_;
+
+    std::string compressed_;
+    unsigned as_is_;                    // batches to send before compressing again
+    std::atomic<bool> connected_;
+    std::atomic<uint64_t> packets_;
+    std::atomic<uint64_t> bytes_;
+    std::atomic<uint64_t> wire_bytes_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> reconnects_;
+};
+
+/**
+ * Accepts sensors and decodes their packets. The packet function is called
+ * by one connection at a time, so it can feed a single producer pipeline; a
+ * slow function holds the sensors back through TCP flow control.
+ */
+class receiver {
+public:
+    typedef std::function<void(const packet* pkts, size_t n)> packet_fn;
+
+    receiver(const std::string& address, unsigned short port, int linktype, packet_fn fn);
+    ~receiver();
+
+    receiver(const receiver&) = delete;
+    receiver& operator=(const receiver&) = delete;
+
+    bool start();
+    void stop();
+
+    unsigned short port() const;
+    std::string error() const;
+    unsigned connections() const;
+    uint64_t packets() const;
+    uint64_t bytes() const;
+
+private:
+    struct connection {
+        int fd;
+        std::thread thread;
+        std::atomic<bool> done;
+
+        explicit connection(int fd) : fd(fd), done(false) {}
+    };
+
+    void accept_loop();
+    void serve(connection* conn);
+    void reap(bool all);
+    void fail(const std::string& error);
+
+    std::string address_;
+    unsigned short port_;
+    int linktype_;
+    packet_fn fn_;
+    int listen_fd_;
+    std::thread thread_;
+    std::atomic<bool> running_;
+
+    mutable std::mutex mutex_;          // connections and error
+    std::list<connection> connections_;
+    std::string error_;
+    std::mutex feed_mutex_;
+
+    std::atomic<uint64_t> packets_;
+    std::atomic<uint64_t> bytes_;
+};
+
+inline const sender_config& sender::config() const
+{
+    return config_;
+}
+
+inline bool sender::connected() const
+{
+    return connected_;
+}
+
+inline uint64_t sender::packets() const
+{
+    return packets_;
+}
+
+inline uint64_t sender::bytes() const
+{
+    return bytes_;
+}
+
+inline uint64_t sender::wire_bytes() const
+{
+    return wire_bytes_;
+}
+
+inline uint64_t sender::dropped() const
+{
+    return dropped_;
+}
+
+inline uint64_t sender::reconnects() const
+{
+    return reconnects_;
+}
+
+inline unsigned short receiver::port() const
+{
+    return port_;
+}
+
+inline uint64_t receiver::packets() const
+{
+    return packets_;
+}
+
+inline uint64_t receiver::bytes() const
+{
+    return bytes_;
+}
+
+}  // namespace forward
+
+}  // namespace pca
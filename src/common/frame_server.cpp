@@ -0,0 +1,411 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Frame Server API documentation.
+ */
+
+/**
+ * @file frame_server.cpp
+ *
+ * @brief      Xabyss's Frame Server library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "frame_server.hpp"
+
+namespace xa {
+
+// responses pending on a connection before its requests wait for them to go
+constexpr static const size_t MAX_PENDING = 1024 * 1024;
+
+static inline uint32_t get32(const char* p)
+{
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+
+    return (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16)
+        | (static_cast<uint32_t>(b[2]) << 8) | b[3];
+}
+
+static inline void put32(char* p, uint32_t v)
+{
+    p[0] = static_cast<char>(v >> 24);
+    p[1] = static_cast<char>(v >> 16);
+    p[2] = static_cast<char>(v >> 8);
+    p[3] = static_cast<char>(v);
+}
+
+struct frame_server::connection {
+    int fd;
+    std::vector<char> in;
+    size_t in_len;          // bytes read into in
+    std::string out;
+    size_t out_pos;         // bytes of out written
+    bool writing;           // waiting for the socket to take out
+
+    explicit connection(int fd) : fd(fd), in(16384), in_len(0), out_pos(0), writing(false) {}
+};
+
+struct frame_server::worker {
+    int epfd = -1;
+    int wake_fd = -1;
+    std::thread thread;
+    std::unordered_set<connection*> connections;
+};
+
+frame_server::frame_server(const std::string& path, mode_t mode, unsigned nthreads, const handler& fn)
+    : path_(path)
+    , mode_(mode)
+    , nthreads_(std::max(nthreads, 1U))
+    , fn_(fn)
+    , listen_fd_(-1)
+    , running_(false)
+{
+}
+
+frame_server::~frame_server()
+{
+    stop();
+
+    for (auto& w : workers_) {
+        if (w->wake_fd >= 0)
+            ::close(w->wake_fd);
+        if (w->epfd >= 0)
+            ::close(w->epfd);
+    }
+}
+
+/**
+ * Listen on the socket file, replacing one left behind, and start serving.
+ *
+ * @return true on success, false otherwise.
+ */
+bool frame_server::start()
+{
+    struct sockaddr_un addr = {};
+
+    if (running_)
+        return true;
+
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        fail("socket path too long: " + path_);
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path_.c_str(), path_.size() + 1);
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        fail(strerror(errno));
+        return false;
+    }
+
+    // connections are taken once the mode is set
+    unlink(path_.c_str());
+    if (bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+            || chmod(path_.c_str(), mode_) != 0 || listen(listen_fd_, 128) != 0) {
+        fail(path_ + ": " + strerror(errno));
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+
+    for (unsigned i = 0; i < nthreads_; i++) {
+        std::unique_ptr<worker> w(new worker);
+        struct epoll_event ev = {};
+
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        // one thread woken for a connection, not all of them
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = nullptr;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, listen_fd_, &ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = w.get();
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wake_fd, &ev);
+        workers_.push_back(std::move(w));
+    }
+
+    running_ = true;
+    for (auto& w : workers_) {
+        w->thread = std::thread(&frame_server::serve, this, w.get());
+    }
+
+    return true;
+}
+
+/**
+ * Stop serving once done with the requests in hand, and remove the socket
+ * file.
+ */
+void frame_server::stop()
+{
+    uint64_t one = 1;
+
+    if (!running_.exchange(false))
+        return;
+
+    for (auto& w : workers_) {
+        if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+            // already woken
+        }
+    }
+    for (auto& w : workers_) {
+        w->thread.join();
+    }
+
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+    unlink(path_.c_str());
+}
+
+std::string frame_server::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return error_;
+}
+
+void frame_server::fail(const std::string& error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    error_ = error;
+}
+
+/**
+ * Write a frame to a blocking socket, as a client does.
+ */
+bool frame_server::write_frame(int fd, const std::string& frame)
+{
+    std::string data(4, '\0');
+
+    put32(&data[0], static_cast<uint32_t>(frame.size()));
+    data += frame;
+    for (size_t sent = 0; sent < data.size(); ) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+
+    return true;
+}
+
+/**
+ * Read a frame from a blocking socket, as a client does.
+ */
+bool frame_server::read_frame(int fd, std::string* frame)
+{
+    char header[4];
+    size_t got = 0;
+
+    while (got < sizeof(header)) {
+        ssize_t n = recv(fd, header + got, sizeof(header) - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        got += n;
+    }
+
+    size_t length = get32(header);
+    if (length > MAX_FRAME)
+        return false;
+    frame->resize(length);
+    for (got = 0; got < length; ) {
+        ssize_t n = recv(fd, &(*frame)[got], length - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        got += n;
+    }
+
+    return true;
+}
+
+void frame_server::serve(worker* w)
+{
+    struct epoll_event events[64];
+
+    while (running_) {
+        int n = epoll_wait(w->epfd, events, 64, -1);
+        if (n < 0 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+
+            if (ptr == nullptr) {
+                accept(w);
+            } else if (ptr != w) {
+                connection* c = static_cast<connection*>(ptr);
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close(w, c);
+                } else if (c->writing) {
+                    if ((events[i].events & EPOLLOUT) && flush(w, c) && !c->writing && process(w, c))
+                        flush(w, c);
+                } else if (events[i].events & EPOLLIN) {
+                    receive(w, c);
+                }
+            }
+        }
+    }
+
+    for (connection* c : w->connections) {
+        ::close(c->fd);
+        delete c;
+    }
+    w->connections.clear();
+}
+
+void frame_server::accept(worker* w)
+{
+    for (;;) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        connection* c = new connection(fd);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            delete c;
+            continue;
+        }
+        w->connections.insert(c);
+    }
+}
+
+void frame_server::receive(worker* w, connection* c)
+{
+    if (c->in.size() - c->in_len < 4096)
+        c->in.resize(c->in.size() * 2);
+
+    ssize_t n = read(c->fd, &c->in[c->in_len], c->in.size() - c->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close(w, c);
+        return;
+    }
+    c->in_len += n;
+
+    if (process(w, c))
+        flush(w, c);
+}
+
+/**
+ * Answer the frames read in full, in order.
+ *
+ * @return true if the connection is still open, false otherwise.
+ */
+bool frame_server::process(worker* w, connection* c)
+{
+    size_t pos = 0;
+
+    while (c->in_len - pos >= 4) {
+        if (c->out.size() - c->out_pos >= MAX_PENDING) {
+            if (!flush(w, c))
+                return false;
+            if (c->writing)
+                break;
+        }
+
+        size_t length = get32(&c->in[pos]);
+        if (length > MAX_FRAME) {
+            close(w, c);
+            return false;
+        }
+        if (c->in_len - pos - 4 < length)
+            break;
+
+        // the length is filled in once the response is there
+        size_t start = c->out.size();
+        c->out.append(4, '\0');
+        fn_(&c->in[pos + 4], length, &c->out);
+        put32(&c->out[start], static_cast<uint32_t>(c->out.size() - start - 4));
+
+        pos += 4 + length;
+    }
+
+    if (pos > 0) {
+        memmove(&c->in[0], &c->in[pos], c->in_len - pos);
+        c->in_len -= pos;
+    }
+
+    return true;
+}
+
+/**
+ * Write out what is queued on a connection, waiting for the socket to take
+ * it if need be.
+ *
+ * @return true if the connection is still open, false otherwise.
+ */
+bool frame_server::flush(worker* w, connection* c)
+{
+    while (c->out_pos < c->out.size()) {
+        ssize_t n = send(c->fd, &c->out[c->out_pos], c->out.size() - c->out_pos, MSG_NOSIGNAL);
+
+        if (n >= 0) {
+            c->out_pos += n;
+        } else if (errno == EAGAIN) {
+            if (!c->writing) {
+                struct epoll_event ev = {};
+                ev.events = EPOLLOUT;
+                ev.data.ptr = c;
+                epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+                c->writing = true;
+            }
+            return true;
+        } else if (errno != EINTR) {
+            close(w, c);
+            return false;
+        }
+    }
+    c->out.clear();
+    c->out_pos = 0;
+
+    if (c->writing) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->writing = false;
+    }
+
+    return true;
+}
+
+void frame_server::close(worker* w, connection* c)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    w->connections.erase(c);
+    delete c;
+}
+
+}  // namespace xa
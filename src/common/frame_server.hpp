@@ -0,0 +1,93 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Frame Server API documentation.
+ */
+
+/**
+ * @file frame_server.hpp
+ *
+ * @brief      Xabyss's Frame Server library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xa {
+
+/**
+ * A server of length-prefixed frames on a unix domain socket, for local
+ * clients: every frame is a 32 bit big-endian length and that many bytes,
+ * and every request frame is answered by a response frame, in order.
+ *
+ * Its threads have an epoll reactor each and share the listening socket,
+ * which only those allowed by the mode of the socket file can connect to.
+ */
+class frame_server {
+public:
+    // the handler appends the response to out
+    typedef std::function<void(const char* frame, size_t n, std::string* out)> handler;
+
+    constexpr static const size_t MAX_FRAME = 64 * 1024 * 1024;
+
+    frame_server(const std::string& path, mode_t mode, unsigned nthreads, const handler& fn);
+    ~frame_server();
+
+    frame_server(const frame_server&) = delete;
+    frame_server& operator=(const frame_server&) = delete;
+
+    bool start();
+    void stop();
+
+    const std::string& path() const;
+    std::string error() const;
+
+    static bool write_frame(int fd, const std::string& frame);
+    static bool read_frame(int fd, std::string* frame);
+
+private:
+    struct connection;
+    struct worker;
+
+    void serve(worker* w);
+    void accept(worker* w);
+    void receive(worker* w, connection* c);
+    bool process(worker* w, connection* c);
+    bool flush(worker* w, connection* c);
+    void close(worker* w, connection* c);
+    void fail(const std::string& error);
+
+    std::string path_;
+    mode_t mode_;
+    unsigned nthreads_;
+    handler fn_;
+    int listen_fd_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::atomic<bool> running_;
+
+    mutable std::mutex mutex_;      // error
+    std::string error_;
+};
+
+inline const std::string& frame_server::path() const
+{
+    return path_;
+}
+
+}  // namespace xa
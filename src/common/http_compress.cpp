@@ -0,0 +1,270 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            HTTP Compression API documentation.
+ */
+
+/**
+ * @file http_compress.cpp
+ *
+ * @brief      Xabyss's HTTP Compression library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "http_compress.hpp"
+
+namespace xa {
+
+namespace http {
+
+// compressed output is taken from zlib this much at a time
+constexpr static const size_t OUTPUT_STEP = 16 * 1024;
+
+static bool token_is(const char* p, size_t n, const char* token)
+{
+    return n == strlen(token) && strncasecmp(p, token, n) == 0;
+}
+
+/**
+ * The coding of the response the client accepts best, per Accept-Encoding:
+ * gzip over deflate when it has no preference, identity without the header.
+ */
+encoding accepted_encoding(const request& req)
+{
+    const header* h = req.find("Accept-Encoding");
+    double gzip = -1, deflate = -1, any = -1;
+
+    if (h == nullptr)
+        return ENCODING_IDENTITY;
+
+    for (const char *p = h->value, *end = h->value + h->value_len; p < end; ) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        const char* item_end = comma != nullptr ? comma : end;
+        const char* params = static_cast<const char*>(memchr(p, ';', item_end - p));
+        const char* token_end = params != nullptr ? params : item_end;
+        double q = 1;
+
+        if (params != nullptr) {
+            std::string rest(params, item_end);
+            size_t pos = rest.find("q=");
+            if (pos != std::string::npos)
+                q = strtod(rest.c_str() + pos + 2, nullptr);
+        }
+        while (p < token_end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        while (token_end > p && (token_end[-1] == ' ' || token_end[-1] == '\t')) {
+            token_end--;
+        }
+
+        size_t n = token_end - p;
+        if (token_is(p, n, "gzip") || token_is(p, n, "x-gzip"))
+            gzip = q;
+        else if (token_is(p, n, "deflate"))
+            deflate = q;
+        else if (token_is(p, n, "*"))
+            any = q;
+
+        p = item_end + 1;
+    }
+
+    // those not named go by *
+    if (gzip < 0)
+        gzip = any;
+    if (deflate < 0)
+        deflate = any;
+
+    if (gzip > 0 && gzip >= deflate)
+        return ENCODING_GZIP;
+    if (deflate > 0)
+        return ENCODING_DEFLATE;
+
+    return ENCODING_IDENTITY;
+}
+
+const char* encoding_name(encoding e)
+{
+    switch (e) {
+    case ENCODING_GZIP: return "gzip";
+    case ENCODING_DEFLATE: return "deflate";
+    default: return "identity";
+    }
+}
+
+compressor::compressor()
+    : ready_(false)
+    , encoding_(ENCODING_IDENTITY)
+    , level_(DEFAULT_LEVEL)
+{
+    memset(&z_, 0, sizeof(z_));
+}
+
+compressor::~compressor()
+{
+    if (ready_)
+        deflateEnd(&z_);
+}
+
+/**
+ * Start on a body, reusing the state of the last one if it was compressed
+ * alike.
+ *
+ * @return true on success, false if the coding or the level is invalid.
+ */
+bool compressor::begin(encoding e, int level)
+{
+    if (e == ENCODING_IDENTITY)
+        return false;
+
+    if (ready_ && e == encoding_ && level == level_)
+        return deflateReset(&z_) == Z_OK;
+
+    if (ready_) {
+        deflateEnd(&z_);
+        ready_ = false;
+    }
+    memset(&z_, 0, sizeof(z_));
+    // 16 more window bits for a gzip header and trailer instead of zlib's
+    if (deflateInit2(&z_, level, Z_DEFLATED, e == ENCODING_GZIP ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    ready_ = true;
+    encoding_ = e;
+    level_ = level;
+
+    return true;
+}
+
+bool compressor::write(const char* data, size_t n, std::string* out)
+{
+    return deflate(data, n, Z_NO_FLUSH, out);
+}
+
+// all written so far out, on a byte boundary
+bool compressor::flush(std::string* out)
+{
+    return deflate(nullptr, 0, Z_SYNC_FLUSH, out);
+}
+
+bool compressor::finish(std::string* out)
+{
+    return deflate(nullptr, 0, Z_FINISH, out);
+}
+
+/**
+ * Compress a whole body begun on, at once.
+ */
+bool compressor::compress(const char* data, size_t n, std::string* out)
+{
+    size_t pos = out->size();
+
+    // room for all of it, for a single pass
+    out->resize(pos + deflateBound(&z_, n));
+    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    z_.avail_in = static_cast<uInt>(n);
+    z_.next_out = reinterpret_cast<Bytef*>(&(*out)[pos]);
+    z_.avail_out = static_cast<uInt>(out->size() - pos);
+
+    int rc = ::deflate(&z_, Z_FINISH);
+    out->resize(out->size() - z_.avail_out);
+    if (rc == Z_STREAM_END)
+        return true;
+
+    return rc == Z_OK && finish(out);
+}
+
+compressor& compressor::local()
+{
+    static thread_local compressor z;
+
+    return z;
+}
+
+bool compressor::deflate(const char* data, size_t n, int mode, std::string* out)
+{
+    if (!ready_)
+        return false;
+
+    z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    z_.avail_in = static_cast<uInt>(n);
+    do {
+        size_t pos = out->size();
+
+        out->resize(pos + OUTPUT_STEP);
+        z_.next_out = reinterpret_cast<Bytef*>(&(*out)[pos]);
+        z_.avail_out = OUTPUT_STEP;
+
+        int rc = ::deflate(&z_, mode);
+        out->resize(pos + OUTPUT_STEP - z_.avail_out);
+        if (rc == Z_STREAM_END)
+            break;
+        if (rc != Z_OK && rc != Z_BUF_ERROR)
+            return false;
+    } while (z_.avail_out == 0);
+
+    return true;
+}
+
+/**
+ * Compress a body with the compressor of the thread.
+ *
+ * @param e         gzip or deflate.
+ * @param level     0 to 9, the higher the smaller and the slower.
+ * @param data      the body.
+ * @param n         its length.
+ * @param out       the string the compressed body is appended to.
+ * @return true on success, false otherwise.
+ */
+bool compress(encoding e, int level, const char* data, size_t n, std::string* out)
+{
+    compressor& z = compressor::local();
+
+    return z.begin(e, level) && z.compress(data, n, out);
+}
+
+compressing_stream::compressing_stream(stream* out, encoding e, int level)
+    : out_(out)
+    , z_(compressor::local())
+{
+    ok_ = z_.begin(e, level);
+}
+
+bool compressing_stream::write(const char* data, size_t n)
+{
+    return ok_ && z_.write(data, n, &buffer_) && put();
+}
+
+bool compressing_stream::flush()
+{
+    return ok_ && z_.flush(&buffer_) && put() && out_->flush();
+}
+
+// the end of the compressed body, to be flushed along with the rest
+bool compressing_stream::finish()
+{
+    return ok_ && z_.finish(&buffer_) && put();
+}
+
+// what came out of the compressor, on to the stream
+bool compressing_stream::put()
+{
+    if (buffer_.empty())
+        return true;
+
+    ok_ = out_->write(buffer_);
+    buffer_.clear();
+
+    return ok_;
+}
+
+}  // namespace http
+
+}  // namespace xa
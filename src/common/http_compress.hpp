@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            HTTP Compression API documentation.
+ */
+
+/**
+ * @file http_compress.hpp
+ *
+ * @brief      Xabyss's HTTP Compression library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <zlib.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "http_server.hpp"
+
+namespace xa {
+
+namespace http {
+
+/**
+ * The content codings of a response: as it is, gzip (RFC 1952) or deflate,
+ * which HTTP takes for the zlib format (RFC 1950).
+ */
+enum encoding : uint8_t {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE,
+};
+
+encoding accepted_encoding(const request& req);
+const char* encoding_name(encoding e);
+
+/**
+ * A deflate compressor, its state (a few hundred KB) allocated once and
+ * reset for every body. A thread has one of its own, local(), for one body
+ * at a time.
+ */
+class compressor {
+public:
+    constexpr static const int DEFAULT_LEVEL = 6;
+
+    compressor();
+    ~compressor();
+
+    compressor(const compressor&) = delete;
+    compressor& operator=(const compressor&) = delete;
+
+    bool begin(encoding e, int level = DEFAULT_LEVEL);
+    bool write(const char* data, size_t n, std::string* out);
+    bool flush(std::string* out);
+    bool finish(std::string* out);
+    bool compress(const char* data, size_t n, std::string* out);
+
+    static compressor& local();
+
+private:
+    bool deflate(const char* data, size_t n, int mode, std::string* out);
+
+    z_stream z_;
+    bool ready_;
+    encoding encoding_;
+    int level_;
+};
+
+bool compress(encoding e, int level, const char* data, size_t n, std::string* out);
+
+/**
+ * A streamed body compressed on its way to another stream, with the
+ * compressor of the thread. A flush writes out all that was written so far,
+ * for the client to decompress it at once.
+ */
+class compressing_stream : public stream {
+public:
+    compressing_stream(stream* out, encoding e, int level = compressor::DEFAULT_LEVEL);
+
+    using stream::write;
+    virtual bool write(const char* data, size_t n);
+    virtual bool flush();
+    bool finish();
+
+private:
+    bool put();
+
+    stream* out_;
+    compressor& z_;
+    bool ok_;
+    std::string buffer_;
+};
+
+}  // namespace http
+
+}  // namespace xa
@@ -0,0 +1,916 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            HTTP Server API documentation.
+ */
+
+/**
+ * @file http_server.cpp
+ *
+ * @brief      Xabyss's HTTP Server library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "http_server.hpp"
+
+namespace xa {
+
+namespace http {
+
+// responses pending on a connection before its requests wait for them to go
+constexpr static const size_t MAX_PENDING = 1024 * 1024;
+// bodies at least this big are written from where the handler left them
+constexpr static const size_t ZERO_COPY_MIN = 16 * 1024;
+// a streamed body waits for the client past this much unsent, that long at most
+constexpr static const size_t STREAM_PENDING = 64 * 1024;
+constexpr static const int STREAM_TIMEOUT_MS = 10000;
+// ... a slice at a time, to give up as soon as the server stops
+constexpr static const int STREAM_POLL_MS = 100;
+
+const header* request::find(const char* name) const
+{
+    size_t n = strlen(name);
+
+    for (const auto& h : headers) {
+        if (h.name_len == n && strncasecmp(h.name, name, n) == 0)
+            return &h;
+    }
+
+    return nullptr;
+}
+
+void response::clear()
+{
+    status = 200;
+    headers.clear();
+    body = nullptr;
+    body_len = 0;
+    text.clear();
+    stream_body = nullptr;
+}
+
+void response::add_header(const char* name, const char* value, size_t len)
+{
+    headers.push_back(header{ name, strlen(name), value, len });
+}
+
+void response::set_text(const char* s, size_t n)
+{
+    text.assign(s, n);
+    body = text.data();
+    body_len = text.size();
+}
+
+void response::set_body(const std::string& s)
+{
+    body = s.data();
+    body_len = s.size();
+}
+
+void response::set_stream(const streamer& fn)
+{
+    stream_body = fn;
+}
+
+const char* reason(int status)
+{
+    switch (status) {
+    case 100:
+        return "Continue";
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 400:
+        return "Bad Request";
+    case 403:
+        return "Forbidden";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 408:
+        return "Request Timeout";
+    case 411:
+        return "Length Required";
+    case 413:
+        return "Payload Too Large";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    case 505:
+        return "HTTP Version Not Supported";
+    default:
+        return "Unknown";
+    }
+}
+
+// a token of a header value such as Connection, whatever its case
+static bool has_token(const header* h, const char* token)
+{
+    size_t n = strlen(token);
+
+    if (h == nullptr)
+        return false;
+    for (size_t i = 0; i + n <= h->value_len; i++) {
+        if (strncasecmp(h->value + i, token, n) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+struct server::connection {
+    int fd;
+    std::vector<char> in;
+    size_t in_len;          // bytes read into in
+    size_t pos;             // where the next request starts
+    std::string out;
+    size_t out_pos;         // bytes of out written
+    int minor;              // of the request being served
+    bool closing;           // closed once out is written
+    bool continued;         // 100 Continue sent for the request pending
+    bool writing;           // waiting for the socket to take out
+    bool streaming;         // handed over to the streamer of a response
+    bool failed;            // ... which left it to be closed
+    size_t length;          // of the request streamed
+    response res;           // ... and its response
+    std::thread streamer;
+
+    explicit connection(int fd)
+        : fd(fd), in(16384), in_len(0), pos(0), out_pos(0), minor(1)
+        , closing(false), continued(false), writing(false), streaming(false), failed(false), length(0) {}
+};
+
+struct server::worker {
+    int epfd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    std::thread thread;
+    std::unordered_set<connection*> connections;
+    request req;
+    response res;
+
+    std::mutex mutex;                   // streamed
+    std::vector<connection*> streamed;  // handed back by their streamers
+};
+
+/**
+ * A streamed body, a chunk out every CHUNK_SIZE or flush. The head of the
+ * response goes with the first chunk, so nothing is sent for a body that
+ * fits in one until the streamer is done.
+ *
+ * It is written on the streamer's thread, which has the connection to
+ * itself meanwhile.
+ */
+class server::chunked_stream : public stream {
+public:
+    chunked_stream(server* s, connection* c, const response* res)
+        : server_(s), c_(c), res_(res), chunked_(c->minor == 1), started_(false), failed_(false) {}
+
+    virtual bool write(const char* data, size_t n)
+    {
+        if (server_->stopping_)
+            failed_ = true;
+        if (failed_)
+            return false;
+
+        buffer_.append(data, n);
+
+        return buffer_.size() < CHUNK_SIZE || flush();
+    }
+
+    virtual bool flush()
+    {
+        char size[24];
+
+        if (failed_)
+            return false;
+        if (buffer_.empty())
+            return true;
+
+        if (!started_) {
+            server_->put_head(c_, *res_, true);
+            started_ = true;
+        }
+        if (chunked_) {
+            snprintf(size, sizeof(size), "%zx\r\n", buffer_.size());
+            c_->out += size;
+        }
+        c_->out += buffer_;
+        if (chunked_)
+            c_->out += "\r\n";
+        buffer_.clear();
+
+        return drain();
+    }
+
+    // the last chunk
+    bool finish()
+    {
+        if (!flush())
+            return false;
+        if (chunked_)
+            c_->out += "0\r\n\r\n";
+
+        return true;
+    }
+
+    bool started() const { return started_; }
+    bool failed() const { return failed_; }
+    const std::string& buffered() const { return buffer_; }
+
+private:
+    // write out what the socket takes, waiting for it past STREAM_PENDING
+    bool drain()
+    {
+        int waited = 0;
+
+        while (c_->out_pos < c_->out.size()) {
+            ssize_t n = send(c_->fd, &c_->out[c_->out_pos], c_->out.size() - c_->out_pos, MSG_NOSIGNAL);
+
+            if (n >= 0) {
+                c_->out_pos += n;
+                waited = 0;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN) {
+                failed_ = true;
+                return false;
+            }
+            if (c_->out.size() - c_->out_pos <= STREAM_PENDING)
+                break;
+
+            struct pollfd pfd = { c_->fd, POLLOUT, 0 };
+            int rc = poll(&pfd, 1, STREAM_POLL_MS);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc < 0 || server_->stopping_ || (rc == 0 && (waited += STREAM_POLL_MS) >= STREAM_TIMEOUT_MS)) {
+                failed_ = true;
+                return false;
+            }
+        }
+
+        if (c_->out_pos == c_->out.size()) {
+            c_->out.clear();
+            c_->out_pos = 0;
+        } else if (c_->out_pos >= c_->out.size() / 2) {
+            c_->out.erase(0, c_->out_pos);
+            c_->out_pos = 0;
+        }
+
+        return true;
+    }
+
+    server* server_;
+    connection* c_;
+    const response* res_;
+    bool chunked_;          // HTTP/1.1, or the body ends with the connection
+    bool started_;
+    bool failed_;
+    std::string buffer_;
+};
+
+server::server(const std::string& address, unsigned short port, unsigned nthreads, const handler& fn)
+    : address_(address)
+    , port_(port)
+    , nthreads_(std::max(nthreads, 1U))
+    , fn_(fn)
+    , stopping_(false)
+{
+}
+
+server::~server()
+{
+    stop();
+
+    for (auto& w : workers_) {
+        for (connection* c : w->connections) {
+            ::close(c->fd);
+            delete c;
+        }
+        if (w->listen_fd >= 0)
+            ::close(w->listen_fd);
+        if (w->wake_fd >= 0)
+            ::close(w->wake_fd);
+        if (w->epfd >= 0)
+            ::close(w->epfd);
+    }
+}
+
+/**
+ * Open a listening socket and a reactor for every thread, on an ephemeral
+ * port if the port is 0.
+ *
+ * @return true on success, false otherwise.
+ */
+bool server::listen()
+{
+    struct addrinfo hints = {};
+    struct addrinfo* addrs;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    int rc = getaddrinfo(address_.empty() ? nullptr : address_.c_str(), std::to_string(port_).c_str(),
+                         &hints, &addrs);
+    if (rc != 0) {
+        fail(std::string("can't resolve ") + address_ + ": " + gai_strerror(rc));
+        return false;
+    }
+    memcpy(&addr, addrs->ai_addr, addrs->ai_addrlen);
+    addr_len = addrs->ai_addrlen;
+    freeaddrinfo(addrs);
+
+    for (unsigned i = 0; i < nthreads_; i++) {
+        std::unique_ptr<worker> w(new worker);
+        int on = 1;
+
+        w->listen_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        workers_.push_back(std::move(w));
+
+        worker* wp = workers_.back().get();
+        if (wp->listen_fd < 0 || wp->epfd < 0 || wp->wake_fd < 0) {
+            fail(strerror(errno));
+            return false;
+        }
+
+        setsockopt(wp->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        setsockopt(wp->listen_fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        if (bind(wp->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) != 0
+                || ::listen(wp->listen_fd, 1024) != 0) {
+            fail(address_ + ":" + std::to_string(port_) + ": " + strerror(errno));
+            return false;
+        }
+
+        // the others bind to the port the first one got
+        if (i == 0) {
+            socklen_t len = sizeof(addr);
+            getsockname(wp->listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+            port_ = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_port
+                          : reinterpret_cast<struct sockaddr_in*>(&addr)->sin_port);
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(wp->epfd, EPOLL_CTL_ADD, wp->listen_fd, &ev);
+        ev.data.ptr = wp;
+        epoll_ctl(wp->epfd, EPOLL_CTL_ADD, wp->wake_fd, &ev);
+    }
+
+    return true;
+}
+
+/**
+ * Serve until stopped, on the calling thread and as many others as asked
+ * for but one.
+ */
+void server::run()
+{
+    if (workers_.empty())
+        return;
+
+    for (size_t i = 1; i < workers_.size(); i++) {
+        workers_[i]->thread = std::thread(&server::serve, this, workers_[i].get());
+    }
+    serve(workers_[0].get());
+
+    for (size_t i = 1; i < workers_.size(); i++) {
+        workers_[i]->thread.join();
+    }
+}
+
+/**
+ * Stop serving: the threads return once done with the requests in hand,
+ * closing their connections.
+ */
+void server::stop()
+{
+    uint64_t one = 1;
+
+    stopping_ = true;
+    for (auto& w : workers_) {
+        if (w->wake_fd >= 0 && write(w->wake_fd, &one, sizeof(one)) < 0) {
+            // already woken
+        }
+    }
+}
+
+std::string server::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return error_;
+}
+
+void server::fail(const std::string& error)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    error_ = error;
+}
+
+void server::serve(worker* w)
+{
+    struct epoll_event events[64];
+
+    while (!stopping_) {
+        int n = epoll_wait(w->epfd, events, 64, -1);
+        if (n < 0 && errno != EINTR)
+            break;
+
+        for (int i = 0; i < n; i++) {
+            void* ptr = events[i].data.ptr;
+
+            if (ptr == nullptr) {
+                accept(w);
+            } else if (ptr == w) {
+                std::vector<connection*> streamed;
+                uint64_t count;
+
+                if (read(w->wake_fd, &count, sizeof(count)) < 0) {
+                    // woken already
+                }
+                {
+                    std::lock_guard<std::mutex> lock(w->mutex);
+                    streamed.swap(w->streamed);
+                }
+                for (connection* c : streamed) {
+                    resume(w, c);
+                }
+            } else {
+                connection* c = static_cast<connection*>(ptr);
+
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    close(w, c);
+                } else if (c->writing) {
+                    // the requests read meanwhile are served once the responses are out
+                    if ((events[i].events & EPOLLOUT) && flush(w, c) && !c->writing && process(w, c))
+                        flush(w, c);
+                } else if (events[i].events & EPOLLIN) {
+                    receive(w, c);
+                }
+            }
+        }
+    }
+
+    for (connection* c : w->connections) {
+        if (c->streaming)
+            c->streamer.join();
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+        ::close(c->fd);
+        delete c;
+    }
+    w->connections.clear();
+    w->streamed.clear();
+}
+
+void server::accept(worker* w)
+{
+    for (;;) {
+        int fd = accept4(w->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        int on = 1;
+
+        if (fd < 0)
+            return;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        connection* c = new connection(fd);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            ::close(fd);
+            delete c;
+            continue;
+        }
+        w->connections.insert(c);
+    }
+}
+
+void server::receive(worker* w, connection* c)
+{
+    if (c->in.size() - c->in_len < 4096)
+        c->in.resize(c->in.size() * 2);
+
+    ssize_t n = read(c->fd, &c->in[c->in_len], c->in.size() - c->in_len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        close(w, c);
+        return;
+    }
+    c->in_len += n;
+
+    if (process(w, c))
+        flush(w, c);
+}
+
+/**
+ * Serve the requests read in full, in order, up to one streamed.
+ *
+ * @return true if the connection is still open and not handed over to a
+ *         streamer, false otherwise.
+ */
+bool server::process(worker* w, connection* c)
+{
+    while (!c->closing) {
+        // let the socket take some before going on
+        if (c->out.size() - c->out_pos >= MAX_PENDING) {
+            if (!flush(w, c))
+                return false;
+            if (c->writing)
+                break;
+        }
+
+        const char* data = &c->in[c->pos];
+        size_t avail = c->in_len - c->pos;
+        const char* end = static_cast<const char*>(memmem(data, avail, "\r\n\r\n", 4));
+
+        if (end == nullptr || static_cast<size_t>(end - data) + 4 > MAX_HEADER) {
+            if (avail > MAX_HEADER)
+                respond(w, c, 431, "request header too large");
+            break;
+        }
+
+        size_t header_len = end - data + 4;
+        size_t length;
+        if (!parse(w, c, header_len, &length))
+            break;
+
+        request& req = w->req;
+        if (avail - header_len < length) {
+            if (!c->continued && c->minor == 1 && has_token(req.find("Expect"), "100-continue")) {
+                c->out += "HTTP/1.1 100 Continue\r\n\r\n";
+                c->continued = true;
+            }
+            break;
+        }
+        req.body = data + header_len;
+        req.body_len = length;
+
+        const header* conn = req.find("Connection");
+        c->closing = c->minor == 0 ? !has_token(conn, "keep-alive") : has_token(conn, "close");
+
+        w->res.clear();
+        fn_(req, &w->res);
+        if (w->res.stream_body) {
+            // the request is left where it is, the response may point into it
+            stream_out(w, c, header_len + length);
+            return false;
+        }
+        put(c, w->res);
+
+        c->pos += header_len + length;
+        c->continued = false;
+    }
+
+    if (c->pos == c->in_len) {
+        c->pos = c->in_len = 0;
+    } else if (c->pos > 0) {
+        memmove(&c->in[0], &c->in[c->pos], c->in_len - c->pos);
+        c->in_len -= c->pos;
+        c->pos = 0;
+    }
+
+    return true;
+}
+
+/**
+ * Parse the request line and the headers of the request at the start of
+ * the connection's input, answering it if it is invalid.
+ *
+ * @return true with the length of the body, false if answered.
+ */
+bool server::parse(worker* w, connection* c, size_t header_len, size_t* length)
+{
+    request& req = w->req;
+    const char* p = &c->in[c->pos];
+    const char* end = p + header_len - 2;
+    const char* eol = static_cast<const char*>(memchr(p, '\r', end - p));
+    const char* sp1 = static_cast<const char*>(memchr(p, ' ', eol - p));
+    const char* sp2 = sp1 == nullptr ? nullptr : static_cast<const char*>(memchr(sp1 + 1, ' ', eol - sp1 - 1));
+
+    c->minor = 1;
+    if (sp2 == nullptr || sp1 == p || sp2 == sp1 + 1) {
+        respond(w, c, 400, "bad request");
+        return false;
+    }
+    if (eol - sp2 - 1 != 8 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0 || (sp2[8] != '0' && sp2[8] != '1')) {
+        respond(w, c, 505, "HTTP version not supported");
+        return false;
+    }
+
+    req.method = p;
+    req.method_len = sp1 - p;
+    req.target = sp1 + 1;
+    req.target_len = sp2 - sp1 - 1;
+    req.minor = c->minor = sp2[8] - '0';
+    req.body = nullptr;
+    req.body_len = 0;
+    req.headers.clear();
+
+    for (p = eol + 2; p < end; p = eol + 2) {
+        eol = static_cast<const char*>(memchr(p, '\r', end - p + 1));
+        const char* colon = static_cast<const char*>(memchr(p, ':', eol - p));
+        if (colon == nullptr || colon == p || eol[1] != '\n') {
+            respond(w, c, 400, "bad request");
+            return false;
+        }
+
+        const char* value = colon + 1;
+        const char* value_end = eol;
+        while (value < value_end && (*value == ' ' || *value == '\t'))
+            value++;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+        req.headers.push_back(header{ p, static_cast<size_t>(colon - p), value, static_cast<size_t>(value_end - value) });
+    }
+
+    if (req.find("Transfer-Encoding") != nullptr) {
+        respond(w, c, 501, "chunked requests not supported");
+        return false;
+    }
+
+    *length = 0;
+    const header* h = req.find("Content-Length");
+    if (h != nullptr) {
+        if (h->value_len == 0 || h->value_len > 10) {
+            respond(w, c, 400, "bad request");
+            return false;
+        }
+        for (size_t i = 0; i < h->value_len; i++) {
+            if (h->value[i] < '0' || h->value[i] > '9') {
+                respond(w, c, 400, "bad request");
+                return false;
+            }
+            *length = *length * 10 + (h->value[i] - '0');
+        }
+    }
+    if (*length > MAX_BODY) {
+        respond(w, c, 413, "request too large");
+        return false;
+    }
+
+    return true;
+}
+
+// an error of the connection, closed after it
+void server::respond(worker* w, connection* c, int status, const char* text)
+{
+    response& res = w->res;
+
+    res.clear();
+    res.status = status;
+    res.set_text(text, strlen(text));
+    res.add_header("Content-Type", "text/plain");
+    c->closing = true;
+    put(c, res);
+}
+
+/**
+ * Hand a connection over to a thread of its own to stream the body of the
+ * response of a request, out of the reactor until the thread hands it back.
+ *
+ * @param w         the worker of the connection.
+ * @param c         the connection.
+ * @param length    the length of the request.
+ */
+void server::stream_out(worker* w, connection* c, size_t length)
+{
+    c->res = w->res;
+    if (w->res.body == w->res.text.data())
+        c->res.set_body(c->res.text);
+    c->length = length;
+    c->streaming = true;
+    c->writing = false;
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+
+    c->streamer = std::thread([this, w, c]() {
+        uint64_t one = 1;
+
+        c->failed = !stream(c);
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->streamed.push_back(c);
+        }
+        if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+            // woken already
+        }
+    });
+}
+
+/**
+ * Stream the body of a response, on the streamer's thread. A body that fits
+ * in a chunk goes as a plain response, as does the response of a streamer
+ * giving up before the first chunk; one giving up later leaves the last
+ * chunk out and the connection closed, for the client to tell.
+ *
+ * @return true if the connection is to be kept, false to close it.
+ */
+bool server::stream(connection* c)
+{
+    response& res = c->res;
+    bool closing = c->closing;
+
+    // HTTP/1.0 has no chunks, the body ends with the connection
+    if (c->minor == 0)
+        c->closing = true;
+
+    chunked_stream out(this, c, &res);
+    bool ok = res.stream_body(&out, &res);
+
+    if (out.failed())
+        return false;
+    if (!out.started()) {
+        c->closing = closing;
+        if (ok) {
+            res.text = out.buffered();
+            res.set_body(res.text);
+        }
+        put(c, res);
+        return true;
+    }
+    if (!ok || !out.finish()) {
+        if (out.failed())
+            return false;
+        c->closing = true;
+    }
+
+    return true;
+}
+
+// a connection back from its streamer, on to the requests after
+void server::resume(worker* w, connection* c)
+{
+    struct epoll_event ev = {};
+
+    c->streamer.join();
+    c->streaming = false;
+    c->res.clear();
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    if (c->failed || epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+        close(w, c);
+        return;
+    }
+
+    c->pos += c->length;
+    c->continued = false;
+    if (process(w, c))
+        flush(w, c);
+}
+
+// the status line and the headers of a response
+void server::put_head(connection* c, const response& res, bool streamed)
+{
+    char line[128];
+
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", res.status, reason(res.status));
+    c->out += line;
+    for (const auto& h : res.headers) {
+        c->out.append(h.name, h.name_len);
+        c->out += ": ";
+        c->out.append(h.value, h.value_len);
+        c->out += "\r\n";
+    }
+    if (!streamed) {
+        snprintf(line, sizeof(line), "Content-Length: %zu\r\n", res.body_len);
+        c->out += line;
+    } else if (c->minor == 1) {
+        c->out += "Transfer-Encoding: chunked\r\n";
+    }
+    if (c->closing)
+        c->out += "Connection: close\r\n";
+    else if (c->minor == 0)
+        c->out += "Connection: keep-alive\r\n";
+    c->out += "\r\n";
+}
+
+// queue a response, or write it out at once if its body is big
+void server::put(connection* c, const response& res)
+{
+    put_head(c, res, false);
+
+    if (res.body_len < ZERO_COPY_MIN || c->writing) {
+        c->out.append(res.body, res.body_len);
+        return;
+    }
+
+    // the body goes straight from the handler's buffer, what the socket
+    // doesn't take is kept
+    struct iovec iov[2];
+    struct msghdr msg = {};
+    iov[0].iov_base = &c->out[c->out_pos];
+    iov[0].iov_len = c->out.size() - c->out_pos;
+    iov[1].iov_base = const_cast<char*>(res.body);
+    iov[1].iov_len = res.body_len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+    size_t written = n > 0 ? static_cast<size_t>(n) : 0;
+    size_t pending = iov[0].iov_len;
+
+    if (written < pending) {
+        c->out_pos += written;
+        c->out.append(res.body, res.body_len);
+    } else {
+        c->out.clear();
+        c->out_pos = 0;
+        c->out.append(res.body + (written - pending), res.body_len - (written - pending));
+    }
+}
+
+/**
+ * Write out what is queued on a connection, waiting for the socket to take
+ * it if need be.
+ *
+ * @return true if the connection is still open, false otherwise.
+ */
+bool server::flush(worker* w, connection* c)
+{
+    while (c->out_pos < c->out.size()) {
+        ssize_t n = send(c->fd, &c->out[c->out_pos], c->out.size() - c->out_pos, MSG_NOSIGNAL);
+
+        if (n >= 0) {
+            c->out_pos += n;
+        } else if (errno == EAGAIN) {
+            if (!c->writing) {
+                struct epoll_event ev = {};
+                ev.events = EPOLLOUT;
+                ev.data.ptr = c;
+                epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+                c->writing = true;
+            }
+            return true;
+        } else if (errno != EINTR) {
+            close(w, c);
+            return false;
+        }
+    }
+    c->out.clear();
+    c->out_pos = 0;
+
+    if (c->closing) {
+        close(w, c);
+        return false;
+    }
+    if (c->writing) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->writing = false;
+    }
+
+    return true;
+}
+
+void server::close(worker* w, connection* c)
+{
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    w->connections.erase(c);
+    delete c;
+}
+
+}  // namespace http
+
+}  // namespace xa
@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            HTTP Server API documentation.
+ */
+
+/**
+ * @file http_server.hpp
+ *
+ * @brief      Xabyss's HTTP Server library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xa {
+
+namespace http {
+
+struct header {
+    const char* name;
+    size_t name_len;
+    const char* value;
+    size_t value_len;
+};
+
+/**
+ * A request, pointing into the buffer of its connection: it is valid only
+ * while it is handled.
+ */
+struct request {
+    const char* method;
+    size_t method_len;
+    const char* target;
+    size_t target_len;
+    const char* body;
+    size_t body_len;
+    int minor;              // HTTP/1.minor
+    std::vector<header> headers;
+
+    bool method_is(const char* name) const;
+    bool target_is(const char* path) const;
+    // by name, whatever its case
+    const header* find(const char* name) const;
+};
+
+/**
+ * The body of a streamed response, written out in parts as it is produced.
+ * A write or a flush fails once the client is gone, for the producer to
+ * give up.
+ */
+class stream {
+public:
+    virtual ~stream() {}
+
+    virtual bool write(const char* data, size_t n) = 0;
+    virtual bool flush() = 0;
+
+    bool write(const std::string& s);
+};
+
+struct response;
+
+// streams the body, false to give up on it
+typedef std::function<bool(stream* out, response* res)> streamer;
+
+/**
+ * A response. Its body is text, or points at a buffer of the handler kept
+ * until the next request of the thread, and sent from there without a copy.
+ * Header values point at literals or into the request.
+ *
+ * Or its body is streamed: once the handler returns, the streamer is called
+ * to write it. Until something is flushed the response may still change,
+ * and if the streamer gives up then, it goes as it is instead.
+ */
+struct response {
+    int status;
+    std::vector<header> headers;
+    const char* body;
+    size_t body_len;
+    std::string text;
+    streamer stream_body;
+
+    void clear();
+    void add_header(const char* name, const char* value);
+    void add_header(const char* name, const char* value, size_t len);
+    void set_text(const char* s, size_t n);
+    void set_text(const std::string& s);
+    void set_body(const std::string& s);
+    void set_stream(const streamer& fn);
+};
+
+const char* reason(int status);
+
+/**
+ * An HTTP/1.1 server of threads with an epoll reactor each, and a listening
+ * socket each on the same port (SO_REUSEPORT) for the kernel to spread the
+ * connections over them.
+ *
+ * Connections are kept alive and the requests pipelined on them are served
+ * in turn, their responses written out together. A request is handled on
+ * the thread of its connection, so a slow one holds up the others of that
+ * thread.
+ *
+ * Streamed bodies go in chunks (in HTTP/1.0 up to the end of the connection).
+ * The streamer runs on a thread of its own, with the connection handed over
+ * to it until done, waiting for the client to take the chunks so that no
+ * more than a few are held at a time; the reactor goes on with the others.
+ */
+class server {
+public:
+    typedef std::function<void(const request& req, response* res)> handler;
+
+    constexpr static const size_t MAX_HEADER = 64 * 1024;
+    constexpr static const size_t MAX_BODY = 64 * 1024 * 1024;
+    constexpr static const size_t CHUNK_SIZE = 16 * 1024;
+
+    server(const std::string& address, unsigned short port, unsigned nthreads, const handler& fn);
+    ~server();
+
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+    bool listen();
+    void run();
+    void stop();
+
+    unsigned short port() const;
+    std::string error() const;
+
+private:
+    struct connection;
+    struct worker;
+    class chunked_stream;
+
+    void serve(worker* w);
+    void accept(worker* w);
+    void receive(worker* w, connection* c);
+    bool process(worker* w, connection* c);
+    bool parse(worker* w, connection* c, size_t end, size_t* length);
+    void respond(worker* w, connection* c, int status, const char* text);
+    void stream_out(worker* w, connection* c, size_t length);
+    bool stream(connection* c);
+    void resume(worker* w, connection* c);
+    void put_head(connection* c, const response& res, bool streamed);
+    void put(connection* c, const response& res);
+    bool flush(worker* w, connection* c);
+    void close(worker* w, connection* c);
+    void fail(const std::string& error);
+
+    std::string address_;
+    unsigned short port_;
+    unsigned nthreads_;
+    handler fn_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::atomic<bool> stopping_;
+
+    mutable std::mutex mutex_;      // error
+    std::string error_;
+};
+
+inline bool request::method_is(const char* name) const
+{
+    return method_len == strlen(name) && memcmp(method, name, method_len) == 0;
+}
+
+inline bool request::target_is(const char* path) const
+{
+    return target_len == strlen(path) && memcmp(target, path, target_len) == 0;
+}
+
+inline bool stream::write(const std::string& s)
+{
+    return write(s.data(), s.size());
+}
+
+inline void response::add_header(const char* name, const char* value)
+{
+    add_header(name, value, strlen(value));
+}
+
+inline void response::set_text(const std::string& s)
+{
+    set_text(s.data(), s.size());
+}
+
+inline unsigned short server::port() const
+{
+    return port_;
+}
+
+}  // namespace http
+
+}  // namespace xa
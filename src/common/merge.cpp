@@ -0,0 +1,262 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap merge API documentation.
+ */
+
+/**
+ * @file merge.cpp
+ *
+ * @brief      Xabyss's Pcap merge library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+#include <string>
+
+#include "logger.hpp"
+#include "merge.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+namespace merge {
+
+// an exhausted source
+constexpr static const uint64_t EXHAUSTED = UINT64_MAX;
+
+loser_tree::loser_tree(size_t k)
+{
+    reset(k);
+}
+
+void loser_tree::reset(size_t k)
+{
+    k_ = k;
+    tree_.assign(std::max<size_t>(k, 1), 0);
+}
+
+bool loser_tree::less(const uint64_t* keys, size_t a, size_t b)
+{
+    return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+}
+
+/**
+ * Play the subtree of a node, the leaves being the nodes [k, 2k).
+ */
+size_t loser_tree::build(const uint64_t* keys, size_t node)
+{
+    if (node >= k_)
+        return node - k_;
+
+    size_t left = build(keys, 2 * node);
+    size_t right = build(keys, 2 * node + 1);
+
+    if (less(keys, left, right)) {
+        tree_[node] = right;
+        return left;
+    }
+
+    tree_[node] = left;
+    return right;
+}
+
+/**
+ * Play the whole tournament.
+ *
+ * @param keys      the current key of each source.
+ */
+void loser_tree::build(const uint64_t* keys)
+{
+    tree_[0] = (k_ > 1) ? build(keys, 1) : 0;
+}
+
+/**
+ * Replay the path of the winner after its key has changed.
+ *
+ * @param keys      the current key of each source.
+ */
+void loser_tree::replay(const uint64_t* keys)
+{
+    size_t winner = tree_[0];
+
+    for (size_t node = (winner + k_) / 2; node > 0; node /= 2) {
+        if (less(keys, tree_[node], winner))
+            std::swap(tree_[node], winner);
+    }
+
+    tree_[0] = winner;
+}
+
+merger::merger(size_t buffer_size)
+    : buffer_size_(buffer_size)
+    , pending_(SIZE_MAX)
+    , alive_(0)
+    , begin_ts_(0)
+    , end_ts_(UINT64_MAX)
+    , linktype_(LINKTYPE_ETHERNET)
+    , packets_(0)
+{
+}
+
+/**
+ * Add a file to merge, before start().
+ *
+ * @param filename  a pcap filename, its timestamp index is used if any.
+ */
+void merger::add(const std::string& filename)
+{
+    files_.push_back(filename);
+}
+
+/**
+ * Restrict the merge to packets in [begin_ts, end_ts).
+ */
+void merger::set_range(uint64_t begin_ts, uint64_t end_ts)
+{
+    begin_ts_ = begin_ts;
+    end_ts_ = end_ts;
+}
+
+/**
+ * Open the files and prime the tree.
+ *
+ * @return true on success, false if a file can't be opened or the link
+ *         types differ.
+ */
+bool merger::start()
+{
+    readers_.clear();
+    heads_.assign(files_.size(), packet());
+    keys_.assign(files_.size(), EXHAUSTED);
+    alive_ = 0;
+    packets_ = 0;
+
+    for (size_t i = 0; i < files_.size(); i++) {
+        std::unique_ptr<pcap::stream_reader> reader(new pcap::stream_reader(buffer_size_));
+
+        if (!reader->open(files_[i]))
+            return false;
+
+        if (i == 0) {
+            linktype_ = reader->linktype();
+        } else if (reader->linktype() != linktype_) {
+            XA_LOGGER(error) << "link type mismatch: " << files_[i];
+            return false;
+        }
+
+        // skip to the start of the range by the timestamp index
+        std::vector<segment::index_entry> index;
+        if (begin_ts_ > 0 && segment::load_index(files_[i], &index)) {
+            auto it = std::upper_bound(index.begin(), index.end(), begin_ts_,
+                                       [](uint64_t ts, const segment::index_entry& e) {
+                                           return ts < e.ts;
+                                       });
+            if (it != index.begin() && !reader->seek((--it)->offset))
+                return false;
+        }
+
+        readers_.push_back(std::move(reader));
+        advance(i);
+    }
+
+    tree_.reset(files_.size());
+    tree_.build(keys_.data());
+    pending_ = SIZE_MAX;
+
+    return true;
+}
+
+/**
+ * Read the next packet of a source within the range.
+ */
+bool merger::advance(size_t i)
+{
+    packet& head = heads_[i];
+
+    while (readers_[i]->next(&head)) {
+        if (head.ts >= end_ts_)
+            break;
+        if (head.ts < begin_ts_)
+            continue;
+
+        if (keys_[i] == EXHAUSTED)
+            alive_++;
+        keys_[i] = head.ts;
+        return true;
+    }
+
+    if (keys_[i] != EXHAUSTED)
+        alive_--;
+    keys_[i] = EXHAUSTED;
+    readers_[i]->close();
+
+    return false;
+}
+
+/**
+ * Take the packet with the lowest timestamp.
+ *
+ * @param pkt       a packet to be filled, the data stays valid until the next
+ *                  call.
+ * @return true on success, false when every source is exhausted.
+ */
+bool merger::next(packet* pkt)
+{
+    // the previous winner is advanced only now, not to overwrite its data
+    if (pending_ != SIZE_MAX) {
+        advance(pending_);
+        tree_.replay(keys_.data());
+        pending_ = SIZE_MAX;
+    }
+
+    if (alive_ == 0)
+        return false;
+
+    pending_ = tree_.winner();
+    *pkt = heads_[pending_];
+    packets_++;
+
+    return true;
+}
+
+/**
+ * Merge pcap files into one, ordered by timestamp.
+ *
+ * @param inputs    pcap files.
+ * @param output    an output filename.
+ * @param begin_ts  the first timestamp to include.
+ * @param end_ts    the timestamp to stop at.
+ * @return true on success, false otherwise.
+ */
+bool merge_files(const std::vector<std::string>& inputs, const std::string& output,
+                 uint64_t begin_ts, uint64_t end_ts)
+{
+    merger m;
+    pcap::writer out(4 << 20);
+    packet pkt;
+
+    for (const auto& input : inputs) {
+        m.add(input);
+    }
+    m.set_range(begin_ts, end_ts);
+
+    if (!m.start() || !out.open(output, m.linktype()))
+        return false;
+
+    while (m.next(&pkt)) {
+        if (!out.write(pkt))
+            return false;
+    }
+
+    return out.close();
+}
+
+}  // namespace merge
+
+}  // namespace pca
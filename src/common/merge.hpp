@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap merge API documentation.
+ */
+
+/**
+ * @file merge.hpp
+ *
+ * @brief      Xabyss's Pcap merge library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packet.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace merge {
+
+/**
+ * Tree of losers over k sources: the overall winner is found with one
+ * comparison per level after the winning source advances, against the two
+ * per level of a binary heap.
+ *
+ * Keys are compared by value, then by source, so that the merge is stable.
+ */
+class loser_tree {
+public:
+    explicit loser_tree(size_t k = 0);
+
+    void reset(size_t k);
+    void build(const uint64_t* keys);
+    void replay(const uint64_t* keys);
+
+    size_t winner() const;
+    size_t size() const;
+
+private:
+    size_t build(const uint64_t* keys, size_t node);
+    static bool less(const uint64_t* keys, size_t a, size_t b);
+
+    size_t k_;
+    std::vector<size_t> tree_;          // [0] is the winner, [1, k) the losers
+};
+
+/**
+ * Timestamp-ordered merge of pcap files, e.g. the segments written by the
+ * workers of a pipeline, each of which is ordered by itself.
+ *
+ * The files are streamed, only a read buffer per file is kept in memory.
+ */
+class merger {
+public:
+    explicit merger(size_t buffer_size = 1 << 20);
+
+    merger(const merger&) = delete;
+    merger& operator=(const merger&) = delete;
+
+    void add(const std::string& filename);
+    void set_range(uint64_t begin_ts, uint64_t end_ts);
+    bool start();
+    bool next(packet* pkt);
+
+    int linktype() const;
+    size_t sources() const;
+    uint64_t packets() const;
+
+private:
+    bool advance(size_t i);
+
+    size_t buffer_size_;
+    std::vector<std::string> files_;
+    std::vector<std::unique_ptr<pcap::stream_reader>> readers_;
+    std::vector<packet> heads_;
+    std::vector<uint64_t> keys_;
+    loser_tree tree_;
+    size_t pending_;
+    size_t alive_;
+    uint64_t begin_ts_;
+    uint64_t end_ts_;
+    int linktype_;
+    uint64_t packets_;
+};
+
+bool merge_files(const std::vector<std::string>& inputs, const std::string& output,
+                 uint64_t begin_ts = 0, uint64_t end_ts = UINT64_MAX);
+
+inline size_t loser_tree::winner() const
+{
+    return tree_[0];
+}
+
+inline size_t loser_tree::size() const
+{
+    return k_;
+}
+
+inline int merger::linktype() const
+{
+    return linktype_;
+}
+
+inline size_t merger::sources() const
+{
+    return files_.size();
+}
+
+inline uint64_t merger::packets() const
+{
+    return packets_;
+}
+
+}  // namespace merge
+
+}  // namespace pca
@@ -0,0 +1,175 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet descriptor API documentation.
+ */
+
+/**
+ * @file packet.cpp
+ *
+ * @brief      Xabyss's Packet descriptor library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <string.h>
+
+#include "packet.hpp"
+
+namespace pca {
+
+namespace decode {
+
+#define ETHERTYPE_IPV4      0x0800
+#define ETHERTYPE_VLAN      0x8100
+#define ETHERTYPE_QINQ      0x88a8
+#define ETHERTYPE_IPV6      0x86dd
+
+#define IPPROTO_HOPOPTS_    0
+#define IPPROTO_TCP_        6
+#define IPPROTO_UDP_        17
+#define IPPROTO_ROUTING_    43
+#define IPPROTO_FRAGMENT_   44
+#define IPPROTO_DSTOPTS_    60
+#define IPPROTO_SCTP_       132
+
+static inline uint16_t read_be16(const uint8_t* p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static void decode_l4(const uint8_t* p, const uint8_t* end, bool fragmented, flow_key* key)
+{
+    // a fragment carries no (or only a partial) transport header, fragments of
+    // a flow must then hash on the addresses only to stay on the same worker.
+    if (fragmented)
+        return;
+
+    switch (key->protocol) {
+    case IPPROTO_TCP_:
+    case IPPROTO_UDP_:
+    case IPPROTO_SCTP_:
+        if (p + 4 > end)
+            return;
+        key->src_port = read_be16(p);
+        key->dst_port = read_be16(p + 2);
+        break;
+    default:
+        break;
+    }
+}
+
+static bool decode_ipv4(const uint8_t* p, const uint8_t* end, flow_key* key)
+{
+    if (p + 20 > end)
+        return false;
+
+    size_t ihl = (p[0] & 0x0f) * 4;
+    if (ihl < 20 || p + ihl > end)
+        return false;
+
+    uint16_t frag = read_be16(p + 6);
+    bool fragmented = (frag & 0x3fff) != 0;     // MF or offset
+
+    key->version = 4;
+    key->protocol = p[9];
+    memcpy(key->src_addr, p + 12, 4);
+    memcpy(key->dst_addr, p + 16, 4);
+
+    decode_l4(p + ihl, end, fragmented, key);
+
+    return true;
+}
+
+static bool decode_ipv6(const uint8_t* p, const uint8_t* end, flow_key* key)
+{
+    if (p + 40 > end)
+        return false;
+
+    uint8_t next = p[6];
+    bool fragmented = false;
+
+    key->version = 6;
+    memcpy(key->src_addr, p + 8, 16);
+    memcpy(key->dst_addr, p + 24, 16);
+
+    p += 40;
+    for (;;) {
+        if (next == IPPROTO_HOPOPTS_ || next == IPPROTO_ROUTING_ || next == IPPROTO_DSTOPTS_) {
+            if (p + 8 > end)
+                break;
+            next = p[0];
+            p += (p[1] + 1) * 8;
+        } else if (next == IPPROTO_FRAGMENT_) {
+            if (p + 8 > end)
+                break;
+            next = p[0];
+            fragmented = true;
+            p += 8;
+        } else {
+            break;
+        }
+    }
+
+    key->protocol = next;
+
+    decode_l4(p, end, fragmented, key);
+
+    return true;
+}
+
+/**
+ * Extract the 5-tuple of a packet.
+ *
+ * @param pkt       a captured packet.
+ * @param key       a flow key to be filled, zeroed when it's not an IP packet.
+ * @param linktype  a link-layer header type of the capture.
+ * @return true if it's an IPv4/IPv6 packet, false otherwise.
+ */
+bool flow_key_of(const packet& pkt, flow_key* key, int linktype)
+{
+    const uint8_t* p = pkt.data;
+    const uint8_t* end = pkt.data + pkt.caplen;
+
+    memset(key, 0, sizeof(*key));
+
+    if (linktype == LINKTYPE_RAW) {
+        if (p >= end)
+            return false;
+        if ((p[0] >> 4) == 4)
+            return decode_ipv4(p, end, key);
+        if ((p[0] >> 4) == 6)
+            return decode_ipv6(p, end, key);
+        return false;
+    }
+
+    if (linktype != LINKTYPE_ETHERNET || p + 14 > end)
+        return false;
+
+    uint16_t ethertype = read_be16(p + 12);
+    p += 14;
+
+    while (ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ) {
+        if (p + 4 > end)
+            return false;
+        ethertype = read_be16(p + 2);
+        p += 4;
+    }
+
+    switch (ethertype) {
+    case ETHERTYPE_IPV4:
+        return decode_ipv4(p, end, key);
+    case ETHERTYPE_IPV6:
+        return decode_ipv6(p, end, key);
+    default:
+        return false;
+    }
+}
+
+}  // namespace decode
+
+}  // namespace pca
@@ -0,0 +1,64 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet descriptor API documentation.
+ */
+
+/**
+ * @file packet.hpp
+ *
+ * @brief      Xabyss's Packet descriptor library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pca {
+
+// link-layer header types (http://www.tcpdump.org/linktypes.html)
+constexpr static const int LINKTYPE_ETHERNET = 1;
+constexpr static const int LINKTYPE_RAW = 101;
+
+/**
+ * A captured packet.
+ *
+ * The descriptor does not own the data, the producer (capture ring, mmap'ed
+ * pcap file, ...) must keep it alive until every consumer has released it.
+ */
+struct packet {
+    uint64_t ts;            // nanoseconds since epoch
+    uint32_t caplen;        // captured length
+    uint32_t len;           // original length on the wire
+    const uint8_t* data;
+};
+
+/**
+ * IPv4/IPv6 5-tuple of a packet, ports are in host byte order.
+ *
+ * IPv4 addresses occupy the first 4 bytes of src_addr/dst_addr and the rest
+ * is zero-filled, so keys can be compared with memcmp().
+ */
+struct flow_key {
+    uint8_t version;        // 4 or 6, 0 if not an IP packet
+    uint8_t protocol;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t src_addr[16];
+    uint8_t dst_addr[16];
+};
+
+namespace decode {
+
+bool flow_key_of(const packet& pkt, flow_key* key, int linktype = LINKTYPE_ETHERNET);
+
+}  // namespace decode
+
+}  // namespace pca
@@ -0,0 +1,325 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet ring API documentation.
+ */
+
+/**
+ * @file packet_ring.cpp
+ *
+ * @brief      Xabyss's Packet ring library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "merge.hpp"
+#include "packet_ring.hpp"
+
+namespace pca {
+
+constexpr const uint32_t packet_ring::PAD;
+
+packet_ring::packet_ring(size_t capacity)
+    : capacity_(std::max<size_t>(capacity & ~static_cast<size_t>(7), 4096))
+    , buffer_(new uint8_t[capacity_])
+    , head_(0)
+    , tail_(0)
+    , first_ts_(0)
+    , last_ts_(0)
+    , evicted_ts_(0)
+{
+}
+
+size_t packet_ring::record_size(uint32_t caplen)
+{
+    return (sizeof(record_header) + caplen + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * Step over the end of the buffer, where a record doesn't fit.
+ *
+ * @return the position of the record header copied into hdr.
+ */
+uint64_t packet_ring::skip_pad(uint64_t pos, record_header* hdr) const
+{
+    size_t left = capacity_ - pos % capacity_;
+
+    if (left >= sizeof(record_header)) {
+        memcpy(hdr, &buffer_[pos % capacity_], sizeof(*hdr));
+        if (hdr->caplen != PAD)
+            return pos;
+    }
+
+    pos += left;
+    memcpy(hdr, &buffer_[0], sizeof(*hdr));
+
+    return pos;
+}
+
+/**
+ * Move the tail until the buffer can hold everything up to end.
+ */
+void packet_ring::reclaim(uint64_t end)
+{
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t evicted = 0;
+
+    if (end - tail <= capacity_)
+        return;
+
+    while (end - tail > capacity_) {
+        record_header hdr;
+        tail = skip_pad(tail, &hdr);
+        evicted = hdr.ts;
+        tail += record_size(hdr.caplen);
+    }
+
+    evicted_ts_.store(evicted, std::memory_order_relaxed);
+    tail_.store(tail, std::memory_order_relaxed);
+    // the tail must be seen moved before the bytes are overwritten
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+ * Append a packet, overwriting the oldest ones, from the single writer.
+ *
+ * @param pkt       a packet.
+ */
+void packet_ring::write(const packet& pkt)
+{
+    size_t size = record_size(pkt.caplen);
+    if (size > capacity_ / 2)
+        return;
+
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    size_t left = capacity_ - head % capacity_;
+    uint64_t pos = (size > left) ? head + left : head;
+
+    reclaim(pos + size);
+
+    if (pos != head && left >= sizeof(record_header)) {
+        record_header pad = { 0, PAD, 0 };
+        memcpy(&buffer_[head % capacity_], &pad, sizeof(pad));
+    }
+
+    record_header hdr = { pkt.ts, pkt.caplen, pkt.len };
+    uint8_t* p = &buffer_[pos % capacity_];
+    memcpy(p, &hdr, sizeof(hdr));
+    memcpy(p + sizeof(hdr), pkt.data, pkt.caplen);
+
+    if (first_ts_.load(std::memory_order_relaxed) == 0)
+        first_ts_.store(pkt.ts, std::memory_order_relaxed);
+    last_ts_.store(pkt.ts, std::memory_order_relaxed);
+    head_.store(pos + size, std::memory_order_release);
+}
+
+/**
+ * Copy the packets in [begin_ts, end_ts) out, as a record header followed by
+ * the packet data each.
+ *
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param records   records to be appended.
+ * @return the number of packets copied.
+ */
+size_t packet_ring::read(uint64_t begin_ts, uint64_t end_ts, std::vector<uint8_t>* records) const
+{
+    uint64_t pos = tail_.load(std::memory_order_acquire);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    size_t count = 0;
+
+    while (pos < head) {
+        record_header hdr;
+        uint64_t at = skip_pad(pos, &hdr);
+
+        // the header is only trusted if it wasn't reclaimed while copying
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail > pos) {
+            pos = tail;
+            continue;
+        }
+        if (at >= head)
+            break;
+
+        size_t size = record_size(hdr.caplen);
+        if (hdr.ts >= end_ts)
+            break;
+        if (hdr.ts < begin_ts) {
+            pos = at + size;
+            continue;
+        }
+
+        size_t offset = records->size();
+        records->resize(offset + sizeof(hdr) + hdr.caplen);
+        memcpy(&(*records)[offset], &buffer_[at % capacity_], sizeof(hdr) + hdr.caplen);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        tail = tail_.load(std::memory_order_relaxed);
+        if (tail > at) {
+            records->resize(offset);
+            pos = tail;
+            continue;
+        }
+
+        count++;
+        pos = at + size;
+    }
+
+    return count;
+}
+
+/**
+ * Create the rings of the workers.
+ *
+ * @param workers   the number of workers.
+ * @param capacity  the total size in bytes.
+ * @param linktype  a link-layer header type of the packets.
+ */
+recent_buffer::recent_buffer(unsigned workers, size_t capacity, int linktype)
+    : linktype_(linktype)
+{
+    workers = std::max(workers, 1U);
+    for (unsigned i = 0; i < workers; i++) {
+        rings_.push_back(std::unique_ptr<packet_ring>(new packet_ring(capacity / workers)));
+    }
+}
+
+/**
+ * Keep packets of a worker, from its own thread.
+ *
+ * @param worker    the worker index.
+ * @param pkts      packets.
+ * @param n         the number of packets.
+ */
+void recent_buffer::write(unsigned worker, const packet* pkts, size_t n)
+{
+    packet_ring& ring = *rings_[worker % rings_.size()];
+
+    for (size_t i = 0; i < n; i++) {
+        ring.write(pkts[i]);
+    }
+}
+
+/**
+ * Take a snapshot of the packets in [begin_ts, end_ts) of every worker.
+ *
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param out       a snapshot to be filled, ordered by timestamp.
+ * @return the number of packets.
+ */
+size_t recent_buffer::read(uint64_t begin_ts, uint64_t end_ts, snapshot* out) const
+{
+    std::vector<size_t> bounds(1, 0);
+
+    out->data.clear();
+    out->packets.clear();
+    for (const auto& ring : rings_) {
+        ring->read(begin_ts, end_ts, &out->data);
+        bounds.push_back(out->data.size());
+    }
+
+    // each ring is ordered by itself, merge them
+    size_t k = rings_.size();
+    std::vector<size_t> pos(bounds.begin(), bounds.end() - 1);
+    std::vector<uint64_t> keys(k, UINT64_MAX);
+    packet_ring::record_header hdr;
+
+    auto load = [&](size_t i) {
+        if (pos[i] < bounds[i + 1]) {
+            memcpy(&hdr, &out->data[pos[i]], sizeof(hdr));
+            keys[i] = hdr.ts;
+        } else {
+            keys[i] = UINT64_MAX;
+        }
+    };
+
+    for (size_t i = 0; i < k; i++) {
+        load(i);
+    }
+
+    merge::loser_tree tree(k);
+    tree.build(keys.data());
+    while (keys[tree.winner()] != UINT64_MAX) {
+        size_t i = tree.winner();
+        memcpy(&hdr, &out->data[pos[i]], sizeof(hdr));
+
+        packet pkt = { hdr.ts, hdr.caplen, hdr.len, &out->data[pos[i] + sizeof(hdr)] };
+        out->packets.push_back(pkt);
+
+        pos[i] += sizeof(hdr) + hdr.caplen;
+        load(i);
+        tree.replay(keys.data());
+    }
+
+    return out->packets.size();
+}
+
+/**
+ * Every packet from the returned timestamp on is held.
+ *
+ * @return the timestamp, or UINT64_MAX if nothing has been written.
+ */
+uint64_t recent_buffer::oldest_ts() const
+{
+    uint64_t oldest = 0;
+    bool written = false;
+
+    for (const auto& ring : rings_) {
+        uint64_t first = ring->first_ts();
+        if (first == 0)
+            continue;
+
+        written = true;
+        uint64_t evicted = ring->evicted_ts();
+        oldest = std::max(oldest, evicted > 0 ? evicted + 1 : first);
+    }
+
+    return written ? oldest : UINT64_MAX;
+}
+
+/**
+ * The timestamp of the last packet written.
+ *
+ * @return the timestamp, or 0 if nothing has been written.
+ */
+uint64_t recent_buffer::newest_ts() const
+{
+    uint64_t newest = 0;
+
+    for (const auto& ring : rings_) {
+        newest = std::max(newest, ring->last_ts());
+    }
+
+    return newest;
+}
+
+/**
+ * Check whether the packets from a timestamp on are all held.
+ */
+bool recent_buffer::covers(uint64_t begin_ts) const
+{
+    return begin_ts >= oldest_ts();
+}
+
+size_t recent_buffer::capacity() const
+{
+    size_t sum = 0;
+
+    for (const auto& ring : rings_) {
+        sum += ring->capacity();
+    }
+
+    return sum;
+}
+
+}  // namespace pca
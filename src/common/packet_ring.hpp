@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet ring API documentation.
+ */
+
+/**
+ * @file packet_ring.hpp
+ *
+ * @brief      Xabyss's Packet ring library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace pca {
+
+/**
+ * Circular buffer of the most recent packets of one writer.
+ *
+ * Readers never lock: they copy packets out and then check that the writer
+ * has not reclaimed what they copied meanwhile, dropping what it has.
+ */
+class packet_ring {
+public:
+    struct record_header {
+        uint64_t ts;
+        uint32_t caplen;
+        uint32_t len;
+    };
+
+    explicit packet_ring(size_t capacity);
+
+    packet_ring(const packet_ring&) = delete;
+    packet_ring& operator=(const packet_ring&) = delete;
+
+    void write(const packet& pkt);
+    size_t read(uint64_t begin_ts, uint64_t end_ts, std::vector<uint8_t>* records) const;
+
+    size_t capacity() const;
+    uint64_t first_ts() const;
+    uint64_t last_ts() const;
+    uint64_t evicted_ts() const;
+
+private:
+    constexpr static const uint32_t PAD = UINT32_MAX;
+
+    static size_t record_size(uint32_t caplen);
+    uint64_t skip_pad(uint64_t pos, record_header* hdr) const;
+    void reclaim(uint64_t end);
+
+    size_t capacity_;
+    std::unique_ptr<uint8_t[]> buffer_;
+
+    // logical byte positions, the buffer holds [tail_, head_)
+    std::atomic<uint64_t> head_;
+    std::atomic<uint64_t> tail_;
+    std::atomic<uint64_t> first_ts_;
+    std::atomic<uint64_t> last_ts_;
+    std::atomic<uint64_t> evicted_ts_;
+};
+
+/**
+ * The last N seconds of packets, a ring per worker, for searches and
+ * downloads not to go to disk for recent traffic.
+ */
+class recent_buffer {
+public:
+    struct snapshot {
+        std::vector<uint8_t> data;
+        std::vector<packet> packets;        // ordered by timestamp, point into data
+    };
+
+    recent_buffer(unsigned workers, size_t capacity, int linktype = LINKTYPE_ETHERNET);
+
+    recent_buffer(const recent_buffer&) = delete;
+    recent_buffer& operator=(const recent_buffer&) = delete;
+
+    void write(unsigned worker, const packet* pkts, size_t n);
+    size_t read(uint64_t begin_ts, uint64_t end_ts, snapshot* out) const;
+
+    bool covers(uint64_t begin_ts) const;
+    uint64_t oldest_ts() const;
+    uint64_t newest_ts() const;
+
+    void set_linktype(int linktype);
+    int linktype() const;
+    size_t capacity() const;
+
+private:
+    std::vector<std::unique_ptr<packet_ring>> rings_;
+    int linktype_;
+};
+
+inline size_t packet_ring::capacity() const
+{
+    return capacity_;
+}
+
+inline uint64_t packet_ring::first_ts() const
+{
+    return first_ts_.load(std::memory_order_relaxed);
+}
+
+inline uint64_t packet_ring::last_ts() const
+{
+    return last_ts_.load(std::memory_order_relaxed);
+}
+
+inline uint64_t packet_ring::evicted_ts() const
+{
+    return evicted_ts_.load(std::memory_order_relaxed);
+}
+
+inline void recent_buffer::set_linktype(int linktype)
+{
+    linktype_ = linktype;
+}
+
+inline int recent_buffer::linktype() const
+{
+    return linktype_;
+}
+
+}  // namespace pca
@@ -0,0 +1,575 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap file API documentation.
+ */
+
+/**
+ * @file pcap_file.cpp
+ *
+ * @brief      Xabyss's Pcap file library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "logger.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace pcap {
+
+reader::reader()
+    : fd_(-1)
+    , map_(nullptr)
+    , size_(0)
+    , offset_(0)
+    , swapped_(false)
+    , nsec_(false)
+    , linktype_(LINKTYPE_ETHERNET)
+    , snaplen_(MAX_SNAPLEN)
+    , first_sec_(0)
+{
+}
+
+reader::~reader()
+{
+    close();
+}
+
+/**
+ * Open a pcap file and map it into memory.
+ *
+ * @param filename  a pcap filename.
+ * @return true on success, false otherwise.
+ */
+bool reader::open(const std::string& filename)
+{
+    struct stat st;
+
+    close();
+
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        XA_LOGGER(error) << "can't open " << filename << ": " << strerror(errno);
+        return false;
+    }
+
+    if (fstat(fd_, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(file_header)) {
+        XA_LOGGER(error) << "not a pcap file: " << filename;
+        close();
+        return false;
+    }
+
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+        XA_LOGGER(error) << "can't mmap " << filename << ": " << strerror(errno);
+        close();
+        return false;
+    }
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    map_ = static_cast<const uint8_t*>(p);
+    size_ = st.st_size;
+
+    file_header hdr;
+    memcpy(&hdr, map_, sizeof(hdr));
+
+    switch (hdr.magic) {
+    case MAGIC_USEC:
+        break;
+    case MAGIC_NSEC:
+        nsec_ = true;
+        break;
+    case __builtin_bswap32(MAGIC_USEC):
+        swapped_ = true;
+        break;
+    case __builtin_bswap32(MAGIC_NSEC):
+        swapped_ = true;
+        nsec_ = true;
+        break;
+    default:
+        XA_LOGGER(error) << "not a pcap file (pcapng is not supported): " << filename;
+        close();
+        return false;
+    }
+
+    linktype_ = swapped_ ? __builtin_bswap32(hdr.linktype) : hdr.linktype;
+    snaplen_ = swapped_ ? __builtin_bswap32(hdr.snaplen) : hdr.snaplen;
+    offset_ = sizeof(file_header);
+
+    record_header rec;
+    if (read_header(offset_, &rec))
+        first_sec_ = rec.ts_sec;
+
+    return true;
+}
+
+/**
+ * Unmap and close the file, packets read so far become invalid.
+ */
+void reader::close()
+{
+    if (map_ != nullptr) {
+        munmap(const_cast<uint8_t*>(map_), size_);
+        map_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    size_ = 0;
+    offset_ = 0;
+    swapped_ = false;
+    nsec_ = false;
+    first_sec_ = 0;
+}
+
+bool reader::read_header(size_t offset, record_header* rec) const
+{
+    if (map_ == nullptr || offset + sizeof(record_header) > size_)
+        return false;
+
+    memcpy(rec, map_ + offset, sizeof(*rec));
+
+    if (swapped_) {
+        rec->ts_sec = __builtin_bswap32(rec->ts_sec);
+        rec->ts_frac = __builtin_bswap32(rec->ts_frac);
+        rec->caplen = __builtin_bswap32(rec->caplen);
+        rec->len = __builtin_bswap32(rec->len);
+    }
+
+    return rec->caplen <= MAX_SNAPLEN && offset + sizeof(*rec) + rec->caplen <= size_;
+}
+
+/**
+ * Read the next packet.
+ *
+ * @param pkt       a packet to be filled, the data points into the mapping.
+ * @return true on success, false at the end of file or on a truncated record.
+ */
+bool reader::next(packet* pkt)
+{
+    record_header rec;
+
+    if (!read_header(offset_, &rec))
+        return false;
+
+    pkt->ts = static_cast<uint64_t>(rec.ts_sec) * 1000000000ULL
+        + (nsec_ ? rec.ts_frac : static_cast<uint64_t>(rec.ts_frac) * 1000);
+    pkt->caplen = rec.caplen;
+    pkt->len = rec.len;
+    pkt->data = map_ + offset_ + sizeof(rec);
+
+    offset_ += sizeof(rec) + rec.caplen;
+
+    return true;
+}
+
+/**
+ * Read up to n packets.
+ *
+ * @param pkts      a buffer for packets.
+ * @param n         the size of the buffer.
+ * @return the number of packets read.
+ */
+size_t reader::next(packet* pkts, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n && next(&pkts[i])) {
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * Move to a record boundary.
+ *
+ * @param offset    a file offset of a record header.
+ * @return true on success, false if the offset is out of the file.
+ */
+bool reader::seek(size_t offset)
+{
+    if (map_ == nullptr || offset < sizeof(file_header) || offset > size_)
+        return false;
+
+    offset_ = offset;
+
+    return true;
+}
+
+bool reader::is_plausible(size_t offset, size_t* next) const
+{
+    record_header rec;
+
+    if (!read_header(offset, &rec))
+        return false;
+
+    if (rec.ts_frac >= (nsec_ ? 1000000000U : 1000000U))
+        return false;
+    if (rec.caplen > rec.len || rec.len > MAX_SNAPLEN)
+        return false;
+    if (snaplen_ > 0 && rec.caplen > snaplen_)
+        return false;
+
+    // a capture file does not span years
+    constexpr static const uint32_t MAX_SPAN = 366 * 86400;
+    if (rec.ts_sec + MAX_SPAN < first_sec_ || rec.ts_sec > first_sec_ + MAX_SPAN)
+        return false;
+
+    *next = offset + sizeof(rec) + rec.caplen;
+
+    return true;
+}
+
+/**
+ * Find a record boundary from an arbitrary offset, so that a file can be
+ * split into chunks read in parallel.
+ *
+ * An offset is taken as a record header when it and the following records
+ * look valid, up to the end of the file.
+ *
+ * @param from      an offset to search from.
+ * @return the offset of the first record found, size() if there is none.
+ */
+size_t reader::resync(size_t from) const
+{
+    constexpr static const int CHAIN = 8;
+
+    if (from <= sizeof(file_header))
+        return sizeof(file_header);
+
+    for (size_t offset = from; offset + sizeof(record_header) <= size_; offset++) {
+        size_t next = offset;
+        int n = 0;
+
+        while (n < CHAIN && next < size_ && is_plausible(next, &next)) {
+            n++;
+        }
+        if (n == CHAIN || (n > 0 && next == size_))
+            return offset;
+    }
+
+    return size_;
+}
+
+stream_reader::stream_reader(size_t buffer_size)
+    : fd_(-1)
+    , buffer_(std::max<size_t>(buffer_size, 2 * (sizeof(record_header) + MAX_SNAPLEN)))
+    , begin_(0)
+    , end_(0)
+    , eof_(false)
+    , swapped_(false)
+    , nsec_(false)
+    , linktype_(LINKTYPE_ETHERNET)
+{
+}
+
+stream_reader::~stream_reader()
+{
+    close();
+}
+
+/**
+ * Open a pcap file for sequential reading.
+ *
+ * @param filename  a pcap filename.
+ * @return true on success, false otherwise.
+ */
+bool stream_reader::open(const std::string& filename)
+{
+    close();
+
+    fd_ = ::open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        XA_LOGGER(error) << "can't open " << filename << ": " << strerror(errno);
+        return false;
+    }
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    file_header hdr;
+    if (!fill(sizeof(hdr))) {
+        XA_LOGGER(error) << "not a pcap file: " << filename;
+        close();
+        return false;
+    }
+    memcpy(&hdr, buffer_.data(), sizeof(hdr));
+    begin_ += sizeof(hdr);
+
+    switch (hdr.magic) {
+    case MAGIC_USEC:
+        break;
+    case MAGIC_NSEC:
+        nsec_ = true;
+        break;
+    case __builtin_bswap32(MAGIC_USEC):
+        swapped_ = true;
+        break;
+    case __builtin_bswap32(MAGIC_NSEC):
+        swapped_ = true;
+        nsec_ = true;
+        break;
+    default:
+        XA_LOGGER(error) << "not a pcap file (pcapng is not supported): " << filename;
+        close();
+        return false;
+    }
+
+    linktype_ = swapped_ ? __builtin_bswap32(hdr.linktype) : hdr.linktype;
+
+    return true;
+}
+
+void stream_reader::close()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    begin_ = end_ = 0;
+    eof_ = false;
+    swapped_ = false;
+    nsec_ = false;
+}
+
+/**
+ * Make at least need bytes available in the buffer.
+ */
+bool stream_reader::fill(size_t need)
+{
+    if (end_ - begin_ >= need)
+        return true;
+    if (fd_ < 0 || eof_)
+        return false;
+
+    memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+
+    while (end_ < need) {
+        ssize_t n = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            XA_LOGGER(error) << "read failed: " << strerror(errno);
+            eof_ = true;
+            return false;
+        }
+        if (n == 0) {
+            eof_ = true;
+            return false;
+        }
+        end_ += n;
+    }
+
+    return true;
+}
+
+/**
+ * Read the next packet.
+ *
+ * @param pkt       a packet to be filled, the data points into the buffer.
+ * @return true on success, false at the end of file or on a truncated record.
+ */
+bool stream_reader::next(packet* pkt)
+{
+    record_header rec;
+
+    if (!fill(sizeof(rec)))
+        return false;
+
+    memcpy(&rec, buffer_.data() + begin_, sizeof(rec));
+    if (swapped_) {
+        rec.ts_sec = __builtin_bswap32(rec.ts_sec);
+        rec.ts_frac = __builtin_bswap32(rec.ts_frac);
+        rec.caplen = __builtin_bswap32(rec.caplen);
+        rec.len = __builtin_bswap32(rec.len);
+    }
+
+    if (rec.caplen > MAX_SNAPLEN || !fill(sizeof(rec) + rec.caplen))
+        return false;
+
+    pkt->ts = static_cast<uint64_t>(rec.ts_sec) * 1000000000ULL
+        + (nsec_ ? rec.ts_frac : static_cast<uint64_t>(rec.ts_frac) * 1000);
+    pkt->caplen = rec.caplen;
+    pkt->len = rec.len;
+    pkt->data = buffer_.data() + begin_ + sizeof(rec);
+
+    begin_ += sizeof(rec) + rec.caplen;
+
+    return true;
+}
+
+/**
+ * Move to a record boundary, e.g. from a timestamp index.
+ *
+ * @param offset    a file offset of a record header.
+ * @return true on success, false otherwise.
+ */
+bool stream_reader::seek(uint64_t offset)
+{
+    if (fd_ < 0 || offset < sizeof(file_header))
+        return false;
+
+    if (lseek(fd_, offset, SEEK_SET) < 0)
+        return false;
+
+    begin_ = end_ = 0;
+    eof_ = false;
+
+    return true;
+}
+
+writer::writer(size_t buffer_size)
+    : fd_(-1)
+    , buffer_(buffer_size)
+    , used_(0)
+    , offset_(0)
+{
+}
+
+writer::~writer()
+{
+    close();
+}
+
+/**
+ * Create a pcap file.
+ *
+ * @param filename  a pcap filename, truncated if it exists.
+ * @param linktype  a link-layer header type.
+ * @param snaplen   a snapshot length.
+ * @return true on success, false otherwise.
+ */
+bool writer::open(const std::string& filename, int linktype, uint32_t snaplen)
+{
+    close();
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        XA_LOGGER(error) << "can't create " << filename << ": " << strerror(errno);
+        return false;
+    }
+
+    file_header hdr;
+    hdr.magic = MAGIC_NSEC;
+    hdr.version_major = 2;
+    hdr.version_minor = 4;
+    hdr.thiszone = 0;
+    hdr.sigfigs = 0;
+    hdr.snaplen = snaplen;
+    hdr.linktype = linktype;
+
+    return append(&hdr, sizeof(hdr));
+}
+
+/**
+ * Append a packet.
+ *
+ * @param pkt       a packet.
+ * @return true on success, false otherwise.
+ */
+bool writer::write(const packet& pkt)
+{
+    record_header rec;
+
+    rec.ts_sec = static_cast<uint32_t>(pkt.ts / 1000000000ULL);
+    rec.ts_frac = static_cast<uint32_t>(pkt.ts % 1000000000ULL);
+    rec.caplen = pkt.caplen;
+    rec.len = pkt.len;
+
+    return append(&rec, sizeof(rec)) && append(pkt.data, pkt.caplen);
+}
+
+bool writer::append(const void* data, size_t n)
+{
+    if (fd_ < 0)
+        return false;
+
+    if (used_ + n > buffer_.size()) {
+        if (!flush())
+            return false;
+
+        // larger than the buffer itself, write through
+        if (n > buffer_.size()) {
+            if (::write(fd_, data, n) != static_cast<ssize_t>(n)) {
+                XA_LOGGER(error) << "write failed: " << strerror(errno);
+                return false;
+            }
+            offset_ += n;
+            return true;
+        }
+    }
+
+    memcpy(buffer_.data() + used_, data, n);
+    used_ += n;
+    offset_ += n;
+
+    return true;
+}
+
+/**
+ * Write the buffered records to the file.
+ *
+ * @return true on success, false otherwise.
+ */
+bool writer::flush()
+{
+    size_t done = 0;
+
+    while (done < used_) {
+        ssize_t n = ::write(fd_, buffer_.data() + done, used_ - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            XA_LOGGER(error) << "write failed: " << strerror(errno);
+            return false;
+        }
+        done += n;
+    }
+    used_ = 0;
+
+    return true;
+}
+
+/**
+ * Flush and close the file.
+ *
+ * @return true on success, false if the buffered records could not be written.
+ */
+bool writer::close()
+{
+    bool ok = true;
+
+    if (fd_ >= 0) {
+        ok = flush();
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    used_ = 0;
+    offset_ = 0;
+
+    return ok;
+}
+
+}  // namespace pcap
+
+}  // namespace pca
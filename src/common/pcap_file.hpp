@@ -0,0 +1,200 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap file API documentation.
+ */
+
+/**
+ * @file pcap_file.hpp
+ *
+ * @brief      Xabyss's Pcap file library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "packet.hpp"
+
+namespace pca {
+
+namespace pcap {
+
+constexpr static const uint32_t MAGIC_USEC = 0xa1b2c3d4;
+constexpr static const uint32_t MAGIC_NSEC = 0xa1b23c4d;
+constexpr static const uint32_t MAX_SNAPLEN = 262144;
+
+struct file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct record_header {
+    uint32_t ts_sec;
+    uint32_t ts_frac;       // micro or nanoseconds by the magic
+    uint32_t caplen;
+    uint32_t len;
+};
+
+/**
+ * Zero-copy pcap file reader.
+ *
+ * The file is mmap'ed, so the data of the returned packets stays valid until
+ * the reader is closed.
+ */
+class reader {
+public:
+    reader();
+    ~reader();
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool next(packet* pkt);
+    size_t next(packet* pkts, size_t n);
+    bool seek(size_t offset);
+    size_t resync(size_t from) const;
+
+    bool is_open() const;
+    int linktype() const;
+    uint32_t snaplen() const;
+    size_t offset() const;
+    size_t size() const;
+
+private:
+    bool read_header(size_t offset, record_header* rec) const;
+    bool is_plausible(size_t offset, size_t* next) const;
+
+    int fd_;
+    const uint8_t* map_;
+    size_t size_;
+    size_t offset_;
+    bool swapped_;
+    bool nsec_;
+    int linktype_;
+    uint32_t snaplen_;
+    uint32_t first_sec_;
+};
+
+/**
+ * Streaming pcap file reader with large sequential reads, for files that are
+ * read once from start to end (merges, downloads).
+ *
+ * The data of a returned packet stays valid until the next call to next().
+ */
+class stream_reader {
+public:
+    explicit stream_reader(size_t buffer_size = 1 << 20);
+    ~stream_reader();
+
+    stream_reader(const stream_reader&) = delete;
+    stream_reader& operator=(const stream_reader&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool next(packet* pkt);
+    bool seek(uint64_t offset);
+
+    int linktype() const;
+
+private:
+    bool fill(size_t need);
+
+    int fd_;
+    std::vector<uint8_t> buffer_;
+    size_t begin_;
+    size_t end_;
+    bool eof_;
+    bool swapped_;
+    bool nsec_;
+    int linktype_;
+};
+
+/**
+ * Buffered pcap file writer, records carry nanosecond timestamps.
+ */
+class writer {
+public:
+    explicit writer(size_t buffer_size = 1 << 20);
+    ~writer();
+
+    writer(const writer&) = delete;
+    writer& operator=(const writer&) = delete;
+
+    bool open(const std::string& filename, int linktype, uint32_t snaplen = MAX_SNAPLEN);
+    bool write(const packet& pkt);
+    bool flush();
+    bool close();
+
+    bool is_open() const;
+    uint64_t offset() const;
+
+private:
+    bool append(const void* data, size_t n);
+
+    int fd_;
+    std::vector<uint8_t> buffer_;
+    size_t used_;
+    uint64_t offset_;
+};
+
+inline bool reader::is_open() const
+{
+    return map_ != nullptr;
+}
+
+inline int reader::linktype() const
+{
+    return linktype_;
+}
+
+inline uint32_t reader::snaplen() const
+{
+    return snaplen_;
+}
+
+inline size_t reader::offset() const
+{
+    return offset_;
+}
+
+inline size_t reader::size() const
+{
+    return size_;
+}
+
+inline int stream_reader::linktype() const
+{
+    return linktype_;
+}
+
+inline bool writer::is_open() const
+{
+    return fd_ >= 0;
+}
+
+inline uint64_t writer::offset() const
+{
+    return offset_;
+}
+
+}  // namespace pcap
+
+}  // namespace pca
@@ -0,0 +1,192 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet pipeline API documentation.
+ */
+
+/**
+ * @file pipeline.cpp
+ *
+ * @brief      Xabyss's Packet pipeline library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <chrono>
+#include <string>
+
+#include "logger.hpp"
+#include "pipeline.hpp"
+
+namespace pca {
+
+pipeline::pipeline(const pipeline_config& config)
+    : config_(config)
+    , dispatcher_(config.workers, config.ring_size, config.linktype)
+    , running_(false)
+    , queued_(0)
+{
+    config_.workers = dispatcher_.nworkers();
+}
+
+pipeline::~pipeline()
+{
+    stop();
+}
+
+/**
+ * Launch the worker threads.
+ */
+void pipeline::start()
+{
+    if (running_)
+        return;
+
+    running_ = true;
+    workers_.clear();
+    for (unsigned i = 0; i < config_.workers; i++) {
+        std::unique_ptr<worker> w(new worker);
+
+        if (!config_.data_path.empty()) {
+            w->writer = std::unique_ptr<segment::writer>(new segment::writer(
+                config_.data_path, config_.first_worker + i, config_.linktype,
+                config_.segment_size, config_.segment_duration_ns));
+            w->writer->on_sealed(sealed_);
+        }
+        workers_.push_back(std::move(w));
+    }
+
+    for (unsigned i = 0; i < config_.workers; i++) {
+        workers_[i]->thread = std::thread(&pipeline::run, this, i);
+#ifdef DEBUG
+        pthread_setname_np(workers_[i]->thread.native_handle(), ("worker-" + std::to_string(i)).c_str());
+#endif
+    }
+}
+
+/**
+ * Drain the rings, join the workers, seal the open segments and emit the
+ * remaining flows.
+ */
+void pipeline::stop()
+{
+    if (!running_)
+        return;
+
+    running_ = false;
+    for (auto& w : workers_) {
+        w->thread.join();
+        if (w->writer)
+            w->writer->seal();
+        w->flows.expire(UINT64_MAX, flow_);
+    }
+}
+
+/**
+ * Feed packets of the source, must be called from a single thread.
+ *
+ * @param pkts      packets.
+ * @param n         the number of packets.
+ * @param lossless  wait for the workers instead of dropping packets.
+ * @return the number of packets accepted.
+ */
+size_t pipeline::feed(const packet* pkts, size_t n, bool lossless)
+{
+    size_t queued = dispatcher_.dispatch(pkts, n, lossless);
+
+    queued_ += queued;
+
+    return queued;
+}
+
+/**
+ * Wait until the workers have processed every packet fed so far, after which
+ * the source may release the packet data.
+ */
+void pipeline::flush()
+{
+    while (running_ && packets() < queued_) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+uint64_t pipeline::packets() const
+{
+    uint64_t sum = 0;
+
+    for (const auto& w : workers_) {
+        sum += w->packets.load(std::memory_order_acquire);
+    }
+
+    return sum;
+}
+
+uint64_t pipeline::bytes() const
+{
+    uint64_t sum = 0;
+
+    for (const auto& w : workers_) {
+        sum += w->bytes.load(std::memory_order_relaxed);
+    }
+
+    return sum;
+}
+
+void pipeline::run(unsigned index)
+{
+    worker& w = *workers_[index];
+    packet pkts[rss::dispatcher::BATCH_SIZE];
+    unsigned idle = 0;
+
+    for (;;) {
+        size_t n = dispatcher_.receive(index, pkts, rss::dispatcher::BATCH_SIZE);
+        if (n == 0) {
+            if (!running_) {
+                // packets fed before stop() are visible once it's observed
+                n = dispatcher_.receive(index, pkts, rss::dispatcher::BATCH_SIZE);
+                if (n == 0)
+                    break;
+            } else {
+                // spin a little, then back off not to burn an idle core
+                if (++idle < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+                continue;
+            }
+        }
+        idle = 0;
+
+        uint64_t bytes = 0;
+        flow_key key;
+        for (size_t i = 0; i < n; i++) {
+            bool ip = decode::flow_key_of(pkts[i], &key, config_.linktype);
+            if (ip)
+                w.flows.update(key, pkts[i]);
+            if (w.writer)
+                w.writer->write(pkts[i], ip ? &key : nullptr);
+            bytes += pkts[i].caplen;
+        }
+        // the packet data is valid until the packets are counted below
+        if (batch_)
+            batch_(index, pkts, n);
+
+        // expire by packet time, so that replayed traffic ages alike
+        uint64_t now = pkts[n - 1].ts;
+        if (now >= w.next_expire) {
+            if (now > config_.flow_timeout_ns)
+                w.flows.expire(now - config_.flow_timeout_ns, flow_);
+            w.next_expire = now + 1000000000ULL;
+        }
+
+        w.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        w.packets.fetch_add(n, std::memory_order_release);
+    }
+}
+
+}  // namespace pca
@@ -0,0 +1,132 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet pipeline API documentation.
+ */
+
+/**
+ * @file pipeline.hpp
+ *
+ * @brief      Xabyss's Packet pipeline library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flow.hpp"
+#include "packet.hpp"
+#include "rss.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+struct pipeline_config {
+    unsigned workers = 1;
+    size_t ring_size = 65536;
+    int linktype = LINKTYPE_ETHERNET;
+
+    // segments are not stored if the data path is empty
+    std::string data_path;
+    uint64_t segment_size = 256ULL * 1024 * 1024;
+    uint64_t segment_duration_ns = 60ULL * 1000000000ULL;
+    // segments are named after the workers from this one on, for pipelines
+    // storing under the same data path not to write the same files
+    unsigned first_worker = 0;
+
+    // a flow is emitted after being idle for this long
+    uint64_t flow_timeout_ns = 120ULL * 1000000000ULL;
+};
+
+/**
+ * Capture pipeline: a single source feeds packets, the RSS dispatcher spreads
+ * them by flow over worker threads, and each worker keeps its own flow table
+ * and stores its own segments.
+ */
+class pipeline {
+public:
+    using batch_fn = std::function<void(unsigned worker, const packet* pkts, size_t n)>;
+
+    explicit pipeline(const pipeline_config& config);
+    ~pipeline();
+
+    pipeline(const pipeline&) = delete;
+    pipeline& operator=(const pipeline&) = delete;
+
+    void on_sealed(segment::writer::sealed_fn fn);
+    void on_flow(flow_table::expired_fn fn);
+    void on_batch(batch_fn fn);
+
+    void start();
+    void stop();
+
+    size_t feed(const packet* pkts, size_t n, bool lossless = false);
+    void flush();
+
+    const pipeline_config& config() const;
+    uint64_t packets() const;
+    uint64_t bytes() const;
+    uint64_t dropped() const;
+
+private:
+    struct worker {
+        std::thread thread;
+        std::atomic<uint64_t> packets;
+        std::atomic<uint64_t> bytes;
+        std::unique_ptr<segment::writer> writer;
+        flow_table flows;
+        uint64_t next_expire;
+
+        worker() : packets(0), bytes(0), next_expire(0) {}
+    };
+
+    void run(unsigned index);
+
+    pipeline_config config_;
+    rss::dispatcher dispatcher_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    segment::writer::sealed_fn sealed_;
+    flow_table::expired_fn flow_;
+    batch_fn batch_;
+    std::atomic<bool> running_;
+    uint64_t queued_;
+};
+
+inline void pipeline::on_sealed(segment::writer::sealed_fn fn)
+{
+    sealed_ = fn;
+}
+
+inline void pipeline::on_flow(flow_table::expired_fn fn)
+{
+    flow_ = fn;
+}
+
+inline void pipeline::on_batch(batch_fn fn)
+{
+    batch_ = fn;
+}
+
+inline const pipeline_config& pipeline::config() const
+{
+    return config_;
+}
+
+inline uint64_t pipeline::dropped() const
+{
+    return dispatcher_.dropped();
+}
+
+}  // namespace pca
@@ -0,0 +1,208 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search planner API documentation.
+ */
+
+/**
+ * @file planner.cpp
+ *
+ * @brief      Xabyss's Search planner library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "block_index.hpp"
+#include "planner.hpp"
+
+namespace pca {
+
+namespace search {
+
+// fraction of the blocks a term appears in: exact for the common terms, the
+// average of the others of its type otherwise
+static double density_of(const segment::term& t, const segment::filter_stats& stats)
+{
+    unsigned type = t.type & 3;
+    uint64_t hash = segment::term_hash()(t);
+    uint64_t terms = stats.terms[type];
+    uint64_t postings = stats.postings[type];
+
+    if (stats.blocks == 0)
+        return 0;
+
+    for (const auto& common : stats.common) {
+        if (common.blocks == 0 || common.type != t.type)
+            continue;
+        if (common.hash == hash)
+            return static_cast<double>(common.blocks) / stats.blocks;
+        terms--;
+        postings -= common.blocks;
+    }
+
+    return terms > 0 ? std::min(1.0, static_cast<double>(postings) / terms / stats.blocks) : 0;
+}
+
+/**
+ * Estimate the fraction of the blocks a block index query selects, taking
+ * the terms as independent.
+ */
+static double selectivity_of(const segment::index_query& query, const segment::filter_stats& stats)
+{
+    std::vector<double> stack;
+
+    for (const auto& op : query) {
+        switch (op.code) {
+        case segment::index_op::TERM:
+            stack.push_back(density_of(op.t, stats));
+            break;
+        case segment::index_op::ALL:
+            stack.push_back(1.0);
+            break;
+        case segment::index_op::NOT:
+            if (stack.empty())
+                return 1.0;
+            stack.back() = 1.0 - stack.back();
+            break;
+        case segment::index_op::AND:
+        case segment::index_op::OR: {
+            if (stack.size() < 2)
+                return 1.0;
+            double b = stack.back();
+            stack.pop_back();
+            double a = stack.back();
+            stack.back() = op.code == segment::index_op::AND ? a * b : a + b - a * b;
+            break;
+        }
+        }
+    }
+
+    return stack.size() == 1 ? stack.back() : 1.0;
+}
+
+/**
+ * Choose how to read a segment for a query: the whole file, the blocks of the
+ * time range, or the blocks of the time range the block index selects, by
+ * the least estimated cost.
+ *
+ * The statistics of the block index are read from its header if the segment
+ * info doesn't have them, e.g. segments loaded from the catalog.
+ *
+ * @param info      a segment.
+ * @param query     a compiled predicate.
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param model     the cost model.
+ * @return the plan of the segment.
+ */
+segment_plan plan_segment(const segment::info& info, const query::program& query, uint64_t begin_ts,
+                          uint64_t end_ts, const cost_model& model)
+{
+    segment_plan p;
+    bool has_index = (info.flags & segment::FLAG_INDEX) != 0;
+    bool has_filter = has_index && query.indexed() && (info.flags & segment::FLAG_FILTER) != 0;
+
+    p.segment = info;
+    if (has_filter && info.filter.blocks == 0 && !segment::block_index::read_stats(info.path, &p.segment.filter))
+        has_filter = false;
+
+    const segment::filter_stats& stats = p.segment.filter;
+
+    p.blocks = stats.blocks > 0 ? stats.blocks : std::max<uint64_t>(1, (info.bytes + segment::INDEX_INTERVAL - 1)
+                                                                       / segment::INDEX_INTERVAL);
+
+    // packets are taken as evenly spread over the segment
+    uint64_t first = std::max(begin_ts, info.first_ts);
+    uint64_t last = std::min(end_ts, info.last_ts + 1);
+    p.range = first < last ? static_cast<double>(last - first) / (info.last_ts - info.first_ts + 1) : 0;
+
+    double data = info.bytes + info.packets * model.packet;
+    double index_bytes = p.blocks * sizeof(segment::index_entry);
+    double range_blocks = std::min<double>(p.blocks, ceil(p.range * p.blocks) + 1);
+
+    p.selectivity = has_filter ? selectivity_of(query.prefilter(), stats) : 1.0;
+    p.scan_cost = model.seek + data;
+    p.range_cost = has_index ? index_bytes + 2 * model.seek + range_blocks / p.blocks * data : HUGE_VAL;
+    if (has_filter) {
+        double selected = p.selectivity * range_blocks;
+        // selected blocks next to each other are read through
+        double runs = selected * (1 - p.selectivity) + 1;
+        p.index_cost = index_bytes + stats.bytes + (1 + runs) * model.seek + selected / p.blocks * data;
+    } else {
+        p.index_cost = HUGE_VAL;
+    }
+
+    p.access = ACCESS_SCAN;
+    p.cost = p.scan_cost;
+    if (p.range_cost < p.cost) {
+        p.access = ACCESS_RANGE;
+        p.cost = p.range_cost;
+    }
+    if (p.index_cost < p.cost) {
+        p.access = ACCESS_INDEX;
+        p.cost = p.index_cost;
+    }
+
+    return p;
+}
+
+/**
+ * Plan a search: the time range after the bounds of the query, the stored
+ * segments to read and how, and the part of the range read from the recent
+ * buffer.
+ *
+ * @param query     a compiled predicate.
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param storage   the stored segments, may be null.
+ * @param recent    the recent buffer, may be null.
+ * @param model     the cost model.
+ * @return the plan.
+ */
+plan make_plan(const query::program& query, uint64_t begin_ts, uint64_t end_ts, const retention* storage,
+               const recent_buffer* recent, const cost_model& model)
+{
+    plan p;
+
+    p.begin_ts = std::max(begin_ts, query.begin_ts());
+    p.end_ts = std::min(end_ts, query.end_ts());
+    p.cost = 0;
+
+    // the recent buffer holds everything from cut on
+    p.cut = recent != nullptr ? std::max(p.begin_ts, recent->oldest_ts()) : p.end_ts;
+    p.cut = std::min(p.cut, p.end_ts);
+
+    if (storage != nullptr && p.begin_ts < p.cut) {
+        for (const auto& info : storage->find(p.begin_ts, p.cut)) {
+            p.segments.push_back(plan_segment(info, query, p.begin_ts, p.cut, model));
+            p.cost += p.segments.back().cost;
+        }
+    }
+
+    return p;
+}
+
+const char* access_name(access_type access)
+{
+    switch (access) {
+    case ACCESS_SCAN:
+        return "scan";
+    case ACCESS_RANGE:
+        return "range";
+    case ACCESS_INDEX:
+        return "index";
+    }
+
+    return "unknown";
+}
+
+}  // namespace search
+
+}  // namespace pca
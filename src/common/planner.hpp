@@ -0,0 +1,78 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search planner API documentation.
+ */
+
+/**
+ * @file planner.hpp
+ *
+ * @brief      Xabyss's Search planner library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "packet_ring.hpp"
+#include "query.hpp"
+#include "retention.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+namespace search {
+
+/**
+ * How a segment is read.
+ */
+enum access_type {
+    ACCESS_SCAN,                // the whole file, sequentially
+    ACCESS_RANGE,               // the blocks of the time range, by the timestamp index
+    ACCESS_INDEX,               // the blocks of the time range the block index selects
+};
+
+/**
+ * Costs in bytes read from disk.
+ */
+struct cost_model {
+    double seek = 256.0 * 1024;         // a random read
+    double packet = 24.0;               // decoding and evaluating a packet
+};
+
+struct segment_plan {
+    segment::info segment;
+    access_type access;
+    uint64_t blocks;            // of the segment
+    double range;               // fraction of the segment in the time range
+    double selectivity;         // fraction of the blocks the block index would select
+    double scan_cost;
+    double range_cost;
+    double index_cost;
+    double cost;                // of the chosen access
+};
+
+struct plan {
+    uint64_t begin_ts;
+    uint64_t end_ts;
+    uint64_t cut;               // the recent buffer holds [cut, end_ts)
+    std::vector<segment_plan> segments;
+    double cost;                // of the stored segments
+};
+
+segment_plan plan_segment(const segment::info& info, const query::program& query, uint64_t begin_ts,
+                          uint64_t end_ts, const cost_model& model = cost_model());
+plan make_plan(const query::program& query, uint64_t begin_ts, uint64_t end_ts, const retention* storage,
+               const recent_buffer* recent, const cost_model& model = cost_model());
+const char* access_name(access_type access);
+
+}  // namespace search
+
+}  // namespace pca
@@ -0,0 +1,875 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search query API documentation.
+ */
+
+/**
+ * @file query.cpp
+ *
+ * @brief      Xabyss's Search query library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+#include "query.hpp"
+
+namespace pca {
+
+namespace query {
+
+constexpr const size_t batch::SIZE;
+constexpr const unsigned program::MAX_REGISTERS;
+
+batch::batch(int linktype)
+    : linktype_(linktype)
+    , size_(0)
+    , pkts_(SIZE)
+    , ts_(SIZE)
+    , columns_(COLUMNS * SIZE)
+    , selected_(SIZE)
+{
+}
+
+void batch::clear()
+{
+    size_ = 0;
+}
+
+/**
+ * Decode a packet into the next row, the packet data must stay valid until
+ * the batch is cleared.
+ *
+ * @param pkt       a packet.
+ */
+void batch::add(const packet& pkt)
+{
+    flow_key key;
+    uint32_t* row = &columns_[size_];
+
+    memset(&key, 0, sizeof(key));
+    if (!decode::flow_key_of(pkt, &key, linktype_))
+        memset(&key, 0, sizeof(key));
+
+    pkts_[size_] = pkt;
+    ts_[size_] = pkt.ts;
+    row[LEN * SIZE] = pkt.len;
+    row[CAPLEN * SIZE] = pkt.caplen;
+    row[VERSION * SIZE] = key.version;
+    row[PROTO * SIZE] = key.protocol;
+    row[SPORT * SIZE] = key.src_port;
+    row[DPORT * SIZE] = key.dst_port;
+    for (unsigned w = 0; w < 4; w++) {
+        memcpy(&row[(SRC0 + w) * SIZE], &key.src_addr[w * 4], 4);
+        memcpy(&row[(DST0 + w) * SIZE], &key.dst_addr[w * 4], 4);
+    }
+    size_++;
+}
+
+namespace {
+
+//
+// Syntax tree
+//
+
+enum field_type {
+    FIELD_TS,
+    FIELD_LEN,
+    FIELD_CAPLEN,
+    FIELD_VERSION,
+    FIELD_PROTO,
+    FIELD_SPORT,
+    FIELD_DPORT,
+    FIELD_PORT,
+    FIELD_SRC,
+    FIELD_DST,
+    FIELD_HOST,
+};
+
+struct node {
+    enum node_type {
+        CMP,
+        AND,
+        OR,
+        NOT,
+    };
+
+    node_type type;
+
+    // CMP
+    field_type field;
+    insn::op_code op;
+    uint64_t value;
+    uint8_t version;
+    uint8_t addr[16];
+    unsigned prefix;
+
+    std::vector<std::unique_ptr<node>> children;
+
+    explicit node(node_type t) : type(t), field(FIELD_TS), op(insn::EQ), value(0), version(0), prefix(0)
+    {
+        memset(addr, 0, sizeof(addr));
+    }
+};
+
+typedef std::unique_ptr<node> node_ptr;
+
+static const struct {
+    const char* name;
+    field_type field;
+} FIELDS[] = {
+    { "ts", FIELD_TS },
+    { "len", FIELD_LEN },
+    { "caplen", FIELD_CAPLEN },
+    { "version", FIELD_VERSION },
+    { "proto", FIELD_PROTO },
+    { "sport", FIELD_SPORT },
+    { "dport", FIELD_DPORT },
+    { "port", FIELD_PORT },
+    { "src", FIELD_SRC },
+    { "dst", FIELD_DST },
+    { "host", FIELD_HOST },
+};
+
+static const struct {
+    const char* name;
+    uint8_t protocol;
+} PROTOCOLS[] = {
+    { "icmp", 1 },
+    { "tcp", 6 },
+    { "udp", 17 },
+};
+
+static bool is_address(field_type f)
+{
+    return f == FIELD_SRC || f == FIELD_DST || f == FIELD_HOST;
+}
+
+//
+// Parser
+//
+
+class parser {
+public:
+    explicit parser(const std::string& text) : pos_(0)
+    {
+        tokenize(text);
+    }
+
+    node_ptr parse()
+    {
+        node_ptr n = parse_or();
+
+        if (n && pos_ < tokens_.size())
+            return fail("unexpected '" + tokens_[pos_] + "'");
+
+        return n;
+    }
+
+    const std::string& error() const
+    {
+        return error_;
+    }
+
+private:
+    void tokenize(const std::string& text)
+    {
+        size_t i = 0;
+
+        while (i < text.size()) {
+            char c = text[i];
+
+            if (isspace(static_cast<unsigned char>(c))) {
+                i++;
+            } else if (c == '(' || c == ')') {
+                tokens_.push_back(std::string(1, c));
+                i++;
+            } else if (strchr("=!<>&|", c) != nullptr) {
+                char next = i + 1 < text.size() ? text[i + 1] : '\0';
+                size_t len = ((c == '&' || c == '|') ? next == c : next == '=') ? 2 : 1;
+                tokens_.push_back(text.substr(i, len));
+                i += len;
+            } else {
+                size_t start = i;
+                while (i < text.size() && !isspace(static_cast<unsigned char>(text[i]))
+                        && strchr("()=!<>&|", text[i]) == nullptr) {
+                    i++;
+                }
+                tokens_.push_back(text.substr(start, i - start));
+            }
+        }
+    }
+
+    bool accept(const char* a, const char* b = nullptr)
+    {
+        if (pos_ < tokens_.size() && (tokens_[pos_] == a || (b != nullptr && tokens_[pos_] == b))) {
+            pos_++;
+            return true;
+        }
+
+        return false;
+    }
+
+    node_ptr fail(const std::string& message)
+    {
+        if (error_.empty())
+            error_ = message;
+
+        return node_ptr();
+    }
+
+    node_ptr parse_or()
+    {
+        node_ptr n = parse_and();
+
+        while (n && accept("or", "||")) {
+            node_ptr rhs = parse_and();
+            if (!rhs)
+                return node_ptr();
+            if (n->type != node::OR) {
+                node_ptr parent(new node(node::OR));
+                parent->children.push_back(std::move(n));
+                n = std::move(parent);
+            }
+            n->children.push_back(std::move(rhs));
+        }
+
+        return n;
+    }
+
+    node_ptr parse_and()
+    {
+        node_ptr n = parse_not();
+
+        while (n && accept("and", "&&")) {
+            node_ptr rhs = parse_not();
+            if (!rhs)
+                return node_ptr();
+            if (n->type != node::AND) {
+                node_ptr parent(new node(node::AND));
+                parent->children.push_back(std::move(n));
+                n = std::move(parent);
+            }
+            n->children.push_back(std::move(rhs));
+        }
+
+        return n;
+    }
+
+    node_ptr parse_not()
+    {
+        if (accept("not", "!")) {
+            node_ptr child = parse_not();
+            if (!child)
+                return node_ptr();
+            node_ptr n(new node(node::NOT));
+            n->children.push_back(std::move(child));
+            return n;
+        }
+
+        if (accept("(")) {
+            node_ptr n = parse_or();
+            if (n && !accept(")"))
+                return fail("missing ')'");
+            return n;
+        }
+
+        return parse_compare();
+    }
+
+    node_ptr parse_compare()
+    {
+        if (pos_ >= tokens_.size())
+            return fail("unexpected end of query");
+
+        const std::string& name = tokens_[pos_++];
+        node_ptr n(new node(node::CMP));
+
+        for (const auto& p : PROTOCOLS) {
+            if (name == p.name) {
+                n->field = FIELD_PROTO;
+                n->value = p.protocol;
+                return n;
+            }
+        }
+
+        bool found = false;
+        for (const auto& f : FIELDS) {
+            if (name == f.name) {
+                n->field = f.field;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return fail("unknown field '" + name + "'");
+
+        if (accept("==", "=")) {
+            n->op = insn::EQ;
+        } else if (accept("!=")) {
+            n->op = insn::NE;
+        } else if (accept("<")) {
+            n->op = insn::LT;
+        } else if (accept("<=")) {
+            n->op = insn::LE;
+        } else if (accept(">")) {
+            n->op = insn::GT;
+        } else if (accept(">=")) {
+            n->op = insn::GE;
+        }
+
+        if (pos_ >= tokens_.size())
+            return fail("missing value of '" + name + "'");
+        if (is_address(n->field) && n->op != insn::EQ && n->op != insn::NE)
+            return fail("'" + name + "' takes == or != only");
+        if (!parse_value(tokens_[pos_++], n.get()))
+            return fail("invalid value '" + tokens_[pos_ - 1] + "' of '" + name + "'");
+
+        return n;
+    }
+
+    static bool parse_number(const std::string& s, uint64_t max, uint64_t* value)
+    {
+        char* end;
+
+        if (s.empty() || !isdigit(static_cast<unsigned char>(s[0])))
+            return false;
+        errno = 0;
+        *value = strtoull(s.c_str(), &end, 10);
+
+        return errno == 0 && *end == '\0' && *value <= max;
+    }
+
+    static bool parse_value(const std::string& s, node* n)
+    {
+        switch (n->field) {
+        case FIELD_TS: {
+            char* end;
+            double sec = strtod(s.c_str(), &end);
+            if (s.empty() || *end != '\0' || !(sec >= 0 && sec < 1.8e10))
+                return false;
+            n->value = static_cast<uint64_t>(sec * 1e9);
+            return true;
+        }
+        case FIELD_LEN:
+        case FIELD_CAPLEN:
+            return parse_number(s, UINT32_MAX, &n->value);
+        case FIELD_VERSION:
+            return parse_number(s, 255, &n->value);
+        case FIELD_PROTO:
+            for (const auto& p : PROTOCOLS) {
+                if (s == p.name) {
+                    n->value = p.protocol;
+                    return true;
+                }
+            }
+            return parse_number(s, 255, &n->value);
+        case FIELD_SPORT:
+        case FIELD_DPORT:
+        case FIELD_PORT:
+            return parse_number(s, 65535, &n->value);
+        default:
+            break;
+        }
+
+        std::string address = s;
+        size_t slash = s.find('/');
+        if (slash != std::string::npos)
+            address = s.substr(0, slash);
+
+        if (inet_pton(AF_INET, address.c_str(), n->addr) == 1) {
+            n->version = 4;
+            n->prefix = 32;
+        } else if (inet_pton(AF_INET6, address.c_str(), n->addr) == 1) {
+            n->version = 6;
+            n->prefix = 128;
+        } else {
+            return false;
+        }
+
+        if (slash != std::string::npos) {
+            uint64_t prefix;
+            if (!parse_number(s.substr(slash + 1), n->prefix, &prefix))
+                return false;
+            n->prefix = static_cast<unsigned>(prefix);
+        }
+
+        return true;
+    }
+
+    std::vector<std::string> tokens_;
+    size_t pos_;
+    std::string error_;
+};
+
+//
+// Code generation
+//
+
+class compiler {
+public:
+    compiler() : registers_(0), overflow_(false) {}
+
+    bool compile(const node& n, std::vector<insn>* code)
+    {
+        code_ = code;
+        emit_node(n, 0);
+
+        return !overflow_;
+    }
+
+    unsigned registers() const
+    {
+        return registers_;
+    }
+
+private:
+    void emit(insn::op_code code, uint8_t dst, uint8_t a = 0, uint8_t b = 0)
+    {
+        insn i;
+
+        memset(&i, 0, sizeof(i));
+        i.code = code;
+        i.dst = dst;
+        i.a = a;
+        i.b = b;
+        use(dst);
+        code_->push_back(i);
+    }
+
+    void emit_compare(insn::op_code code, uint8_t column, uint8_t dst, uint64_t imm, uint32_t mask = UINT32_MAX)
+    {
+        insn i;
+
+        memset(&i, 0, sizeof(i));
+        i.code = (code == insn::EQ && mask != UINT32_MAX) ? insn::MASK_EQ : code;
+        i.column = column;
+        i.dst = dst;
+        i.mask = mask;
+        i.imm = imm;
+        use(dst);
+        code_->push_back(i);
+    }
+
+    void use(unsigned r)
+    {
+        if (r >= program::MAX_REGISTERS)
+            overflow_ = true;
+        else if (r + 1 > registers_)
+            registers_ = r + 1;
+    }
+
+    // dst = the address of one side is in the network of n
+    void emit_address(const node& n, uint8_t first, uint8_t dst)
+    {
+        uint8_t mask[16] = {};
+
+        for (unsigned bit = 0; bit < n.prefix; bit++) {
+            mask[bit / 8] |= 0x80 >> (bit % 8);
+        }
+
+        emit_compare(insn::EQ, batch::VERSION, dst, n.version);
+        for (unsigned w = 0; w < (n.version == 4 ? 1U : 4U); w++) {
+            uint32_t m, v;
+            memcpy(&m, &mask[w * 4], 4);
+            memcpy(&v, &n.addr[w * 4], 4);
+            if (m == 0)
+                continue;
+            emit_compare(insn::EQ, first + w, dst + 1, v & m, m);
+            emit(insn::AND, dst, dst, dst + 1);
+        }
+    }
+
+    void emit_node(const node& n, uint8_t dst)
+    {
+        switch (n.type) {
+        case node::AND:
+        case node::OR:
+            emit_node(*n.children[0], dst);
+            for (size_t i = 1; i < n.children.size(); i++) {
+                emit_node(*n.children[i], dst + 1);
+                emit(n.type == node::AND ? insn::AND : insn::OR, dst, dst, dst + 1);
+            }
+            break;
+        case node::NOT:
+            emit_node(*n.children[0], dst);
+            emit(insn::NOT, dst, dst);
+            break;
+        case node::CMP:
+            emit_leaf(n, dst);
+            break;
+        }
+    }
+
+    void emit_leaf(const node& n, uint8_t dst)
+    {
+        static const uint8_t COLUMNS[] = {
+            batch::TS, batch::LEN, batch::CAPLEN, batch::VERSION, batch::PROTO, batch::SPORT, batch::DPORT,
+        };
+
+        switch (n.field) {
+        case FIELD_PORT:
+            // either port equals, or neither does
+            emit_compare(n.op == insn::NE ? insn::EQ : n.op, batch::SPORT, dst, n.value);
+            emit_compare(n.op == insn::NE ? insn::EQ : n.op, batch::DPORT, dst + 1, n.value);
+            emit(insn::OR, dst, dst, dst + 1);
+            break;
+        case FIELD_SRC:
+        case FIELD_DST:
+            emit_address(n, n.field == FIELD_SRC ? batch::SRC0 : batch::DST0, dst);
+            break;
+        case FIELD_HOST:
+            emit_address(n, batch::SRC0, dst);
+            emit_address(n, batch::DST0, dst + 1);
+            emit(insn::OR, dst, dst, dst + 1);
+            break;
+        default:
+            emit_compare(n.op, COLUMNS[n.field], dst, n.value);
+            return;
+        }
+
+        if (n.op == insn::NE)
+            emit(insn::NOT, dst, dst);
+    }
+
+    std::vector<insn>* code_;
+    unsigned registers_;
+    bool overflow_;
+};
+
+/**
+ * Translate a predicate to a block index query that selects a superset of
+ * the blocks with matching packets.
+ */
+static bool narrow(const node& n, segment::index_query* query)
+{
+    segment::index_op op;
+    size_t mark = query->size();
+
+    memset(&op, 0, sizeof(op));
+
+    switch (n.type) {
+    case node::CMP:
+        if (n.op != insn::EQ)
+            return false;
+        op.code = segment::index_op::TERM;
+        if (is_address(n.field) && n.prefix == (n.version == 4 ? 32U : 128U)) {
+            op.t = segment::term::host(n.version, n.addr);
+        } else if ((n.field == FIELD_PORT || n.field == FIELD_SPORT || n.field == FIELD_DPORT) && n.value != 0) {
+            // port 0 of packets without ports is not indexed
+            op.t = segment::term::port(static_cast<uint16_t>(n.value));
+        } else if (n.field == FIELD_PROTO && n.value != 0) {
+            op.t = segment::term::protocol(static_cast<uint8_t>(n.value));
+        } else {
+            return false;
+        }
+        query->push_back(op);
+        return true;
+    case node::AND: {
+        size_t terms = 0;
+        op.code = segment::index_op::AND;
+        for (const auto& child : n.children) {
+            if (narrow(*child, query) && terms++ > 0)
+                query->push_back(op);
+        }
+        return terms > 0;
+    }
+    case node::OR:
+        op.code = segment::index_op::OR;
+        for (size_t i = 0; i < n.children.size(); i++) {
+            if (!narrow(*n.children[i], query)) {
+                query->resize(mark);
+                return false;
+            }
+            if (i > 0)
+                query->push_back(op);
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+// time range implied by the conjunctions on ts at the top
+static void bound(const node& n, uint64_t* begin_ts, uint64_t* end_ts)
+{
+    if (n.type == node::AND) {
+        for (const auto& child : n.children) {
+            bound(*child, begin_ts, end_ts);
+        }
+        return;
+    }
+    if (n.type != node::CMP || n.field != FIELD_TS)
+        return;
+
+    switch (n.op) {
+    case insn::EQ:
+        *begin_ts = std::max(*begin_ts, n.value);
+        *end_ts = std::min(*end_ts, n.value + 1);
+        break;
+    case insn::LT:
+        *end_ts = std::min(*end_ts, n.value);
+        break;
+    case insn::LE:
+        *end_ts = std::min(*end_ts, n.value + 1);
+        break;
+    case insn::GT:
+        *begin_ts = std::max(*begin_ts, n.value + 1);
+        break;
+    case insn::GE:
+        *begin_ts = std::max(*begin_ts, n.value);
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// Kernels, branch-free loops over a column to be vectorized by the compiler
+//
+
+template <typename T, typename F>
+static void compare(const T* __restrict__ column, T imm, uint8_t* __restrict__ out, size_t n, F f)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = -static_cast<uint8_t>(f(column[i], imm));
+    }
+}
+
+template <typename T>
+static void compare(insn::op_code code, const T* column, T imm, uint8_t* out, size_t n)
+{
+    switch (code) {
+    case insn::EQ:
+        compare(column, imm, out, n, std::equal_to<T>());
+        break;
+    case insn::NE:
+        compare(column, imm, out, n, std::not_equal_to<T>());
+        break;
+    case insn::LT:
+        compare(column, imm, out, n, std::less<T>());
+        break;
+    case insn::LE:
+        compare(column, imm, out, n, std::less_equal<T>());
+        break;
+    case insn::GT:
+        compare(column, imm, out, n, std::greater<T>());
+        break;
+    case insn::GE:
+        compare(column, imm, out, n, std::greater_equal<T>());
+        break;
+    default:
+        break;
+    }
+}
+
+static void mask_equal(const uint32_t* __restrict__ column, uint32_t mask, uint32_t imm,
+                       uint8_t* __restrict__ out, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = -static_cast<uint8_t>((column[i] & mask) == imm);
+    }
+}
+
+}  // namespace
+
+/**
+ * Compile a predicate.
+ *
+ * @param text      a predicate in the expression language.
+ * @param error     the reason of a failure to be filled, may be null.
+ * @return true on success, false otherwise.
+ */
+bool program::compile(const std::string& text, std::string* error)
+{
+    text_ = text;
+    code_.clear();
+    prefilter_.clear();
+    registers_ = 0;
+    begin_ts_ = 0;
+    end_ts_ = UINT64_MAX;
+
+    // an empty query matches everything
+    if (text.find_first_not_of(" \t\r\n") == std::string::npos) {
+        insn i;
+        memset(&i, 0, sizeof(i));
+        i.code = insn::SET;
+        code_.push_back(i);
+        registers_ = 1;
+        prefilter_.push_back(segment::index_op());
+        prefilter_.back().code = segment::index_op::ALL;
+        return true;
+    }
+
+    parser p(text);
+    node_ptr root = p.parse();
+    if (!root) {
+        if (error != nullptr)
+            *error = p.error();
+        return false;
+    }
+
+    compiler c;
+    if (!c.compile(*root, &code_)) {
+        if (error != nullptr)
+            *error = "query is too complex";
+        code_.clear();
+        return false;
+    }
+    registers_ = c.registers();
+
+    if (!narrow(*root, &prefilter_)) {
+        prefilter_.clear();
+        prefilter_.push_back(segment::index_op());
+        prefilter_.back().code = segment::index_op::ALL;
+    }
+    bound(*root, &begin_ts_, &end_ts_);
+
+    return true;
+}
+
+/**
+ * Evaluate the predicate over the rows of a batch.
+ *
+ * @param b         a batch, whose selected() is filled with the matching rows.
+ * @return the number of matching rows.
+ */
+size_t program::run(batch* b) const
+{
+    const size_t n = b->size_;
+    const size_t SIZE = batch::SIZE;
+
+    if (b->registers_.size() < registers_ * SIZE)
+        b->registers_.resize(registers_ * SIZE);
+
+    uint8_t* regs = b->registers_.data();
+
+    for (const auto& i : code_) {
+        // dst may be a, but the logical operations are elementwise
+        uint8_t* dst = regs + i.dst * SIZE;
+        const uint8_t* a = regs + i.a * SIZE;
+        const uint8_t* c = regs + i.b * SIZE;
+
+        switch (i.code) {
+        case insn::SET:
+            memset(dst, 0xff, n);
+            break;
+        case insn::MASK_EQ:
+            mask_equal(&b->columns_[i.column * SIZE], i.mask, static_cast<uint32_t>(i.imm), dst, n);
+            break;
+        case insn::AND:
+            for (size_t k = 0; k < n; k++) {
+                dst[k] = a[k] & c[k];
+            }
+            break;
+        case insn::OR:
+            for (size_t k = 0; k < n; k++) {
+                dst[k] = a[k] | c[k];
+            }
+            break;
+        case insn::NOT:
+            for (size_t k = 0; k < n; k++) {
+                dst[k] = ~a[k];
+            }
+            break;
+        default:
+            if (i.column == batch::TS)
+                compare<uint64_t>(i.code, b->ts_.data(), i.imm, dst, n);
+            else
+                compare<uint32_t>(i.code, &b->columns_[i.column * SIZE], static_cast<uint32_t>(i.imm), dst, n);
+            break;
+        }
+    }
+
+    // gather the matching rows without a branch per row
+    uint16_t* selected = b->selected_.data();
+    size_t matched = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        selected[matched] = static_cast<uint16_t>(k);
+        matched += regs[k] & 1;
+    }
+
+    return matched;
+}
+
+/**
+ * Disassemble the program, an instruction a line.
+ *
+ * @return the instructions, e.g. "r1 = (dst0 & 0xffffff) == 0xa".
+ */
+std::vector<std::string> program::listing() const
+{
+    static const char* COLUMNS[] = {
+        "len", "caplen", "version", "proto", "sport", "dport",
+        "src0", "src1", "src2", "src3", "dst0", "dst1", "dst2", "dst3", "ts",
+    };
+    static const char* OPS[] = { "", "==", "!=", "<", "<=", ">", ">=" };
+    std::vector<std::string> lines;
+    char line[128];
+
+    for (const auto& i : code_) {
+        switch (i.code) {
+        case insn::SET:
+            snprintf(line, sizeof(line), "r%u = all", i.dst);
+            break;
+        case insn::MASK_EQ:
+            snprintf(line, sizeof(line), "r%u = (%s & 0x%x) == 0x%llx", i.dst, COLUMNS[i.column], i.mask,
+                     static_cast<unsigned long long>(i.imm));
+            break;
+        case insn::AND:
+            snprintf(line, sizeof(line), "r%u = r%u & r%u", i.dst, i.a, i.b);
+            break;
+        case insn::OR:
+            snprintf(line, sizeof(line), "r%u = r%u | r%u", i.dst, i.a, i.b);
+            break;
+        case insn::NOT:
+            snprintf(line, sizeof(line), "r%u = ~r%u", i.dst, i.a);
+            break;
+        default:
+            snprintf(line, sizeof(line), "r%u = %s %s %llu", i.dst, COLUMNS[i.column], OPS[i.code],
+                     static_cast<unsigned long long>(i.imm));
+            break;
+        }
+        lines.push_back(line);
+    }
+
+    return lines;
+}
+
+/**
+ * The compiled code on one line: queries that only differ in spelling, e.g.
+ * "and" and "&&", or in whitespace, compile to the same code.
+ *
+ * @return the code.
+ */
+std::string program::normalized() const
+{
+    std::string text;
+
+    for (const auto& line : listing()) {
+        if (!text.empty())
+            text += "; ";
+        text += line;
+    }
+
+    return text;
+}
+
+}  // namespace query
+
+}  // namespace pca
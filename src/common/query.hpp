@@ -0,0 +1,218 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search query API documentation.
+ */
+
+/**
+ * @file query.hpp
+ *
+ * @brief      Xabyss's Search query library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block_index.hpp"
+#include "packet.hpp"
+
+namespace pca {
+
+namespace query {
+
+/**
+ * Decoded packets in struct-of-arrays form, one array per field, so that a
+ * comparison runs over a whole column at once.
+ *
+ * IP addresses are split into four 32-bit words in memory order, an IPv4
+ * address being the first word followed by zeros.
+ */
+class batch {
+public:
+    constexpr static const size_t SIZE = 1024;
+
+    enum column : uint8_t {
+        LEN,
+        CAPLEN,
+        VERSION,
+        PROTO,
+        SPORT,
+        DPORT,
+        SRC0, SRC1, SRC2, SRC3,
+        DST0, DST1, DST2, DST3,
+        COLUMNS,
+        TS = COLUMNS,           // 64-bit, stored apart
+    };
+
+    explicit batch(int linktype = LINKTYPE_ETHERNET);
+
+    void clear();
+    void add(const packet& pkt);
+
+    size_t size() const;
+    bool full() const;
+    int linktype() const;
+    const packet& at(size_t i) const;
+    const uint16_t* selected() const;
+
+private:
+    friend class program;
+
+    int linktype_;
+    size_t size_;
+    std::vector<packet> pkts_;
+    std::vector<uint64_t> ts_;
+    std::vector<uint32_t> columns_;     // COLUMNS x SIZE
+    std::vector<uint8_t> registers_;    // lane masks of the program, 0 or 0xff
+    std::vector<uint16_t> selected_;    // matching rows of the last run
+};
+
+/**
+ * A register machine instruction. A register holds one lane mask per row of
+ * a batch; comparisons fill a register from a column and an immediate, and
+ * logical operations combine registers.
+ */
+struct insn {
+    enum op_code : uint8_t {
+        SET,                    // dst = all rows
+        EQ,                     // dst = column == imm
+        NE,
+        LT,
+        LE,
+        GT,
+        GE,
+        MASK_EQ,                // dst = (column & mask) == imm
+        AND,                    // dst = a & b
+        OR,                     // dst = a | b
+        NOT,                    // dst = ~a
+    };
+
+    op_code code;
+    uint8_t column;
+    uint8_t dst;
+    uint8_t a;
+    uint8_t b;
+    uint32_t mask;
+    uint64_t imm;
+};
+
+/**
+ * A compiled search predicate.
+ *
+ * The expression language:
+ *
+ *     expr    := term { ("or" | "||") term }
+ *     term    := factor { ("and" | "&&") factor }
+ *     factor  := ("not" | "!") factor | "(" expr ")" | "tcp" | "udp" | "icmp"
+ *              | field [ op ] value
+ *     field   := ts | len | caplen | version | proto | sport | dport | port
+ *              | src | dst | host
+ *     op      := "==" | "=" | "!=" | "<" | "<=" | ">" | ">="
+ *
+ * The operator defaults to "==". ts is in seconds since the epoch, proto
+ * takes a number or tcp/udp/icmp, and src, dst and host take an IPv4/IPv6
+ * address or network (10.0.0.0/8) with "==" or "!=" only. port and host
+ * match either side of the packet, e.g. "host 10.0.0.1 and port 443 and
+ * not udp".
+ */
+class program {
+public:
+    constexpr static const unsigned MAX_REGISTERS = 16;
+
+    bool compile(const std::string& text, std::string* error = nullptr);
+
+    size_t run(batch* b) const;
+
+    std::vector<std::string> listing() const;
+    std::string normalized() const;
+
+    const std::string& text() const;
+    const std::vector<insn>& code() const;
+    unsigned registers() const;
+    const segment::index_query& prefilter() const;
+    bool indexed() const;
+    uint64_t begin_ts() const;
+    uint64_t end_ts() const;
+
+private:
+    std::string text_;
+    std::vector<insn> code_;
+    unsigned registers_ = 0;
+    segment::index_query prefilter_;
+    uint64_t begin_ts_ = 0;
+    uint64_t end_ts_ = UINT64_MAX;
+};
+
+inline size_t batch::size() const
+{
+    return size_;
+}
+
+inline bool batch::full() const
+{
+    return size_ == SIZE;
+}
+
+inline int batch::linktype() const
+{
+    return linktype_;
+}
+
+inline const packet& batch::at(size_t i) const
+{
+    return pkts_[i];
+}
+
+inline const uint16_t* batch::selected() const
+{
+    return selected_.data();
+}
+
+inline const std::string& program::text() const
+{
+    return text_;
+}
+
+inline const std::vector<insn>& program::code() const
+{
+    return code_;
+}
+
+inline unsigned program::registers() const
+{
+    return registers_;
+}
+
+inline const segment::index_query& program::prefilter() const
+{
+    return prefilter_;
+}
+
+inline bool program::indexed() const
+{
+    return !(prefilter_.size() == 1 && prefilter_[0].code == segment::index_op::ALL);
+}
+
+inline uint64_t program::begin_ts() const
+{
+    return begin_ts_;
+}
+
+inline uint64_t program::end_ts() const
+{
+    return end_ts_;
+}
+
+}  // namespace query
+
+}  // namespace pca
@@ -0,0 +1,228 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap replay API documentation.
+ */
+
+/**
+ * @file replay.cpp
+ *
+ * @brief      Xabyss's Pcap replay library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "logger.hpp"
+#include "pcap_file.hpp"
+#include "replay.hpp"
+#include "utils.hpp"
+
+namespace pca {
+
+namespace replay {
+
+using pca::utils::ends_with;
+using pca::utils::is_equal;
+using pca::utils::is_nocase_equal;
+
+// don't sleep for less than this, the batch is sent a bit early instead
+constexpr static const auto PACING_SLACK = std::chrono::microseconds(200);
+
+/**
+ * Parse a replay speed.
+ *
+ * @param s         "max", "original" or a multiplier such as "4" or "4x".
+ * @param speed     a parsed speed.
+ * @return true on success, false otherwise.
+ */
+bool parse_speed(const std::string& s, double* speed)
+{
+    if (is_nocase_equal(s.c_str(), "max")) {
+        *speed = SPEED_MAX;
+        return true;
+    }
+    if (is_nocase_equal(s.c_str(), "original")) {
+        *speed = SPEED_ORIGINAL;
+        return true;
+    }
+
+    char* end = nullptr;
+    double v = strtod(s.c_str(), &end);
+    if (end == s.c_str() || v < 0)
+        return false;
+    if (*end == 'x' || *end == 'X')
+        end++;
+    if (*end != '\0')
+        return false;
+
+    *speed = v;
+
+    return true;
+}
+
+static bool scan_dir(const std::string& path, std::vector<std::string>* files)
+{
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        XA_LOGGER(error) << "can't open " << path;
+        return false;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != nullptr) {
+        if (is_equal(ent->d_name, ".") || is_equal(ent->d_name, ".."))
+            continue;
+
+        if (ent->d_type == DT_DIR) {
+            scan_dir(path + "/" + ent->d_name, files);
+        } else if (ends_with(ent->d_name, ".pcap") || ends_with(ent->d_name, ".cap")) {
+            files->push_back(path + "/" + ent->d_name);
+        }
+    }
+    closedir(dir);
+
+    return true;
+}
+
+/**
+ * List the pcap files to replay.
+ *
+ * @param path      a pcap file or a directory of pcap files, searched recursively.
+ * @param files     filenames in replay order (sorted by path).
+ * @return true on success, false otherwise.
+ */
+bool list_files(const std::string& path, std::vector<std::string>* files)
+{
+    struct stat st;
+
+    files->clear();
+    if (stat(path.c_str(), &st) < 0) {
+        XA_LOGGER(error) << "can't find " << path;
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        files->push_back(path);
+        return true;
+    }
+
+    if (!scan_dir(path, files))
+        return false;
+
+    std::sort(files->begin(), files->end());
+
+    return true;
+}
+
+player::player(pipeline& pipe, double speed)
+    : pipeline_(pipe)
+    , speed_(speed)
+    , stopped_(false)
+    , paced_(false)
+    , base_ts_(0)
+    , files_(0)
+    , packets_(0)
+    , bytes_(0)
+{
+}
+
+/**
+ * Replay a pcap file or a directory of pcap files.
+ *
+ * @param path      a pcap file or a directory.
+ * @return true on success, false otherwise.
+ */
+bool player::play(const std::string& path)
+{
+    std::vector<std::string> files;
+
+    if (!list_files(path, &files))
+        return false;
+
+    for (const auto& filename : files) {
+        if (stopped_)
+            break;
+        if (play_file(filename))
+            files_++;
+    }
+
+    return true;
+}
+
+bool player::play_file(const std::string& filename)
+{
+    pcap::reader reader;
+
+    if (!reader.open(filename))
+        return false;
+
+    if (reader.linktype() != pipeline_.config().linktype) {
+        XA_LOGGER(warning) << "skip " << filename << ": linktype " << reader.linktype()
+            << " differs from " << pipeline_.config().linktype;
+        return false;
+    }
+
+    packet batch[rss::dispatcher::BATCH_SIZE];
+    size_t n = 0;
+    packet pkt;
+    auto now = std::chrono::steady_clock::now();
+
+    auto send = [&]() {
+        // replay is lossless, the pipeline applies backpressure
+        pipeline_.feed(batch, n, true);
+        n = 0;
+    };
+
+    while (!stopped_ && reader.next(&pkt)) {
+        if (speed_ > 0) {
+            if (!paced_) {
+                paced_ = true;
+                base_ts_ = pkt.ts;
+                base_clock_ = std::chrono::steady_clock::now();
+            }
+
+            uint64_t delta = (pkt.ts > base_ts_) ? pkt.ts - base_ts_ : 0;
+            auto due = base_clock_ + std::chrono::nanoseconds(static_cast<uint64_t>(delta / speed_));
+
+            if (due > now + PACING_SLACK) {
+                now = std::chrono::steady_clock::now();
+                if (due > now + PACING_SLACK) {
+                    if (n > 0)
+                        send();
+                    std::this_thread::sleep_until(due);
+                    now = std::chrono::steady_clock::now();
+                }
+            }
+        }
+
+        batch[n++] = pkt;
+        packets_++;
+        bytes_ += pkt.caplen;
+
+        if (n == rss::dispatcher::BATCH_SIZE)
+            send();
+    }
+
+    if (n > 0)
+        send();
+
+    // the packets point into the mapping of the reader
+    pipeline_.flush();
+
+    return true;
+}
+
+}  // namespace replay
+
+}  // namespace pca
@@ -0,0 +1,93 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Pcap replay API documentation.
+ */
+
+/**
+ * @file replay.hpp
+ *
+ * @brief      Xabyss's Pcap replay library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pipeline.hpp"
+
+namespace pca {
+
+namespace replay {
+
+// replay speed: 0 as fast as possible, 1 original timing, N N times faster
+constexpr static const double SPEED_MAX = 0.0;
+constexpr static const double SPEED_ORIGINAL = 1.0;
+
+bool parse_speed(const std::string& s, double* speed);
+bool list_files(const std::string& path, std::vector<std::string>* files);
+
+/**
+ * Feeds stored pcap files through a pipeline.
+ */
+class player {
+public:
+    player(pipeline& pipe, double speed);
+
+    bool play(const std::string& path);
+    void stop();
+
+    uint64_t files() const;
+    uint64_t packets() const;
+    uint64_t bytes() const;
+
+private:
+    bool play_file(const std::string& filename);
+
+    pipeline& pipeline_;
+    double speed_;
+    std::atomic<bool> stopped_;
+
+    // pacing keeps one time base across the files of a directory
+    bool paced_;
+    uint64_t base_ts_;
+    std::chrono::steady_clock::time_point base_clock_;
+
+    uint64_t files_;
+    uint64_t packets_;
+    uint64_t bytes_;
+};
+
+inline void player::stop()
+{
+    stopped_ = true;
+}
+
+inline uint64_t player::files() const
+{
+    return files_;
+}
+
+inline uint64_t player::packets() const
+{
+    return packets_;
+}
+
+inline uint64_t player::bytes() const
+{
+    return bytes_;
+}
+
+}  // namespace replay
+
+}  // namespace pca
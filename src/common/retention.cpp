@@ -0,0 +1,412 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Retention manager API documentation.
+ */
+
+/**
+ * @file retention.cpp
+ *
+ * @brief      Xabyss's Retention manager library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "block_index.hpp"
+#include "logger.hpp"
+#include "pcap_file.hpp"
+#include "retention.hpp"
+
+namespace pca {
+
+retention::retention(const retention_config& config)
+    : config_(config)
+    , bytes_(0)
+    , newest_ts_(0)
+    , max_span_ns_(0)
+    , evicted_(0)
+    , loaded_(false)
+    , running_(false)
+{
+    if (config_.batch_size == 0)
+        config_.batch_size = 1;
+}
+
+retention::~retention()
+{
+    stop();
+}
+
+/**
+ * Load the catalog file and launch the background thread, which fills the
+ * catalog first if it's empty.
+ */
+void retention::start()
+{
+    if (running_)
+        return;
+
+    if (!config_.catalog_path.empty()) {
+        std::vector<segment::info> segments;
+
+        if (file_.open(config_.catalog_path, config_.data_path, &segments)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            for (const auto& info : segments) {
+                insert(info);
+            }
+            loaded_ = file_.records() > 0;
+            XA_LOGGER(info) << "retention: loaded " << segments.size() << " segments from "
+                            << config_.catalog_path;
+        }
+    }
+
+    running_ = true;
+    thread_ = std::thread(&retention::run, this);
+#ifdef DEBUG
+    pthread_setname_np(thread_.native_handle(), "retention");
+#endif
+}
+
+void retention::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    wait_cv_.notify_all();
+    thread_.join();
+    file_.close();
+}
+
+// with mutex_ held
+bool retention::insert(const segment::info& info)
+{
+    if (!catalog_.insert(info).second)
+        return false;
+
+    bytes_ += info.bytes;
+    if (info.last_ts > newest_ts_)
+        newest_ts_ = info.last_ts;
+    if (info.last_ts - info.first_ts > max_span_ns_)
+        max_span_ns_ = info.last_ts - info.first_ts;
+
+    return true;
+}
+
+/**
+ * Add a sealed segment to the catalog, it's cheap enough to be called from
+ * the writers.
+ *
+ * @param info      a sealed segment.
+ */
+void retention::add(const segment::info& info)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // recorded before an eviction of it can be
+    if (insert(info) && file_.is_open())
+        file_.append(info);
+}
+
+/**
+ * Fill in a segment found on disk if it was sealed: its index is written
+ * once the pcap file is complete, so a segment still being written, or cut
+ * short by a crash before that, has none. The last packet is read from the
+ * last block the index points at, and must end the file.
+ */
+static bool read_sealed(const std::string& path, segment::info* info)
+{
+    std::vector<segment::index_entry> index;
+    pcap::reader reader;
+    packet pkt;
+
+    if (!segment::load_index(path, &index) || index.empty() || !reader.open(path)
+            || !reader.seek(index.back().offset))
+        return false;
+
+    info->last_ts = info->first_ts;
+    while (reader.next(&pkt)) {
+        info->last_ts = std::max(info->last_ts, pkt.ts);
+    }
+    if (reader.offset() != reader.size())
+        return false;
+
+    info->path = path;
+    info->bytes = reader.size();
+    info->flags = segment::FLAG_INDEX;
+    if (access(segment::filter_path_of(path).c_str(), F_OK) == 0)
+        info->flags |= segment::FLAG_FILTER;
+
+    return true;
+}
+
+static bool scan_hour(const std::string& dir, std::vector<segment::info>* segments)
+{
+    DIR* dp = opendir(dir.c_str());
+    if (dp == nullptr)
+        return false;
+
+    struct dirent* ent;
+    while ((ent = readdir(dp)) != nullptr) {
+        segment::info info = segment::info();
+        std::string path = dir + "/" + ent->d_name;
+
+        if (!segment::parse_path(path, &info.first_ts, &info.worker))
+            continue;
+        if (!read_sealed(path, &info)) {
+            XA_LOGGER(warning) << "left out " << path << ", not sealed";
+            continue;
+        }
+        segments->push_back(info);
+    }
+    closedir(dp);
+
+    return true;
+}
+
+/**
+ * Fill the catalog from the segments found in the data directory.
+ *
+ * @return true on success, false if the directory can't be read.
+ */
+bool retention::scan()
+{
+    return scan(std::string());
+}
+
+/**
+ * Add the segments found in the hour directories from the given one on.
+ */
+bool retention::scan(const std::string& from_hour)
+{
+    std::vector<segment::info> segments;
+
+    DIR* dp = opendir(config_.data_path.c_str());
+    if (dp == nullptr) {
+        XA_LOGGER(error) << "can't open " << config_.data_path << ": " << strerror(errno);
+        return false;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dp)) != nullptr) {
+        if (ent->d_name[0] != '.' && ent->d_name >= from_hour)
+            scan_hour(config_.data_path + "/" + ent->d_name, &segments);
+    }
+    closedir(dp);
+
+    for (const auto& info : segments) {
+        add(info);
+    }
+
+    return true;
+}
+
+uint64_t retention::free_bytes() const
+{
+    struct statvfs st;
+
+    if (statvfs(config_.data_path.c_str(), &st) < 0)
+        return UINT64_MAX;
+
+    return static_cast<uint64_t>(st.f_bavail) * st.f_frsize;
+}
+
+void retention::remove(const segment::info& info)
+{
+    if (unlink(info.path.c_str()) < 0 && errno != ENOENT)
+        XA_LOGGER(error) << "can't delete " << info.path << ": " << strerror(errno);
+    unlink(segment::index_path_of(info.path).c_str());
+    unlink(segment::filter_path_of(info.path).c_str());
+
+    // the hour directory goes with its last segment
+    rmdir(info.path.substr(0, info.path.rfind('/')).c_str());
+}
+
+/**
+ * Take a batch of the oldest segments over the limits out of the catalog, and
+ * delete them.
+ */
+size_t retention::evict_batch()
+{
+    std::vector<segment::info> victims;
+    uint64_t need_free = 0;
+
+    if (config_.min_free_bytes > 0) {
+        uint64_t free = free_bytes();
+        if (free < config_.min_free_bytes)
+            need_free = config_.min_free_bytes - free;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t freed = 0;
+
+        while (!catalog_.empty() && victims.size() < config_.batch_size) {
+            const segment::info& oldest = *catalog_.begin();
+
+            bool over = (config_.max_bytes > 0 && bytes_ > config_.max_bytes)
+                || (config_.max_age_ns > 0 && newest_ts_ - oldest.last_ts > config_.max_age_ns)
+                || freed < need_free;
+            if (!over)
+                break;
+
+            freed += oldest.bytes;
+            bytes_ -= oldest.bytes;
+            victims.push_back(oldest);
+            catalog_.erase(catalog_.begin());
+        }
+    }
+
+    if (!victims.empty() && file_.is_open())
+        file_.remove(victims);
+
+    // the files are deleted out of the lock, not to hold up the writers
+    for (const auto& info : victims) {
+        remove(info);
+        if (evicted_fn_)
+            evicted_fn_(info);
+    }
+    evicted_.fetch_add(victims.size(), std::memory_order_relaxed);
+
+    return victims.size();
+}
+
+/**
+ * Delete segments until the data directory is within its limits.
+ *
+ * @return the number of segments deleted.
+ */
+size_t retention::enforce()
+{
+    size_t total = 0;
+
+    for (;;) {
+        size_t n = evict_batch();
+        total += n;
+        if (n < config_.batch_size)
+            break;
+
+        // throttle, not to starve the writers of disk bandwidth
+        if (running_ && !wait(config_.batch_interval_ms))
+            break;
+    }
+
+    if (total > 0)
+        XA_LOGGER(info) << "retention: deleted " << total << " segments";
+
+    return total;
+}
+
+/**
+ * Find the segments that overlap a time range.
+ *
+ * @param begin_ts  the beginning of the range.
+ * @param end_ts    the end of the range (exclusive).
+ * @return segments ordered by their first timestamp.
+ */
+std::vector<segment::info> retention::find(uint64_t begin_ts, uint64_t end_ts) const
+{
+    std::vector<segment::info> found;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // no segment spans more than max_span_ns_, so start looking from there
+    segment::info key = segment::info();
+    key.first_ts = begin_ts > max_span_ns_ ? begin_ts - max_span_ns_ : 0;
+
+    for (auto it = catalog_.lower_bound(key); it != catalog_.end() && it->first_ts < end_ts; ++it) {
+        if (it->last_ts >= begin_ts)
+            found.push_back(*it);
+    }
+
+    return found;
+}
+
+uint64_t retention::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return bytes_;
+}
+
+size_t retention::segments() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return catalog_.size();
+}
+
+/**
+ * Sleep unless stopped.
+ *
+ * @return true if still running, false otherwise.
+ */
+bool retention::wait(unsigned ms)
+{
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+
+    wait_cv_.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return !running_; });
+
+    return running_;
+}
+
+/**
+ * Rewrite the catalog file once it's mostly made of deleted segments. The
+ * segments are taken under the lock, along with the count of the records
+ * they stand for, and written out of it.
+ */
+void retention::compact()
+{
+    std::vector<segment::info> live;
+    uint64_t records;
+
+    if (!file_.is_open() || file_.deleted() < 1024 || file_.deleted() < file_.records() / 2)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live.assign(catalog_.begin(), catalog_.end());
+        records = file_.records();
+    }
+
+    file_.compact(live, records);
+}
+
+void retention::run()
+{
+    if (loaded_) {
+        // segments sealed after the last record, e.g. before a crash
+        uint64_t newest_first_ts = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!catalog_.empty())
+                newest_first_ts = catalog_.rbegin()->first_ts;
+        }
+        scan(segment::hour_of(newest_first_ts));
+    } else if (segments() == 0) {
+        scan();
+    }
+
+    do {
+        enforce();
+        compact();
+    } while (wait(config_.check_interval_ms));
+}
+
+}  // namespace pca
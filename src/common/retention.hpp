@@ -0,0 +1,138 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Retention manager API documentation.
+ */
+
+/**
+ * @file retention.hpp
+ *
+ * @brief      Xabyss's Retention manager library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catalog.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+struct retention_config {
+    std::string data_path;
+    // the catalog is not kept on disk if the path is empty
+    std::string catalog_path;
+
+    // a limit of 0 is not enforced
+    uint64_t max_bytes = 0;
+    uint64_t max_age_ns = 0;
+    uint64_t min_free_bytes = 0;
+
+    // segments deleted at a time, and the pause between the batches
+    size_t batch_size = 64;
+    unsigned batch_interval_ms = 100;
+    unsigned check_interval_ms = 1000;
+};
+
+/**
+ * Retention manager: keeps a catalog of the stored segments in memory and
+ * deletes the oldest ones in the background when the data directory is over
+ * its size, age or free space limits.
+ *
+ * The age of a segment is measured against the newest stored packet, so that
+ * replayed traffic ages alike.
+ *
+ * With a catalog file, the catalog is loaded at start and only the directories
+ * of the last hour it knows are scanned for segments it missed. A scan takes
+ * only sealed segments, those with their index written.
+ */
+class retention {
+public:
+    using evicted_fn = std::function<void(const segment::info&)>;
+
+    explicit retention(const retention_config& config);
+    ~retention();
+
+    retention(const retention&) = delete;
+    retention& operator=(const retention&) = delete;
+
+    void on_evicted(evicted_fn fn);
+
+    void start();
+    void stop();
+
+    void add(const segment::info& info);
+    bool scan();
+    size_t enforce();
+
+    std::vector<segment::info> find(uint64_t begin_ts, uint64_t end_ts) const;
+
+    const retention_config& config() const;
+    uint64_t bytes() const;
+    size_t segments() const;
+    uint64_t evicted() const;
+
+private:
+    struct order {
+        bool operator()(const segment::info& a, const segment::info& b) const {
+            return a.first_ts < b.first_ts || (a.first_ts == b.first_ts && a.path < b.path);
+        }
+    };
+
+    bool insert(const segment::info& info);
+    bool scan(const std::string& from_hour);
+    void compact();
+    uint64_t free_bytes() const;
+    size_t evict_batch();
+    void remove(const segment::info& info);
+    bool wait(unsigned ms);
+    void run();
+
+    retention_config config_;
+    mutable std::mutex mutex_;
+    std::set<segment::info, order> catalog_;
+    uint64_t bytes_;
+    uint64_t newest_ts_;
+    uint64_t max_span_ns_;
+    std::atomic<uint64_t> evicted_;
+    evicted_fn evicted_fn_;
+    segment::catalog file_;
+    bool loaded_;
+
+    std::thread thread_;
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+    std::atomic<bool> running_;
+};
+
+inline void retention::on_evicted(evicted_fn fn)
+{
+    evicted_fn_ = fn;
+}
+
+inline const retention_config& retention::config() const
+{
+    return config_;
+}
+
+inline uint64_t retention::evicted() const
+{
+    return evicted_.load(std::memory_order_relaxed);
+}
+
+}  // namespace pca
@@ -16,6 +16,10 @@
  * @details    This header file must be included in any xabyss's probe applications.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 
 #include "rpc_base.hpp"
@@ -62,6 +66,38 @@ struct rpc_base::rpc_handler {
         return true;
     }
 
+    // as is_valid_req(), picking the members out on the way
+    static bool is_valid_req(const json::value& req, const json::value** method,
+                             const json::value** params, const json::value** id)
+    {
+        const json::value* jsonrpc = nullptr;
+
+        if (!req.is_object())
+            return false;
+
+        for (const json::value& member : req) {
+            if (member.key_equals("jsonrpc", 7))
+                jsonrpc = &member;
+            else if (member.key_equals("method", 6))
+                *method = &member;
+            else if (member.key_equals("params", 6))
+                *params = &member;
+            else if (member.key_equals("id", 2))
+                *id = &member;
+            else
+                return false;
+        }
+
+        if (jsonrpc == nullptr || *method == nullptr || *id == nullptr)
+            return false;
+        if (!jsonrpc->is_string() || !jsonrpc->equals("2.0") || !(*method)->is_string())
+            return false;
+        if (*params != nullptr && !(*params)->is_array() && !(*params)->is_object())
+            return false;
+
+        return true;
+    }
+
     static void set_response_error(int code, std::string msg, Json::Value* res)
     {
         (*res)["error"] = Json::Value(Json::objectValue);
@@ -100,92 +136,477 @@ struct rpc_base::rpc_handler {
         return code;
     }
 
-    void operator()(http_server::request const &request, http_server::response &response)
+    // the calls run at once, their responses in the order of the calls
+    int serve_batch(const Json::Value& reqs, Json::Value* res)
     {
-        std::string path = destination(request);
-        if (path == "/test" && method(request) == "GET") {
-            response = http_server::response::stock_reply(http_server::response::ok, "Testing 1,2,3");
-            return;
+        size_t n = reqs.size();
+
+        if (n > server->max_batch_size_) {
+            set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Batch too large", res);
+            return 400;
         }
 
-        if (path != "/rpc") {
-            response = http_server::response::stock_reply(http_server::response::not_found, "not found");
-            return;
+        std::vector<Json::Value> results(n, Json::Value(Json::objectValue));
+        std::vector<int> codes(n, 200);
+        auto call = [&](size_t i) {
+            const Json::Value& item_req = reqs[static_cast<Json::ArrayIndex>(i)];
+
+            if (is_valid_req(item_req)) {
+                codes[i] = serve(item_req, &results[i]);
+            } else {
+                set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Invalid Request", &results[i]);
+                codes[i] = 400;
+            }
+        };
+
+        if (server->batch_pool_ && n > 1) {
+            server->batch_pool_->for_each(n, server->batch_concurrency_, call);
+        } else {
+            for (size_t i = 0; i < n; i++) {
+                call(i);
+            }
         }
 
-        if (method(request) == "OPTIONS") {
-            response = http_server::response::stock_reply(http_server::response::ok, "");
-            http_server::response_header header;
+        int code = 200;
+        *res = Json::Value(Json::arrayValue);
+        for (size_t i = 0; i < n; i++) {
+            code = std::max(code, codes[i]);
+            res->append(std::move(results[i]));
+        }
 
-            header = { "Content-Type", "application/json" };
-            response.headers.push_back(header);
-            header = { "Allow", "GET,POST,OPTIONS" };
-            response.headers.push_back(header);
-            if (server->allow_cors()) {
-                header = { "Access-Control-Allow-Origin", "*" };
-                response.headers.push_back(header);
-                header = { "Access-Control-Allow-Methods", "GET,POST,OPTIONS" };
-                response.headers.push_back(header);
-
-                for (const auto& h : request.headers) {
-                    if (h.name == "Access-Control-Request-Headers") {
-                        header = { "Access-Control-Allow-Headers", h.value };
-                        response.headers.push_back(header);
-                    }
-                }
+        return code;
+    }
+
+    /**
+     * Serve a call to a fast method without going through Json::Value: the
+     * request is parsed or decoded into an arena kept by the thread and the
+     * response written into the caller's buffer, so nothing is allocated once
+     * warmed up.
+     *
+     * @param req       the request, parsed.
+     * @param code      the HTTP status.
+     * @param format    the encoding of the response.
+     * @param out       the buffer the response body is appended to.
+     * @return true if served, false for the Json::Value path to take it.
+     */
+    bool serve_fast(const json::value& req, int* code, json::format format, std::string* out)
+    {
+        static thread_local std::string text;
+        static thread_local json::parser parser;
+        static const json::value no_params = json::value();
+        const json::value *method = nullptr, *params = nullptr, *id = nullptr;
+
+        if (!is_valid_req(req, &method, &params, &id))
+            return false;
+
+        const method_table::method* m = server->methods_.find(method->text, method->len);
+        if (m == nullptr || !m->fast)
+            return false;
+
+        if (params == nullptr)
+            params = &no_params;
+
+        // fast methods write JSON, read back to be encoded otherwise
+        text.clear();
+        request_context ctx;
+        ctx.set_timeout(m->info.timeout_ms);
+        size_t start = out->size();
+        json::writer writer(format == json::FORMAT_JSON ? out : &text);
+        std::string error;
+        bool ok = true;
+
+        writer.begin_object();
+        writer.key("jsonrpc").string("2.0");
+        writer.key("id").write(*id);
+        if (!m->info.check(*params, &error)) {
+            server->serve_error(rpc_base::ERROR_INVALID_PARAMS, error.c_str(), &writer);
+            *code = http_status_from_error_code(rpc_base::ERROR_INVALID_PARAMS);
+        } else if ((ok = m->fast(*params, &writer, &ctx))) {
+            *code = 200;
+        } else {
+            // the status of the error the handler wrote, as on the Json::Value path
+            *code = http_status_from_error_code(writer.error_code() != 0 ? writer.error_code()
+                                                : rpc_base::ERROR_INTERNAL_ERROR);
+        }
+        writer.end_object();
+
+        // only a handler giving up may have left its response unfinished;
+        // the parser decodes in place, so JSON is checked on a copy
+        const json::value* written = nullptr;
+        if (format == json::FORMAT_JSON) {
+            if (!ok)
+                text.assign(*out, start, std::string::npos);
+            if (ok || parser.parse(&text[0], text.size()) != nullptr) {
+                *out += '\n';
+                return true;
             }
+            out->resize(start);
+        } else if ((written = parser.parse(&text[0], text.size())) != nullptr) {
+            json::encode(format, *written, out);
+            return true;
+        }
 
-            return;
-        } else if (method(request) == "POST") {
-            int code;
-            Json::Value json_req, json_res;
+        Json::Value json_res;
+        set_response_error(rpc_base::ERROR_INTERNAL_ERROR, "Invalid Response", &json_res);
+        json::convert(*id, &json_res["id"]);
+        *code = http_status_from_error_code(rpc_base::ERROR_INTERNAL_ERROR);
+        if (format == json::FORMAT_JSON)
+            *out += Json::FastWriter().write(json_res);
+        else
+            json::encode(format, json_res, out);
+
+        return true;
+    }
+
+    /**
+     * Serve a call to a streaming method by streaming its result: the
+     * response goes out as {"jsonrpc":"2.0","id":...,"result":[ and the
+     * items as they are appended, closed by ]} when the handler is done.
+     *
+     * A handler giving up before the first chunk is out answers its error
+     * as usual, one giving up later cuts the response short.
+     *
+     * @param req       the request, parsed.
+     * @param res       the response to stream.
+     * @return true if streamed, false for the Json::Value path to take it.
+     */
+    bool serve_stream(const json::value& req, http::response* res)
+    {
+        static const json::value no_params = json::value();
+        const json::value *method = nullptr, *params = nullptr, *id = nullptr;
+        std::string error;
+
+        if (!is_valid_req(req, &method, &params, &id))
+            return false;
+
+        const method_table::method* m = server->methods_.find(method->text, method->len);
+        if (m == nullptr || !m->stream || !m->info.check(params != nullptr ? *params : no_params, &error))
+            return false;
+
+        // the request is gone by the time the result streams
+        Json::Value json_params;
+        std::string id_text, head;
+        if (params != nullptr)
+            json::convert(*params, &json_params);
+        json::writer(&id_text).write(*id);
+        head = "{\"jsonrpc\":\"2.0\",\"id\":" + id_text + ",\"result\":[";
+
+        rpc_base* s = server;
+        res->set_stream([s, m, json_params, id_text, head](http::stream* out, http::response* res) {
+            request_context ctx;
+            result_stream result(out);
+            bool ok;
+
+            ctx.set_timeout(m->info.timeout_ms);
+            result.set_deadline(ctx.deadline());
+            if (!out->write(head))
+                return false;
+            // out of dispatch(), a throwing handler fails here alike
+            try {
+                ok = m->stream(json_params, &result, &ctx);
+            } catch (const std::exception&) {
+                ok = false;
+            }
+            if (ok)
+                return out->write("]}\n", 3);
+
+            if (result.error_code() == 0 && result.expired())
+                result.fail(rpc_base::ERROR_SERVER_ERROR_START, "Timed out");
+            int code = result.error_code() != 0 ? result.error_code() : rpc_base::ERROR_INTERNAL_ERROR;
+            json::writer writer(&res->text);
+            res->text.clear();
+            writer.begin_object();
+            writer.key("jsonrpc").string("2.0");
+            writer.key("id").raw(id_text.data(), id_text.size());
+            s->serve_error(code, result.error_code() != 0 ? result.error_message().c_str() : "Internal Error",
+                           &writer);
+            writer.end_object();
+            res->text += '\n';
+            res->set_body(res->text);
+            res->status = http_status_from_error_code(code);
+
+            return false;
+        });
+
+        return true;
+    }
+
+    /**
+     * Serve the body of a request, a call or a batch of them, on the fast
+     * path if it can be.
+     *
+     * @param text      the request body.
+     * @param n         its length.
+     * @param in        the encoding of the body.
+     * @param format    the encoding of the response.
+     * @param out       the buffer the response body is appended to.
+     * @param res       the response to stream the result of a streaming
+     *                  method to, nullptr to collect it instead.
+     * @return the HTTP status.
+     */
+    int serve_body(const char* text, size_t n, json::format in, json::format format, std::string* out,
+                   http::response* res)
+    {
+        static thread_local json::parser parser;
+        static thread_local json::decoder decoder;
+        static thread_local std::string input;
+        const json::value* fast_req;
+        int code;
+
+        if (in == json::FORMAT_JSON) {
+            input.assign(text, n);
+            fast_req = parser.parse(&input[0], input.size());
+        } else {
+            fast_req = decoder.decode(in, text, n);
+        }
+        if (fast_req != nullptr && serve_fast(*fast_req, &code, format, out))
+            return code;
+        if (fast_req != nullptr && res != nullptr && format == json::FORMAT_JSON && serve_stream(*fast_req, res))
+            return 200;
+
+        Json::Value json_req, json_res;
+        Json::FastWriter writer;
+        bool parsed = fast_req != nullptr;
+
+        // from what was parsed already; Json::Reader only for text the parser refused
+        if (parsed) {
+            json::convert(*fast_req, &json_req);
+        } else if (in == json::FORMAT_JSON) {
             Json::Reader reader;
-            Json::FastWriter writer;
-
-            if (!reader.parse(body(request), json_req)) {
-                set_response_error(rpc_base::ERROR_PARSE_ERROR, "Parse Error", &json_res);
-                code = 500;
-            } else if (json_req.isObject()) {
-                if (is_valid_req(json_req)) {
-                    code = serve(json_req, &json_res);
-                } else {
-                    set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Invalid Request", &json_res);
-                    code = 400;
-                }
-            } else if (json_req.isArray()) {
-                code = 200;
-                json_res = Json::Value(Json::arrayValue);
-                for (const auto& item_req : json_req) {
-                    Json::Value item_res(Json::objectValue);
-
-                    if (is_valid_req(item_req)) {
-                        int item_status = serve(item_req, &item_res);
-                        if (item_status > code)
-                            code = item_status;
-                    } else {
-                        set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Invalid Request", &item_res);
-                        code = 400;
-                    }
-                    json_res.append(item_res);
-                }
+            parsed = reader.parse(text, text + n, json_req);
+        }
+
+        if (!parsed) {
+            set_response_error(rpc_base::ERROR_PARSE_ERROR, "Parse Error", &json_res);
+            code = 500;
+        } else if (json_req.isObject()) {
+            if (is_valid_req(json_req)) {
+                code = serve(json_req, &json_res);
             } else {
                 set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Invalid Request", &json_res);
                 code = 400;
             }
+        } else if (json_req.isArray()) {
+            code = serve_batch(json_req, &json_res);
+        } else {
+            set_response_error(rpc_base::ERROR_INVALID_REQUEST, "Invalid Request", &json_res);
+            code = 400;
+        }
 
-            response = http_server::response::stock_reply(
-                (http_server::response::status_type) code,
-                writer.write(json_res));
-            http_server::response_header header;
+        if (format == json::FORMAT_JSON)
+            *out += writer.write(json_res);
+        else
+            json::encode(format, json_res, out);
 
-            header = { "Content-Type", "application/json" };
-            response.headers.push_back(header);
+        return code;
+    }
+
+    /**
+     * Serve the body of a request as serve_body() does, anything thrown out
+     * of it, by a handler or for want of memory, answered as an internal
+     * error of this request alone rather than taking the server down.
+     */
+    int serve_body_guarded(const char* text, size_t n, json::format in, json::format format, std::string* out,
+                           http::response* res)
+    {
+        size_t pos = out->size();
+
+        try {
+            return serve_body(text, n, in, format, out, res);
+        } catch (...) {
+            Json::Value json_res;
+
+            out->resize(pos);
+            if (res != nullptr)
+                res->stream_body = nullptr;
+            set_response_error(rpc_base::ERROR_INTERNAL_ERROR, "Internal Error", &json_res);
+            if (format == json::FORMAT_JSON)
+                *out += Json::FastWriter().write(json_res);
+            else
+                json::encode(format, json_res, out);
+
+            return 500;
+        }
+    }
+
+    /**
+     * The encoding a response is asked in: the best of Accept that we have,
+     * the one of the request if anything goes, JSON otherwise.
+     */
+    static json::format response_format(const http::request& req, json::format in)
+    {
+        const http::header* h = req.find("Accept");
+        json::format best = json::FORMAT_JSON;
+        double best_q = 0;
+
+        if (h == nullptr)
+            return in;
+
+        for (const char *p = h->value, *end = h->value + h->value_len; p < end; ) {
+            const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+            const char* item_end = comma != nullptr ? comma : end;
+            const char* params = static_cast<const char*>(memchr(p, ';', item_end - p));
+            const char* type_end = params != nullptr ? params : item_end;
+            double q = 1;
+            json::format f;
+
+            if (params != nullptr) {
+                std::string rest(params, item_end);
+                size_t pos = rest.find("q=");
+                if (pos != std::string::npos)
+                    q = strtod(rest.c_str() + pos + 2, nullptr);
+            }
+            while (p < type_end && *p == ' ') {
+                p++;
+            }
+
+            std::string type(p, type_end);
+            type.erase(type.find_last_not_of(" \t") + 1);
+            bool any = type == "*/*" || type == "application/*";
+            if (any)
+                f = in;
+            if ((any || json::format_of(type.data(), type.size(), &f)) && q > best_q) {
+                best = f;
+                best_q = q;
+            }
+
+            p = item_end + 1;
+        }
+
+        return best;
+    }
+
+    /**
+     * Compress the body of a response in the coding the client accepts best:
+     * a streamed one as it goes, others if at least so big and the smaller
+     * for it.
+     */
+    void compress(const http::request& req, http::response* res)
+    {
+        static thread_local std::string output;
+        http::encoding e;
+
+        if (server->compress_min_size_ == 0 || (e = http::accepted_encoding(req)) == http::ENCODING_IDENTITY)
+            return;
+
+        int level = server->compress_level_;
+        if (res->stream_body) {
+            http::streamer fn = std::move(res->stream_body);
+            res->set_stream([fn, e, level](http::stream* out, http::response* res) {
+                http::compressing_stream z(out, e, level);
+
+                if (fn(&z, res))
+                    return z.finish();
+
+                // the response given instead, if nothing is out yet
+                std::string text;
+                http::compress(e, level, res->body, res->body_len, &text);
+                res->text.swap(text);
+                res->set_body(res->text);
+
+                return false;
+            });
+        } else {
+            if (res->body_len < server->compress_min_size_)
+                return;
+            output.clear();
+            if (!http::compress(e, level, res->body, res->body_len, &output) || output.size() >= res->body_len)
+                return;
+            res->set_body(output);
+        }
+        res->add_header("Content-Encoding", http::encoding_name(e));
+        res->add_header("Vary", "Accept-Encoding");
+    }
+
+    /**
+     * Answer a request, whichever engine it came from, streaming results if
+     * it can.
+     */
+    void handle(const http::request& req, http::response* res, bool stream)
+    {
+        if (req.target_is("/test") && req.method_is("GET")) {
+            res->set_text("Testing 1,2,3", 13);
+            return;
+        }
+
+        if (!req.target_is("/rpc")) {
+            res->status = 404;
+            res->set_text("not found", 9);
+            return;
+        }
+
+        if (req.method_is("OPTIONS")) {
+            res->add_header("Content-Type", "application/json");
+            res->add_header("Allow", "GET,POST,OPTIONS");
             if (server->allow_cors()) {
-                header = { "Access-Control-Allow-Origin", "*" };
-                response.headers.push_back(header);
+                res->add_header("Access-Control-Allow-Origin", "*");
+                res->add_header("Access-Control-Allow-Methods", "GET,POST,OPTIONS");
+
+                const http::header* h = req.find("Access-Control-Request-Headers");
+                if (h != nullptr)
+                    res->add_header("Access-Control-Allow-Headers", h->value, h->value_len);
             }
+        } else if (req.method_is("POST")) {
+            static thread_local std::string output;
+            const http::header* h = req.find("Content-Type");
+            json::format in = json::FORMAT_JSON;
+
+            // anything but ours is taken for JSON, as it always was
+            if (h != nullptr && !json::format_of(h->value, h->value_len, &in))
+                in = json::FORMAT_JSON;
+            json::format format = response_format(req, in);
+
+            output.clear();
+            res->status = serve_body_guarded(req.body, req.body_len, in, format, &output, stream ? res : nullptr);
+            res->set_body(output);
+            res->add_header("Content-Type", json::media_type(format));
+            if (server->allow_cors())
+                res->add_header("Access-Control-Allow-Origin", "*");
+            compress(req, res);
         } else {
-            response = http_server::response::stock_reply(http_server::response::bad_request, "bad request");
+            res->status = 400;
+            res->set_text("bad request", 11);
+        }
+    }
+
+    /**
+     * Answer a frame of the unix socket: a body, as POSTed over HTTP.
+     */
+    void handle_frame(const char* frame, size_t n, std::string* out)
+    {
+        serve_body_guarded(frame, n, json::FORMAT_JSON, json::FORMAT_JSON, out, nullptr);
+    }
+
+    // cpp-netlib's requests, through handle()
+    void operator()(http_server::request const &request, http_server::response &response)
+    {
+        static thread_local http::request req;
+        static thread_local http::response res;
+        std::string m = method(request);
+        std::string path = destination(request);
+        std::string text = body(request);
+
+        req.method = m.data();
+        req.method_len = m.size();
+        req.target = path.data();
+        req.target_len = path.size();
+        req.body = text.data();
+        req.body_len = text.size();
+        req.minor = 1;
+        req.headers.clear();
+        for (const auto& h : request.headers) {
+            req.headers.push_back(http::header{ h.name.data(), h.name.size(), h.value.data(), h.value.size() });
+        }
+
+        res.clear();
+        handle(req, &res, false);
+
+        response = http_server::response::stock_reply((http_server::response::status_type) res.status,
+                                                      std::string(res.body, res.body_len));
+        for (const auto& h : res.headers) {
+            http_server::response_header header = { std::string(h.name, h.name_len),
+                                                    std::string(h.value, h.value_len) };
+            response.headers.push_back(header);
         }
     }
 
@@ -198,8 +619,9 @@ struct rpc_base::rpc_handler {
 rpc_base::rpc_base(const std::string& address, unsigned short port, int nthreads)
     : listen_address_(address)
     , listen_port_(port)
-    , nthreads_(nthreads)
+    , nthreads_(std::max(nthreads, 1))
 {
+    add_method("list_methods", &rpc_base::serve_list_methods, method_info({}, true, 1000));
 }
 
 rpc_base::~rpc_base()
@@ -214,9 +636,19 @@ void rpc_base::start()
 #endif
 }
 
+/**
+ * Stop serving. The requests being served are answered first, then every
+ * thread of the server returns and join() can collect them.
+ */
 void rpc_base::stop()
 {
-    server_->stop();
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    stopped_ = true;
+    if (server_)
+        server_->stop();
+    if (epoll_server_)
+        epoll_server_->stop();
 }
 
 void rpc_base::join()
@@ -229,21 +661,192 @@ void rpc_base::run()
     rpc_handler handler(this);
     http_server::options options(handler);
 
-    server_ = std::unique_ptr<http_server>(new http_server(
-                options.address(listen_address_).port(std::to_string(listen_port_)).reuse_address(true)));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // stopped before it even started
+        if (stopped_)
+            return;
+
+        if (engine_ == ENGINE_EPOLL) {
+            epoll_server_ = std::unique_ptr<http::server>(new http::server(
+                        listen_address_, listen_port_, nthreads_,
+                        [&handler](const http::request& req, http::response* res) { handler.handle(req, res, true); }));
+            // as cpp-netlib does when it can't listen
+            if (!epoll_server_->listen())
+                throw std::runtime_error(epoll_server_->error());
+        } else {
+            server_ = std::unique_ptr<http_server>(new http_server(
+                        options.address(listen_address_).port(std::to_string(listen_port_)).reuse_address(true)));
+        }
+        if (batch_concurrency_ > 1)
+            batch_pool_ = std::unique_ptr<task_pool>(new task_pool(batch_concurrency_ - 1, "rpc-batch"));
+        if (!unix_path_.empty()) {
+            frame_server_ = std::unique_ptr<frame_server>(new frame_server(
+                        unix_path_, unix_mode_, nthreads_,
+                        [&handler](const char* frame, size_t n, std::string* out) {
+                            handler.handle_frame(frame, n, out);
+                        }));
+            if (!frame_server_->start())
+                throw std::runtime_error(frame_server_->error());
+        }
+    }
+
+    if (epoll_server_) {
+        epoll_server_->run();
+    } else {
+        run_netlib();
+    }
+
+    // its handler is local to run(), so the unix socket stops here
+    if (frame_server_)
+        frame_server_->stop();
+    if (batch_pool_)
+        batch_pool_->stop();
+}
+
+void rpc_base::run_netlib()
+{
+    // the other threads of the pool share the server, the calling one is the first
+    pool_.reserve(nthreads_ - 1);
+    for (int i = 1; i < nthreads_; i++) {
+        pool_.emplace_back(&http_server::run, server_.get());
+#ifdef DEBUG
+        pthread_setname_np(pool_.back().native_handle(), ("rpc-" + std::to_string(i)).c_str());
+#endif
+    }
+
+    server_->run();
 
-    std::thread services[nthreads_ - 1];
-    if (nthreads_ >= 2) {
-        for (std::thread& service : services) {
-            service = std::thread(&http_server::run, server_.get());
+    for (std::thread& t : pool_) {
+        t.join();
+    }
+    pool_.clear();
+}
+
+/**
+ * Serve a request in a context of its own, its temporaries freed with it on
+ * return. Servers overriding this, as they did before contexts, are called
+ * as ever; others get the context in the overload below.
+ */
+bool rpc_base::serve(const Json::Value& req, Json::Value* res)
+{
+    request_context ctx;
+
+    return serve(req, res, &ctx);
+}
+
+/**
+ * Serve a request by the methods added, the default of serve().
+ */
+bool rpc_base::serve(const Json::Value& req, Json::Value* res, request_context* ctx)
+{
+    return dispatch(req, res, ctx);
+}
+
+/**
+ * Call the method of a request once its params are checked.
+ *
+ * @param req       the request.
+ * @param res       the response to be filled.
+ * @param ctx       the context of the request.
+ * @return true on success, false otherwise.
+ */
+bool rpc_base::dispatch(const Json::Value& req, Json::Value* res, request_context* ctx)
+{
+    const method_table::method* m = methods_.lookup(req["method"]);
+    const Json::Value& params = req["params"];
+    std::string error;
+
+    if (m == nullptr)
+        return serve_method_not_found(params, res);
+    if (!m->info.check(params, &error))
+        return serve_error(ERROR_INVALID_PARAMS, error, res);
+
+    // the timeout of the method from now on, for its handler to give up at
+    ctx->set_timeout(m->info.timeout_ms);
+
+    // a handler throwing, e.g. on a value of another type, fails its call only
+    try {
+        if (m->fn)
+            return m->fn(params, res, ctx);
+        if (m->stream) {
+            Json::Value items;
+            result_stream result(&items);
+
+            result.set_deadline(ctx->deadline());
+            if (!m->stream(params, &result, ctx)) {
+                if (result.error_code() == 0 && result.expired())
+                    return serve_error(ERROR_SERVER_ERROR_START, "Timed out", res);
+                if (result.error_code() == 0)
+                    return serve_error(ERROR_INTERNAL_ERROR, "Internal Error", res);
+                return serve_error(result.error_code(), result.error_message(), res);
+            }
+            (*res)["result"].swap(items);
+            return true;
         }
+
+        return dispatch_fast(*m, params, res, ctx);
+    } catch (const std::exception&) {
+        res->removeMember("result");
+        return serve_error(ERROR_INTERNAL_ERROR, "Internal Error", res);
     }
-    server_->run();  // run 1 in the main thread
-    if (nthreads_ >= 2) {
-        for (std::thread& service : services) {
-            service.join();
+}
+
+/**
+ * Call a fast method from a Json::Value request, as the calls of a batch
+ * are, by converting the params and the response.
+ */
+bool rpc_base::dispatch_fast(const method_table::method& m, const Json::Value& params, Json::Value* res,
+                             request_context* ctx)
+{
+    std::string output;
+    json::parser parser(&ctx->arena());
+    json::writer writer(&output);
+    json::value fast_params;
+
+    json::convert(params, &fast_params, &ctx->arena());
+    writer.begin_object();
+    bool ok = m.fast(fast_params, &writer, ctx);
+    writer.end_object();
+
+    const json::value* value = parser.parse(&output[0], output.size());
+    if (value == nullptr || !value->is_object())
+        return serve_error(ERROR_INTERNAL_ERROR, "Invalid Response", res);
+    for (const json::value& member : *value) {
+        json::convert(member, &(*res)[std::string(member.key, member.key_len)]);
+    }
+
+    return ok;
+}
+
+/**
+ * The methods of the server along with their params.
+ */
+bool rpc_base::serve_list_methods(const Json::Value& params, Json::Value* res)
+{
+    (*res)["result"] = Json::Value(Json::arrayValue);
+
+    for (const auto& m : methods_.methods()) {
+        Json::Value method(Json::objectValue);
+
+        method["name"] = m.name;
+        method["params"] = Json::Value(Json::arrayValue);
+        for (const auto& spec : m.info.params) {
+            Json::Value param(Json::objectValue);
+
+            param["name"] = spec.name;
+            param["type"] = method_table::type_name(spec.type);
+            param["required"] = spec.required;
+            method["params"].append(param);
         }
+        method["idempotent"] = m.info.idempotent;
+        method["timeout"] = m.info.timeout_ms / 1000.0;
+        method["streamed"] = static_cast<bool>(m.stream);
+        (*res)["result"].append(method);
     }
+
+    return true;
 }
 
 bool rpc_base::serve_method_not_found(const Json::Value &params, Json::Value* res)
@@ -264,4 +867,24 @@ bool rpc_base::serve_unimplemented(const Json::Value &params, Json::Value* res)
     return false;
 }
 
+bool rpc_base::serve_error(int code, const std::string& message, Json::Value* res)
+{
+    (*res)["error"] = Json::Value(Json::objectValue);
+    (*res)["error"]["code"] = code;
+    (*res)["error"]["message"] = message;
+
+    return false;
+}
+
+bool rpc_base::serve_error(int code, const char* message, json::writer* res)
+{
+    res->set_error_code(code);
+    res->key("error").begin_object();
+    res->key("code").number(code);
+    res->key("message").string(message);
+    res->end_object();
+
+    return false;
+}
+
 }  // namespace xa
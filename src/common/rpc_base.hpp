@@ -22,11 +22,21 @@
 #include <sys/socket.h>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <boost/network/protocol/http/server.hpp>
 
+#include "binary_json.hpp"
+#include "frame_server.hpp"
+#include "http_compress.hpp"
+#include "http_server.hpp"
+#include "rpc_method.hpp"
+#include "rpc_stream.hpp"
+#include "task_pool.hpp"
+
 namespace xa {
 
 class rpc_base {
@@ -40,7 +50,15 @@ public:
     constexpr static const int ERROR_SERVER_ERROR_START = -32000;
     constexpr static const int ERROR_SERVER_ERROR_END = -32099;
 
-    virtual bool serve(const Json::Value &req, Json::Value* res) = 0;
+    // what serves HTTP: cpp-netlib, or the epoll reactors of http::server
+    enum engine {
+        ENGINE_NETLIB,
+        ENGINE_EPOLL,
+    };
+
+    // the server calls the first, which gives the second a context
+    virtual bool serve(const Json::Value &req, Json::Value* res);
+    virtual bool serve(const Json::Value &req, Json::Value* res, request_context* ctx);
 
     void start();
     void stop();
@@ -48,27 +66,89 @@ public:
     void run();
 
     void set_allow_cors(bool enable);
+    void set_batch_limits(size_t max_size, unsigned concurrency);
+    void set_compression(size_t min_size, int level = http::compressor::DEFAULT_LEVEL);
+    void set_engine(engine e);
+    void set_unix_socket(const std::string& path, mode_t mode = 0660);
 
 protected:
     rpc_base(const std::string& address, unsigned short port, int nthreads = 1);
     virtual ~rpc_base();
 
     bool allow_cors() const;
+
+    bool add_method(const std::string& name, const method_table::handler& fn,
+                    const method_info& info = method_info());
+    template <class T>
+    bool add_method(const std::string& name, bool (T::*fn)(const Json::Value& params, Json::Value* res),
+                    const method_info& info = method_info());
+    template <class T>
+    bool add_method(const std::string& name,
+                    bool (T::*fn)(const Json::Value& params, Json::Value* res, request_context* ctx),
+                    const method_info& info = method_info());
+    bool add_fast_method(const std::string& name, const method_table::fast_handler& fn,
+                         const method_info& info = method_info());
+    template <class T>
+    bool add_fast_method(const std::string& name, bool (T::*fn)(const json::value& params, json::writer* res),
+                         const method_info& info = method_info());
+    template <class T>
+    bool add_fast_method(const std::string& name,
+                         bool (T::*fn)(const json::value& params, json::writer* res, request_context* ctx),
+                         const method_info& info = method_info());
+    bool add_stream_method(const std::string& name, const method_table::stream_handler& fn,
+                           const method_info& info = method_info());
+    template <class T>
+    bool add_stream_method(const std::string& name, bool (T::*fn)(const Json::Value& params, result_stream* res),
+                           const method_info& info = method_info());
+    template <class T>
+    bool add_stream_method(const std::string& name,
+                           bool (T::*fn)(const Json::Value& params, result_stream* res, request_context* ctx),
+                           const method_info& info = method_info());
+    bool dispatch(const Json::Value& req, Json::Value* res, request_context* ctx);
+    bool dispatch_fast(const method_table::method& m, const Json::Value& params, Json::Value* res,
+                       request_context* ctx);
+    const method_table& methods() const;
+
+    bool serve_list_methods(const Json::Value& params, Json::Value* res);
     bool serve_build_info(const Json::Value& params, Json::Value* res);
     bool serve_method_not_found(const Json::Value& params, Json::Value* res);
     bool serve_unimplemented(const Json::Value& params, Json::Value* res);
+    bool serve_error(int code, const std::string& message, Json::Value* res);
+    bool serve_error(int code, const char* message, json::writer* res);
 
 private:
+    void run_netlib();
+
     std::thread thread_;
+    std::vector<std::thread> pool_;     // along with thread_, all running the server
     std::string listen_address_;
     unsigned short listen_port_;
     int nthreads_;
+    std::mutex mutex_;
+    bool stopped_ = false;
 
     bool allow_cors_ = false;
+    method_table methods_;
+
+    // the calls of a batch run on a pool of their own, as many as this at once
+    std::unique_ptr<task_pool> batch_pool_;
+    size_t max_batch_size_ = 100;
+    unsigned batch_concurrency_ = 8;
+
+    // bodies at least this big compressed if the client accepts it, none if 0
+    size_t compress_min_size_ = 0;
+    int compress_level_ = http::compressor::DEFAULT_LEVEL;
 
     struct rpc_handler;
     typedef boost::network::http::server<rpc_handler> http_server;
     std::unique_ptr<http_server> server_;
+    engine engine_ = ENGINE_NETLIB;
+    std::unique_ptr<http::server> epoll_server_;
+
+    // local clients may also call over a unix socket, along with HTTP
+    std::string unix_path_;
+    mode_t unix_mode_ = 0660;
+    std::unique_ptr<frame_server> frame_server_;
 };
 
 inline void rpc_base::set_allow_cors(bool enable)
@@ -76,9 +156,146 @@ inline void rpc_base::set_allow_cors(bool enable)
     allow_cors_ = enable;
 }
 
+inline void rpc_base::set_batch_limits(size_t max_size, unsigned concurrency)
+{
+    max_batch_size_ = max_size;
+    batch_concurrency_ = concurrency;
+}
+
+/**
+ * Compress responses for the clients that accept it: those at least
+ * min_size bytes, and streamed ones whatever their size. 0 turns it off.
+ */
+inline void rpc_base::set_compression(size_t min_size, int level)
+{
+    compress_min_size_ = min_size;
+    compress_level_ = level;
+}
+
+inline void rpc_base::set_engine(engine e)
+{
+    engine_ = e;
+}
+
+inline void rpc_base::set_unix_socket(const std::string& path, mode_t mode)
+{
+    unix_path_ = path;
+    unix_mode_ = mode;
+}
+
 inline bool rpc_base::allow_cors() const
 {
     return allow_cors_;
 }
 
+inline bool rpc_base::add_method(const std::string& name, const method_table::handler& fn,
+                                 const method_info& info)
+{
+    return methods_.add(name, fn, info);
+}
+
+/**
+ * Add a method served by a member function of the derived server.
+ */
+template <class T>
+inline bool rpc_base::add_method(const std::string& name, bool (T::*fn)(const Json::Value& params, Json::Value* res),
+                                 const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add(name, [self, fn](const Json::Value& params, Json::Value* res, request_context*) {
+        return (self->*fn)(params, res);
+    }, info);
+}
+
+/**
+ * Add a method served by a member function of the derived server, handed
+ * the context of the request.
+ */
+template <class T>
+inline bool rpc_base::add_method(const std::string& name,
+                                 bool (T::*fn)(const Json::Value& params, Json::Value* res, request_context* ctx),
+                                 const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add(name, [self, fn](const Json::Value& params, Json::Value* res, request_context* ctx) {
+        return (self->*fn)(params, res, ctx);
+    }, info);
+}
+
+inline bool rpc_base::add_fast_method(const std::string& name, const method_table::fast_handler& fn,
+                                      const method_info& info)
+{
+    return methods_.add_fast(name, fn, info);
+}
+
+/**
+ * Add a method served on the fast path by a member function of the derived
+ * server.
+ */
+template <class T>
+inline bool rpc_base::add_fast_method(const std::string& name, bool (T::*fn)(const json::value& params, json::writer* res),
+                                      const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add_fast(name, [self, fn](const json::value& params, json::writer* res, request_context*) {
+        return (self->*fn)(params, res);
+    }, info);
+}
+
+template <class T>
+inline bool rpc_base::add_fast_method(const std::string& name,
+                                      bool (T::*fn)(const json::value& params, json::writer* res,
+                                                    request_context* ctx),
+                                      const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add_fast(name, [self, fn](const json::value& params, json::writer* res, request_context* ctx) {
+        return (self->*fn)(params, res, ctx);
+    }, info);
+}
+
+inline bool rpc_base::add_stream_method(const std::string& name, const method_table::stream_handler& fn,
+                                        const method_info& info)
+{
+    return methods_.add_stream(name, fn, info);
+}
+
+/**
+ * Add a method whose result is streamed by a member function of the derived
+ * server.
+ */
+template <class T>
+inline bool rpc_base::add_stream_method(const std::string& name,
+                                        bool (T::*fn)(const Json::Value& params, result_stream* res),
+                                        const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add_stream(name, [self, fn](const Json::Value& params, result_stream* res, request_context*) {
+        return (self->*fn)(params, res);
+    }, info);
+}
+
+template <class T>
+inline bool rpc_base::add_stream_method(const std::string& name,
+                                        bool (T::*fn)(const Json::Value& params, result_stream* res,
+                                                      request_context* ctx),
+                                        const method_info& info)
+{
+    T* self = static_cast<T*>(this);
+
+    return methods_.add_stream(name, [self, fn](const Json::Value& params, result_stream* res, request_context* ctx) {
+        return (self->*fn)(params, res, ctx);
+    }, info);
+}
+
+inline const method_table& rpc_base::methods() const
+{
+    return methods_;
+}
+
 }  // namespace xa
@@ -0,0 +1,318 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Mini-HTTP Client API documentation.
+ */
+
+/**
+ * @file rpc_client.cpp
+ *
+ * @brief      Xabyss's Mini-HTTP Client library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "rpc_client.hpp"
+
+namespace xa {
+
+// milliseconds left, 0 once past
+static int remaining_ms(rpc_client::time_point deadline)
+{
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+
+    return left.count() > 0 ? static_cast<int>(left.count()) : 0;
+}
+
+static bool wait_for(int fd, short events, rpc_client::time_point deadline)
+{
+    struct pollfd pfd = { fd, events, 0 };
+
+    for (;;) {
+        int ms = remaining_ms(deadline);
+        if (ms == 0)
+            return false;
+
+        int n = poll(&pfd, 1, ms);
+        if (n > 0)
+            return true;
+        if (n < 0 && errno != EINTR)
+            return false;
+    }
+}
+
+// the body of a chunked response, false if it's not complete yet
+static bool dechunk(const std::string& data, size_t pos, std::string* body)
+{
+    body->clear();
+    for (;;) {
+        size_t eol = data.find("\r\n", pos);
+        if (eol == std::string::npos)
+            return false;
+
+        size_t size = strtoul(data.c_str() + pos, nullptr, 16);
+        pos = eol + 2;
+        if (size == 0)
+            return true;
+        if (data.size() < pos + size + 2)
+            return false;
+
+        body->append(data, pos, size);
+        pos += size + 2;
+    }
+}
+
+rpc_client::rpc_client(const std::string& host, unsigned short port)
+    : host_(host)
+    , port_(port)
+    , next_id_(1)
+{
+}
+
+rpc_client::rpc_client(const std::string& path)
+    : port_(0)
+    , path_(path)
+    , next_id_(1)
+{
+}
+
+/**
+ * Split a "host:port" address, the host of an IPv6 address in brackets.
+ *
+ * @param address   an address.
+ * @param host      the host to be filled.
+ * @param port      the port to be filled.
+ * @return true on success, false otherwise.
+ */
+bool rpc_client::parse_address(const std::string& address, std::string* host, unsigned short* port)
+{
+    size_t colon = address.rfind(':');
+    char* end;
+
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.size())
+        return false;
+
+    unsigned long n = strtoul(address.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || n == 0 || n > 65535)
+        return false;
+
+    *host = address.substr(0, colon);
+    if (host->size() > 2 && (*host)[0] == '[' && host->back() == ']')
+        *host = host->substr(1, host->size() - 2);
+    *port = static_cast<unsigned short>(n);
+
+    return true;
+}
+
+int rpc_client::connect(time_point deadline, std::string* error) const
+{
+    struct addrinfo hints = {};
+    struct addrinfo* addrs;
+
+    if (!path_.empty()) {
+        struct sockaddr_un addr = {};
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0)
+            return fd;
+
+        *error = path_ + ": " + strerror(errno);
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int rc = getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &addrs);
+    if (rc != 0) {
+        *error = std::string("can't resolve ") + host_ + ": " + gai_strerror(rc);
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* ai = addrs; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+
+        int err = errno;
+        socklen_t len = sizeof(err);
+        if (err == EINPROGRESS && wait_for(fd, POLLOUT, deadline)
+                && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+            break;
+
+        *error = remaining_ms(deadline) == 0 ? std::string("timed out") : std::string(strerror(err));
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+
+    return fd;
+}
+
+/**
+ * Call a method and wait for its result.
+ *
+ * @param method    the method name.
+ * @param params    the params.
+ * @param result    the result to be filled.
+ * @param error     the error message to be filled on failure.
+ * @param deadline  the time to give up at.
+ * @return true on success, false otherwise.
+ */
+bool rpc_client::call(const std::string& method, const Json::Value& params, Json::Value* result,
+                      std::string* error, time_point deadline)
+{
+    Json::Value req(Json::objectValue);
+    Json::FastWriter writer;
+
+    req["jsonrpc"] = "2.0";
+    req["method"] = method;
+    req["params"] = params;
+    req["id"] = next_id_++;
+
+    std::string body = writer.write(req);
+    std::string request;
+    if (!path_.empty()) {
+        // a 32 bit big-endian length and the body
+        uint32_t n = static_cast<uint32_t>(body.size());
+        char length[4] = { static_cast<char>(n >> 24), static_cast<char>(n >> 16),
+                           static_cast<char>(n >> 8), static_cast<char>(n) };
+        request.assign(length, 4);
+        request += body;
+    } else {
+        request = "POST /rpc HTTP/1.1\r\nHost: " + host_ + ":" + std::to_string(port_)
+            + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(body.size())
+            + "\r\nConnection: close\r\n\r\n" + body;
+    }
+
+    int fd = connect(deadline, error);
+    if (fd < 0)
+        return false;
+
+    for (size_t sent = 0; sent < request.size(); ) {
+        ssize_t n = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            *error = strerror(errno);
+            ::close(fd);
+            return false;
+        } else if (!wait_for(fd, POLLOUT, deadline)) {
+            *error = "timed out";
+            ::close(fd);
+            return false;
+        }
+    }
+
+    // the response ends with its length, its last chunk or the connection
+    std::string data;
+    size_t header_end = std::string::npos;
+    size_t length = std::string::npos;
+    bool chunked = false;
+    bool complete = false;
+    char buf[65536];
+
+    while (!complete) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            data.append(buf, n);
+        } else if (n == 0) {
+            // a frame is cut short by the connection
+            complete = path_.empty();
+            if (!complete)
+                *error = "connection closed";
+            break;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            *error = strerror(errno);
+            break;
+        } else if (!wait_for(fd, POLLIN, deadline)) {
+            *error = "timed out";
+            break;
+        }
+
+        if (!path_.empty()) {
+            if (data.size() >= 4) {
+                const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data());
+                length = (static_cast<size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+                header_end = 4;
+                complete = data.size() >= header_end + length;
+            }
+            continue;
+        }
+
+        if (header_end == std::string::npos) {
+            header_end = data.find("\r\n\r\n");
+            if (header_end == std::string::npos)
+                continue;
+
+            for (size_t pos = data.find("\r\n") + 2; pos < header_end; ) {
+                size_t eol = data.find("\r\n", pos);
+                std::string line = data.substr(pos, eol - pos);
+                pos = eol + 2;
+
+                if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0)
+                    length = strtoul(line.c_str() + 15, nullptr, 10);
+                else if (strncasecmp(line.c_str(), "Transfer-Encoding:", 18) == 0
+                        && strcasestr(line.c_str() + 18, "chunked") != nullptr)
+                    chunked = true;
+            }
+            header_end += 4;
+        }
+
+        if (chunked)
+            complete = dechunk(data, header_end, &body);
+        else if (length != std::string::npos)
+            complete = data.size() >= header_end + length;
+    }
+    ::close(fd);
+
+    if (!complete)
+        return false;
+    if (header_end == std::string::npos || (path_.empty() && data.compare(0, 5, "HTTP/") != 0)) {
+        *error = "invalid response";
+        return false;
+    }
+
+    if (!chunked)
+        body = data.substr(header_end, length);
+
+    Json::Value res;
+    Json::Reader reader;
+    if (!reader.parse(body, res) || !res.isObject()) {
+        *error = "invalid response: " + data.substr(0, data.find("\r\n"));
+        return false;
+    }
+
+    if (res.isMember("error")) {
+        *error = res["error"]["message"].asString();
+        return false;
+    }
+
+    *result = res["result"];
+
+    return true;
+}
+
+}  // namespace xa
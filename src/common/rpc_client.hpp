@@ -0,0 +1,67 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Mini-HTTP Client API documentation.
+ */
+
+/**
+ * @file rpc_client.hpp
+ *
+ * @brief      Xabyss's Mini-HTTP Client library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace xa {
+
+/**
+ * A JSON-RPC client of rpc_base servers: one request per connection, every
+ * step bounded by a deadline. It talks HTTP to a host and port, or frames
+ * to the unix socket of a local server.
+ */
+class rpc_client {
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    rpc_client(const std::string& host, unsigned short port);
+    explicit rpc_client(const std::string& path);
+
+    static bool parse_address(const std::string& address, std::string* host, unsigned short* port);
+
+    bool call(const std::string& method, const Json::Value& params, Json::Value* result, std::string* error,
+              time_point deadline);
+
+    const std::string& host() const;
+    unsigned short port() const;
+
+private:
+    int connect(time_point deadline, std::string* error) const;
+
+    std::string host_;
+    unsigned short port_;
+    std::string path_;
+    std::atomic<unsigned> next_id_;
+};
+
+inline const std::string& rpc_client::host() const
+{
+    return host_;
+}
+
+inline unsigned short rpc_client::port() const
+{
+    return port_;
+}
+
+}  // namespace xa
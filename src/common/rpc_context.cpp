@@ -0,0 +1,46 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Request Context API documentation.
+ */
+
+/**
+ * @file rpc_context.cpp
+ *
+ * @brief      Xabyss's RPC Request Context library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "rpc_context.hpp"
+
+namespace xa {
+
+// the arenas of the thread, the first `depth` of them in use; a request
+// served from within another, as a local node of a federated search is,
+// takes the next one
+static thread_local std::vector<std::unique_ptr<arena>> arenas;
+static thread_local size_t depth = 0;
+
+request_context::request_context()
+    : deadline_(std::chrono::steady_clock::time_point::max())
+{
+    if (depth == arenas.size())
+        arenas.emplace_back(new xa::arena());
+    arena_ = arenas[depth++].get();
+}
+
+request_context::~request_context()
+{
+    arena_->reset();
+    depth--;
+}
+
+}  // namespace xa
@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Request Context API documentation.
+ */
+
+/**
+ * @file rpc_context.hpp
+ *
+ * @brief      Xabyss's RPC Request Context library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <chrono>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+
+namespace xa {
+
+/**
+ * What a request is served with: an arena the temporaries of its handler
+ * are allocated from, freed at once when the request is done, and the time
+ * it is to be served by, for a handler to give up at.
+ *
+ * The arenas are kept by the thread serving, one per request it serves at
+ * once, so a request allocates nothing from the heap once they are warmed
+ * up and does not contend with other threads for the allocator.
+ */
+class request_context {
+public:
+    typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> string;
+    template <class T>
+    using vector = std::vector<T, arena_allocator<T>>;
+
+    request_context();
+    ~request_context();
+
+    request_context(const request_context&) = delete;
+    request_context& operator=(const request_context&) = delete;
+
+    xa::arena& arena();
+
+    template <class T>
+    arena_allocator<T> allocator();
+    string make_string(const char* s, size_t n);
+    string make_string(const std::string& s);
+    template <class T>
+    vector<T> make_vector();
+    // only for what needs no destructor, none is ever called
+    template <class T, class... Args>
+    T* make(Args&&... args);
+
+    // as of now, 0 for none
+    void set_timeout(unsigned ms);
+    std::chrono::steady_clock::time_point deadline() const;
+    bool expired() const;
+
+private:
+    xa::arena* arena_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+inline xa::arena& request_context::arena()
+{
+    return *arena_;
+}
+
+template <class T>
+inline arena_allocator<T> request_context::allocator()
+{
+    return arena_allocator<T>(arena_);
+}
+
+inline request_context::string request_context::make_string(const char* s, size_t n)
+{
+    return string(s, n, allocator<char>());
+}
+
+inline request_context::string request_context::make_string(const std::string& s)
+{
+    return make_string(s.data(), s.size());
+}
+
+template <class T>
+inline request_context::vector<T> request_context::make_vector()
+{
+    return vector<T>(allocator<T>());
+}
+
+template <class T, class... Args>
+inline T* request_context::make(Args&&... args)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "the arena never calls destructors");
+
+    return new (arena_->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+inline void request_context::set_timeout(unsigned ms)
+{
+    deadline_ = ms > 0 ? std::chrono::steady_clock::now() + std::chrono::milliseconds(ms)
+        : std::chrono::steady_clock::time_point::max();
+}
+
+inline std::chrono::steady_clock::time_point request_context::deadline() const
+{
+    return deadline_;
+}
+
+inline bool request_context::expired() const
+{
+    return deadline_ != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline_;
+}
+
+}  // namespace xa
@@ -0,0 +1,275 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Method Table API documentation.
+ */
+
+/**
+ * @file rpc_method.cpp
+ *
+ * @brief      Xabyss's RPC Method Table library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <string.h>
+
+#include "rpc_method.hpp"
+
+namespace xa {
+
+static bool type_matches(const Json::Value& value, param_type type)
+{
+    switch (type) {
+    case PARAM_BOOLEAN:
+        return value.isBool();
+    case PARAM_INTEGER:
+        // as asInt64() takes it
+        return value.isInt64();
+    case PARAM_NUMBER:
+        return value.isNumeric() && !value.isBool();
+    case PARAM_STRING:
+        return value.isString();
+    case PARAM_ARRAY:
+        return value.isArray();
+    case PARAM_OBJECT:
+        return value.isObject();
+    default:
+        return true;
+    }
+}
+
+// an integral number as text, within the range of int64_t
+static bool fits_int64(const json::value& value)
+{
+    static const char MAX[] = "9223372036854775807";
+    static const char MIN[] = "9223372036854775808";
+    bool negative = value.len > 0 && value.text[0] == '-';
+    const char* digits = value.text + (negative ? 1 : 0);
+    size_t n = value.len - (negative ? 1 : 0);
+
+    // no leading zeros in JSON, the longer the greater
+    if (n != sizeof(MAX) - 1)
+        return n < sizeof(MAX) - 1;
+
+    return memcmp(digits, negative ? MIN : MAX, n) <= 0;
+}
+
+static bool type_matches(const json::value& value, param_type type)
+{
+    switch (type) {
+    case PARAM_BOOLEAN:
+        return value.is_bool();
+    case PARAM_INTEGER:
+        return value.is_integral() && fits_int64(value);
+    case PARAM_NUMBER:
+        return value.is_number();
+    case PARAM_STRING:
+        return value.is_string();
+    case PARAM_ARRAY:
+        return value.is_array();
+    case PARAM_OBJECT:
+        return value.is_object();
+    default:
+        return true;
+    }
+}
+
+/**
+ * Check the params of a call against the specs of the method.
+ *
+ * @param params    the params, an object, an array or null.
+ * @param error     the reason to be filled if they don't match.
+ * @return true if they match, false otherwise.
+ */
+bool method_info::check(const Json::Value& params, std::string* error) const
+{
+    // positional params are left to the handler
+    if (params.isArray())
+        return true;
+
+    for (const auto& spec : this->params) {
+        const Json::Value* value = params.isObject() ? params.find(spec.name.data(),
+                                                                   spec.name.data() + spec.name.size()) : nullptr;
+
+        if (value == nullptr || value->isNull()) {
+            if (spec.required) {
+                *error = "Missing param: " + spec.name;
+                return false;
+            }
+            continue;
+        }
+        if (!type_matches(*value, spec.type)) {
+            *error = "Invalid param: " + spec.name + " must be " + method_table::type_name(spec.type);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check the params of a call parsed by the fast path.
+ */
+bool method_info::check(const json::value& params, std::string* error) const
+{
+    if (params.is_array())
+        return true;
+
+    for (const auto& spec : this->params) {
+        const json::value* value = params.find(spec.name.data(), spec.name.size());
+
+        if (value == nullptr || value->is_null()) {
+            if (spec.required) {
+                *error = "Missing param: " + spec.name;
+                return false;
+            }
+            continue;
+        }
+        if (!type_matches(*value, spec.type)) {
+            *error = "Invalid param: " + spec.name + " must be " + method_table::type_name(spec.type);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+method_table::method_table()
+    : mask_(0)
+{
+    rehash(16);
+}
+
+const char* method_table::type_name(param_type type)
+{
+    switch (type) {
+    case PARAM_BOOLEAN:
+        return "boolean";
+    case PARAM_INTEGER:
+        return "integer";
+    case PARAM_NUMBER:
+        return "number";
+    case PARAM_STRING:
+        return "string";
+    case PARAM_ARRAY:
+        return "array";
+    case PARAM_OBJECT:
+        return "object";
+    default:
+        return "any";
+    }
+}
+
+// FNV-1a
+uint32_t method_table::hash_of(const char* name, size_t len)
+{
+    uint32_t h = 2166136261U;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ static_cast<uint8_t>(name[i])) * 16777619U;
+    }
+
+    return h;
+}
+
+void method_table::insert(size_t index)
+{
+    uint32_t h = hash_of(methods_[index].name.data(), methods_[index].name.size());
+    size_t pos = h & mask_;
+
+    while (slots_[pos].index >= 0) {
+        pos = (pos + 1) & mask_;
+    }
+    slots_[pos] = slot{ h, static_cast<int32_t>(index) };
+}
+
+void method_table::rehash(size_t capacity)
+{
+    slots_.assign(capacity, slot{ 0, -1 });
+    mask_ = capacity - 1;
+
+    for (size_t i = 0; i < methods_.size(); i++) {
+        insert(i);
+    }
+}
+
+/**
+ * Add a method, kept at most half full so that lookups stay a probe or two
+ * however many methods there are.
+ *
+ * @param name      the method name.
+ * @param fn        its handler.
+ * @param info      its params, idempotence and timeout.
+ * @return true on success, false if the name is taken.
+ */
+bool method_table::add(const std::string& name, const handler& fn, const method_info& info)
+{
+    return add(method{ name, fn, fast_handler(), stream_handler(), info });
+}
+
+/**
+ * Add a method served by the fast path. Calls through Json::Value, like
+ * those of a batch, are converted to it.
+ */
+bool method_table::add_fast(const std::string& name, const fast_handler& fn, const method_info& info)
+{
+    return add(method{ name, handler(), fn, stream_handler(), info });
+}
+
+/**
+ * Add a method whose result is streamed. Calls through Json::Value, like
+ * those of a batch, have the items collected into an array instead.
+ */
+bool method_table::add_stream(const std::string& name, const stream_handler& fn, const method_info& info)
+{
+    return add(method{ name, handler(), fast_handler(), fn, info });
+}
+
+bool method_table::add(const method& m)
+{
+    if (find(m.name) != nullptr)
+        return false;
+
+    methods_.push_back(m);
+    if (methods_.size() * 2 > slots_.size())
+        rehash(slots_.size() * 2);
+    else
+        insert(methods_.size() - 1);
+
+    return true;
+}
+
+const method_table::method* method_table::find(const char* name, size_t len) const
+{
+    uint32_t h = hash_of(name, len);
+
+    for (size_t pos = h & mask_; slots_[pos].index >= 0; pos = (pos + 1) & mask_) {
+        const method& m = methods_[slots_[pos].index];
+
+        if (slots_[pos].hash == h && m.name.size() == len && memcmp(m.name.data(), name, len) == 0)
+            return &m;
+    }
+
+    return nullptr;
+}
+
+/**
+ * Look up the method of a request by its "method" member as is.
+ */
+const method_table::method* method_table::lookup(const Json::Value& name) const
+{
+    const char* begin;
+    const char* end;
+
+    if (!name.isString() || !name.getString(&begin, &end))
+        return nullptr;
+
+    return find(begin, end - begin);
+}
+
+}  // namespace xa
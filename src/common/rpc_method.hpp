@@ -0,0 +1,140 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Method Table API documentation.
+ */
+
+/**
+ * @file rpc_method.hpp
+ *
+ * @brief      Xabyss's RPC Method Table library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <json/json.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "fast_json.hpp"
+#include "rpc_context.hpp"
+
+namespace xa {
+
+class result_stream;
+
+enum param_type {
+    PARAM_ANY,
+    PARAM_BOOLEAN,
+    PARAM_INTEGER,
+    PARAM_NUMBER,
+    PARAM_STRING,
+    PARAM_ARRAY,
+    PARAM_OBJECT,
+};
+
+struct param_spec {
+    std::string name;
+    param_type type;
+    bool required;
+
+    param_spec(const std::string& name, param_type type, bool required = true)
+        : name(name), type(type), required(required) {}
+};
+
+struct method_info {
+    // members of the params object, others are let through
+    std::vector<param_spec> params;
+    // calling it twice does no more than calling it once
+    bool idempotent;
+    // how long a call may take, 0 for no limit
+    unsigned timeout_ms;
+
+    method_info(std::initializer_list<param_spec> params = {}, bool idempotent = false, unsigned timeout_ms = 0)
+        : params(params), idempotent(idempotent), timeout_ms(timeout_ms) {}
+
+    bool check(const Json::Value& params, std::string* error) const;
+    bool check(const json::value& params, std::string* error) const;
+};
+
+/**
+ * The methods of a server by name: an open addressing table of the name
+ * hashes, looked up without copying the name out of the request.
+ *
+ * A method has a handler of Json::Value, or a fast handler of the parsed
+ * request that writes its response as it goes, without allocating, or a
+ * stream handler of Json::Value params whose result is an array it appends
+ * the items of as they are produced. All are handed the context of the
+ * request, to allocate their temporaries from.
+ */
+class method_table {
+public:
+    typedef std::function<bool(const Json::Value& params, Json::Value* res, request_context* ctx)> handler;
+    typedef std::function<bool(const json::value& params, json::writer* res, request_context* ctx)> fast_handler;
+    typedef std::function<bool(const Json::Value& params, result_stream* res, request_context* ctx)> stream_handler;
+
+    struct method {
+        std::string name;
+        handler fn;
+        fast_handler fast;
+        stream_handler stream;
+        method_info info;
+    };
+
+    method_table();
+
+    bool add(const std::string& name, const handler& fn, const method_info& info = method_info());
+    bool add_fast(const std::string& name, const fast_handler& fn, const method_info& info = method_info());
+    bool add_stream(const std::string& name, const stream_handler& fn, const method_info& info = method_info());
+    const method* find(const char* name, size_t len) const;
+    const method* find(const std::string& name) const;
+    const method* lookup(const Json::Value& name) const;
+
+    // in the order they were added
+    const std::vector<method>& methods() const;
+    size_t size() const;
+
+    static const char* type_name(param_type type);
+
+private:
+    struct slot {
+        uint32_t hash;
+        int32_t index;      // -1 if empty
+    };
+
+    static uint32_t hash_of(const char* name, size_t len);
+    bool add(const method& m);
+    void insert(size_t index);
+    void rehash(size_t capacity);
+
+    std::vector<method> methods_;
+    std::vector<slot> slots_;
+    size_t mask_;
+};
+
+inline const method_table::method* method_table::find(const std::string& name) const
+{
+    return find(name.data(), name.size());
+}
+
+inline const std::vector<method_table::method>& method_table::methods() const
+{
+    return methods_;
+}
+
+inline size_t method_table::size() const
+{
+    return methods_.size();
+}
+
+}  // namespace xa
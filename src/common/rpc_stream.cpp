@@ -0,0 +1,140 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Result Stream API documentation.
+ */
+
+/**
+ * @file rpc_stream.cpp
+ *
+ * @brief      Xabyss's RPC Result Stream library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include "binary_json.hpp"
+#include "rpc_stream.hpp"
+
+namespace xa {
+
+result_stream::result_stream(http::stream* out)
+    : out_(out)
+    , items_(nullptr)
+    , writer_(&item_)
+    , size_(0)
+    , deadline_(std::chrono::steady_clock::time_point::max())
+    , error_code_(0)
+{
+}
+
+result_stream::result_stream(Json::Value* items)
+    : out_(nullptr)
+    , items_(items)
+    , writer_(&item_)
+    , size_(0)
+    , deadline_(std::chrono::steady_clock::time_point::max())
+    , error_code_(0)
+{
+    *items_ = Json::Value(Json::arrayValue);
+}
+
+/**
+ * Append an item to the result.
+ *
+ * @return true on success, false if the client is gone or the request has
+ *         run out of time.
+ */
+bool result_stream::append(const Json::Value& item)
+{
+    if (expired())
+        return false;
+    if (items_ != nullptr) {
+        items_->append(item);
+        size_++;
+        return true;
+    }
+
+    Json::FastWriter writer;
+    writer.omitEndingLineFeed();
+    item_ = writer.write(item);
+
+    return put();
+}
+
+bool result_stream::append(const json::value& item)
+{
+    if (expired())
+        return false;
+    if (items_ != nullptr) {
+        json::convert(item, &items_->append(Json::Value()));
+        size_++;
+        return true;
+    }
+
+    item_.clear();
+    writer_.write(item);
+
+    return put();
+}
+
+json::writer& result_stream::begin_item()
+{
+    item_.clear();
+
+    return writer_;
+}
+
+bool result_stream::end_item()
+{
+    if (expired())
+        return false;
+    if (items_ != nullptr) {
+        Json::Reader reader;
+        if (!reader.parse(item_, items_->append(Json::Value())))
+            return false;
+        size_++;
+        return true;
+    }
+
+    return put();
+}
+
+/**
+ * Write out the items appended so far, rather than wait for a chunk of
+ * them.
+ */
+bool result_stream::flush()
+{
+    flushed_ = std::chrono::steady_clock::now();
+
+    return out_ == nullptr || out_->flush();
+}
+
+bool result_stream::fail(int code, const std::string& message)
+{
+    error_code_ = code;
+    error_message_ = message;
+
+    return false;
+}
+
+// the item written, after a comma if it is not the first
+bool result_stream::put()
+{
+    if (size_ > 0 && !out_->write(",", 1))
+        return false;
+    if (!out_->write(item_))
+        return false;
+
+    // the first at once for the client to start on, the others in a while
+    if (size_++ == 0 || std::chrono::steady_clock::now() - flushed_ >= std::chrono::milliseconds(FLUSH_INTERVAL_MS))
+        return flush();
+
+    return true;
+}
+
+}  // namespace xa
@@ -0,0 +1,108 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            RPC Result Stream API documentation.
+ */
+
+/**
+ * @file rpc_stream.hpp
+ *
+ * @brief      Xabyss's RPC Result Stream library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <json/json.h>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "fast_json.hpp"
+#include "http_server.hpp"
+
+namespace xa {
+
+/**
+ * The result of a streaming method, an array its handler appends the items
+ * of as they are produced.
+ *
+ * Streamed, the items are written out as they come, the first one at once
+ * and the others a chunk or FLUSH_INTERVAL_MS at a time, so a result of any
+ * size holds no more than a chunk. Otherwise, in batches and where the
+ * engine doesn't stream, they are collected into a Json::Value array.
+ *
+ * An append fails once the client is gone, or past the deadline of the
+ * request, for the handler to give up.
+ */
+class result_stream {
+public:
+    constexpr static const int FLUSH_INTERVAL_MS = 50;
+
+    explicit result_stream(http::stream* out);
+    explicit result_stream(Json::Value* items);
+
+    result_stream(const result_stream&) = delete;
+    result_stream& operator=(const result_stream&) = delete;
+
+    bool append(const Json::Value& item);
+    bool append(const json::value& item);
+    // an item written with the writer, up to end_item()
+    json::writer& begin_item();
+    bool end_item();
+    bool flush();
+
+    // the error of a handler giving up, returning false
+    bool fail(int code, const std::string& message);
+    void set_deadline(std::chrono::steady_clock::time_point deadline);
+    bool expired() const;
+
+    size_t size() const;
+    int error_code() const;
+    const std::string& error_message() const;
+
+private:
+    bool put();
+
+    http::stream* out_;
+    Json::Value* items_;
+    std::string item_;
+    json::writer writer_;
+    size_t size_;
+    std::chrono::steady_clock::time_point flushed_;
+    std::chrono::steady_clock::time_point deadline_;
+    int error_code_;
+    std::string error_message_;
+};
+
+inline size_t result_stream::size() const
+{
+    return size_;
+}
+
+inline int result_stream::error_code() const
+{
+    return error_code_;
+}
+
+inline const std::string& result_stream::error_message() const
+{
+    return error_message_;
+}
+
+inline void result_stream::set_deadline(std::chrono::steady_clock::time_point deadline)
+{
+    deadline_ = deadline;
+}
+
+inline bool result_stream::expired() const
+{
+    return deadline_ != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() >= deadline_;
+}
+
+}  // namespace xa
@@ -0,0 +1,214 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Software RSS API documentation.
+ */
+
+/**
+ * @file rss.cpp
+ *
+ * @brief      Xabyss's Software RSS library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+#include <thread>
+
+#include "rss.hpp"
+
+namespace pca {
+
+namespace rss {
+
+// Woo and Park, "Scalable TCP Session Monitoring with Symmetric Receive-side Scaling"
+static const uint8_t symmetric_key[toeplitz::KEY_SIZE] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+toeplitz::toeplitz()
+{
+    init(symmetric_key);
+}
+
+toeplitz::toeplitz(const uint8_t (&key)[KEY_SIZE])
+{
+    init(key);
+}
+
+/**
+ * Precompute the hash contribution of every byte value at every position.
+ *
+ * @param key       a KEY_SIZE bytes secret key.
+ */
+void toeplitz::init(const uint8_t* key)
+{
+    for (size_t i = 0; i < MAX_INPUT_SIZE; i++) {
+        // 64 bits of the key starting at byte i cover the 32 bits windows of
+        // all 8 input bits of the byte.
+        uint64_t k = 0;
+        for (size_t j = 0; j < 8; j++) {
+            k = (k << 8) | ((i + j < KEY_SIZE) ? key[i + j] : 0);
+        }
+
+        for (unsigned b = 0; b < 256; b++) {
+            uint32_t v = 0;
+            for (unsigned bit = 0; bit < 8; bit++) {
+                if (b & (0x80 >> bit))
+                    v ^= static_cast<uint32_t>(k >> (32 - bit));
+            }
+            table_[i][b] = v;
+        }
+    }
+}
+
+/**
+ * Compute the Toeplitz hash of a byte string.
+ *
+ * @param input     bytes to hash.
+ * @param n         the length, at most MAX_INPUT_SIZE.
+ * @return the hash value.
+ */
+uint32_t toeplitz::hash(const uint8_t* input, size_t n) const
+{
+    uint32_t h = 0;
+
+    for (size_t i = 0; i < n && i < MAX_INPUT_SIZE; i++) {
+        h ^= table_[i][input[i]];
+    }
+
+    return h;
+}
+
+/**
+ * Compute the Toeplitz hash of a flow as a NIC does: source address,
+ * destination address, source port and destination port in network order.
+ *
+ * @param key       a flow key.
+ * @return the hash value, 0 if it's not an IP flow.
+ */
+uint32_t toeplitz::hash(const flow_key& key) const
+{
+    if (key.version == 0)
+        return 0;
+
+    const size_t n = (key.version == 6) ? 16 : 4;
+    const uint32_t (*t)[256] = table_;
+    uint32_t h = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        h ^= (*t++)[key.src_addr[i]];
+    }
+    for (size_t i = 0; i < n; i++) {
+        h ^= (*t++)[key.dst_addr[i]];
+    }
+    h ^= t[0][key.src_port >> 8] ^ t[1][key.src_port & 0xff]
+        ^ t[2][key.dst_port >> 8] ^ t[3][key.dst_port & 0xff];
+
+    return h;
+}
+
+/**
+ * Create a dispatcher.
+ *
+ * @param nworkers  the number of workers (rings).
+ * @param ring_size the capacity of a ring in packets.
+ * @param linktype  a link-layer header type of the source.
+ */
+dispatcher::dispatcher(unsigned nworkers, size_t ring_size, int linktype)
+    : linktype_(linktype)
+    , nworkers_(nworkers > 0 ? nworkers : 1)
+    , rings_(nworkers_)
+    , stages_(nworkers_)
+    , dropped_(0)
+{
+    for (unsigned i = 0; i < nworkers_; i++) {
+        rings_[i] = std::unique_ptr<ring>(new ring(ring_size));
+        stages_[i].reserve(BATCH_SIZE);
+    }
+}
+
+/**
+ * Find the worker that owns the flow of a packet.
+ *
+ * @param pkt       a packet.
+ * @return the worker index.
+ */
+unsigned dispatcher::worker_of(const packet& pkt) const
+{
+    flow_key key;
+
+    decode::flow_key_of(pkt, &key, linktype_);
+
+    // multiply-shift instead of modulo
+    return static_cast<unsigned>((static_cast<uint64_t>(toeplitz_.hash(key)) * nworkers_) >> 32);
+}
+
+/**
+ * Distribute packets over the worker rings.
+ *
+ * Packets are bucketed per worker first, so each ring is published once per
+ * batch instead of once per packet.
+ *
+ * @param pkts      packets to dispatch.
+ * @param n         the number of packets.
+ * @param lossless  wait for room in full rings instead of dropping packets.
+ * @return the number of packets queued.
+ */
+size_t dispatcher::dispatch(const packet* pkts, size_t n, bool lossless)
+{
+    size_t queued = 0;
+
+    for (size_t off = 0; off < n; off += BATCH_SIZE) {
+        const size_t count = std::min(BATCH_SIZE, n - off);
+
+        for (size_t i = 0; i < count; i++) {
+            stages_[worker_of(pkts[off + i])].push_back(pkts[off + i]);
+        }
+
+        for (unsigned w = 0; w < nworkers_; w++) {
+            std::vector<packet>& stage = stages_[w];
+            if (stage.empty())
+                continue;
+
+            size_t pushed = rings_[w]->push(stage.data(), stage.size());
+            while (lossless && pushed < stage.size()) {
+                std::this_thread::yield();
+                pushed += rings_[w]->push(stage.data() + pushed, stage.size() - pushed);
+            }
+
+            queued += pushed;
+            if (pushed < stage.size())
+                dropped_.fetch_add(stage.size() - pushed, std::memory_order_relaxed);
+
+            stage.clear();
+        }
+    }
+
+    return queued;
+}
+
+/**
+ * Take packets from a worker ring.
+ *
+ * @param worker    the worker index.
+ * @param pkts      a buffer for packets.
+ * @param n         the size of the buffer.
+ * @return the number of packets taken.
+ */
+size_t dispatcher::receive(unsigned worker, packet* pkts, size_t n)
+{
+    return rings_[worker]->pop(pkts, n);
+}
+
+}  // namespace rss
+
+}  // namespace pca
@@ -0,0 +1,99 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Software RSS API documentation.
+ */
+
+/**
+ * @file rss.hpp
+ *
+ * @brief      Xabyss's Software RSS library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include "packet.hpp"
+
+namespace pca {
+
+namespace rss {
+
+/**
+ * Toeplitz hash with per-byte lookup tables.
+ *
+ * The default key repeats 0x6d5a, which makes the hash symmetric: both
+ * directions of a flow (src/dst addresses and ports swapped) hash the same.
+ */
+class toeplitz {
+public:
+    constexpr static const size_t KEY_SIZE = 40;
+    constexpr static const size_t MAX_INPUT_SIZE = 36;     // IPv6 addresses + ports
+
+    toeplitz();
+    explicit toeplitz(const uint8_t (&key)[KEY_SIZE]);
+
+    uint32_t hash(const uint8_t* input, size_t n) const;
+    uint32_t hash(const flow_key& key) const;
+
+private:
+    void init(const uint8_t* key);
+
+    uint32_t table_[MAX_INPUT_SIZE][256];
+};
+
+/**
+ * Spreads packets of a single source over per-worker rings by flow.
+ *
+ * dispatch() must be called from one thread only, and each worker ring must
+ * be drained by one thread only (single-producer/single-consumer).
+ */
+class dispatcher {
+public:
+    constexpr static const size_t BATCH_SIZE = 256;
+
+    typedef boost::lockfree::spsc_queue<packet> ring;
+
+    dispatcher(unsigned nworkers, size_t ring_size, int linktype = LINKTYPE_ETHERNET);
+
+    size_t dispatch(const packet* pkts, size_t n, bool lossless = false);
+    size_t receive(unsigned worker, packet* pkts, size_t n);
+
+    unsigned worker_of(const packet& pkt) const;
+    unsigned nworkers() const;
+    uint64_t dropped() const;
+
+private:
+    toeplitz toeplitz_;
+    int linktype_;
+    unsigned nworkers_;
+    std::vector<std::unique_ptr<ring>> rings_;
+    std::vector<std::vector<packet>> stages_;
+    std::atomic<uint64_t> dropped_;
+};
+
+inline unsigned dispatcher::nworkers() const
+{
+    return nworkers_;
+}
+
+inline uint64_t dispatcher::dropped() const
+{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+}  // namespace rss
+
+}  // namespace pca
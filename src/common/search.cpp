@@ -0,0 +1,443 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet search API documentation.
+ */
+
+/**
+ * @file search.cpp
+ *
+ * @brief      Xabyss's Packet search library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "block_index.hpp"
+#include "logger.hpp"
+#include "pcap_file.hpp"
+#include "planner.hpp"
+#include "search.hpp"
+
+namespace pca {
+
+namespace search {
+
+namespace {
+
+/**
+ * Copies of the matching packets, of which only the earliest are kept once
+ * there are more than the limit.
+ *
+ * The packet data goes into memory up to SPILL_BYTES, then into an unlinked
+ * file next to the output so that a large limit doesn't take as much memory.
+ */
+class collector {
+public:
+    constexpr static const size_t SPILL_BYTES = 8 << 20;
+
+    collector(size_t limit, const std::string& filename)
+        : limit_(limit)
+        , truncated_(false)
+        , spill_name_(filename + ".spill")
+        , spill_fd_(-1)
+        , spilled_(0)
+        , failed_(false)
+    {
+    }
+
+    ~collector()
+    {
+        if (spill_fd_ >= 0)
+            ::close(spill_fd_);
+    }
+
+    collector(const collector&) = delete;
+    collector& operator=(const collector&) = delete;
+
+    void add(const packet& pkt)
+    {
+        hit h = { pkt.ts, pkt.caplen, pkt.len, spilled_ + data_.size() };
+
+        hits_.push_back(h);
+        data_.append(reinterpret_cast<const char*>(pkt.data), pkt.caplen);
+        if (data_.size() >= SPILL_BYTES)
+            spill();
+        if (hits_.size() >= 2 * limit_ + 1024)
+            trim();
+    }
+
+    void trim()
+    {
+        std::stable_sort(hits_.begin(), hits_.end(), [](const hit& a, const hit& b) { return a.ts < b.ts; });
+        if (hits_.size() <= limit_)
+            return;
+
+        hits_.resize(limit_);
+        truncated_ = true;
+
+        // the dropped packets are left in the spill file
+        if (spilled_ > 0)
+            return;
+
+        std::string data;
+        for (auto& h : hits_) {
+            data.append(data_, h.offset, h.caplen);
+            h.offset = data.size() - h.caplen;
+        }
+        data_.swap(data);
+    }
+
+    // no packet from this time on can make it into the result
+    uint64_t bound() const
+    {
+        return hits_.size() >= limit_ ? hits_[limit_ - 1].ts : UINT64_MAX;
+    }
+
+    bool write(pcap::writer* out, result* res, const control* ctl)
+    {
+        std::vector<uint8_t> buf;
+
+        trim();
+        if (failed_)
+            return false;
+
+        for (const auto& h : hits_) {
+            packet pkt = { h.ts, h.caplen, h.len, nullptr };
+
+            if (ctl != nullptr && ctl->cancelled.load(std::memory_order_relaxed))
+                return false;
+
+            if (h.offset >= spilled_) {
+                pkt.data = reinterpret_cast<const uint8_t*>(&data_[h.offset - spilled_]);
+            } else {
+                buf.resize(h.caplen);
+                if (pread(spill_fd_, buf.data(), h.caplen, h.offset) != static_cast<ssize_t>(h.caplen)) {
+                    XA_LOGGER(error) << "search: can't read " << spill_name_ << ": " << strerror(errno);
+                    return false;
+                }
+                pkt.data = buf.data();
+            }
+
+            if (!out->write(pkt))
+                return false;
+            res->packets++;
+            res->bytes += h.caplen;
+        }
+        res->truncated = truncated_;
+
+        return true;
+    }
+
+    void set_truncated()
+    {
+        truncated_ = true;
+    }
+
+private:
+    struct hit {
+        uint64_t ts;
+        uint32_t caplen;
+        uint32_t len;
+        uint64_t offset;            // in the spill file, then in data_
+    };
+
+    void spill()
+    {
+        if (spill_fd_ < 0 && !failed_) {
+            spill_fd_ = ::open(spill_name_.c_str(), O_RDWR | O_CREAT | O_EXCL | O_TRUNC, 0600);
+            if (spill_fd_ < 0) {
+                XA_LOGGER(error) << "search: can't create " << spill_name_ << ": " << strerror(errno);
+                failed_ = true;
+            } else {
+                ::unlink(spill_name_.c_str());
+            }
+        }
+        if (failed_)
+            return;
+
+        if (pwrite(spill_fd_, data_.data(), data_.size(), spilled_) != static_cast<ssize_t>(data_.size())) {
+            XA_LOGGER(error) << "search: can't write " << spill_name_ << ": " << strerror(errno);
+            failed_ = true;
+            return;
+        }
+        spilled_ += data_.size();
+        data_.clear();
+    }
+
+    size_t limit_;
+    bool truncated_;
+    std::vector<hit> hits_;
+    std::string data_;
+    std::string spill_name_;
+    int spill_fd_;
+    uint64_t spilled_;
+    bool failed_;
+};
+
+/**
+ * Runs the predicate over batches of packets in [begin_ts, end_ts).
+ */
+class scanner {
+public:
+    scanner(const query::program& query, uint64_t begin_ts, uint64_t end_ts, int linktype,
+            collector* hits, result* res, const control* ctl, segment_result* record = nullptr)
+        : query_(query)
+        , begin_ts_(begin_ts)
+        , end_ts_(end_ts)
+        , batch_(linktype)
+        , hits_(hits)
+        , res_(res)
+        , ctl_(ctl)
+        , record_(record)
+    {
+    }
+
+    // false once the search is cancelled
+    bool add(const packet& pkt)
+    {
+        if (ctl_ != nullptr && ctl_->cancelled.load(std::memory_order_relaxed))
+            return false;
+
+        if (pkt.ts < begin_ts_ || pkt.ts >= end_ts_)
+            return true;
+
+        batch_.add(pkt);
+        if (batch_.full())
+            flush();
+
+        return true;
+    }
+
+    // must be called before the packets of the batch are released
+    void flush()
+    {
+        size_t n = query_.run(&batch_);
+        const uint16_t* selected = batch_.selected();
+
+        for (size_t i = 0; i < n; i++) {
+            hits_->add(batch_.at(selected[i]));
+        }
+        if (record_ != nullptr)
+            keep(selected, n);
+        res_->scanned += batch_.size();
+        res_->matched += n;
+        batch_.clear();
+    }
+
+private:
+    // copy the hits for the cache while they fit into it
+    void keep(const uint16_t* selected, size_t n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            record_->add(batch_.at(selected[i]));
+        }
+        if (record_->bytes() > ctl_->results->budget() / 4) {
+            *record_ = segment_result();
+            record_->overflow = true;
+            record_ = nullptr;
+        }
+    }
+
+    const query::program& query_;
+    uint64_t begin_ts_;
+    uint64_t end_ts_;
+    query::batch batch_;
+    collector* hits_;
+    result* res_;
+    const control* ctl_;
+    segment_result* record_;
+};
+
+// search a stored segment the way the plan chose, false if it's gone
+static bool search_segment(const segment_plan& plan, const query::program& query, uint64_t begin_ts,
+                           uint64_t end_ts, collector* hits, result* res, const control* ctl,
+                           segment_result* record, int* linktype)
+{
+    const segment::info& info = plan.segment;
+    pcap::reader reader;
+    std::vector<segment::index_entry> index;
+
+    // the segment may have been evicted since
+    if (!reader.open(info.path)) {
+        XA_LOGGER(debug) << "search: can't open " << info.path;
+        return false;
+    }
+    *linktype = reader.linktype();
+    res->segments++;
+    if (record != nullptr)
+        record->linktype = reader.linktype();
+
+    scanner scan(query, begin_ts, end_ts, reader.linktype(), hits, res, ctl, record);
+
+    if (plan.access == ACCESS_SCAN || !segment::load_index(info.path, &index) || index.empty()) {
+        packet pkt;
+        while (reader.next(&pkt) && scan.add(pkt)) {
+        }
+        scan.flush();
+        return true;
+    }
+
+    // the blocks of the time range
+    auto lower = std::upper_bound(index.begin(), index.end(), begin_ts,
+                                  [](uint64_t ts, const segment::index_entry& e) { return ts < e.ts; });
+    auto upper = std::lower_bound(index.begin(), index.end(), end_ts,
+                                  [](const segment::index_entry& e, uint64_t ts) { return e.ts < ts; });
+    uint32_t first = lower == index.begin() ? 0 : static_cast<uint32_t>(lower - index.begin() - 1);
+    bitmap blocks = bitmap::range(first, static_cast<uint32_t>(upper - index.begin()));
+
+    if (plan.access == ACCESS_INDEX) {
+        segment::block_index filter;
+        bitmap matched;
+
+        if (filter.load(info.path) && segment::evaluate(filter, query.prefilter(), &matched)) {
+            blocks &= matched;
+            res->indexed++;
+        }
+    }
+    res->blocks += blocks.cardinality();
+
+    segment::read_blocks(&reader, index, blocks, [&](const packet& pkt) {
+        return scan.add(pkt) && pkt.ts < end_ts;
+    });
+    scan.flush();
+
+    return true;
+}
+
+// the packets of a segment from an earlier search
+static void replay(const segment_result& cached, collector* hits, result* res, int* linktype)
+{
+    for (const auto& h : cached.hits) {
+        packet pkt = { h.ts, h.caplen, h.len, reinterpret_cast<const uint8_t*>(&cached.data[h.offset]) };
+        hits->add(pkt);
+    }
+    *linktype = cached.linktype;
+    res->matched += cached.hits.size();
+    res->cached++;
+}
+
+}  // namespace
+
+/**
+ * Write the packets in [begin_ts, end_ts) matching a predicate into a pcap
+ * file, ordered by timestamp. Each stored segment is read the way the planner
+ * finds the cheapest, and the recent buffer is read for the part of the range
+ * it holds.
+ *
+ * Once more than the limit packets matched, only the earliest are written
+ * and the segments starting after them are skipped.
+ *
+ * A search cancelled through its control stops before the next packet read
+ * and writes nothing. With a cache in the control, the segments searched
+ * before for the same query and range are taken from it.
+ *
+ * @param filename  an output filename.
+ * @param query     a compiled predicate.
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param limit     the maximum number of packets to write.
+ * @param storage   the stored segments, may be null.
+ * @param recent    the recent buffer, may be null.
+ * @param res       the result to be filled.
+ * @param ctl       the cancellation flag, progress callback and cache, may be null.
+ * @return true on success, false otherwise.
+ */
+bool write(const std::string& filename, const query::program& query, uint64_t begin_ts, uint64_t end_ts,
+           size_t limit, const retention* storage, const recent_buffer* recent, result* res,
+           control* ctl)
+{
+    *res = result();
+
+    if (limit == 0)
+        limit = 1;
+
+    plan p = make_plan(query, begin_ts, end_ts, storage, recent);
+    collector hits(limit, filename);
+    int linktype = recent != nullptr ? recent->linktype() : LINKTYPE_ETHERNET;
+    auto cancelled = [&] {
+        res->cancelled = ctl != nullptr && ctl->cancelled.load(std::memory_order_relaxed);
+        return res->cancelled;
+    };
+
+    res->planned = p.segments.size();
+    for (const auto& segment : p.segments) {
+        hits.trim();
+        if (segment.segment.first_ts > hits.bound()) {
+            hits.set_truncated();
+            break;
+        }
+        if (cancelled())
+            return false;
+
+        std::string key;
+        std::shared_ptr<const segment_result> cached;
+        if (ctl != nullptr && ctl->results != nullptr) {
+            key = cache::key_of(query, segment.segment, p.begin_ts, p.cut);
+            cached = ctl->results->find(key);
+        }
+
+        if (cached) {
+            replay(*cached, &hits, res, &linktype);
+        } else {
+            std::shared_ptr<segment_result> record(key.empty() ? nullptr : new segment_result);
+            if (search_segment(segment, query, p.begin_ts, p.cut, &hits, res, ctl, record.get(), &linktype)
+                    && record && !record->overflow && !ctl->cancelled.load(std::memory_order_relaxed))
+                ctl->results->insert(key, record);
+        }
+
+        if (ctl != nullptr && ctl->progress)
+            ctl->progress(*res);
+    }
+
+    if (cancelled())
+        return false;
+
+    if (recent != nullptr && p.cut < p.end_ts) {
+        recent_buffer::snapshot snap;
+
+        hits.trim();
+        if (p.cut <= hits.bound()) {
+            recent->read(p.cut, p.end_ts, &snap);
+
+            scanner scan(query, p.cut, p.end_ts, recent->linktype(), &hits, res, ctl);
+            for (const auto& pkt : snap.packets) {
+                if (!scan.add(pkt))
+                    break;
+            }
+            scan.flush();
+            res->memory = true;
+            if (cancelled())
+                return false;
+        } else {
+            hits.set_truncated();
+        }
+    }
+
+    pcap::writer out(4 << 20);
+
+    if (!out.open(filename, linktype))
+        return false;
+    if (!hits.write(&out, res, ctl)) {
+        out.close();
+        ::unlink(filename.c_str());
+        cancelled();
+        return false;
+    }
+
+    return out.close();
+}
+
+}  // namespace search
+
+}  // namespace pca
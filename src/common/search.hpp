@@ -0,0 +1,68 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Packet search API documentation.
+ */
+
+/**
+ * @file search.hpp
+ *
+ * @brief      Xabyss's Packet search library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "packet_ring.hpp"
+#include "query.hpp"
+#include "retention.hpp"
+#include "search_cache.hpp"
+
+namespace pca {
+
+namespace search {
+
+struct result {
+    uint64_t packets = 0;       // matching packets written
+    uint64_t bytes = 0;
+    uint64_t scanned = 0;       // packets the predicate ran on
+    uint64_t matched = 0;       // packets the predicate selected, before the limit
+    size_t planned = 0;         // segments in the plan
+    size_t segments = 0;        // segments read from disk
+    size_t indexed = 0;         // segments narrowed by their block index
+    size_t cached = 0;          // segments taken from the cache
+    uint64_t blocks = 0;        // blocks read from disk
+    bool memory = false;        // read from the recent buffer
+    bool truncated = false;     // more packets matched than the limit
+    bool cancelled = false;
+};
+
+/**
+ * Hooks into a running search: a flag to give it up, checked before every
+ * packet read, a callback after every segment read, and the cache of the
+ * results by segment.
+ */
+struct control {
+    std::atomic<bool> cancelled{false};
+    std::function<void(const result&)> progress;
+    cache* results = nullptr;
+};
+
+bool write(const std::string& filename, const query::program& query, uint64_t begin_ts, uint64_t end_ts,
+           size_t limit, const retention* storage, const recent_buffer* recent, result* res,
+           control* ctl = nullptr);
+
+}  // namespace search
+
+}  // namespace pca
@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search cache API documentation.
+ */
+
+/**
+ * @file search_cache.cpp
+ *
+ * @brief      Xabyss's Search cache library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <algorithm>
+
+#include "fmt/format.h"
+
+#include "search_cache.hpp"
+
+namespace pca {
+
+namespace search {
+
+void segment_result::add(const packet& pkt)
+{
+    hit h = { pkt.ts, pkt.caplen, pkt.len, data.size() };
+
+    hits.push_back(h);
+    data.append(reinterpret_cast<const char*>(pkt.data), pkt.caplen);
+}
+
+size_t segment_result::bytes() const
+{
+    return sizeof(*this) + hits.size() * sizeof(hit) + data.size();
+}
+
+cache::cache(size_t budget)
+    : budget_(budget)
+    , bytes_(0)
+    , hits_(0)
+    , misses_(0)
+{
+}
+
+/**
+ * Build the key of the result of a query in a segment.
+ *
+ * @param query     a compiled predicate.
+ * @param info      a sealed segment.
+ * @param begin_ts  the first timestamp of the search.
+ * @param end_ts    the timestamp the search stops at.
+ * @return the key.
+ */
+std::string cache::key_of(const query::program& query, const segment::info& info, uint64_t begin_ts,
+                          uint64_t end_ts)
+{
+    // ranges covering the whole segment are the same
+    uint64_t first = std::max(begin_ts, info.first_ts);
+    uint64_t last = std::min(end_ts, info.last_ts + 1);
+
+    return fmt::format("{}\n{}\n{}-{}", query.normalized(), info.path, first, last);
+}
+
+std::shared_ptr<const segment_result> cache::find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+        misses_++;
+        return nullptr;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second);
+    hits_++;
+
+    return it->second->second;
+}
+
+/**
+ * Add a result, evicting the least recently used ones to make room.
+ *
+ * @param key       the key from key_of().
+ * @param result    the result.
+ * @return true if added, false if it takes more than a quarter of the budget.
+ */
+bool cache::insert(const std::string& key, std::shared_ptr<const segment_result> result)
+{
+    size_t size = key.size() + result->bytes();
+
+    if (size > budget_ / 4)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+        bytes_ -= it->first.size() + it->second->second->bytes();
+        lru_.erase(it->second);
+        map_.erase(it);
+    }
+
+    while (!lru_.empty() && bytes_ + size > budget_) {
+        const entry& oldest = lru_.back();
+        bytes_ -= oldest.first.size() + oldest.second->bytes();
+        map_.erase(oldest.first);
+        lru_.pop_back();
+    }
+
+    lru_.emplace_front(key, std::move(result));
+    map_[key] = lru_.begin();
+    bytes_ += size;
+
+    return true;
+}
+
+void cache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    lru_.clear();
+    map_.clear();
+    bytes_ = 0;
+}
+
+size_t cache::bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return bytes_;
+}
+
+size_t cache::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return map_.size();
+}
+
+uint64_t cache::hits() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return hits_;
+}
+
+uint64_t cache::misses() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return misses_;
+}
+
+}  // namespace search
+
+}  // namespace pca
@@ -0,0 +1,106 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search cache API documentation.
+ */
+
+/**
+ * @file search_cache.hpp
+ *
+ * @brief      Xabyss's Search cache library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "query.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+namespace search {
+
+/**
+ * The packets of a sealed segment matching a query in a time range.
+ */
+struct segment_result {
+    struct hit {
+        uint64_t ts;
+        uint32_t caplen;
+        uint32_t len;
+        size_t offset;          // in data
+    };
+
+    std::vector<hit> hits;
+    std::string data;
+    int linktype = LINKTYPE_ETHERNET;
+    bool overflow = false;      // too large to keep, incomplete
+
+    void add(const packet& pkt);
+    size_t bytes() const;
+};
+
+/**
+ * The results of searches by query and sealed segment, so that a search
+ * repeated over a moving time range only reads the segments it hasn't read
+ * before and the recent buffer.
+ *
+ * The key is the compiled code of the query, the segment and the part of the
+ * time range in it; a query with the time range in its text, e.g. "ts >= x",
+ * is a new query each time it moves. The least recently used results are
+ * evicted beyond the byte budget.
+ */
+class cache {
+public:
+    explicit cache(size_t budget);
+
+    cache(const cache&) = delete;
+    cache& operator=(const cache&) = delete;
+
+    static std::string key_of(const query::program& query, const segment::info& info, uint64_t begin_ts,
+                              uint64_t end_ts);
+
+    std::shared_ptr<const segment_result> find(const std::string& key);
+    bool insert(const std::string& key, std::shared_ptr<const segment_result> result);
+    void clear();
+
+    size_t budget() const;
+    size_t bytes() const;
+    size_t size() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    typedef std::pair<std::string, std::shared_ptr<const segment_result>> entry;
+
+    size_t budget_;
+    mutable std::mutex mutex_;
+    std::list<entry> lru_;      // the most recently used first
+    std::unordered_map<std::string, std::list<entry>::iterator> map_;
+    size_t bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+};
+
+inline size_t cache::budget() const
+{
+    return budget_;
+}
+
+}  // namespace search
+
+}  // namespace pca
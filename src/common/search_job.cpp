@@ -0,0 +1,328 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search job API documentation.
+ */
+
+/**
+ * @file search_job.cpp
+ *
+ * @brief      Xabyss's Search job library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "fmt/format.h"
+
+#include "logger.hpp"
+#include "pcap_file.hpp"
+#include "search_job.hpp"
+
+namespace pca {
+
+namespace search {
+
+constexpr static const size_t MAX_FINISHED_JOBS = 64;
+
+// the calling thread gets the CPU and the disk only when nothing else wants them
+static void lower_priority()
+{
+    struct sched_param param = {};
+
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0
+            && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19) < 0)
+        XA_LOGGER(debug) << "search: can't lower the CPU priority";
+
+#ifdef SYS_ioprio_set
+    constexpr static const int IOPRIO_WHO_PROCESS = 1;
+    constexpr static const int IOPRIO_CLASS_IDLE = 3;
+    constexpr static const int IOPRIO_CLASS_SHIFT = 13;
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+        XA_LOGGER(debug) << "search: can't lower the I/O priority";
+#endif
+}
+
+static bool is_finished(job_state state)
+{
+    return state == JOB_DONE || state == JOB_FAILED || state == JOB_CANCELLED;
+}
+
+/**
+ * Start the workers of search jobs.
+ *
+ * @param dir       the directory of the result files.
+ * @param storage   the stored segments, may be null.
+ * @param recent    the recent buffer, may be null.
+ * @param results   the cache of the results by segment, may be null.
+ * @param workers   the number of jobs run at once.
+ * @param max_pending the maximum number of jobs queued or running.
+ */
+job_manager::job_manager(const std::string& dir, const retention* storage, const recent_buffer* recent,
+                         cache* results, unsigned workers, size_t max_pending)
+    : dir_(dir)
+    , storage_(storage)
+    , recent_(recent)
+    , results_(results)
+    , max_pending_(max_pending)
+    , next_id_(1)
+    , stopped_(false)
+{
+    for (unsigned i = 0; i < std::max(workers, 1U); i++) {
+        workers_.emplace_back(&job_manager::run, this);
+    }
+}
+
+job_manager::~job_manager()
+{
+    stop();
+}
+
+/**
+ * Queue a search.
+ *
+ * @param query     a compiled predicate.
+ * @param begin_ts  the first timestamp.
+ * @param end_ts    the timestamp to stop at.
+ * @param limit     the maximum number of packets to keep.
+ * @return the job id, or -1 if too many jobs are pending.
+ */
+int job_manager::start(const query::program& query, uint64_t begin_ts, uint64_t end_ts, size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t pending = 0;
+
+    if (stopped_)
+        return -1;
+
+    for (const auto& it : jobs_) {
+        if (!is_finished(it.second->state))
+            pending++;
+    }
+    if (pending >= max_pending_)
+        return -1;
+
+    forget_finished();
+
+    int id = next_id_++;
+    std::unique_ptr<job> j(new job);
+
+    j->query = query;
+    j->begin_ts = begin_ts;
+    j->end_ts = end_ts;
+    j->limit = limit;
+    j->path = fmt::format("{}/job-{}.pcap", dir_, id);
+    j->state = JOB_QUEUED;
+    jobs_[id] = std::move(j);
+    queue_.push_back(id);
+    cond_.notify_one();
+
+    return id;
+}
+
+bool job_manager::get_status(int id, job_status* st) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = jobs_.find(id);
+    if (it == jobs_.end())
+        return false;
+
+    const job& j = *it->second;
+    st->state = j.state;
+    st->query = j.query.text();
+    st->path = j.state == JOB_DONE ? j.path : std::string();
+    st->res = j.res;
+
+    return true;
+}
+
+/**
+ * Read a page of the result of a finished job.
+ *
+ * @param id        a job id.
+ * @param cursor    the offset of the first packet, 0 for the beginning.
+ * @param limit     the maximum number of packets to read.
+ * @param fn        called on each packet.
+ * @param next      the cursor of the next page to be filled, 0 at the end.
+ * @return true on success, false if the job isn't done or the cursor is invalid.
+ */
+bool job_manager::fetch(int id, uint64_t cursor, size_t limit, const packet_func& fn, uint64_t* next) const
+{
+    std::string path;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = jobs_.find(id);
+        if (it == jobs_.end() || it->second->state != JOB_DONE)
+            return false;
+        path = it->second->path;
+    }
+
+    // the file stays mapped even if the job is forgotten meanwhile
+    pcap::reader reader;
+    packet pkt;
+
+    if (!reader.open(path))
+        return false;
+    if (cursor != 0 && !reader.seek(cursor))
+        return false;
+
+    for (size_t n = 0; n < limit && reader.next(&pkt); n++) {
+        fn(pkt, reader.linktype());
+    }
+    *next = reader.offset() < reader.size() ? reader.offset() : 0;
+
+    return true;
+}
+
+/**
+ * Cancel a job: a queued one never runs, a running one stops before its next
+ * packet read, and the result of a finished one is removed.
+ *
+ * @param id        a job id.
+ * @return true if the job exists, false otherwise.
+ */
+bool job_manager::cancel(int id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = jobs_.find(id);
+    if (it == jobs_.end())
+        return false;
+
+    job& j = *it->second;
+    switch (j.state) {
+    case JOB_QUEUED:
+        for (auto q = queue_.begin(); q != queue_.end(); ++q) {
+            if (*q == id) {
+                queue_.erase(q);
+                break;
+            }
+        }
+        j.state = JOB_CANCELLED;
+        break;
+    case JOB_RUNNING:
+        j.ctl.cancelled = true;
+        break;
+    case JOB_DONE:
+        ::unlink(j.path.c_str());
+        j.state = JOB_CANCELLED;
+        break;
+    default:
+        break;
+    }
+
+    return true;
+}
+
+/**
+ * Cancel every job, wait for the workers and remove the result files.
+ */
+void job_manager::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (stopped_)
+            return;
+        stopped_ = true;
+        queue_.clear();
+        for (auto& it : jobs_) {
+            it.second->ctl.cancelled = true;
+        }
+        cond_.notify_all();
+    }
+
+    for (auto& t : workers_) {
+        t.join();
+    }
+
+    for (auto& it : jobs_) {
+        if (it.second->state == JOB_DONE)
+            ::unlink(it.second->path.c_str());
+    }
+}
+
+// must be called with the lock held
+void job_manager::forget_finished()
+{
+    size_t finished = 0;
+
+    for (const auto& it : jobs_) {
+        if (is_finished(it.second->state))
+            finished++;
+    }
+
+    // the oldest first
+    for (auto it = jobs_.begin(); it != jobs_.end() && finished >= MAX_FINISHED_JOBS; ) {
+        if (is_finished(it->second->state)) {
+            if (it->second->state == JOB_DONE)
+                ::unlink(it->second->path.c_str());
+            it = jobs_.erase(it);
+            finished--;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void job_manager::run()
+{
+    lower_priority();
+
+    for (;;) {
+        job* j;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            cond_.wait(lock, [this] { return stopped_ || !queue_.empty(); });
+            if (stopped_)
+                return;
+
+            // running jobs are never forgotten
+            j = jobs_[queue_.front()].get();
+            queue_.pop_front();
+            j->state = JOB_RUNNING;
+        }
+
+        result res;
+
+        j->ctl.results = results_;
+        j->ctl.progress = [this, j](const result& r) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            j->res = r;
+        };
+
+        bool ok = write(j->path, j->query, j->begin_ts, j->end_ts, j->limit, storage_, recent_, &res, &j->ctl);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        j->res = res;
+        if (ok) {
+            j->state = JOB_DONE;
+        } else if (res.cancelled) {
+            j->state = JOB_CANCELLED;
+        } else {
+            j->state = JOB_FAILED;
+            ::unlink(j->path.c_str());
+        }
+    }
+}
+
+}  // namespace search
+
+}  // namespace pca
@@ -0,0 +1,111 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Search job API documentation.
+ */
+
+/**
+ * @file search_job.hpp
+ *
+ * @brief      Xabyss's Search job library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "packet.hpp"
+#include "search.hpp"
+
+namespace pca {
+
+namespace search {
+
+enum job_state {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED,
+};
+
+struct job_status {
+    job_state state;
+    std::string query;
+    std::string path;           // the result file, once done
+    result res;                 // so far while running
+};
+
+/**
+ * Searches run in the background by a fixed number of worker threads at
+ * idle CPU and I/O priority, so that they only take what capture leaves.
+ *
+ * The matching packets of a job go into a pcap file of its own, read back a
+ * page at a time through a cursor: the offset of the next packet in the file,
+ * 0 being the first one. The files are removed along with their jobs.
+ */
+class job_manager {
+public:
+    typedef std::function<void(const packet& pkt, int linktype)> packet_func;
+
+    job_manager(const std::string& dir, const retention* storage, const recent_buffer* recent,
+                cache* results = nullptr, unsigned workers = 2, size_t max_pending = 16);
+    ~job_manager();
+
+    job_manager(const job_manager&) = delete;
+    job_manager& operator=(const job_manager&) = delete;
+
+    int start(const query::program& query, uint64_t begin_ts, uint64_t end_ts, size_t limit);
+    bool get_status(int id, job_status* st) const;
+    bool fetch(int id, uint64_t cursor, size_t limit, const packet_func& fn, uint64_t* next) const;
+    bool cancel(int id);
+    void stop();
+
+private:
+    struct job {
+        query::program query;
+        uint64_t begin_ts;
+        uint64_t end_ts;
+        size_t limit;
+        std::string path;
+        job_state state;
+        result res;
+        control ctl;
+    };
+
+    void run();
+    void forget_finished();
+
+    std::string dir_;
+    const retention* storage_;
+    const recent_buffer* recent_;
+    cache* results_;
+    size_t max_pending_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::map<int, std::unique_ptr<job>> jobs_;
+    std::deque<int> queue_;
+    std::vector<std::thread> workers_;
+    int next_id_;
+    bool stopped_;
+};
+
+}  // namespace search
+
+}  // namespace pca
@@ -0,0 +1,273 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Segment storage API documentation.
+ */
+
+/**
+ * @file segment.cpp
+ *
+ * @brief      Xabyss's Segment storage library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fmt/format.h"
+
+#include "block_index.hpp"
+#include "logger.hpp"
+#include "segment.hpp"
+
+namespace pca {
+
+namespace segment {
+
+constexpr const unsigned filter_stats::COMMON_TERMS;
+
+/**
+ * Build the name of the hour directory of a timestamp.
+ *
+ * @param ts        a timestamp in nanoseconds.
+ * @return the directory name, YYYYMMDDHH.
+ */
+std::string hour_of(uint64_t ts)
+{
+    time_t sec = static_cast<time_t>(ts / 1000000000ULL);
+    struct tm dt;
+    char hour[16];
+
+    gmtime_r(&sec, &dt);
+    strftime(hour, sizeof(hour), "%Y%m%d%H", &dt);
+
+    return hour;
+}
+
+/**
+ * Build the path of a segment.
+ *
+ * @param root      the data directory.
+ * @param first_ts  the timestamp of the first packet in nanoseconds.
+ * @param worker    the worker index.
+ * @return the pcap file path.
+ */
+std::string path_of(const std::string& root, uint64_t first_ts, unsigned worker)
+{
+    return fmt::format("{}/{}/{:020d}-{:02d}.pcap", root, hour_of(first_ts), first_ts, worker);
+}
+
+/**
+ * Build the timestamp index path of a segment.
+ *
+ * @param path      the pcap file path.
+ * @return the index file path.
+ */
+std::string index_path_of(const std::string& path)
+{
+    return path.substr(0, path.rfind('.')) + ".idx";
+}
+
+/**
+ * Parse the first timestamp and the worker out of a segment path.
+ *
+ * @param path      the pcap file path.
+ * @param first_ts  the timestamp of the first packet to be filled.
+ * @param worker    the worker index to be filled.
+ * @return true if the path names a segment, false otherwise.
+ */
+bool parse_path(const std::string& path, uint64_t* first_ts, unsigned* worker)
+{
+    size_t slash = path.rfind('/');
+    std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+    unsigned long long ts;
+    unsigned w;
+    int n = 0;
+
+    if (sscanf(name.c_str(), "%20llu-%u.pcap%n", &ts, &w, &n) != 2
+            || n != static_cast<int>(name.size()))
+        return false;
+
+    *first_ts = ts;
+    *worker = w;
+
+    return true;
+}
+
+/**
+ * Load the timestamp index of a segment.
+ *
+ * @param path      the pcap file path.
+ * @param index     entries to be filled.
+ * @return true on success, false otherwise.
+ */
+bool load_index(const std::string& path, std::vector<index_entry>* index)
+{
+    struct stat st;
+    int fd = ::open(index_path_of(path).c_str(), O_RDONLY);
+
+    index->clear();
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    index->resize(st.st_size / sizeof(index_entry));
+    size_t n = index->size() * sizeof(index_entry);
+    bool ok = (::read(fd, index->data(), n) == static_cast<ssize_t>(n));
+    ::close(fd);
+
+    if (!ok)
+        index->clear();
+
+    return ok;
+}
+
+static bool make_dirs(const std::string& path)
+{
+    for (size_t pos = path.find('/', 1); ; pos = path.find('/', pos + 1)) {
+        std::string dir = path.substr(0, pos);
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            XA_LOGGER(error) << "can't create " << dir << ": " << strerror(errno);
+            return false;
+        }
+        if (pos == std::string::npos)
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * Create a segment writer of a worker.
+ *
+ * @param root      the data directory.
+ * @param worker    the worker index.
+ * @param linktype  a link-layer header type of the packets.
+ * @param max_bytes a segment is sealed when it grows beyond this size.
+ * @param max_duration_ns a segment is sealed when it spans more than this.
+ */
+writer::writer(const std::string& root, unsigned worker, int linktype,
+               uint64_t max_bytes, uint64_t max_duration_ns)
+    : root_(root)
+    , worker_(worker)
+    , linktype_(linktype)
+    , max_bytes_(max_bytes)
+    , max_duration_ns_(max_duration_ns)
+    , blocks_(new block_index)
+    , next_index_offset_(0)
+{
+}
+
+writer::~writer()
+{
+    seal();
+}
+
+bool writer::open_next(uint64_t ts)
+{
+    current_ = info();
+    current_.path = path_of(root_, ts, worker_);
+    current_.worker = worker_;
+    current_.first_ts = ts;
+    current_.last_ts = ts;
+
+    std::string dir = current_.path.substr(0, current_.path.rfind('/'));
+    if (!make_dirs(dir) || !out_.open(current_.path, linktype_))
+        return false;
+
+    index_.clear();
+    blocks_->clear();
+    next_index_offset_ = 0;
+
+    return true;
+}
+
+/**
+ * Store a packet, rotating the segment if needed.
+ *
+ * @param pkt       a packet.
+ * @param key       the 5-tuple of the packet to index, if it's an IP packet.
+ * @return true on success, false otherwise.
+ */
+bool writer::write(const packet& pkt, const flow_key* key)
+{
+    if (out_.is_open()) {
+        if (out_.offset() >= max_bytes_
+                || (pkt.ts > current_.first_ts && pkt.ts - current_.first_ts >= max_duration_ns_))
+            seal();
+    }
+
+    if (!out_.is_open() && !open_next(pkt.ts))
+        return false;
+
+    uint64_t offset = out_.offset();
+    if (offset >= next_index_offset_) {
+        index_entry entry = { pkt.ts, offset };
+        index_.push_back(entry);
+        next_index_offset_ = offset + INDEX_INTERVAL;
+    }
+
+    if (!out_.write(pkt))
+        return false;
+
+    if (key != nullptr)
+        blocks_->add(index_.size() - 1, *key);
+
+    if (pkt.ts > current_.last_ts)
+        current_.last_ts = pkt.ts;
+    current_.packets++;
+
+    return true;
+}
+
+/**
+ * Close the current segment and write its timestamp index.
+ */
+void writer::seal()
+{
+    if (!out_.is_open())
+        return;
+
+    current_.bytes = out_.offset();
+    out_.close();
+
+    std::string idx = index_path_of(current_.path);
+    int fd = ::open(idx.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        size_t n = index_.size() * sizeof(index_entry);
+        if (::write(fd, index_.data(), n) == static_cast<ssize_t>(n))
+            current_.flags |= FLAG_INDEX;
+        else
+            XA_LOGGER(error) << "can't write " << idx << ": " << strerror(errno);
+        ::close(fd);
+    } else {
+        XA_LOGGER(error) << "can't create " << idx << ": " << strerror(errno);
+    }
+
+    if (blocks_->terms() > 0) {
+        blocks_->set_blocks(index_.size());
+        if (blocks_->save(current_.path, &current_.filter))
+            current_.flags |= FLAG_FILTER;
+    }
+
+    if (sealed_)
+        sealed_(current_);
+}
+
+}  // namespace segment
+
+}  // namespace pca
@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Segment storage API documentation.
+ */
+
+/**
+ * @file segment.hpp
+ *
+ * @brief      Xabyss's Segment storage library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "packet.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace segment {
+
+/**
+ * A stored segment is a pcap file written by one worker, named by the
+ * timestamp of its first packet:
+ *
+ *     <data.path>/<YYYYMMDDHH>/<first ts in ns>-<worker>.pcap
+ *     <data.path>/<YYYYMMDDHH>/<first ts in ns>-<worker>.idx
+ *
+ * The .idx file is the timestamp index, an array of index_entry. The .flt
+ * file is the block index of the hosts, ports and protocols (block_index.hpp).
+ */
+enum info_flags : uint32_t {
+    FLAG_INDEX = 0x01,          // the timestamp index is written
+    FLAG_FILTER = 0x02,         // the filter index is written
+};
+
+/**
+ * Selectivity statistics of the block index of a segment, gathered as it's
+ * sealed for the search planner: the terms in the most blocks, and the
+ * average of the others by term type.
+ */
+struct filter_stats {
+    constexpr static const unsigned COMMON_TERMS = 8;
+
+    struct common_term {
+        uint64_t hash;          // term_hash() of the term
+        uint32_t type;
+        uint32_t blocks;
+    };
+
+    uint32_t blocks;
+    uint32_t terms[4];                      // distinct terms
+    uint64_t postings[4];                   // sum of the blocks each term appears in
+    common_term common[COMMON_TERMS];       // in the most blocks, included in the above
+    uint64_t bytes;                         // size of the .flt file
+};
+
+struct info {
+    std::string path;
+    unsigned worker;
+    uint64_t first_ts;
+    uint64_t last_ts;
+    uint64_t bytes;
+    uint64_t packets;
+    uint32_t flags;
+    filter_stats filter;        // zero if unknown, e.g. loaded from the catalog
+};
+
+struct index_entry {
+    uint64_t ts;
+    uint64_t offset;        // a record boundary in the pcap file
+};
+
+constexpr static const uint64_t INDEX_INTERVAL = 64 * 1024;
+
+class block_index;
+
+std::string hour_of(uint64_t ts);
+std::string path_of(const std::string& root, uint64_t first_ts, unsigned worker);
+std::string index_path_of(const std::string& path);
+bool parse_path(const std::string& path, uint64_t* first_ts, unsigned* worker);
+bool load_index(const std::string& path, std::vector<index_entry>* index);
+
+class writer {
+public:
+    using sealed_fn = std::function<void(const info&)>;
+
+    writer(const std::string& root, unsigned worker, int linktype,
+           uint64_t max_bytes, uint64_t max_duration_ns);
+    ~writer();
+
+    void on_sealed(sealed_fn fn);
+
+    bool write(const packet& pkt, const flow_key* key = nullptr);
+    void seal();
+
+private:
+    bool open_next(uint64_t ts);
+
+    std::string root_;
+    unsigned worker_;
+    int linktype_;
+    uint64_t max_bytes_;
+    uint64_t max_duration_ns_;
+
+    pcap::writer out_;
+    info current_;
+    std::vector<index_entry> index_;
+    std::unique_ptr<block_index> blocks_;
+    uint64_t next_index_offset_;
+    sealed_fn sealed_;
+};
+
+inline void writer::on_sealed(sealed_fn fn)
+{
+    sealed_ = fn;
+}
+
+}  // namespace segment
+
+}  // namespace pca
@@ -0,0 +1,156 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Task Pool API documentation.
+ */
+
+/**
+ * @file task_pool.cpp
+ *
+ * @brief      Xabyss's Task Pool library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "task_pool.hpp"
+
+namespace xa {
+
+task_pool::task_pool(unsigned nthreads, const std::string& name)
+    : stopping_(false)
+{
+    for (unsigned i = 0; i < nthreads; i++) {
+        threads_.emplace_back(&task_pool::run, this);
+        if (!name.empty())
+            pthread_setname_np(threads_.back().native_handle(), (name + "-" + std::to_string(i)).substr(0, 15).c_str());
+    }
+}
+
+task_pool::~task_pool()
+{
+    stop();
+}
+
+/**
+ * Queue a task.
+ *
+ * @param t         the task.
+ * @return true on success, false once stopped.
+ */
+bool task_pool::post(const task& t)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (stopping_)
+            return false;
+        tasks_.push_back(t);
+    }
+    ready_.notify_one();
+
+    return true;
+}
+
+/**
+ * Run fn(0) to fn(n - 1), up to `concurrency` of them at once, and wait for
+ * all of them. The calling thread runs them too, so this finishes even when
+ * every thread of the pool is busy, or the pool itself calls it.
+ *
+ * @param n             the number of calls.
+ * @param concurrency   the most calls at once.
+ * @param fn            the function called with each index.
+ */
+void task_pool::for_each(size_t n, size_t concurrency, const std::function<void(size_t)>& fn)
+{
+    struct state {
+        std::atomic<size_t> next;
+        size_t n;
+        const std::function<void(size_t)>* fn;
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t finished;
+    };
+
+    // helpers still queued when every call is done find nothing left and
+    // don't touch fn, only the state they share
+    std::shared_ptr<state> st = std::make_shared<state>();
+    st->next = 0;
+    st->n = n;
+    st->fn = &fn;
+    st->finished = 0;
+
+    auto work = [](const std::shared_ptr<state>& st) {
+        for (;;) {
+            size_t i = st->next++;
+            if (i >= st->n)
+                return;
+
+            (*st->fn)(i);
+
+            std::lock_guard<std::mutex> lock(st->mutex);
+            if (++st->finished == st->n)
+                st->done.notify_all();
+        }
+    };
+
+    size_t helpers = std::min(std::max<size_t>(concurrency, 1), n) - (n > 0 ? 1 : 0);
+    helpers = std::min<size_t>(helpers, threads_.size());
+    for (size_t i = 0; i < helpers; i++) {
+        if (!post([st, work] { work(st); }))
+            break;
+    }
+
+    work(st);
+
+    std::unique_lock<std::mutex> lock(st->mutex);
+    st->done.wait(lock, [&st] { return st->finished == st->n; });
+}
+
+/**
+ * Run the tasks queued and join the threads.
+ */
+void task_pool::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (stopping_)
+            return;
+        stopping_ = true;
+    }
+    ready_.notify_all();
+
+    for (auto& t : threads_) {
+        t.join();
+    }
+    threads_.clear();
+}
+
+void task_pool::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;) {
+        ready_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty())
+            return;
+
+        task t = std::move(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        t();
+        lock.lock();
+    }
+}
+
+}  // namespace xa
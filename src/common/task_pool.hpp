@@ -0,0 +1,66 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Task Pool API documentation.
+ */
+
+/**
+ * @file task_pool.hpp
+ *
+ * @brief      Xabyss's Task Pool library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xa {
+
+/**
+ * Threads running tasks in the order they are posted.
+ */
+class task_pool {
+public:
+    typedef std::function<void()> task;
+
+    explicit task_pool(unsigned nthreads, const std::string& name = std::string());
+    ~task_pool();
+
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+
+    bool post(const task& t);
+    void for_each(size_t n, size_t concurrency, const std::function<void(size_t)>& fn);
+    void stop();
+
+    unsigned threads() const;
+
+private:
+    void run();
+
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<task> tasks_;
+    bool stopping_;
+};
+
+inline unsigned task_pool::threads() const
+{
+    return static_cast<unsigned>(threads_.size());
+}
+
+}  // namespace xa
@@ -0,0 +1,214 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Triggered capture API documentation.
+ */
+
+/**
+ * @file trigger.cpp
+ *
+ * @brief      Xabyss's Triggered capture library source file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <arpa/inet.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "logger.hpp"
+#include "trigger.hpp"
+
+namespace pca {
+
+namespace trigger {
+
+// finished jobs kept for their status
+constexpr static const size_t MAX_FINISHED_JOBS = 64;
+
+/**
+ * Set the host to match.
+ *
+ * @param s         an IPv4 or IPv6 address.
+ * @return true on success, false if the address is invalid.
+ */
+bool filter::set_host(const std::string& s)
+{
+    memset(addr, 0, sizeof(addr));
+
+    if (inet_pton(AF_INET, s.c_str(), addr) == 1) {
+        version = 4;
+    } else if (inet_pton(AF_INET6, s.c_str(), addr) == 1) {
+        version = 6;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool filter::match(const packet& pkt, int linktype) const
+{
+    flow_key key;
+
+    if (!decode::flow_key_of(pkt, &key, linktype))
+        return version == 0 && port < 0 && protocol < 0;
+
+    if (version != 0 && (key.version != version
+            || (memcmp(key.src_addr, addr, 16) != 0 && memcmp(key.dst_addr, addr, 16) != 0)))
+        return false;
+    if (port >= 0 && key.src_port != port && key.dst_port != port)
+        return false;
+    if (protocol >= 0 && key.protocol != protocol)
+        return false;
+
+    return true;
+}
+
+manager::manager(const recent_buffer& recent, unsigned poll_ms)
+    : recent_(recent)
+    , poll_ms_(poll_ms)
+    , next_id_(1)
+    , stopped_(false)
+{
+}
+
+manager::~manager()
+{
+    stop();
+}
+
+/**
+ * Trigger a capture now, in the time of the newest packet.
+ *
+ * @param filename  an output filename.
+ * @param f         packets to keep.
+ * @param before_ns how long before the trigger to save.
+ * @param after_ns  how long after the trigger to save.
+ * @return the capture id, or -1 on failure.
+ */
+int manager::start(const std::string& filename, const filter& f, uint64_t before_ns, uint64_t after_ns)
+{
+    std::unique_ptr<job> j(new job);
+    uint64_t now = recent_.newest_ts();
+
+    j->f = f;
+    j->filename = filename;
+    j->trigger_ts = now;
+    j->end_ts = now + after_ns;
+    if (!j->out.open(filename, recent_.linktype()))
+        return -1;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // forget the oldest finished captures
+    for (auto it = jobs_.begin(); it != jobs_.end() && jobs_.size() >= MAX_FINISHED_JOBS; ) {
+        if (it->second->done) {
+            it->second->thread.join();
+            it = jobs_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    int id = next_id_++;
+    job& ref = *j;
+    jobs_[id] = std::move(j);
+    ref.thread = std::thread(&manager::run, this, std::ref(ref), now > before_ns ? now - before_ns : 0);
+
+    return id;
+}
+
+bool manager::get_status(int id, status* st) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = jobs_.find(id);
+    if (it == jobs_.end())
+        return false;
+
+    const job& j = *it->second;
+    st->path = j.filename;
+    st->trigger_ts = j.trigger_ts;
+    st->packets = j.packets;
+    st->done = j.done;
+    st->lost = j.lost;
+
+    return true;
+}
+
+/**
+ * Cut every running capture short and wait for them.
+ */
+void manager::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    stopped_ = true;
+    for (auto& it : jobs_) {
+        if (it.second->thread.joinable())
+            it.second->thread.join();
+    }
+}
+
+/**
+ * Save the matching packets in [begin_ts, end_ts) of the recent buffer.
+ */
+size_t manager::save(job& j, uint64_t begin_ts, uint64_t end_ts, uint64_t* last_ts)
+{
+    recent_buffer::snapshot snap;
+    size_t saved = 0;
+
+    if (recent_.oldest_ts() > begin_ts)
+        j.lost = true;
+
+    recent_.read(begin_ts, end_ts, &snap);
+    for (const auto& pkt : snap.packets) {
+        if (j.f.match(pkt, recent_.linktype())) {
+            j.out.write(pkt);
+            saved++;
+        }
+    }
+    if (!snap.packets.empty())
+        *last_ts = snap.packets.back().ts;
+
+    j.packets += saved;
+
+    return saved;
+}
+
+void manager::run(job& j, uint64_t begin_ts)
+{
+    // give up if the traffic stops before the end
+    auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::nanoseconds(j.end_ts - j.trigger_ts) + std::chrono::seconds(5);
+    uint64_t last_ts = 0;
+    uint64_t next = begin_ts;
+
+    for (;;) {
+        bool complete = recent_.newest_ts() >= j.end_ts;
+
+        save(j, next, j.end_ts, &last_ts);
+        if (last_ts >= next)
+            next = last_ts + 1;
+
+        if (complete || stopped_ || std::chrono::steady_clock::now() >= deadline)
+            break;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms_));
+    }
+
+    j.out.close();
+    j.done = true;
+
+    XA_LOGGER(info) << "trigger: saved " << j.packets << " packets into " << j.filename;
+}
+
+}  // namespace trigger
+
+}  // namespace pca
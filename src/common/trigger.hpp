@@ -0,0 +1,105 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+
+/**
+ * @mainpage  Main Page
+ *
+ *            Triggered capture API documentation.
+ */
+
+/**
+ * @file trigger.hpp
+ *
+ * @brief      Xabyss's Triggered capture library header file.
+ * @details    This header file must be included in any xabyss's probe applications.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "packet.hpp"
+#include "packet_ring.hpp"
+#include "pcap_file.hpp"
+
+namespace pca {
+
+namespace trigger {
+
+/**
+ * Packets to keep: a host, a port and a protocol, each one optional.
+ */
+struct filter {
+    uint8_t version = 0;            // 0 for any host
+    uint8_t addr[16] = {};
+    int port = -1;                  // -1 for any
+    int protocol = -1;              // -1 for any
+
+    bool set_host(const std::string& s);
+    bool match(const packet& pkt, int linktype) const;
+};
+
+struct status {
+    std::string path;
+    uint64_t trigger_ts;
+    uint64_t packets;
+    bool done;
+    bool lost;                      // some packets had left the buffer
+};
+
+/**
+ * Triggered captures: on a trigger, the packets matching a filter from some
+ * time before to some time after it are saved into a file of their own.
+ *
+ * The packets before are taken from the recent buffer, the packets after are
+ * followed in it as they arrive, so nothing is written to disk until then.
+ */
+class manager {
+public:
+    explicit manager(const recent_buffer& recent, unsigned poll_ms = 100);
+    ~manager();
+
+    manager(const manager&) = delete;
+    manager& operator=(const manager&) = delete;
+
+    int start(const std::string& filename, const filter& f, uint64_t before_ns, uint64_t after_ns);
+    bool get_status(int id, status* st) const;
+    void stop();
+
+private:
+    struct job {
+        filter f;
+        std::string filename;
+        uint64_t trigger_ts;
+        uint64_t end_ts;
+        pcap::writer out;
+        std::thread thread;
+        std::atomic<uint64_t> packets;
+        std::atomic<bool> done;
+        std::atomic<bool> lost;
+
+        job() : packets(0), done(false), lost(false) {}
+    };
+
+    void run(job& j, uint64_t begin_ts);
+    size_t save(job& j, uint64_t begin_ts, uint64_t end_ts, uint64_t* last_ts);
+
+    const recent_buffer& recent_;
+    unsigned poll_ms_;
+    mutable std::mutex mutex_;
+    std::map<int, std::unique_ptr<job>> jobs_;
+    int next_id_;
+    std::atomic<bool> stopped_;
+};
+
+}  // namespace trigger
+
+}  // namespace pca
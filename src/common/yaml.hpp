@@ -56,6 +56,28 @@ namespace yaml {
             session_heartbeat_timeout_sec = value.as_integer();                                         \
         } else if (key == "session-search-timeout") {                                                   \
             session_search_timeout_sec = value.as_integer();                                            \
+        } else if (key == "segment-size") {                                                             \
+            data_segment_size_mb = value.as_integer();                                                  \
+            if (data_segment_size_mb == 0) {                                                            \
+                logger::error("invalid segment-size: {}"_format(data_segment_size_mb));                 \
+                                                                                                        \
+                return false;                                                                           \
+            }                                                                                           \
+        } else if (key == "segment-duration") {                                                         \
+            data_segment_duration_sec = value.as_integer();                                             \
+            if (data_segment_duration_sec == 0) {                                                       \
+                logger::error("invalid segment-duration: {}"_format(data_segment_duration_sec));        \
+                                                                                                        \
+                return false;                                                                           \
+            }                                                                                           \
+        } else if (key == "max-size") {                                                                 \
+            data_max_size_gb = value.as_integer();                                                      \
+        } else if (key == "max-age") {                                                                  \
+            data_max_age_hours = value.as_integer();                                                    \
+        } else if (key == "min-free") {                                                                 \
+            data_min_free_gb = value.as_integer();                                                      \
+        } else if (key == "search-cache-size") {                                                        \
+            data_search_cache_size_mb = value.as_integer();                                             \
         }                                                                                               \
                                                                                                         \
         return true;                                                                                    \
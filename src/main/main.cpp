@@ -2,7 +2,9 @@
 /*
  * Copyright (c) 2014 Xabyss Inc. All rights reserved.
  */
+#include <algorithm>
 #include <chrono>
+#include <memory>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -10,8 +12,15 @@
 #include <execinfo.h>
 
 #include "common/async.hpp"
+#include "common/forward.hpp"
 #include "common/logger.hpp"
 #include "common/mariadb.hpp"
+#include "common/packet_ring.hpp"
+#include "common/pcap_file.hpp"
+#include "common/pipeline.hpp"
+#include "common/replay.hpp"
+#include "common/retention.hpp"
+#include "common/rpc_client.hpp"
 
 #include "fmt/format.h"
 
@@ -57,6 +66,14 @@ static void do_output_features()
         BOOST_LOG_TRIVIAL(info) << msg << (value ? "YES" : "NO");
     };
 
+    BOOST_LOG_TRIVIAL(info) << " CAPTURE ----------------------";
+    message("          REPLAY : ", !options::replay_path.empty());
+    message("         STORAGE : ", !options::output_file_path.empty());
+    message("          MEMORY : ", options::capture_memory_size_mb > 0);
+    message("       RETENTION : ", options::data_max_size_gb > 0 || options::data_max_age_hours > 0
+            || options::data_min_free_gb > 0);
+    message("         FORWARD : ", !options::forward_to.empty());
+    message("       COLLECTOR : ", !options::forward_listen.empty());
     BOOST_LOG_TRIVIAL(info) << " CONTROL ----------------------";
     message("          DAEMON : ", options::control_enabled);
     message("      ALLOW CORS : ", options::control_allow_cors);
@@ -79,22 +96,193 @@ void capture_init(int argc, char* argv[])
     do_output_features();
 }
 
+static pipeline_config make_pipeline_config(int linktype, unsigned first_worker = 0)
+{
+    pipeline_config config;
+
+    config.workers = options::capture_workers;
+    config.ring_size = options::capture_ring_size;
+    config.linktype = linktype;
+    config.data_path = options::output_file_path;
+    config.segment_size = static_cast<uint64_t>(options::data_segment_size_mb) * 1024 * 1024;
+    config.segment_duration_ns = static_cast<uint64_t>(options::data_segment_duration_sec) * 1000000000ULL;
+    config.first_worker = first_worker;
+
+    return config;
+}
+
+static retention_config make_retention_config()
+{
+    retention_config config;
+
+    config.data_path = options::output_file_path;
+    config.catalog_path = options::output_file_path + "/catalog";
+    config.max_bytes = static_cast<uint64_t>(options::data_max_size_gb) << 30;
+    config.max_age_ns = static_cast<uint64_t>(options::data_max_age_hours) * 3600 * 1000000000ULL;
+    config.min_free_bytes = static_cast<uint64_t>(options::data_min_free_gb) << 30;
+
+    return config;
+}
+
+// storage, the recent buffer and the collector take the packets of a pipeline
+static void attach(pipeline* pipe, retention* storage, recent_buffer* recent, forward::sender* forwarder)
+{
+    if (storage != nullptr)
+        pipe->on_sealed([storage](const segment::info& info) { storage->add(info); });
+    if (recent != nullptr)
+        recent->set_linktype(pipe->config().linktype);
+    if (recent != nullptr || forwarder != nullptr) {
+        pipe->on_batch([recent, forwarder](unsigned worker, const packet* pkts, size_t n) {
+            if (recent != nullptr)
+                recent->write(worker, pkts, n);
+            if (forwarder != nullptr)
+                forwarder->send(pkts, n);
+        });
+    }
+}
+
+static std::unique_ptr<forward::sender> make_forwarder(int linktype)
+{
+    forward::sender_config config;
+
+    if (options::forward_to.empty())
+        return nullptr;
+    if (!xa::rpc_client::parse_address(options::forward_to, &config.host, &config.port)) {
+        logger::error("invalid forward address: {}"_format(options::forward_to));
+        return nullptr;
+    }
+    config.linktype = linktype;
+    config.snaplen = options::forward_snaplen;
+    config.compress = options::forward_compression;
+
+    std::unique_ptr<forward::sender> forwarder(new forward::sender(config));
+    forwarder->start();
+
+    return forwarder;
+}
+
+static void do_replay(retention* storage, recent_buffer* recent, unsigned first_worker)
+{
+    std::vector<std::string> files;
+    pcap::reader first;
+
+    if (!replay::list_files(options::replay_path, &files) || files.empty()) {
+        logger::error("No pcap file to replay in {}"_format(options::replay_path));
+        return;
+    }
+    if (!first.open(files.front())) {
+        logger::error("Can't open {}"_format(files.front()));
+        return;
+    }
+
+    pipeline pipe(make_pipeline_config(first.linktype(), first_worker));
+    replay::player player(pipe, options::replay_speed);
+    std::unique_ptr<forward::sender> forwarder = make_forwarder(first.linktype());
+
+    attach(&pipe, storage, recent, forwarder.get());
+
+    first.close();
+    pipe.start();
+
+    auto begin = std::chrono::steady_clock::now();
+    player.play(options::replay_path);
+    pipe.stop();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    double sec = std::max(elapsed.count(), 1e-9);
+    logger::info("replayed {} files, {} packets, {} bytes in {:.3f} sec ({:.3f} Mpps, {:.3f} Gbps)"_format(
+        player.files(), player.packets(), player.bytes(), sec,
+        player.packets() / sec / 1e6, player.bytes() * 8 / sec / 1e9));
+
+    if (forwarder) {
+        forwarder->stop();
+        logger::info("forwarded {} packets, {} bytes as {} bytes, {} dropped, {} reconnects"_format(
+            forwarder->packets(), forwarder->bytes(), forwarder->wire_bytes(), forwarder->dropped(),
+            forwarder->reconnects()));
+    }
+}
+
 void capture_main_loop()
 {
-    rpc rpc(options::control_listen_address, options::control_listen_port);
+    std::unique_ptr<retention> storage;
+    if (!options::output_file_path.empty()) {
+        storage = std::unique_ptr<retention>(new retention(make_retention_config()));
+        storage->start();
+    }
+
+    std::unique_ptr<recent_buffer> recent;
+    if (options::capture_memory_size_mb > 0) {
+        recent = std::unique_ptr<recent_buffer>(new recent_buffer(
+            options::capture_workers, static_cast<size_t>(options::capture_memory_size_mb) << 20));
+    }
+
+    rpc rpc(options::control_listen_address, options::control_listen_port, options::control_threads);
     if (options::control_enabled) {
         rpc.set_allow_cors(options::control_allow_cors);
+        rpc.set_batch_limits(options::control_max_batch_size, options::control_batch_concurrency);
+        rpc.set_compression(options::control_compress_min_size, options::control_compress_level);
+        rpc.set_engine(options::control_epoll ? rpc::ENGINE_EPOLL : rpc::ENGINE_NETLIB);
+        if (!options::control_unix_socket.empty())
+            rpc.set_unix_socket(options::control_unix_socket, options::control_unix_socket_mode);
+        // triggered captures and downloads go there even if nothing is stored
+        rpc.set_storage(options::output_file_path.empty() ? options::path_prefix + "/data"
+                        : options::output_file_path, storage.get(), recent.get(),
+                        static_cast<size_t>(options::data_search_cache_size_mb) << 20);
+        if (!rpc.set_peers(options::federation_peers, options::federation_timeout_sec))
+            logger::error("invalid federation peers, federated searches are local only");
         rpc.start();
     }
 
+    // the packets of the sensors go through a pipeline of their own
+    std::unique_ptr<pipeline> collector_pipe;
+    std::unique_ptr<forward::receiver> collector;
+    if (!options::forward_listen.empty()) {
+        std::string host;
+        unsigned short port;
+
+        if (xa::rpc_client::parse_address(options::forward_listen, &host, &port)) {
+            collector_pipe = std::unique_ptr<pipeline>(new pipeline(make_pipeline_config(LINKTYPE_ETHERNET)));
+            // a ring of the recent buffer has a single writer, the replay has them if any
+            attach(collector_pipe.get(), storage.get(), options::replay_path.empty() ? recent.get() : nullptr,
+                   nullptr);
+            collector_pipe->start();
+
+            pipeline* pipe = collector_pipe.get();
+            collector = std::unique_ptr<forward::receiver>(new forward::receiver(host, port, LINKTYPE_ETHERNET,
+                [pipe](const packet* pkts, size_t n) { pipe->feed(pkts, n, true); }));
+            if (!collector->start())
+                logger::error("Can't listen for sensors on {}: {}"_format(options::forward_listen, collector->error()));
+        } else {
+            logger::error("invalid forward listen address: {}"_format(options::forward_listen));
+        }
+    }
+
     printf("Hello, world!\n");
 
+    if (!options::replay_path.empty()) {
+        // its segments named after workers of its own, the collector's being
+        // stored alongside
+        do_replay(storage.get(), recent.get(), collector_pipe ? collector_pipe->config().workers : 0);
+
+        // keep serving the replayed data only if there is a control channel
+        if (!options::control_enabled && !collector)
+            is_running = false;
+    }
+
     while(is_running) {
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 
     printf("Exit!\n");
 
+    if (collector) {
+        collector->stop();
+        collector_pipe->stop();
+    }
+
+    if (storage)
+        storage->stop();
+
     if (options::control_enabled) {
         rpc.stop();
         rpc.join();
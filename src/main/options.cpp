@@ -19,6 +19,7 @@
 #include "common/cmdline.hpp"
 #include "common/logger.hpp"
 #include "common/mariadb.hpp"
+#include "common/replay.hpp"
 #include "common/utils.hpp"
 #include "common/validation.hpp"
 
@@ -48,17 +49,50 @@ std::vector<std::string> options::args;
 std::string options::path_prefix = ".";
 unsigned options::debug_level = 0;
 
+unsigned options::capture_workers = 1;
+unsigned options::capture_ring_size = 65536;
+unsigned options::capture_memory_size_mb = 0;
+
+std::string options::output_file_path;
+unsigned options::session_heartbeat_timeout_sec = 30;
+unsigned options::session_search_timeout_sec = 300;
+unsigned options::data_segment_size_mb = 256;
+unsigned options::data_segment_duration_sec = 60;
+unsigned options::data_max_size_gb = 0;
+unsigned options::data_max_age_hours = 0;
+unsigned options::data_min_free_gb = 0;
+unsigned options::data_search_cache_size_mb = 64;
+
+std::string options::replay_path;
+double options::replay_speed = pca::replay::SPEED_ORIGINAL;
+
 bool options::control_enabled = false;
 std::string options::control_listen_address = "127.0.0.1";
 uint16_t options::control_listen_port = 10081;
 bool options::control_allow_cors = false;
+unsigned options::control_threads = 4;
+unsigned options::control_max_batch_size = 100;
+unsigned options::control_batch_concurrency = 8;
+bool options::control_epoll = false;
+std::string options::control_unix_socket;
+unsigned options::control_unix_socket_mode = 0660;
+unsigned options::control_compress_min_size = 1024;
+unsigned options::control_compress_level = 6;
+
+std::vector<std::string> options::federation_peers;
+unsigned options::federation_timeout_sec = 10;
+
+std::string options::forward_to;
+unsigned options::forward_snaplen = 0;
+bool options::forward_compression = true;
+std::string options::forward_listen;
 
 bool options::settings_enabled = false;
 std::string options::settings_database_uri;
 
 bool options::parse_cmdline(int argc, char *argv[])
 {
-    MAKE_CLI_PARSER();
+    MAKE_CLI_PARSER_WITH_REPLAY();
 
     if (settings_enabled) {
         load_settings_from_database();
@@ -71,6 +105,27 @@ bool options::parse_config(const char* filename)
 {
     static std::map<std::string, xa::yaml::fn_body> yaml_settings = {
         DEBUG_COMMON_ENUM(),
+        DATA_SEARCH_ENUM(),
+        {
+            "capture",
+            [](const std::string& key, xa::yaml::node& value) -> bool
+            {
+                if (key == "workers") {
+                    capture_workers = value.as_integer();
+                    if (capture_workers == 0) {
+                        logger::error("invalid workers: {}"_format(capture_workers));
+
+                        return false;
+                    }
+                } else if (key == "ring-size") {
+                    capture_ring_size = value.as_integer();
+                } else if (key == "memory-size") {
+                    capture_memory_size_mb = value.as_integer();
+                }
+
+                return true;
+            }
+        },
         {
             "control",
             [](const std::string& key, xa::yaml::node& value) -> bool
@@ -88,6 +143,93 @@ bool options::parse_config(const char* filename)
                     }
                 } else if (key == "allow-cors") {
                     control_allow_cors = value.as_boolean();
+                } else if (key == "threads") {
+                    control_threads = value.as_integer();
+                    if (control_threads == 0) {
+                        logger::error("invalid threads: {}"_format(control_threads));
+
+                        return false;
+                    }
+                } else if (key == "max-batch-size") {
+                    control_max_batch_size = value.as_integer();
+                } else if (key == "batch-concurrency") {
+                    control_batch_concurrency = value.as_integer();
+                    if (control_batch_concurrency == 0) {
+                        logger::error("invalid batch-concurrency: {}"_format(control_batch_concurrency));
+
+                        return false;
+                    }
+                } else if (key == "engine") {
+                    std::string engine = value.as_string();
+                    if (engine != "netlib" && engine != "epoll") {
+                        logger::error("invalid engine: {}"_format(engine));
+
+                        return false;
+                    }
+                    control_epoll = engine == "epoll";
+                } else if (key == "unix-socket") {
+                    control_unix_socket = value.as_string();
+                } else if (key == "unix-socket-mode") {
+                    std::string mode = value.as_string();
+                    char* end;
+                    control_unix_socket_mode = strtoul(mode.c_str(), &end, 8);
+                    if (mode.empty() || *end != '\0' || control_unix_socket_mode > 0777) {
+                        logger::error("invalid unix-socket-mode: {}"_format(mode));
+
+                        return false;
+                    }
+                } else if (key == "compress-min-size") {
+                    control_compress_min_size = value.as_integer();
+                } else if (key == "compress-level") {
+                    control_compress_level = value.as_integer();
+                    if (control_compress_level > 9) {
+                        logger::error("invalid compress-level: {}"_format(control_compress_level));
+
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+        },
+        {
+            "federation",
+            [](const std::string& key, xa::yaml::node& value) -> bool
+            {
+                if (key == "peers") {
+                    if (value.type != xa::yaml::node::TYPE_SEQUENCE) {
+                        logger::error("invalid peers: not a list");
+
+                        return false;
+                    }
+                    for (auto& peer : value.as_sequence()) {
+                        federation_peers.push_back(peer.as_string());
+                    }
+                } else if (key == "timeout") {
+                    federation_timeout_sec = value.as_integer();
+                }
+
+                return true;
+            }
+        },
+        {
+            "forward",
+            [](const std::string& key, xa::yaml::node& value) -> bool
+            {
+                if (key == "to") {
+                    forward_to = value.as_string();
+                } else if (key == "snaplen") {
+                    forward_snaplen = value.as_integer();
+                } else if (key == "compression") {
+                    std::string codec = value.as_string();
+                    if (codec != "lz4" && codec != "none") {
+                        logger::error("invalid compression: {}"_format(codec));
+
+                        return false;
+                    }
+                    forward_compression = codec == "lz4";
+                } else if (key == "listen") {
+                    forward_listen = value.as_string();
                 }
 
                 return true;
@@ -255,7 +397,7 @@ static void show_help(const char *progname)
     printf("Usage: %s [OPTIONS...]\n\n", progname);
     printf("Run CAPTURE\n\n");
 
-    MAKE_CLI_HELP();
+    MAKE_CLI_HELP_WITH_REPLAY();
 }
 
 }  // namespace pca
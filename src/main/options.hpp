@@ -26,11 +26,49 @@ public:
     static bool settings_enabled;
     static std::string settings_database_uri;
 
+    // capture
+    static unsigned capture_workers;
+    static unsigned capture_ring_size;
+    static unsigned capture_memory_size_mb;
+
+    // data
+    static std::string output_file_path;
+    static unsigned session_heartbeat_timeout_sec;
+    static unsigned session_search_timeout_sec;
+    static unsigned data_segment_size_mb;
+    static unsigned data_segment_duration_sec;
+    static unsigned data_max_size_gb;
+    static unsigned data_max_age_hours;
+    static unsigned data_min_free_gb;
+    static unsigned data_search_cache_size_mb;
+
+    // replay
+    static std::string replay_path;
+    static double replay_speed;
+
     // control
     static bool control_enabled;
     static std::string control_listen_address;
     static uint16_t control_listen_port;
     static bool control_allow_cors;
+    static unsigned control_threads;
+    static unsigned control_max_batch_size;
+    static unsigned control_batch_concurrency;
+    static bool control_epoll;
+    static std::string control_unix_socket;
+    static unsigned control_unix_socket_mode;
+    static unsigned control_compress_min_size;
+    static unsigned control_compress_level;
+
+    // federation
+    static std::vector<std::string> federation_peers;
+    static unsigned federation_timeout_sec;
+
+    // forward
+    static std::string forward_to;
+    static unsigned forward_snaplen;
+    static bool forward_compression;
+    static std::string forward_listen;
 
 public:
     static bool parse_cmdline(int argc, char *argv[]);
@@ -3,36 +3,651 @@
  * Copyright (c) 2014 Xabyss Inc. All rights reserved.
  */
 
+#include <errno.h>
+#include <sys/stat.h>
+#include <cmath>
+
 #include "rpc.hpp"
 #include "options.hpp"
+#include "common/download.hpp"
+#include "common/flow.hpp"
+#include "common/planner.hpp"
+#include "common/search.hpp"
+#include "fmt/format.h"
 #include <boost/thread.hpp>
 #include <boost/chrono.hpp>
 
 namespace pca {
 
-rpc::rpc(const std::string& address, unsigned short port)
-    : rpc_base(address, port)
+rpc::rpc(const std::string& address, unsigned short port, unsigned nthreads)
+    : rpc_base(address, port, static_cast<int>(nthreads))
+    , downloads_(0)
+{
+    using xa::method_info;
+    using xa::PARAM_INTEGER;
+    using xa::PARAM_NUMBER;
+    using xa::PARAM_OBJECT;
+    using xa::PARAM_STRING;
+
+    const unsigned search_ms = options::session_search_timeout_sec * 1000;
+    const unsigned federation_ms = options::federation_timeout_sec * 1000;
+
+    // interactive
+    add_fast_method("ping", &rpc::serve_ping, method_info({}, true, 1000));
+
+    // packets
+    add_method("download", &rpc::serve_download, method_info({
+        { "begin", PARAM_NUMBER }, { "end", PARAM_NUMBER } }, false, search_ms));
+    add_method("trigger_capture", &rpc::serve_trigger_capture, method_info({
+        { "before", PARAM_NUMBER }, { "after", PARAM_NUMBER }, { "filter", PARAM_OBJECT, false } }, false, 1000));
+    add_method("trigger_status", &rpc::serve_trigger_status, method_info({
+        { "id", PARAM_INTEGER } }, true, 1000));
+    add_method("search", &rpc::serve_search, method_info({
+        { "query", PARAM_STRING }, { "begin", PARAM_NUMBER }, { "end", PARAM_NUMBER },
+        { "limit", PARAM_INTEGER, false } }, false, search_ms));
+    add_method("explain", &rpc::serve_explain, method_info({
+        { "query", PARAM_STRING }, { "begin", PARAM_NUMBER }, { "end", PARAM_NUMBER } }, true, 10000));
+    add_method("search_start", &rpc::serve_search_start, method_info({
+        { "query", PARAM_STRING }, { "begin", PARAM_NUMBER }, { "end", PARAM_NUMBER },
+        { "limit", PARAM_INTEGER, false } }, false, 1000));
+    add_method("search_poll", &rpc::serve_search_poll, method_info({
+        { "id", PARAM_INTEGER } }, true, 1000));
+    add_method("search_fetch", &rpc::serve_search_fetch, method_info({
+        { "id", PARAM_INTEGER }, { "cursor", PARAM_INTEGER, false }, { "limit", PARAM_INTEGER, false } },
+        true, 60000));
+    add_stream_method("search_stream", &rpc::serve_search_stream, method_info({
+        { "id", PARAM_INTEGER } }, true, 600000));
+    add_method("search_cancel", &rpc::serve_search_cancel, method_info({
+        { "id", PARAM_INTEGER } }, true, 1000));
+    add_stream_method("federated_search", &rpc::serve_federated_search, method_info({
+        { "query", PARAM_STRING }, { "begin", PARAM_NUMBER }, { "end", PARAM_NUMBER },
+        { "limit", PARAM_INTEGER, false }, { "timeout", PARAM_NUMBER, false } }, false, federation_ms + 1000));
+}
+
+void rpc::set_storage(const std::string& data_path, retention* storage, recent_buffer* recent,
+                      size_t cache_bytes)
+{
+    data_path_ = data_path;
+    storage_ = storage;
+    recent_ = recent;
+    if (recent != nullptr)
+        triggers_ = std::unique_ptr<trigger::manager>(new trigger::manager(*recent));
+    if (storage != nullptr && cache_bytes > 0)
+        search_cache_ = std::unique_ptr<search::cache>(new search::cache(cache_bytes));
+    if (storage != nullptr || recent != nullptr)
+        search_jobs_ = std::unique_ptr<search::job_manager>(
+            new search::job_manager(data_path + "/search", storage, recent, search_cache_.get()));
+}
+
+/**
+ * Set the peers searched along with this node by federated_search.
+ *
+ * @param peers     their control addresses, host:port.
+ * @param timeout_sec how long a peer has to answer by default.
+ * @return true on success, false if an address is invalid.
+ */
+bool rpc::set_peers(const std::vector<std::string>& peers, unsigned timeout_sec)
+{
+    std::string host;
+    unsigned short port;
+
+    peers_.clear();
+    for (const auto& peer : peers) {
+        if (!xa::rpc_client::parse_address(peer, &host, &port))
+            return false;
+        peers_.push_back(std::unique_ptr<federation::node>(new federation::peer_node(peer, host, port)));
+    }
+    federation_timeout_sec_ = timeout_sec;
+
+    return true;
+}
+
+static bool make_dir(const std::string& parent, const std::string& dir)
+{
+    mkdir(parent.c_str(), 0755);
+
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// seconds since the epoch to nanoseconds; up to 2500-01-01, as beyond
+// 1.8e10 seconds they overflow 64 bits
+static bool parse_time(const Json::Value& value, uint64_t* ts)
+{
+    const double MAX_SEC = 16725225600.0;
+
+    if (!value.isNumeric() || value.asDouble() < 0 || value.asDouble() >= MAX_SEC)
+        return false;
+
+    *ts = static_cast<uint64_t>(value.asDouble() * 1e9);
+
+    return true;
+}
+
+// on the fast path, it is what health checks poll
+bool rpc::serve_ping(const xa::json::value& params, xa::json::writer* res)
+{
+    res->key("result").begin_object();
+    res->key("message").string("OK");
+    res->key("params").write(params);
+    res->end_object();
+
+    return true;
+}
+
+/**
+ * Write the packets of a time range into a pcap file under data.path.
+ *
+ * params: { "begin": seconds, "end": seconds }
+ */
+bool rpc::serve_download(const Json::Value& params, Json::Value* res)
+{
+    uint64_t begin_ts, end_ts;
+
+    if (!parse_time(params["begin"], &begin_ts) || !parse_time(params["end"], &end_ts) || begin_ts >= end_ts)
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid time range", res);
+
+    if (storage_ == nullptr && recent_ == nullptr)
+        return serve_error(ERROR_SERVER_ERROR_START, "No packet storage", res);
+
+    std::string dir = data_path_ + "/download";
+    if (!make_dir(data_path_, dir))
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't create " + dir, res);
+
+    std::string filename = fmt::format("{}/{:020d}-{:020d}-{}.pcap", dir, begin_ts, end_ts, downloads_++);
+    download::result result;
+    if (!download::write(filename, begin_ts, end_ts, storage_, recent_, &result))
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't write " + filename, res);
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["path"] = filename;
+    (*res)["result"]["packets"] = static_cast<Json::UInt64>(result.packets);
+    (*res)["result"]["bytes"] = static_cast<Json::UInt64>(result.bytes);
+    (*res)["result"]["segments"] = static_cast<Json::UInt64>(result.segments);
+    (*res)["result"]["memory"] = result.memory;
+
+    return true;
+}
+
+/**
+ * Save the packets matching a filter from some time before to some time after
+ * now into a file under data.path.
+ *
+ * params: { "before": seconds, "after": seconds,
+ *           "filter": { "host": address, "port": number, "protocol": number } }
+ */
+bool rpc::serve_trigger_capture(const Json::Value& params, Json::Value* res)
+{
+    uint64_t before_ns, after_ns;
+    trigger::filter f;
+    const Json::Value& filter = params["filter"];
+
+    if (!parse_time(params["before"], &before_ns) || !parse_time(params["after"], &after_ns))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid before or after", res);
+
+    if (filter.isMember("host") && !f.set_host(filter["host"].asString()))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid host", res);
+    if (filter.isMember("port")) {
+        if (!filter["port"].isInt() || filter["port"].asInt() < 0 || filter["port"].asInt() > 65535)
+            return serve_error(ERROR_INVALID_PARAMS, "Invalid port", res);
+        f.port = filter["port"].asInt();
+    }
+    if (filter.isMember("protocol")) {
+        if (!filter["protocol"].isInt() || filter["protocol"].asInt() < 0 || filter["protocol"].asInt() > 255)
+            return serve_error(ERROR_INVALID_PARAMS, "Invalid protocol", res);
+        f.protocol = filter["protocol"].asInt();
+    }
+
+    if (!triggers_)
+        return serve_error(ERROR_SERVER_ERROR_START, "No packet buffer", res);
+
+    std::string dir = data_path_ + "/trigger";
+    if (!make_dir(data_path_, dir))
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't create " + dir, res);
+
+    std::string filename = fmt::format("{}/{:020d}-{}.pcap", dir, recent_->newest_ts(), downloads_++);
+    int id = triggers_->start(filename, f, before_ns, after_ns);
+    if (id < 0)
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't write " + filename, res);
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["id"] = id;
+    (*res)["result"]["path"] = filename;
+
+    return true;
+}
+
+/**
+ * params: { "id": number }
+ */
+bool rpc::serve_trigger_status(const Json::Value& params, Json::Value* res)
+{
+    trigger::status st;
+
+    if (!triggers_ || !params["id"].isInt() || !triggers_->get_status(params["id"].asInt(), &st))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid id", res);
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["path"] = st.path;
+    (*res)["result"]["trigger"] = static_cast<double>(st.trigger_ts) / 1e9;
+    (*res)["result"]["packets"] = static_cast<Json::UInt64>(st.packets);
+    (*res)["result"]["done"] = st.done;
+    (*res)["result"]["lost"] = st.lost;
+
+    return true;
+}
+
+// the query, time range and limit of a search, an error message if invalid
+static std::string parse_search(const Json::Value& params, query::program* query, uint64_t* begin_ts,
+                                uint64_t* end_ts, unsigned* limit)
+{
+    const unsigned DEFAULT_LIMIT = 10000;
+    const unsigned MAX_LIMIT = 1000000;
+    std::string error;
+
+    if (!parse_time(params["begin"], begin_ts) || !parse_time(params["end"], end_ts) || *begin_ts >= *end_ts)
+        return "Invalid time range";
+
+    *limit = DEFAULT_LIMIT;
+    if (params.isMember("limit")) {
+        if (!params["limit"].isInt64() || params["limit"].asInt64() <= 0 || params["limit"].asInt64() > MAX_LIMIT)
+            return "Invalid limit";
+        *limit = params["limit"].asUInt();
+    }
+
+    if (!params["query"].isString() || !query->compile(params["query"].asString(), &error))
+        return "Invalid query: " + error;
+
+    return std::string();
+}
+
+static void search_result(const search::result& result, Json::Value* value)
+{
+    (*value)["packets"] = static_cast<Json::UInt64>(result.packets);
+    (*value)["bytes"] = static_cast<Json::UInt64>(result.bytes);
+    (*value)["scanned"] = static_cast<Json::UInt64>(result.scanned);
+    (*value)["segments"] = static_cast<Json::UInt64>(result.segments);
+    (*value)["indexed"] = static_cast<Json::UInt64>(result.indexed);
+    (*value)["cached"] = static_cast<Json::UInt64>(result.cached);
+    (*value)["blocks"] = static_cast<Json::UInt64>(result.blocks);
+    (*value)["memory"] = result.memory;
+    (*value)["truncated"] = result.truncated;
+}
+
+/**
+ * Write the packets of a time range matching a query into a pcap file under
+ * data.path, see query.hpp for the query language. It is given up once the
+ * method has timed out, after the segment being read.
+ *
+ * params: { "query": string, "begin": seconds, "end": seconds, "limit": number }
+ */
+bool rpc::serve_search(const Json::Value& params, Json::Value* res, xa::request_context* ctx)
+{
+    uint64_t begin_ts, end_ts;
+    unsigned limit;
+    query::program query;
+
+    std::string error = parse_search(params, &query, &begin_ts, &end_ts, &limit);
+    if (!error.empty())
+        return serve_error(ERROR_INVALID_PARAMS, error, res);
+
+    if (storage_ == nullptr && recent_ == nullptr)
+        return serve_error(ERROR_SERVER_ERROR_START, "No packet storage", res);
+
+    std::string dir = data_path_ + "/search";
+    if (!make_dir(data_path_, dir))
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't create " + dir, res);
+
+    std::string filename = fmt::format("{}/{:020d}-{:020d}-{}.pcap", dir, begin_ts, end_ts, downloads_++);
+    search::result result;
+    search::control ctl;
+    ctl.results = search_cache_.get();
+    ctl.progress = [&ctl, ctx](const search::result&) {
+        if (ctx->expired())
+            ctl.cancelled = true;
+    };
+    if (!search::write(filename, query, begin_ts, end_ts, limit, storage_, recent_, &result, &ctl)) {
+        if (result.cancelled)
+            return serve_error(ERROR_SERVER_ERROR_START, "Search timed out", res);
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't write " + filename, res);
+    }
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["path"] = filename;
+    search_result(result, &(*res)["result"]);
+
+    return true;
+}
+
+/**
+ * Run a search in the background, see serve_search for the params.
+ *
+ * result: { "id": number }
+ */
+bool rpc::serve_search_start(const Json::Value& params, Json::Value* res)
 {
+    uint64_t begin_ts, end_ts;
+    unsigned limit;
+    query::program query;
+
+    std::string error = parse_search(params, &query, &begin_ts, &end_ts, &limit);
+    if (!error.empty())
+        return serve_error(ERROR_INVALID_PARAMS, error, res);
+
+    if (!search_jobs_)
+        return serve_error(ERROR_SERVER_ERROR_START, "No packet storage", res);
+
+    std::string dir = data_path_ + "/search";
+    if (!make_dir(data_path_, dir))
+        return serve_error(ERROR_INTERNAL_ERROR, "Can't create " + dir, res);
+
+    int id = search_jobs_->start(query, begin_ts, end_ts, limit);
+    if (id < 0)
+        return serve_error(ERROR_SERVER_ERROR_START, "Too many searches", res);
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["id"] = id;
+
+    return true;
 }
 
-bool rpc::serve(const Json::Value& req, Json::Value* res)
+static const char* job_state_name(search::job_state state)
 {
-    std::string method = req["method"].asString();
+    switch (state) {
+    case search::JOB_QUEUED:
+        return "queued";
+    case search::JOB_RUNNING:
+        return "running";
+    case search::JOB_DONE:
+        return "done";
+    case search::JOB_FAILED:
+        return "failed";
+    case search::JOB_CANCELLED:
+        return "cancelled";
+    }
+
+    return "unknown";
+}
 
-    if ("ping" == method) {
-        return serve_ping(req["params"], res);
-    } else {
-        return serve_method_not_found(req["params"], res);
+/**
+ * The progress of a background search, and its result once done.
+ *
+ * params: { "id": number }
+ */
+bool rpc::serve_search_poll(const Json::Value& params, Json::Value* res)
+{
+    search::job_status st;
+
+    if (!search_jobs_ || !params["id"].isInt() || !search_jobs_->get_status(params["id"].asInt(), &st))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid search id", res);
+
+    Json::Value& result = (*res)["result"] = Json::Value(Json::objectValue);
+
+    result["state"] = job_state_name(st.state);
+    result["query"] = st.query;
+    result["matched"] = static_cast<Json::UInt64>(st.res.matched);
+    result["planned"] = static_cast<Json::UInt64>(st.res.planned);
+    search_result(st.res, &result);
+    if (st.state == search::JOB_DONE)
+        result["path"] = st.path;
+
+    return true;
+}
+
+// a packet found by a search, as search_fetch and search_stream give it
+static Json::Value packet_summary(const packet& pkt, int linktype)
+{
+    Json::Value p(Json::objectValue);
+    flow_key key;
+
+    p["ts"] = static_cast<double>(pkt.ts) / 1e9;
+    p["len"] = pkt.len;
+    p["caplen"] = pkt.caplen;
+    if (decode::flow_key_of(pkt, &key, linktype)) {
+        p["proto"] = key.protocol;
+        p["src"] = address_to_string(key, key.src_addr);
+        p["dst"] = address_to_string(key, key.dst_addr);
+        p["sport"] = key.src_port;
+        p["dport"] = key.dst_port;
     }
 
+    return p;
+}
+
+/**
+ * A page of the packets a background search found, once done. The cursor of
+ * the next page is null after the last one.
+ *
+ * params: { "id": number, "cursor": number, "limit": number }
+ */
+bool rpc::serve_search_fetch(const Json::Value& params, Json::Value* res)
+{
+    const unsigned DEFAULT_LIMIT = 100;
+    const unsigned MAX_LIMIT = 10000;
+    uint64_t cursor = 0;
+    uint64_t next = 0;
+    unsigned limit = DEFAULT_LIMIT;
+    search::job_status st;
+
+    if (!search_jobs_ || !params["id"].isInt() || !search_jobs_->get_status(params["id"].asInt(), &st))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid search id", res);
+
+    if (params.isMember("cursor")) {
+        if (!params["cursor"].isInt64() || params["cursor"].asInt64() < 0)
+            return serve_error(ERROR_INVALID_PARAMS, "Invalid cursor", res);
+        cursor = params["cursor"].asUInt64();
+    }
+
+    if (params.isMember("limit")) {
+        if (!params["limit"].isInt64() || params["limit"].asInt64() <= 0 || params["limit"].asInt64() > MAX_LIMIT)
+            return serve_error(ERROR_INVALID_PARAMS, "Invalid limit", res);
+        limit = params["limit"].asUInt();
+    }
+
+    if (st.state != search::JOB_DONE)
+        return serve_error(ERROR_SERVER_ERROR_START, std::string("Search is ") + job_state_name(st.state), res);
+
+    Json::Value packets(Json::arrayValue);
+    bool ok = search_jobs_->fetch(params["id"].asInt(), cursor, limit, [&](const packet& pkt, int linktype) {
+        packets.append(packet_summary(pkt, linktype));
+    }, &next);
+    if (!ok)
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid cursor", res);
+
+    (*res)["result"] = Json::Value(Json::objectValue);
+    (*res)["result"]["packets"] = packets;
+    (*res)["result"]["next"] = next != 0 ? Json::Value(static_cast<Json::UInt64>(next)) : Json::Value();
+
     return true;
 }
 
-bool rpc::serve_ping(const Json::Value& params, Json::Value* res)
+/**
+ * All the packets a background search found, once done, streamed as they
+ * are read rather than a page at a time.
+ *
+ * params: { "id": number }
+ */
+bool rpc::serve_search_stream(const Json::Value& params, xa::result_stream* res)
+{
+    const unsigned PAGE = 1000;
+    uint64_t cursor = 0;
+    search::job_status st;
+    bool gone = false;
+
+    if (!search_jobs_ || !params["id"].isInt() || !search_jobs_->get_status(params["id"].asInt(), &st))
+        return res->fail(ERROR_INVALID_PARAMS, "Invalid search id");
+    if (st.state != search::JOB_DONE)
+        return res->fail(ERROR_SERVER_ERROR_START, std::string("Search is ") + job_state_name(st.state));
+
+    do {
+        bool ok = search_jobs_->fetch(params["id"].asInt(), cursor, PAGE, [&](const packet& pkt, int linktype) {
+            if (!gone && !res->append(packet_summary(pkt, linktype)))
+                gone = true;
+        }, &cursor);
+        if (!ok)
+            return res->fail(ERROR_SERVER_ERROR_START, "Search result removed");
+        if (gone)
+            return false;
+    } while (cursor != 0);
+
+    return true;
+}
+
+/**
+ * Stop a background search, or remove the result of a finished one.
+ *
+ * params: { "id": number }
+ */
+bool rpc::serve_search_cancel(const Json::Value& params, Json::Value* res)
 {
+    if (!search_jobs_ || !params["id"].isInt() || !search_jobs_->cancel(params["id"].asInt()))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid search id", res);
+
     (*res)["result"] = Json::Value(Json::objectValue);
-    (*res)["result"]["message"] = "OK";
-    (*res)["result"]["params"] = params;
+    (*res)["result"]["id"] = params["id"].asInt();
+
+    return true;
+}
+
+/**
+ * Search this node and its peers at once, the packets of all merged by
+ * timestamp as in search_fetch with the name of their node, and streamed as
+ * the pages of the nodes come. A peer that fails or doesn't answer by the
+ * timeout is left out of the result, which is then partial.
+ *
+ * The last item is not a packet but the outcome:
+ * { "status": { "nodes": [...], "partial": bool, "truncated": bool } }
+ *
+ * params: { "query": string, "begin": seconds, "end": seconds, "limit": number, "timeout": seconds }
+ */
+bool rpc::serve_federated_search(const Json::Value& params, xa::result_stream* res)
+{
+    const unsigned DEFAULT_LIMIT = 1000;
+    const unsigned MAX_LIMIT = 100000;
+    uint64_t begin_ts, end_ts;
+    unsigned limit;
+    double timeout = federation_timeout_sec_;
+    query::program query;
+
+    // checked here once rather than by every peer
+    std::string error = parse_search(params, &query, &begin_ts, &end_ts, &limit);
+    if (!error.empty())
+        return res->fail(ERROR_INVALID_PARAMS, error);
+    if (!params.isMember("limit"))
+        limit = DEFAULT_LIMIT;
+    else if (limit > MAX_LIMIT)
+        return res->fail(ERROR_INVALID_PARAMS, "Invalid limit");
+
+    if (params.isMember("timeout")) {
+        if (!params["timeout"].isNumeric() || params["timeout"].asDouble() <= 0)
+            return res->fail(ERROR_INVALID_PARAMS, "Invalid timeout");
+        timeout = params["timeout"].asDouble();
+    }
+
+    federation::local_node local("local", [this](const Json::Value& req, Json::Value* res) {
+        xa::request_context ctx;
+        return serve(req, res, &ctx);
+    });
+    std::vector<federation::node*> nodes;
+    if (search_jobs_)
+        nodes.push_back(&local);
+    for (const auto& peer : peers_) {
+        nodes.push_back(peer.get());
+    }
+
+    Json::Value job(Json::objectValue);
+    job["query"] = params["query"];
+    job["begin"] = params["begin"];
+    job["end"] = params["end"];
+    job["limit"] = limit;
+
+    std::vector<federation::node_status> status;
+    bool gone = false;
+
+    // the client gone, the search stops
+    bool complete = federation::search(nodes, job, limit,
+                                       std::chrono::milliseconds(static_cast<int64_t>(timeout * 1000)),
+                                       [res, &gone](const Json::Value& record) {
+                                           gone = !res->append(record);
+                                           return !gone;
+                                       }, &status);
+    if (gone)
+        return false;
+
+    Json::Value outcome(Json::objectValue);
+    Json::Value& result = outcome["status"] = Json::Value(Json::objectValue);
+    bool truncated = false;
+    result["nodes"] = Json::Value(Json::arrayValue);
+    for (const auto& st : status) {
+        Json::Value node(Json::objectValue);
+        node["name"] = st.name;
+        node["complete"] = st.complete;
+        node["truncated"] = st.truncated;
+        node["timed_out"] = st.timed_out;
+        node["packets"] = static_cast<Json::UInt64>(st.packets);
+        if (!st.error.empty())
+            node["error"] = st.error;
+        result["nodes"].append(node);
+        truncated = truncated || st.truncated || (!st.complete && st.error.empty());
+    }
+    result["partial"] = !complete;
+    result["truncated"] = truncated;
+
+    return res->append(outcome);
+}
+
+// a cost, null if the access isn't possible
+static Json::Value cost_value(double cost)
+{
+    return std::isfinite(cost) ? Json::Value(cost) : Json::Value();
+}
+
+/**
+ * Show how a search would run without running it: the compiled query, and
+ * for each stored segment how it would be read and the estimated cost in
+ * bytes.
+ *
+ * params: { "query": string, "begin": seconds, "end": seconds }
+ */
+bool rpc::serve_explain(const Json::Value& params, Json::Value* res)
+{
+    uint64_t begin_ts, end_ts;
+    query::program query;
+    std::string error;
+
+    if (!parse_time(params["begin"], &begin_ts) || !parse_time(params["end"], &end_ts) || begin_ts >= end_ts)
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid time range", res);
+
+    if (!params["query"].isString() || !query.compile(params["query"].asString(), &error))
+        return serve_error(ERROR_INVALID_PARAMS, "Invalid query: " + error, res);
+
+    search::plan plan = search::make_plan(query, begin_ts, end_ts, storage_, recent_);
+    Json::Value& result = (*res)["result"] = Json::Value(Json::objectValue);
+
+    result["query"] = query.text();
+    result["code"] = Json::Value(Json::arrayValue);
+    for (const auto& line : query.listing()) {
+        result["code"].append(line);
+    }
+    result["prefilter"] = segment::to_string(query.prefilter());
+    result["begin"] = static_cast<double>(plan.begin_ts) / 1e9;
+    result["end"] = static_cast<double>(plan.end_ts) / 1e9;
+    result["memory"] = recent_ != nullptr && plan.cut < plan.end_ts;
+    result["cost"] = plan.cost;
+
+    result["segments"] = Json::Value(Json::arrayValue);
+    for (const auto& p : plan.segments) {
+        Json::Value segment(Json::objectValue);
+        segment["path"] = p.segment.path;
+        segment["access"] = search::access_name(p.access);
+        segment["blocks"] = static_cast<Json::UInt64>(p.blocks);
+        segment["range"] = p.range;
+        segment["selectivity"] = p.selectivity;
+        segment["cost"] = p.cost;
+        segment["costs"]["scan"] = cost_value(p.scan_cost);
+        segment["costs"]["range"] = cost_value(p.range_cost);
+        segment["costs"]["index"] = cost_value(p.index_cost);
+        result["segments"].append(segment);
+    }
 
     return true;
 }
@@ -5,20 +5,54 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "common/federation.hpp"
+#include "common/packet_ring.hpp"
+#include "common/retention.hpp"
 #include "common/rpc_base.hpp"
+#include "common/search_job.hpp"
+#include "common/trigger.hpp"
 
 namespace pca {
 
 class rpc : public xa::rpc_base {
 public:
-    rpc(const std::string& address, unsigned short port);
-    virtual bool serve(const Json::Value &req, Json::Value* res);
+    rpc(const std::string& address, unsigned short port, unsigned nthreads = 1);
+
+    void set_storage(const std::string& data_path, retention* storage, recent_buffer* recent,
+                     size_t cache_bytes = 0);
+    bool set_peers(const std::vector<std::string>& peers, unsigned timeout_sec);
 
 private:
     // interactive
-    bool serve_ping(const Json::Value& params, Json::Value* res);
+    bool serve_ping(const xa::json::value& params, xa::json::writer* res);
+
+    // packets
+    bool serve_download(const Json::Value& params, Json::Value* res);
+    bool serve_trigger_capture(const Json::Value& params, Json::Value* res);
+    bool serve_trigger_status(const Json::Value& params, Json::Value* res);
+    bool serve_search(const Json::Value& params, Json::Value* res, xa::request_context* ctx);
+    bool serve_explain(const Json::Value& params, Json::Value* res);
+    bool serve_search_start(const Json::Value& params, Json::Value* res);
+    bool serve_search_poll(const Json::Value& params, Json::Value* res);
+    bool serve_search_fetch(const Json::Value& params, Json::Value* res);
+    bool serve_search_stream(const Json::Value& params, xa::result_stream* res);
+    bool serve_search_cancel(const Json::Value& params, Json::Value* res);
+    bool serve_federated_search(const Json::Value& params, xa::result_stream* res);
+
+    std::string data_path_;
+    retention* storage_ = nullptr;
+    recent_buffer* recent_ = nullptr;
+    std::atomic<unsigned> downloads_;
+    std::unique_ptr<trigger::manager> triggers_;
+    std::unique_ptr<search::cache> search_cache_;
+    std::unique_ptr<search::job_manager> search_jobs_;
+    std::vector<std::unique_ptr<federation::node>> peers_;
+    unsigned federation_timeout_sec_ = 10;
 };
 
 }  // namespace pca
@@ -0,0 +1,53 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/logger.hpp"
+#include "common/merge.hpp"
+#include "common/replay.hpp"
+
+#include "fmt/format.h"
+
+#include "options.hpp"
+
+using fmt::literals::operator""_format;
+
+int main(int argc, char *argv[])
+{
+    using namespace pca;
+    using pca::merge::options;
+
+    setenv("TZ", "UTC", 1);
+
+    if (!options::parse_cmdline(argc, argv))
+        return 1;
+
+    std::vector<std::string> files;
+    for (const auto& path : options::input_paths) {
+        std::vector<std::string> found;
+        if (!replay::list_files(path, &found)) {
+            logger::fatal("Can't read {}"_format(path));
+            return 1;
+        }
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    if (files.empty()) {
+        logger::fatal("No pcap file to merge");
+        return 1;
+    }
+
+    uint64_t begin_ts = options::merge_begin_sec * 1000000000ULL;
+    uint64_t end_ts = options::merge_end_sec > 0 ? options::merge_end_sec * 1000000000ULL : UINT64_MAX;
+
+    if (!merge::merge_files(files, options::output_path, begin_ts, end_ts)) {
+        logger::fatal("Can't merge into {}"_format(options::output_path));
+        return 1;
+    }
+
+    logger::info("merged {} files into {}"_format(files.size(), options::output_path));
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+
+#include "fmt/format.h"
+
+#include "common/cmdline.hpp"
+#include "common/logger.hpp"
+
+#include "options.hpp"
+
+using fmt::literals::operator""_format;
+
+namespace pca {
+
+namespace merge {
+
+static void show_help(const char *progname);
+
+std::vector<std::string> options::args;
+
+unsigned options::debug_level = 0;
+
+uint64_t options::merge_begin_sec = 0;
+uint64_t options::merge_end_sec = 0;
+std::string options::output_path;
+std::vector<std::string> options::input_paths;
+
+bool options::parse_cmdline(int argc, char *argv[])
+{
+    const char* progname = argv[0];
+
+    MAKE_CLI_PARSER_WITH_MERGE();
+
+    if (argc < 3) {
+        show_help(progname);
+        return false;
+    }
+
+    output_path = argv[1];
+    input_paths.assign(argv + 2, argv + argc);
+
+    return true;
+}
+
+bool options::parse_config(const char* filename)
+{
+    static std::map<std::string, xa::yaml::fn_body> yaml_settings = {
+        DEBUG_COMMON_ENUM()
+    };
+
+    xa::yaml::node config;
+
+    return config.load_settings(filename, yaml_settings);
+}
+
+static void show_help(const char *progname)
+{
+    printf("Usage: %s [OPTIONS...] OUTPUT_FILE INPUT_FILE|DIR...\n\n", progname);
+    printf("Merge pcap files into one, ordered by timestamp\n\n");
+
+    MAKE_CLI_HELP_WITH_MERGE();
+}
+
+}  // namespace merge
+
+}  // namespace pca
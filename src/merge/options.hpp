@@ -0,0 +1,39 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common/yaml.hpp"
+
+namespace pca {
+
+namespace merge {
+
+class options {
+public:
+    static std::vector<std::string> args;
+
+    // debug
+    static unsigned debug_level;
+
+    // merge
+    static uint64_t merge_begin_sec;
+    static uint64_t merge_end_sec;
+    static std::string output_path;
+    static std::vector<std::string> input_paths;
+
+public:
+    static bool parse_cmdline(int argc, char *argv[]);
+
+protected:
+    static bool parse_config(const char* filename);
+};
+
+}  // namespace merge
+
+}  // namespace pca
@@ -3,29 +3,70 @@
  * Copyright (c) 2014 Xabyss Inc. All rights reserved.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
 #include "common/rpc_base.hpp"
 
 class rpc_echo: public xa::rpc_base {
 public:
-    rpc_echo() : rpc_base("0.0.0.0", 10080)
+    explicit rpc_echo(int nthreads) : rpc_base("0.0.0.0", 10080, nthreads)
     {
+        // "ping" on the fast path, anything else echoed through Json::Value
+        add_fast_method("ping", &rpc_echo::serve_ping);
+        // "count" streams n numbers, one every delay ms
+        add_stream_method("count", &rpc_echo::serve_count, xa::method_info({
+            { "n", xa::PARAM_INTEGER, false }, { "delay", xa::PARAM_INTEGER, false } }));
     }
 
     virtual ~rpc_echo()
     {
     }
-    virtual bool serve(const Json::Value& req, Json::Value* res);
+    using rpc_base::serve;
+    virtual bool serve(const Json::Value& req, Json::Value* res, xa::request_context* ctx);
+    bool serve_ping(const xa::json::value& params, xa::json::writer* res);
+    bool serve_count(const Json::Value& params, xa::result_stream* res);
 };
 
-bool rpc_echo::serve(const Json::Value& req, Json::Value* res)
+bool rpc_echo::serve(const Json::Value& req, Json::Value* res, xa::request_context* ctx)
 {
     (*res)["result"] = req;
     return true;
 }
 
+bool rpc_echo::serve_ping(const xa::json::value& params, xa::json::writer* res)
+{
+    res->key("result").write(params);
+    return true;
+}
+
+bool rpc_echo::serve_count(const Json::Value& params, xa::result_stream* res)
+{
+    int n = params.get("n", 10).asInt();
+    int delay = params.get("delay", 0).asInt();
+
+    for (int i = 0; i < n; i++) {
+        if (delay > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        if (!res->append(Json::Value(i)))
+            return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
-    rpc_echo echo;
+    // rpc-echo [netlib|epoll [threads [unix-socket]]]
+    rpc_echo echo(argc > 2 ? atoi(argv[2]) : 1);
+
+    if (argc > 1 && strcmp(argv[1], "epoll") == 0)
+        echo.set_engine(xa::rpc_base::ENGINE_EPOLL);
+    if (argc > 3)
+        echo.set_unix_socket(argv[3]);
+    echo.set_compression(1024);
     echo.start();
     echo.join();
 }
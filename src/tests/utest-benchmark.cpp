@@ -5,7 +5,15 @@
 
 #define CATCH_CONFIG_MAIN
 
+#include <stdio.h>
+#include <json/json.h>
+#include <string>
+#include <vector>
+
 #include "catch2/catch.hpp"
+#include "common/binary_json.hpp"
+#include "common/fast_json.hpp"
+#include "common/query.hpp"
 #include "common/validation.hpp"
 
 using pca::validation::validate_ipv4_address;
@@ -41,4 +49,127 @@ TEST_CASE("Benchmarking") {
             return !validate_ipv4_address("www.22.com");
         };
     }
+
+    SECTION("search query benchmark test") {
+        // a batch of tcp 10.0.0.3:1000 > 10.0.0.4:443
+        std::vector<uint8_t> frame(60, 0);
+        frame[12] = 0x08;
+        frame[14] = 0x45;
+        frame[14 + 9] = 6;
+        frame[14 + 12] = 10;
+        frame[14 + 15] = 3;
+        frame[14 + 16] = 10;
+        frame[14 + 19] = 4;
+        frame[34] = 0x03;
+        frame[35] = 0xe8;
+        frame[36] = 0x01;
+        frame[37] = 0xbb;
+
+        pca::query::batch b;
+        pca::packet pkt = { 0, 60, 60, frame.data() };
+        for (size_t i = 0; i < pca::query::batch::SIZE; i++) {
+            pkt.ts = i;
+            b.add(pkt);
+        }
+
+        pca::query::program tcp, host_port, mixed;
+        REQUIRE(tcp.compile("tcp"));
+        REQUIRE(host_port.compile("host 10.0.0.3 and port 443 and not udp"));
+        REQUIRE(mixed.compile("(src 10.0.0.1 || dst == 10.0.0.2) && len >= 700 && dport != 81"));
+
+        // 1024 packets a run
+        BENCHMARK("run(\"tcp\")") {
+            return tcp.run(&b);
+        };
+
+        BENCHMARK("run(\"host 10.0.0.3 and port 443 and not udp\")") {
+            return host_port.run(&b);
+        };
+
+        BENCHMARK("run(\"(src 10.0.0.1 || dst == 10.0.0.2) && len >= 700 && dport != 81\")") {
+            return mixed.run(&b);
+        };
+    }
+
+    SECTION("json-rpc ping benchmark test") {
+        const std::string req = "{\"jsonrpc\":\"2.0\",\"id\":42,\"method\":\"ping\","
+                                "\"params\":{\"from\":\"10.0.0.1\",\"seq\":[1,2,3]}}";
+
+        // what the Json::Value path does for a call, serve() aside
+        BENCHMARK("jsoncpp ping") {
+            Json::Value json_req, json_res;
+            Json::Reader reader;
+            Json::FastWriter writer;
+
+            reader.parse(req, json_req);
+            json_res["result"]["message"] = "OK";
+            json_res["result"]["params"] = json_req["params"];
+            json_res["id"] = json_req["id"];
+            json_res["jsonrpc"] = "2.0";
+
+            return writer.write(json_res);
+        };
+
+        // and the fast path, its parser and buffers kept from call to call
+        xa::json::parser parser;
+        std::string input, output;
+
+        BENCHMARK("fast_json ping") {
+            input.assign(req);
+            const xa::json::value* v = parser.parse(&input[0], input.size());
+
+            output.clear();
+            xa::json::writer writer(&output);
+            writer.begin_object();
+            writer.key("jsonrpc").string("2.0");
+            writer.key("id").write(*v->find("id"));
+            writer.key("result").begin_object();
+            writer.key("message").string("OK");
+            writer.key("params").write(*v->find("params"));
+            writer.end_object();
+            writer.end_object();
+
+            return output.size();
+        };
+    }
+
+    SECTION("bulk stats encoding benchmark test") {
+        // a stats pull of a thousand flows, as a result of the Json::Value path
+        Json::Value res;
+        for (int i = 0; i < 1000; i++) {
+            Json::Value& flow = res["result"]["flows"][i];
+            flow["src"] = "10.0.0." + std::to_string(i % 256);
+            flow["dst"] = "192.168.1." + std::to_string(i % 200);
+            flow["sport"] = 1024 + i;
+            flow["dport"] = 443;
+            flow["packets"] = Json::UInt64(1000 + i * 37);
+            flow["bytes"] = Json::UInt64(1500000000ULL + i * 1234567ULL);
+            flow["rtt"] = 0.25 + i / 1000.0;
+        }
+        res["id"] = 1;
+        res["jsonrpc"] = "2.0";
+
+        std::string json = Json::FastWriter().write(res), cbor, msgpack;
+        xa::json::encode(xa::json::FORMAT_CBOR, res, &cbor);
+        xa::json::encode(xa::json::FORMAT_MSGPACK, res, &msgpack);
+        printf("stats of 1000 flows: %zu bytes of JSON, %zu of CBOR, %zu of MessagePack\n",
+               json.size(), cbor.size(), msgpack.size());
+
+        BENCHMARK("jsoncpp stats") {
+            return Json::FastWriter().write(res);
+        };
+
+        std::string out;
+        BENCHMARK("cbor stats") {
+            out.clear();
+            xa::json::encode(xa::json::FORMAT_CBOR, res, &out);
+            return out.size();
+        };
+
+        BENCHMARK("msgpack stats") {
+            out.clear();
+            xa::json::encode(xa::json::FORMAT_MSGPACK, res, &out);
+            return out.size();
+        };
+    }
 }
@@ -0,0 +1,400 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/federation.hpp"
+#include "common/rpc_client.hpp"
+
+using pca::federation::node_status;
+using xa::rpc_client;
+
+typedef std::function<bool(const Json::Value& req, Json::Value* res)> handler_func;
+
+/**
+ * A JSON-RPC server on a port of its own, one connection at a time.
+ */
+class test_server {
+public:
+    explicit test_server(const handler_func& handler, bool chunked = false)
+        : handler_(handler)
+        , chunked_(chunked)
+    {
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+        int on = 1;
+
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        REQUIRE(bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        REQUIRE(listen(fd_, 16) == 0);
+        getsockname(fd_, reinterpret_cast<struct sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+
+        thread_ = std::thread(&test_server::run, this);
+    }
+
+    ~test_server()
+    {
+        shutdown(fd_, SHUT_RDWR);
+        thread_.join();
+        close(fd_);
+    }
+
+    unsigned short port() const
+    {
+        return port_;
+    }
+
+private:
+    void run()
+    {
+        for (;;) {
+            int c = accept(fd_, nullptr, nullptr);
+            if (c < 0)
+                return;
+            serve(c);
+            close(c);
+        }
+    }
+
+    void serve(int c)
+    {
+        std::string data;
+        char buf[4096];
+        size_t header_end;
+
+        while ((header_end = data.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(c, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            data.append(buf, n);
+        }
+
+        size_t length = strtoul(strcasestr(data.c_str(), "Content-Length:") + 15, nullptr, 10);
+        while (data.size() < header_end + 4 + length) {
+            ssize_t n = recv(c, buf, sizeof(buf), 0);
+            if (n <= 0)
+                return;
+            data.append(buf, n);
+        }
+
+        Json::Value req, res(Json::objectValue);
+        Json::Reader reader;
+        Json::FastWriter writer;
+        REQUIRE(reader.parse(data.substr(header_end + 4), req));
+
+        bool ok = handler_(req, &res);
+        res["id"] = req["id"];
+        res["jsonrpc"] = "2.0";
+
+        std::string body = writer.write(res);
+        std::string response = std::string("HTTP/1.1 ") + (ok ? "200 OK" : "500 Internal Server Error")
+            + "\r\nContent-Type: application/json\r\n";
+        if (chunked_) {
+            // in two chunks
+            size_t half = body.size() / 2;
+            char size[32];
+            response += "Transfer-Encoding: chunked\r\n\r\n";
+            snprintf(size, sizeof(size), "%zx\r\n", half);
+            response += size + body.substr(0, half) + "\r\n";
+            snprintf(size, sizeof(size), "%zx\r\n", body.size() - half);
+            response += size + body.substr(half) + "\r\n0\r\n\r\n";
+        } else {
+            response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+        send(c, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+
+    handler_func handler_;
+    bool chunked_;
+    int fd_;
+    unsigned short port_;
+    std::thread thread_;
+};
+
+/**
+ * The background search methods of a node over a fixed list of timestamps.
+ */
+class fake_node {
+public:
+    explicit fake_node(const std::vector<double>& ts, unsigned polls = 2) : ts_(ts), polls_(polls) {}
+
+    bool operator()(const Json::Value& req, Json::Value* res)
+    {
+        std::string method = req["method"].asString();
+        const Json::Value& params = req["params"];
+        Json::Value& result = (*res)["result"] = Json::Value(Json::objectValue);
+
+        if (method == "search_start") {
+            size_t limit = params["limit"].asUInt();
+            truncated_ = ts_.size() > limit;
+            if (truncated_)
+                ts_.resize(limit);
+            result["id"] = 7;
+        } else if (method == "search_poll") {
+            result["state"] = polls_ != 0 && ++polled_ >= polls_ ? "done" : "running";
+            result["truncated"] = truncated_;
+        } else if (method == "search_fetch") {
+            size_t first = params["cursor"].asUInt64() > 0 ? params["cursor"].asUInt64() - 1 : 0;
+            size_t last = std::min<size_t>(ts_.size(), first + params["limit"].asUInt());
+            fetched_++;
+            result["packets"] = Json::Value(Json::arrayValue);
+            for (size_t i = first; i < last; i++) {
+                Json::Value p(Json::objectValue);
+                p["ts"] = ts_[i];
+                p["len"] = 60;
+                result["packets"].append(p);
+            }
+            result["next"] = last < ts_.size() ? Json::Value(static_cast<Json::UInt64>(last + 1)) : Json::Value();
+        } else if (method == "search_cancel") {
+            cancelled_++;
+            result["id"] = params["id"];
+        } else {
+            res->removeMember("result");
+            (*res)["error"]["code"] = -32601;
+            (*res)["error"]["message"] = "Method not found";
+            return false;
+        }
+
+        return true;
+    }
+
+    std::atomic<unsigned> fetched_{0};
+    std::atomic<unsigned> cancelled_{0};
+
+private:
+    std::vector<double> ts_;
+    unsigned polls_;            // 0 for never done
+    unsigned polled_ = 0;
+    bool truncated_ = false;
+};
+
+static std::vector<double> every(double first, double step, size_t n)
+{
+    std::vector<double> ts;
+
+    for (size_t i = 0; i < n; i++) {
+        ts.push_back(first + i * step);
+    }
+
+    return ts;
+}
+
+TEST_CASE("common_rpc_client_test")
+{
+    std::string host;
+    unsigned short port;
+    Json::Value result;
+    std::string error;
+    auto deadline = [] { return std::chrono::steady_clock::now() + std::chrono::seconds(2); };
+
+    SECTION("Checking the peer addresses are parsed.") {
+        REQUIRE(rpc_client::parse_address("10.0.0.2:10081", &host, &port));
+        REQUIRE(host == "10.0.0.2");
+        REQUIRE(port == 10081);
+        REQUIRE(rpc_client::parse_address("[::1]:80", &host, &port));
+        REQUIRE(host == "::1");
+        REQUIRE(port == 80);
+        REQUIRE(!rpc_client::parse_address("10.0.0.2", &host, &port));
+        REQUIRE(!rpc_client::parse_address("10.0.0.2:", &host, &port));
+        REQUIRE(!rpc_client::parse_address(":80", &host, &port));
+        REQUIRE(!rpc_client::parse_address("10.0.0.2:65536", &host, &port));
+        REQUIRE(!rpc_client::parse_address("10.0.0.2:80x", &host, &port));
+    }
+
+    SECTION("Checking results, errors and chunked responses.") {
+        handler_func echo = [](const Json::Value& req, Json::Value* res) {
+            if (req["method"] == "fail") {
+                (*res)["error"]["code"] = -32602;
+                (*res)["error"]["message"] = "Invalid params";
+                return false;
+            }
+            (*res)["result"] = req["params"];
+            return true;
+        };
+        test_server plain(echo);
+        test_server chunked(echo, true);
+        Json::Value params(Json::objectValue);
+
+        params["text"] = std::string(100000, 'x');
+        for (unsigned short p : { plain.port(), chunked.port() }) {
+            rpc_client client("127.0.0.1", p);
+            REQUIRE(client.call("echo", params, &result, &error, deadline()));
+            REQUIRE(result == params);
+            REQUIRE(!client.call("fail", params, &result, &error, deadline()));
+            REQUIRE(error == "Invalid params");
+        }
+    }
+
+    SECTION("Checking unreachable and silent servers fail by the deadline.") {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        socklen_t len = sizeof(addr);
+
+        // listening, never accepting
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        REQUIRE(bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+        REQUIRE(listen(fd, 4) == 0);
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+
+        rpc_client silent("127.0.0.1", ntohs(addr.sin_port));
+        auto begin = std::chrono::steady_clock::now();
+        REQUIRE(!silent.call("ping", Json::Value(), &result, &error,
+                             begin + std::chrono::milliseconds(200)));
+        REQUIRE(error == "timed out");
+        REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(1));
+        close(fd);
+
+        // nothing listening any more
+        rpc_client closed("127.0.0.1", ntohs(addr.sin_port));
+        REQUIRE(!closed.call("ping", Json::Value(), &result, &error, deadline()));
+        REQUIRE(!error.empty());
+    }
+}
+
+TEST_CASE("common_federation_test")
+{
+    Json::Value params(Json::objectValue);
+    std::vector<Json::Value> records;
+    std::vector<node_status> status;
+    auto collect = [&records](const Json::Value& record) {
+        records.push_back(record);
+        return true;
+    };
+
+    params["query"] = "udp";
+    params["begin"] = 0;
+    params["end"] = 100000;
+    params["limit"] = 100000;
+
+    // three nodes, interleaved, the first one with several pages
+    fake_node a(every(0, 1, 2500)), b(every(0.5, 3, 300)), c(every(1000, 1, 10));
+    test_server sa(std::ref(a)), sb(std::ref(b)), sc(std::ref(c));
+    pca::federation::peer_node na("a", "127.0.0.1", sa.port());
+    pca::federation::peer_node nb("b", "127.0.0.1", sb.port());
+    pca::federation::peer_node nc("c", "127.0.0.1", sc.port());
+
+    SECTION("Checking the packets of every node are merged in time order.") {
+        REQUIRE(pca::federation::search({ &na, &nb, &nc }, params, 100000, std::chrono::seconds(5),
+                                        collect, &status));
+        REQUIRE(records.size() == 2500 + 300 + 10);
+        for (size_t i = 1; i < records.size(); i++) {
+            REQUIRE(records[i - 1]["ts"].asDouble() <= records[i]["ts"].asDouble());
+        }
+        REQUIRE(records[0]["node"] == "a");
+        REQUIRE(records[1]["node"] == "b");
+        REQUIRE(records.back()["node"] == "a");
+
+        REQUIRE(status.size() == 3);
+        REQUIRE(status[0].name == "a");
+        REQUIRE(status[0].packets == 2500);
+        REQUIRE(status[1].packets == 300);
+        REQUIRE(status[2].packets == 10);
+        for (const auto& st : status) {
+            REQUIRE(st.complete);
+            REQUIRE(!st.timed_out);
+            REQUIRE(st.error.empty());
+        }
+        REQUIRE(a.fetched_ == 3);
+        REQUIRE(a.cancelled_ == 1);
+        REQUIRE(b.cancelled_ == 1);
+    }
+
+    SECTION("Checking the merge stops at the limit.") {
+        REQUIRE(pca::federation::search({ &na, &nb, &nc }, params, 100, std::chrono::seconds(5),
+                                        collect, &status));
+        REQUIRE(records.size() == 100);
+        REQUIRE(records.back()["ts"].asDouble() < 100);
+        REQUIRE(!status[0].complete);
+        REQUIRE(status[0].error.empty());
+        REQUIRE(a.fetched_ == 1);
+        REQUIRE(a.cancelled_ == 1);
+
+        // each node keeps no more than the limit either
+        params["limit"] = 200;
+        records.clear();
+        REQUIRE(pca::federation::search({ &na }, params, 200, std::chrono::seconds(5), collect, &status));
+        REQUIRE(records.size() == 200);
+        REQUIRE(status[0].truncated);
+    }
+
+    SECTION("Checking slow and unreachable nodes make a partial result.") {
+        fake_node slow(every(0, 1, 10), 0);
+        test_server ss(std::ref(slow));
+        pca::federation::peer_node ns("slow", "127.0.0.1", ss.port());
+        pca::federation::peer_node nd("dead", "127.0.0.1", 1);
+
+        auto begin = std::chrono::steady_clock::now();
+        REQUIRE(!pca::federation::search({ &nb, &ns, &nd }, params, 100000, std::chrono::milliseconds(300),
+                                         collect, &status));
+        REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(2));
+
+        REQUIRE(records.size() == 300);
+        REQUIRE(status[0].complete);
+        REQUIRE(!status[1].complete);
+        REQUIRE(status[1].timed_out);
+        REQUIRE(status[1].error == "timed out");
+        REQUIRE(slow.cancelled_ == 1);
+        REQUIRE(!status[2].complete);
+        REQUIRE(!status[2].timed_out);
+        REQUIRE(!status[2].error.empty());
+    }
+
+    SECTION("Checking a slow merge doesn't time the nodes out.") {
+        size_t taken = 0;
+
+        // a page every 200 ms, each within the timeout, all of them not
+        REQUIRE(pca::federation::search({ &na }, params, 100000, std::chrono::milliseconds(300),
+                                        [&](const Json::Value& record) {
+            if (++taken % pca::federation::PAGE_SIZE == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            return true;
+        }, &status));
+        REQUIRE(taken == 2500);
+        REQUIRE(status[0].complete);
+        REQUIRE(!status[0].timed_out);
+    }
+
+    SECTION("Checking this node is searched in process.") {
+        fake_node self(every(0.25, 1, 50));
+        pca::federation::local_node local("local", std::ref(self));
+
+        REQUIRE(pca::federation::search({ &local, &nb }, params, 100000, std::chrono::seconds(5),
+                                        collect, &status));
+        REQUIRE(records.size() == 350);
+        REQUIRE(records[0]["node"] == "local");
+        REQUIRE(status[0].packets == 50);
+
+        // a failing node
+        pca::federation::local_node broken("broken", [](const Json::Value& req, Json::Value* res) {
+            (*res)["error"]["message"] = "No packet storage";
+            return false;
+        });
+        records.clear();
+        REQUIRE(!pca::federation::search({ &broken, &nb }, params, 100000, std::chrono::seconds(5),
+                                         collect, &status));
+        REQUIRE(records.size() == 300);
+        REQUIRE(status[0].error == "No packet storage");
+    }
+}
@@ -0,0 +1,134 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/flow.hpp"
+#include "common/pcap_file.hpp"
+
+using pca::flow_key;
+using pca::flow_record;
+using pca::flow_table;
+using pca::packet;
+
+static flow_key make_key(uint8_t src, uint16_t sport, uint8_t dst, uint16_t dport)
+{
+    flow_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.version = 4;
+    key.protocol = 6;
+    key.src_addr[0] = 10;
+    key.src_addr[3] = src;
+    key.dst_addr[0] = 10;
+    key.dst_addr[3] = dst;
+    key.src_port = sport;
+    key.dst_port = dport;
+
+    return key;
+}
+
+TEST_CASE("common_flow_test")
+{
+    std::vector<uint8_t> frame(60, 0);
+    packet pkt = { 1000, 60, 100, frame.data() };
+
+    SECTION("Checking both directions go to one flow.") {
+        flow_table flows;
+
+        flows.update(make_key(2, 40000, 1, 443), pkt);
+        pkt.ts = 2000;
+        flows.update(make_key(1, 443, 2, 40000), pkt);
+        flows.update(make_key(1, 443, 2, 40000), pkt);
+
+        REQUIRE(flows.size() == 1);
+        flow_record rec = flows.records()[0];
+        REQUIRE(rec.key.src_addr[3] == 1);
+        REQUIRE(rec.key.src_port == 443);
+        REQUIRE(rec.packets[0] == 2);
+        REQUIRE(rec.packets[1] == 1);
+        REQUIRE(rec.bytes[1] == 100);
+        REQUIRE(rec.first_ts == 1000);
+        REQUIRE(rec.last_ts == 2000);
+        REQUIRE(pca::address_to_string(rec.key, rec.key.dst_addr) == "10.0.0.2");
+    }
+
+    SECTION("Checking partitioned merge.") {
+        flow_table a(4), b(4), merged(4);
+
+        for (uint16_t port = 0; port < 100; port++) {
+            a.update(make_key(1, 1000 + port, 2, 80), pkt);
+            b.update(make_key(2, 80, 1, 1000 + port), pkt);
+            b.update(make_key(3, 1000 + port, 2, 80), pkt);
+        }
+        for (unsigned p = 0; p < merged.partitions(); p++) {
+            merged.merge(a, p);
+            merged.merge(b, p);
+        }
+
+        REQUIRE(merged.size() == 200);
+        for (const auto& rec : merged.records()) {
+            REQUIRE(rec.packets[0] + rec.packets[1] == (rec.key.dst_addr[3] == 3 ? 1 : 2));
+        }
+    }
+
+    SECTION("Checking idle flows expire.") {
+        flow_table flows;
+        size_t emitted = 0;
+
+        flows.update(make_key(1, 1000, 2, 80), pkt);
+        pkt.ts = 5000;
+        flows.update(make_key(1, 1001, 2, 80), pkt);
+
+        REQUIRE(flows.expire(3000, [&](const flow_record&) { emitted++; }) == 1);
+        REQUIRE(emitted == 1);
+        REQUIRE(flows.size() == 1);
+    }
+}
+
+TEST_CASE("common_pcap_resync_test")
+{
+    char tmpl[] = "/tmp/utest-flow.XXXXXX";
+    std::string filename = std::string(mkdtemp(tmpl)) + "/resync.pcap";
+    std::vector<size_t> offsets;
+
+    {
+        pca::pcap::writer out;
+        REQUIRE(out.open(filename, pca::LINKTYPE_ETHERNET));
+        for (uint32_t i = 0; i < 1000; i++) {
+            // payload that looks like record headers
+            std::vector<uint8_t> frame(60 + i % 40, 0);
+            for (size_t k = 0; k + 4 <= frame.size(); k += 4) {
+                uint32_t v = 60;
+                memcpy(&frame[k], &v, 4);
+            }
+            packet pkt = { 1500000000ULL * 1000000000ULL + i, static_cast<uint32_t>(frame.size()),
+                           static_cast<uint32_t>(frame.size()), frame.data() };
+            offsets.push_back(out.offset());
+            REQUIRE(out.write(pkt));
+        }
+        REQUIRE(out.close());
+    }
+
+    pca::pcap::reader in;
+    REQUIRE(in.open(filename));
+
+    for (size_t from = 0; from < in.size(); from += 1234) {
+        size_t found = in.resync(from);
+        auto it = std::lower_bound(offsets.begin(), offsets.end(), from);
+        size_t expected = (from <= sizeof(pca::pcap::file_header)) ? offsets.front()
+            : (it == offsets.end() ? in.size() : *it);
+        REQUIRE(found == expected);
+    }
+
+    in.close();
+    REQUIRE(system(("rm -rf " + std::string(tmpl)).c_str()) == 0);
+}
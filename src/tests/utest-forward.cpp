@@ -0,0 +1,337 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/forward.hpp"
+
+using pca::packet;
+using namespace pca::forward;
+
+// wait up to a few seconds for a condition
+static bool eventually(const std::function<bool()>& cond)
+{
+    for (int i = 0; i < 500; i++) {
+        if (cond())
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return cond();
+}
+
+// a packet whose payload tells its sequence number
+static packet make_packet(uint64_t seq, std::vector<uint8_t>* storage, uint32_t size = 200)
+{
+    storage->resize(size);
+    for (uint32_t i = 0; i < size; i++) {
+        (*storage)[i] = static_cast<uint8_t>(seq + i / 16);
+    }
+    memcpy(storage->data(), &seq, sizeof(seq));
+
+    return packet{ 1000000000ULL + seq, size, size + 4, storage->data() };
+}
+
+struct collected {
+    std::mutex mutex;
+    std::vector<uint64_t> ts;
+    std::vector<uint32_t> caplen;
+    bool payload_ok = true;
+
+    void add(const packet* pkts, size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t seq;
+            memcpy(&seq, pkts[i].data, sizeof(seq));
+            payload_ok = payload_ok && seq + 1000000000ULL == pkts[i].ts && pkts[i].len == 204;
+            ts.push_back(pkts[i].ts);
+            caplen.push_back(pkts[i].caplen);
+        }
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ts.size();
+    }
+};
+
+static sender_config make_config(unsigned short port)
+{
+    sender_config config;
+
+    config.host = "127.0.0.1";
+    config.port = port;
+    config.batch_bytes = 16384;
+    config.flush_ms = 10;
+
+    return config;
+}
+
+TEST_CASE("common_forward_codec_test")
+{
+    std::mt19937 rng(7);
+
+    SECTION("Checking blocks are restored as they were.") {
+        std::vector<std::vector<uint8_t>> inputs;
+
+        inputs.push_back({});
+        inputs.push_back({ 1, 2, 3 });
+        inputs.push_back(std::vector<uint8_t>(100000, 0));
+        std::vector<uint8_t> random(70000);
+        for (auto& b : random) {
+            b = static_cast<uint8_t>(rng());
+        }
+        inputs.push_back(random);
+        std::vector<uint8_t> text;
+        for (int i = 0; i < 5000; i++) {
+            std::string line = "GET /index" + std::to_string(i % 37) + ".html HTTP/1.1\r\n";
+            text.insert(text.end(), line.begin(), line.end());
+        }
+        inputs.push_back(text);
+
+        for (auto& in : inputs) {
+            std::vector<uint8_t> out(compress_bound(in.size()));
+            std::vector<uint8_t> back(in.size());
+            size_t written = 0;
+
+            size_t n = compress(in.data(), in.size(), out.data(), out.size());
+            REQUIRE(n > 0);
+            REQUIRE(decompress(out.data(), n, back.data(), back.size(), &written));
+            REQUIRE(written == in.size());
+            REQUIRE(back == in);
+        }
+
+        std::vector<uint8_t> out(compress_bound(text.size()));
+        REQUIRE(compress(text.data(), text.size(), out.data(), out.size()) < text.size() / 4);
+    }
+
+    SECTION("Checking corrupted blocks are rejected, not overrun.") {
+        std::vector<uint8_t> in(20000);
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = static_cast<uint8_t>(i % 251);
+        }
+        std::vector<uint8_t> out(compress_bound(in.size()));
+        size_t n = compress(in.data(), in.size(), out.data(), out.size());
+        out.resize(n);
+
+        std::vector<uint8_t> back(in.size());
+        size_t written;
+
+        // too small for the block
+        REQUIRE_FALSE(decompress(out.data(), n, back.data(), back.size() - 1, &written));
+
+        for (int i = 0; i < 1000; i++) {
+            std::vector<uint8_t> bad = out;
+            bad[rng() % bad.size()] ^= static_cast<uint8_t>(1 + rng() % 255);
+            // whatever the result, nothing is written past the end
+            decompress(bad.data(), bad.size(), back.data(), back.size(), &written);
+        }
+
+        std::vector<uint8_t> offset_zero = { 0x04, 'a', 'b', 'c', 'd', 0x00, 0x00, 0x00 };
+        REQUIRE_FALSE(decompress(offset_zero.data(), offset_zero.size(), back.data(), back.size(), &written));
+    }
+}
+
+TEST_CASE("common_forward_test")
+{
+    std::vector<uint8_t> payload;
+
+    SECTION("Checking packets reach the collector in order, cut to the snaplen.") {
+        collected got;
+        receiver collector("127.0.0.1", 0, pca::LINKTYPE_ETHERNET,
+                           [&got](const packet* pkts, size_t n) { got.add(pkts, n); });
+        REQUIRE(collector.start());
+
+        sender_config config = make_config(collector.port());
+        sender sensor(config);
+        sensor.start();
+        for (uint64_t i = 0; i < 1000; i++) {
+            packet pkt = make_packet(i, &payload);
+            REQUIRE(sensor.send(&pkt, 1, true) == 1);
+        }
+        REQUIRE(eventually([&] { return got.size() == 1000; }));
+        REQUIRE(got.payload_ok);
+        for (uint64_t i = 0; i < 1000; i++) {
+            REQUIRE(got.ts[i] == 1000000000ULL + i);
+            REQUIRE(got.caplen[i] == 200);
+        }
+        sensor.stop();
+        REQUIRE(sensor.packets() == 1000);
+        REQUIRE(sensor.dropped() == 0);
+        // compressible payloads are sent compressed
+        REQUIRE(sensor.wire_bytes() < sensor.bytes());
+
+        // header-only records
+        collected headers;
+        receiver collector2("127.0.0.1", 0, pca::LINKTYPE_ETHERNET,
+                            [&headers](const packet* pkts, size_t n) { headers.add(pkts, n); });
+        REQUIRE(collector2.start());
+        config = make_config(collector2.port());
+        config.snaplen = 64;
+        config.compress = false;
+        sender sensor2(config);
+        sensor2.start();
+        for (uint64_t i = 0; i < 100; i++) {
+            packet pkt = make_packet(i, &payload);
+            sensor2.send(&pkt, 1);
+        }
+        sensor2.stop();
+        REQUIRE(eventually([&] { return headers.size() == 100; }));
+        REQUIRE(headers.payload_ok);
+        REQUIRE(headers.caplen[0] == 64);
+        REQUIRE(collector2.bytes() == 6400);
+    }
+
+    SECTION("Checking the sensor reconnects once the collector is back.") {
+        collected got;
+        auto fn = [&got](const packet* pkts, size_t n) { got.add(pkts, n); };
+        std::unique_ptr<receiver> collector(new receiver("127.0.0.1", 0, pca::LINKTYPE_ETHERNET, fn));
+        REQUIRE(collector->start());
+        unsigned short port = collector->port();
+
+        sender sensor(make_config(port));
+        sensor.start();
+        packet pkt = make_packet(0, &payload);
+        sensor.send(&pkt, 1);
+        REQUIRE(eventually([&] { return got.size() == 1; }));
+
+        collector.reset();
+        // the first batch after the collector went away finds the connection lost
+        for (uint64_t i = 1; i < 5; i++) {
+            pkt = make_packet(i, &payload);
+            sensor.send(&pkt, 1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        REQUIRE(eventually([&] { return !sensor.connected(); }));
+
+        collector.reset(new receiver("127.0.0.1", port, pca::LINKTYPE_ETHERNET, fn));
+        REQUIRE(collector->start());
+        pkt = make_packet(5, &payload);
+        sensor.send(&pkt, 1);
+        REQUIRE(eventually([&] { return got.size() > 0 && got.ts.back() == 1000000005ULL; }));
+        REQUIRE(sensor.reconnects() >= 1);
+        sensor.stop();
+    }
+
+    SECTION("Checking a slow collector holds lossless sensors back and others drop.") {
+        std::atomic<bool> slow(true);
+        std::atomic<uint64_t> count(0);
+        receiver collector("127.0.0.1", 0, pca::LINKTYPE_ETHERNET, [&](const packet* pkts, size_t n) {
+            while (slow) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            count += n;
+        });
+        REQUIRE(collector.start());
+
+        sender_config config = make_config(collector.port());
+        config.compress = false;
+        config.max_batches = 2;
+        sender lossy(config);
+        lossy.start();
+        std::vector<packet> pkts;
+        std::vector<std::vector<uint8_t>> payloads(100);
+        for (uint64_t i = 0; i < 100; i++) {
+            pkts.push_back(make_packet(i, &payloads[i], 1400));
+        }
+        // far more than the socket buffers and the queue hold
+        for (int i = 0; i < 2000; i++) {
+            lossy.send(pkts.data(), pkts.size());
+        }
+        REQUIRE(lossy.dropped() > 0);
+
+        slow = false;
+        lossy.stop();
+        REQUIRE(eventually([&] { return count == lossy.packets(); }));
+        REQUIRE(lossy.packets() + lossy.dropped() == 200000);
+
+        count = 0;
+        slow = true;
+        sender lossless(config);
+        lossless.start();
+        std::thread producer([&] {
+            for (int i = 0; i < 2000; i++) {
+                lossless.send(pkts.data(), pkts.size(), true);
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        slow = false;
+        producer.join();
+        lossless.stop();
+        REQUIRE(lossless.dropped() == 0);
+        REQUIRE(eventually([&] { return count == 200000; }));
+    }
+
+    SECTION("Checking a sensor of another linktype is refused.") {
+        collected got;
+        receiver collector("127.0.0.1", 0, pca::LINKTYPE_RAW,
+                           [&got](const packet* pkts, size_t n) { got.add(pkts, n); });
+        REQUIRE(collector.start());
+
+        sender sensor(make_config(collector.port()));
+        sensor.start();
+        packet pkt = make_packet(0, &payload);
+        sensor.send(&pkt, 1);
+        REQUIRE(eventually([&] { return !collector.error().empty(); }));
+        sensor.stop();
+        REQUIRE(got.size() == 0);
+    }
+
+    SECTION("Checking the throughput over loopback.") {
+        std::atomic<uint64_t> bytes(0);
+        receiver collector("127.0.0.1", 0, pca::LINKTYPE_ETHERNET,
+                           [&bytes](const packet* pkts, size_t n) {
+                               for (size_t i = 0; i < n; i++) {
+                                   bytes += pkts[i].caplen;
+                               }
+                           });
+        REQUIRE(collector.start());
+
+        std::vector<packet> pkts;
+        std::vector<std::vector<uint8_t>> payloads(256);
+        std::mt19937 rng(1);
+        for (uint64_t i = 0; i < payloads.size(); i++) {
+            pkts.push_back(make_packet(i, &payloads[i], 1500));
+            for (size_t j = 54; j < payloads[i].size(); j++) {
+                payloads[i][j] = static_cast<uint8_t>(rng());
+            }
+        }
+
+        for (int compressed = 0; compressed < 2; compressed++) {
+            sender_config config = make_config(collector.port());
+            config.batch_bytes = 1 << 20;
+            config.compress = compressed != 0;
+            sender sensor(config);
+            uint64_t before = bytes;
+
+            sensor.start();
+            auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < 8000; i++) {
+                sensor.send(pkts.data(), pkts.size(), true);
+            }
+            sensor.stop();
+            REQUIRE(eventually([&] { return bytes - before == sensor.bytes(); }));
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+            // a figure to compare, not checked: it depends on the machine
+            printf("forwarded %.1f MB of 1500 byte packets of random payload %s in %.3f sec: %.2f Gbps\n",
+                   sensor.bytes() / 1e6, compressed ? "compressed" : "as is", elapsed.count(),
+                   sensor.bytes() * 8 / elapsed.count() / 1e9);
+            REQUIRE(sensor.dropped() == 0);
+        }
+    }
+}
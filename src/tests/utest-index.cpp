@@ -0,0 +1,215 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/bitmap.hpp"
+#include "common/block_index.hpp"
+#include "common/segment.hpp"
+
+using pca::bitmap;
+using pca::packet;
+using pca::segment::block_index;
+using pca::segment::index_op;
+using pca::segment::index_query;
+using pca::segment::term;
+
+static bitmap make_bitmap(const std::set<uint32_t>& values)
+{
+    bitmap b;
+
+    for (uint32_t v : values) {
+        b.add(v);
+    }
+
+    return b;
+}
+
+static std::vector<uint32_t> to_vector(const std::set<uint32_t>& values)
+{
+    return std::vector<uint32_t>(values.begin(), values.end());
+}
+
+TEST_CASE("common_bitmap_test")
+{
+    std::mt19937 rng(1234);
+
+    SECTION("Checking set operations against std::set.") {
+        // sparse, dense and mixed containers
+        for (uint32_t density : { 10U, 3000U, 20000U, 60000U }) {
+            std::set<uint32_t> a, b;
+            for (uint32_t i = 0; i < density; i++) {
+                a.insert(rng() % 65536 + (rng() % 3) * 65536);
+                b.insert(rng() % 65536 + (rng() % 2) * 65536);
+            }
+            for (uint32_t i = 0; i < 100; i++) {
+                b.insert(rng() % 200000);
+            }
+
+            bitmap ba = make_bitmap(a), bb = make_bitmap(b);
+            REQUIRE(ba.cardinality() == a.size());
+            REQUIRE(ba.values() == to_vector(a));
+
+            std::set<uint32_t> expected;
+            std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            REQUIRE((ba & bb).values() == to_vector(expected));
+
+            expected.clear();
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            REQUIRE((ba | bb).values() == to_vector(expected));
+            REQUIRE((ba | bb).cardinality() == expected.size());
+
+            expected.clear();
+            std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::inserter(expected, expected.end()));
+            REQUIRE((ba - bb).values() == to_vector(expected));
+
+            std::string data;
+            ba.serialize(&data);
+            bitmap copy;
+            size_t used = 0;
+            REQUIRE(copy.deserialize(reinterpret_cast<const uint8_t*>(data.data()), data.size(), &used));
+            REQUIRE(used == data.size());
+            REQUIRE(copy == ba);
+            REQUIRE(!copy.deserialize(reinterpret_cast<const uint8_t*>(data.data()), data.size() - 1, &used));
+        }
+    }
+
+    SECTION("Checking a range.") {
+        bitmap b = bitmap::range(10, 5000);
+
+        REQUIRE(b.cardinality() == 4990);
+        REQUIRE(!b.contains(9));
+        REQUIRE(b.contains(10));
+        REQUIRE(b.contains(4999));
+        REQUIRE(!b.contains(5000));
+        REQUIRE((b - bitmap::range(0, 4000)).cardinality() == 1000);
+    }
+}
+
+static std::vector<uint8_t> make_udp4_frame(uint8_t src, uint8_t dst, uint16_t port)
+{
+    std::vector<uint8_t> frame(14 + 20 + 8 + 18, 0);
+
+    frame[12] = 0x08;
+    frame[14] = 0x45;
+    frame[14 + 9] = 17;
+    frame[14 + 12] = 10;
+    frame[14 + 15] = src;
+    frame[14 + 16] = 10;
+    frame[14 + 19] = dst;
+    frame[34] = 0xc0;
+    frame[36] = port >> 8;
+    frame[37] = port & 0xff;
+
+    return frame;
+}
+
+static term host(uint8_t last)
+{
+    uint8_t addr[4] = { 10, 0, 0, last };
+
+    return term::host(4, addr);
+}
+
+TEST_CASE("common_block_index_test")
+{
+    char tmpl[] = "/tmp/utest-index.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    const uint64_t start_ts = 1500000000ULL * 1000000000ULL;
+    pca::segment::info sealed;
+
+    // host 1 talks to port 53 all along, host 2 to port 443 in the first half
+    // only, and host 3 to port 80 in a single short burst
+    {
+        pca::segment::writer seg(dir, 0, pca::LINKTYPE_ETHERNET, 1ULL << 30, 3600ULL * 1000000000ULL);
+        seg.on_sealed([&](const pca::segment::info& info) { sealed = info; });
+
+        for (uint64_t i = 0; i < 100000; i++) {
+            std::vector<uint8_t> frame;
+            if (i % 2 == 0)
+                frame = make_udp4_frame(1, 254, 53);
+            else if (i < 50000)
+                frame = make_udp4_frame(2, 254, 443);
+            else if (i >= 70000 && i < 70010)
+                frame = make_udp4_frame(3, 254, 80);
+            else
+                frame = make_udp4_frame(4, 254, 8080);
+
+            packet pkt = { start_ts + i, static_cast<uint32_t>(frame.size()), static_cast<uint32_t>(frame.size()),
+                           frame.data() };
+            pca::flow_key key;
+            REQUIRE(pca::decode::flow_key_of(pkt, &key));
+            REQUIRE(seg.write(pkt, &key));
+        }
+    }
+    REQUIRE((sealed.flags & pca::segment::FLAG_FILTER) != 0);
+
+    block_index index;
+    REQUIRE(index.load(sealed.path));
+
+    std::vector<pca::segment::index_entry> entries;
+    REQUIRE(pca::segment::load_index(sealed.path, &entries));
+    REQUIRE(index.blocks() == entries.size());
+    REQUIRE(index.blocks() > 50);
+
+    SECTION("Checking terms map to the blocks they appear in.") {
+        REQUIRE(index.find(host(1))->cardinality() == index.blocks());
+        REQUIRE(index.find(host(2))->cardinality() < index.blocks() / 2 + 2);
+        REQUIRE(index.find(host(3))->cardinality() <= 2);
+        REQUIRE(index.find(host(9)) == nullptr);
+        REQUIRE(index.find(term::port(53))->cardinality() == index.blocks());
+        REQUIRE(index.find(term::protocol(17))->cardinality() == index.blocks());
+    }
+
+    SECTION("Checking boolean queries.") {
+        pca::bitmap blocks;
+        index_op op;
+
+        // host 1 AND port 443 AND NOT host 3
+        index_query query;
+        op.code = index_op::TERM;
+        op.t = host(1);
+        query.push_back(op);
+        op.t = term::port(443);
+        query.push_back(op);
+        op.code = index_op::AND;
+        query.push_back(op);
+        op.code = index_op::TERM;
+        op.t = host(3);
+        query.push_back(op);
+        op.code = index_op::NOT;
+        query.push_back(op);
+        op.code = index_op::AND;
+        query.push_back(op);
+
+        REQUIRE(pca::segment::evaluate(index, query, &blocks));
+        REQUIRE(blocks == *index.find(term::port(443)));
+
+        // only the matching blocks are read
+        size_t packets = 0, matched = 0;
+        REQUIRE(pca::segment::read_blocks(sealed.path, entries, *index.find(host(3)), [&](const packet& pkt) {
+            packets++;
+            if (pkt.data[14 + 15] == 3)
+                matched++;
+            return true;
+        }));
+        REQUIRE(matched == 5);
+        REQUIRE(packets < sealed.packets / 10);
+
+        query.resize(2);
+        REQUIRE(!pca::segment::evaluate(index, query, &blocks));
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
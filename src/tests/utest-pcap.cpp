@@ -0,0 +1,550 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/catalog.hpp"
+#include "common/merge.hpp"
+#include "common/pcap_file.hpp"
+#include "common/pipeline.hpp"
+#include "common/replay.hpp"
+#include "common/retention.hpp"
+#include "common/segment.hpp"
+
+using pca::packet;
+using pca::pipeline;
+using pca::pipeline_config;
+
+static std::string make_temp_dir()
+{
+    char tmpl[] = "/tmp/utest-pcap.XXXXXX";
+
+    return std::string(mkdtemp(tmpl));
+}
+
+static std::vector<uint8_t> make_udp4_frame(uint8_t host, uint16_t sport)
+{
+    std::vector<uint8_t> frame(14 + 20 + 8 + 18, 0);
+
+    frame[12] = 0x08;
+    frame[14] = 0x45;
+    frame[14 + 9] = 17;
+    frame[14 + 12] = 10;
+    frame[14 + 15] = host;
+    frame[14 + 16] = 10;
+    frame[14 + 19] = 254;
+    frame[34] = sport >> 8;
+    frame[35] = sport & 0xff;
+    frame[37] = 53;
+
+    return frame;
+}
+
+static void write_capture(const std::string& filename, size_t count, uint64_t start_ts, uint64_t gap_ns)
+{
+    pca::pcap::writer out;
+
+    REQUIRE(out.open(filename, pca::LINKTYPE_ETHERNET));
+    for (size_t i = 0; i < count; i++) {
+        std::vector<uint8_t> frame = make_udp4_frame(i % 16, 1024 + i);
+        packet pkt;
+
+        pkt.ts = start_ts + i * gap_ns;
+        pkt.caplen = pkt.len = frame.size();
+        pkt.data = frame.data();
+        REQUIRE(out.write(pkt));
+    }
+    REQUIRE(out.close());
+}
+
+TEST_CASE("common_pcap_test")
+{
+    std::string dir = make_temp_dir();
+    const uint64_t start_ts = 1500000000ULL * 1000000000ULL;
+
+    SECTION("Checking pcap writer and reader round trip.") {
+        std::string filename = dir + "/roundtrip.pcap";
+        write_capture(filename, 100, start_ts, 1000);
+
+        pca::pcap::reader in;
+        REQUIRE(in.open(filename));
+        REQUIRE(in.linktype() == pca::LINKTYPE_ETHERNET);
+
+        packet pkt;
+        size_t n = 0;
+        while (in.next(&pkt)) {
+            REQUIRE(pkt.ts == start_ts + n * 1000);
+            REQUIRE(pkt.caplen == 60);
+            REQUIRE(pkt.data[14 + 15] == n % 16);
+            n++;
+        }
+        REQUIRE(n == 100);
+        REQUIRE(in.offset() == in.size());
+    }
+
+    SECTION("Checking segment rotation and timestamp index.") {
+        std::vector<pca::segment::info> sealed;
+        {
+            pca::segment::writer seg(dir + "/data", 3, pca::LINKTYPE_ETHERNET, 1024 * 1024, 1000000000ULL);
+            seg.on_sealed([&](const pca::segment::info& info) { sealed.push_back(info); });
+
+            std::vector<uint8_t> frame = make_udp4_frame(1, 1000);
+            for (uint64_t i = 0; i < 30; i++) {
+                packet pkt = { start_ts + i * 100000000ULL, 60, 60, frame.data() };
+                REQUIRE(seg.write(pkt));
+            }
+        }
+
+        REQUIRE(sealed.size() == 3);
+        REQUIRE(sealed[0].path == pca::segment::path_of(dir + "/data", start_ts, 3));
+        REQUIRE(sealed[0].packets == 10);
+        REQUIRE(sealed[1].first_ts == start_ts + 1000000000ULL);
+        REQUIRE(sealed[2].last_ts == start_ts + 29 * 100000000ULL);
+
+        std::vector<pca::segment::index_entry> index;
+        REQUIRE(pca::segment::load_index(sealed[0].path, &index));
+        REQUIRE(index.size() == 1);
+        REQUIRE(index[0].ts == start_ts);
+        REQUIRE(index[0].offset == sizeof(pca::pcap::file_header));
+    }
+
+    SECTION("Checking replay speed parser.") {
+        double speed = -1;
+
+        REQUIRE(pca::replay::parse_speed("max", &speed));
+        REQUIRE(speed == pca::replay::SPEED_MAX);
+        REQUIRE(pca::replay::parse_speed("original", &speed));
+        REQUIRE(speed == pca::replay::SPEED_ORIGINAL);
+        REQUIRE(pca::replay::parse_speed("4x", &speed));
+        REQUIRE(speed == 4.0);
+        REQUIRE(pca::replay::parse_speed("0.5", &speed));
+        REQUIRE(speed == 0.5);
+        REQUIRE(!pca::replay::parse_speed("fast", &speed));
+        REQUIRE(!pca::replay::parse_speed("-2", &speed));
+    }
+
+    SECTION("Checking replay through the pipeline.") {
+        write_capture(dir + "/a.pcap", 5000, start_ts, 1000);
+        write_capture(dir + "/b.pcap", 5000, start_ts + 5000 * 1000, 1000);
+
+        pipeline_config config;
+        config.workers = 4;
+        config.ring_size = 1024;
+        config.data_path = dir + "/data";
+        config.first_worker = 4;
+
+        uint64_t stored = 0;
+        unsigned min_worker = UINT_MAX;
+        pipeline pipe(config);
+        pipe.on_sealed([&](const pca::segment::info& info) {
+            stored += info.packets;
+            min_worker = std::min(min_worker, info.worker);
+        });
+        pipe.start();
+
+        pca::replay::player player(pipe, pca::replay::SPEED_MAX);
+        REQUIRE(player.play(dir));
+        pipe.stop();
+
+        REQUIRE(player.files() == 2);
+        REQUIRE(player.packets() == 10000);
+        REQUIRE(pipe.packets() == 10000);
+        REQUIRE(pipe.dropped() == 0);
+        REQUIRE(stored == 10000);
+        REQUIRE(min_worker == 4);
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+TEST_CASE("common_merge_test")
+{
+    std::string dir = make_temp_dir();
+    const uint64_t start_ts = 1500000000ULL * 1000000000ULL;
+
+    SECTION("Checking loser tree against sort.") {
+        for (size_t k = 1; k <= 9; k++) {
+            std::vector<std::vector<uint64_t>> runs(k);
+            std::vector<uint64_t> expected;
+            for (size_t i = 0; i < k; i++) {
+                for (size_t n = 0; n < 50 + 13 * i; n++) {
+                    runs[i].push_back(n * (i + 3) + i % 4);
+                }
+                expected.insert(expected.end(), runs[i].begin(), runs[i].end());
+            }
+            std::sort(expected.begin(), expected.end());
+
+            std::vector<size_t> pos(k, 0);
+            std::vector<uint64_t> keys(k);
+            for (size_t i = 0; i < k; i++) {
+                keys[i] = runs[i][0];
+            }
+
+            pca::merge::loser_tree tree(k);
+            tree.build(keys.data());
+
+            std::vector<uint64_t> merged;
+            while (keys[tree.winner()] != UINT64_MAX) {
+                size_t w = tree.winner();
+                merged.push_back(keys[w]);
+                keys[w] = (++pos[w] < runs[w].size()) ? runs[w][pos[w]] : UINT64_MAX;
+                tree.replay(keys.data());
+            }
+            REQUIRE(merged == expected);
+        }
+    }
+
+    SECTION("Checking merged files are ordered by timestamp.") {
+        std::vector<std::string> inputs;
+        for (unsigned i = 0; i < 5; i++) {
+            inputs.push_back(dir + "/" + std::to_string(i) + ".pcap");
+            write_capture(inputs.back(), 1000 + i * 100, start_ts + i * 250, 1000);
+        }
+
+        std::string output = dir + "/merged.pcap";
+        REQUIRE(pca::merge::merge_files(inputs, output));
+
+        pca::pcap::reader in;
+        REQUIRE(in.open(output));
+
+        packet pkt;
+        uint64_t last_ts = 0;
+        size_t n = 0;
+        while (in.next(&pkt)) {
+            REQUIRE(pkt.ts >= last_ts);
+            REQUIRE(pkt.caplen == 60);
+            last_ts = pkt.ts;
+            n++;
+        }
+        REQUIRE(n == 6000);
+    }
+
+    SECTION("Checking merge of a time range seeks by the index.") {
+        std::vector<std::string> inputs;
+        std::vector<uint8_t> frame = make_udp4_frame(1, 1000);
+        {
+            for (unsigned w = 0; w < 3; w++) {
+                pca::segment::writer seg(dir + "/data", w, pca::LINKTYPE_ETHERNET, 1ULL << 30, 3600ULL * 1000000000ULL);
+                seg.on_sealed([&](const pca::segment::info& info) { inputs.push_back(info.path); });
+                for (uint64_t i = 0; i < 20000; i++) {
+                    packet pkt = { start_ts + i * 1000 + w, 60, 60, frame.data() };
+                    REQUIRE(seg.write(pkt));
+                }
+            }
+        }
+        REQUIRE(inputs.size() == 3);
+
+        pca::merge::merger m(64 * 1024);
+        for (const auto& input : inputs) {
+            m.add(input);
+        }
+        m.set_range(start_ts + 10000 * 1000, start_ts + 15000 * 1000);
+        REQUIRE(m.start());
+        REQUIRE(m.sources() == 3);
+
+        packet pkt;
+        uint64_t last_ts = 0;
+        size_t n = 0;
+        while (m.next(&pkt)) {
+            REQUIRE(pkt.ts >= last_ts);
+            REQUIRE(pkt.ts >= start_ts + 10000 * 1000);
+            REQUIRE(pkt.ts < start_ts + 15000 * 1000);
+            REQUIRE(pkt.data[14 + 15] == 1);
+            last_ts = pkt.ts;
+            n++;
+        }
+        REQUIRE(n == 15000);
+        REQUIRE(m.packets() == 15000);
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+TEST_CASE("common_retention_test")
+{
+    std::string dir = make_temp_dir();
+    const uint64_t start_ts = 1500000000ULL * 1000000000ULL;
+    const uint64_t minute = 60ULL * 1000000000ULL;
+    std::vector<pca::segment::info> sealed;
+
+    // 2 workers, a segment a minute for 3 hours
+    {
+        std::vector<uint8_t> frame = make_udp4_frame(1, 1000);
+        for (unsigned w = 0; w < 2; w++) {
+            pca::segment::writer seg(dir, w, pca::LINKTYPE_ETHERNET, 1ULL << 30, minute);
+            seg.on_sealed([&](const pca::segment::info& info) { sealed.push_back(info); });
+            for (uint64_t i = 0; i < 180 * 10; i++) {
+                packet pkt = { start_ts + i * minute / 10, 60, 60, frame.data() };
+                REQUIRE(seg.write(pkt));
+            }
+        }
+    }
+    REQUIRE(sealed.size() == 360);
+
+    pca::retention_config config;
+    config.data_path = dir;
+    config.batch_size = 16;
+
+    SECTION("Checking the oldest segments are deleted over the size limit.") {
+        config.max_bytes = sealed[0].bytes * 100;
+        pca::retention storage(config);
+        std::vector<pca::segment::info> evicted;
+        storage.on_evicted([&](const pca::segment::info& info) { evicted.push_back(info); });
+
+        for (const auto& info : sealed) {
+            storage.add(info);
+        }
+        REQUIRE(storage.segments() == 360);
+
+        REQUIRE(storage.enforce() == 260);
+        REQUIRE(storage.segments() == 100);
+        REQUIRE(storage.bytes() <= config.max_bytes);
+        for (size_t i = 1; i < evicted.size(); i++) {
+            REQUIRE(evicted[i - 1].first_ts <= evicted[i].first_ts);
+        }
+        REQUIRE(evicted.back().first_ts < start_ts + 130 * minute);
+        REQUIRE(access(evicted[0].path.c_str(), F_OK) < 0);
+        REQUIRE(access(pca::segment::index_path_of(evicted[0].path).c_str(), F_OK) < 0);
+        REQUIRE(access(sealed.back().path.c_str(), F_OK) == 0);
+
+        // a segment being written has no index yet, one cut short is shorter
+        // than its index has it
+        std::string last = sealed.back().path;
+        std::string open_path = pca::segment::path_of(dir, sealed.back().first_ts + 1, 0);
+        std::string cut_path = pca::segment::path_of(dir, sealed.back().first_ts + 2, 0);
+        REQUIRE(system(("cp " + last + " " + open_path).c_str()) == 0);
+        REQUIRE(system(("cp " + last + " " + cut_path).c_str()) == 0);
+        REQUIRE(system(("cp " + pca::segment::index_path_of(last) + " "
+                        + pca::segment::index_path_of(cut_path)).c_str()) == 0);
+        REQUIRE(truncate(cut_path.c_str(), sealed.back().bytes - 10) == 0);
+
+        // the remaining segments are found by a scan after a restart
+        pca::retention restarted(config);
+        REQUIRE(restarted.scan());
+        REQUIRE(restarted.segments() == 100);
+        REQUIRE(restarted.bytes() == storage.bytes());
+        std::vector<pca::segment::info> found = restarted.find(0, UINT64_MAX);
+        REQUIRE(found.back().last_ts == sealed.back().last_ts);
+        REQUIRE((found.back().flags & pca::segment::FLAG_INDEX) != 0);
+    }
+
+    SECTION("Checking the segments older than the age limit are deleted.") {
+        config.max_age_ns = 60 * minute;
+        pca::retention storage(config);
+
+        for (const auto& info : sealed) {
+            storage.add(info);
+        }
+        storage.enforce();
+
+        REQUIRE(storage.segments() == 2 * 61);
+        std::vector<pca::segment::info> found = storage.find(0, UINT64_MAX);
+        REQUIRE(found.front().last_ts >= start_ts + 119 * minute);
+    }
+
+    SECTION("Checking segments are found by time range.") {
+        pca::retention storage(config);
+
+        for (const auto& info : sealed) {
+            storage.add(info);
+        }
+
+        std::vector<pca::segment::info> found = storage.find(start_ts + 10 * minute + 1, start_ts + 12 * minute);
+        REQUIRE(found.size() == 4);
+        REQUIRE(found[0].first_ts == start_ts + 10 * minute);
+        REQUIRE(found[3].first_ts == start_ts + 11 * minute);
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+TEST_CASE("common_catalog_test")
+{
+    std::string dir = make_temp_dir();
+    std::string filename = dir + "/catalog";
+    const uint64_t start_ts = 1500000000ULL * 1000000000ULL;
+    std::vector<pca::segment::info> sealed;
+
+    for (unsigned i = 0; i < 100; i++) {
+        pca::segment::info info = pca::segment::info();
+        info.worker = i % 4;
+        info.first_ts = start_ts + i * 1000;
+        info.last_ts = info.first_ts + 999;
+        info.path = pca::segment::path_of(dir, info.first_ts, info.worker);
+        info.bytes = 1000 + i;
+        info.packets = i;
+        info.flags = pca::segment::FLAG_INDEX;
+        sealed.push_back(info);
+    }
+
+    SECTION("Checking sealed and deleted segments are loaded back.") {
+        std::vector<pca::segment::info> loaded;
+        {
+            pca::segment::catalog cat;
+            REQUIRE(cat.open(filename, dir, &loaded));
+            REQUIRE(loaded.empty());
+            for (const auto& info : sealed) {
+                REQUIRE(cat.append(info));
+            }
+            REQUIRE(cat.remove(std::vector<pca::segment::info>(sealed.begin(), sealed.begin() + 10)));
+        }
+
+        pca::segment::catalog cat;
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(cat.records() == 110);
+        REQUIRE(cat.deleted() == 10);
+        REQUIRE(loaded.size() == 90);
+        REQUIRE(loaded[0].path == sealed[10].path);
+        REQUIRE(loaded[0].last_ts == sealed[10].last_ts);
+        REQUIRE(loaded[0].bytes == sealed[10].bytes);
+        REQUIRE(loaded[89].packets == 99);
+        REQUIRE(loaded[89].flags == pca::segment::FLAG_INDEX);
+
+        REQUIRE(cat.compact(loaded, cat.records()));
+        REQUIRE(cat.records() == 90);
+        REQUIRE(cat.deleted() == 0);
+        REQUIRE(cat.append(sealed[0]));
+        cat.close();
+
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(cat.records() == 91);
+        REQUIRE(loaded.size() == 91);
+
+        // the records after those the segments were taken at are kept
+        uint64_t records = cat.records();
+        REQUIRE(cat.append(sealed[1]));
+        REQUIRE(cat.remove(std::vector<pca::segment::info>(1, sealed[20])));
+        REQUIRE(cat.compact(loaded, records));
+        REQUIRE(cat.records() == 93);
+        REQUIRE(cat.deleted() == 1);
+        cat.close();
+
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(loaded.size() == 91);
+        REQUIRE(std::find_if(loaded.begin(), loaded.end(), [&](const pca::segment::info& info) {
+            return info.path == sealed[1].path;
+        }) != loaded.end());
+        REQUIRE(std::find_if(loaded.begin(), loaded.end(), [&](const pca::segment::info& info) {
+            return info.path == sealed[20].path;
+        }) == loaded.end());
+    }
+
+    SECTION("Checking a torn tail is cut off.") {
+        std::vector<pca::segment::info> loaded;
+        {
+            pca::segment::catalog cat;
+            REQUIRE(cat.open(filename, dir, &loaded));
+            for (const auto& info : sealed) {
+                REQUIRE(cat.append(info));
+            }
+        }
+
+        size_t size = sizeof(pca::segment::catalog::file_header) + 100 * sizeof(pca::segment::catalog::record);
+        REQUIRE(truncate(filename.c_str(), size - 10) == 0);
+
+        pca::segment::catalog cat;
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(loaded.size() == 99);
+        REQUIRE(cat.append(sealed[99]));
+        cat.close();
+
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(loaded.size() == 100);
+
+        struct stat st;
+        REQUIRE(stat(filename.c_str(), &st) == 0);
+        REQUIRE(static_cast<size_t>(st.st_size) == size);
+    }
+
+    SECTION("Checking a damaged record is skipped alone.") {
+        std::vector<pca::segment::info> loaded;
+        {
+            pca::segment::catalog cat;
+            REQUIRE(cat.open(filename, dir, &loaded));
+            for (const auto& info : sealed) {
+                REQUIRE(cat.append(info));
+            }
+        }
+
+        // a bit flipped in the bytes of the 51st
+        size_t offset = sizeof(pca::segment::catalog::file_header) + 50 * sizeof(pca::segment::catalog::record)
+            + offsetof(pca::segment::catalog::record, bytes);
+        int fd = open(filename.c_str(), O_RDWR);
+        uint8_t byte;
+        REQUIRE(pread(fd, &byte, 1, offset) == 1);
+        byte ^= 0x10;
+        REQUIRE(pwrite(fd, &byte, 1, offset) == 1);
+        close(fd);
+
+        pca::segment::catalog cat;
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(loaded.size() == 99);
+        REQUIRE(loaded[49].path == sealed[49].path);
+        REQUIRE(loaded[50].path == sealed[51].path);
+        REQUIRE(loaded[98].path == sealed[99].path);
+        REQUIRE(cat.records() == 100);
+        REQUIRE(cat.deleted() == 1);
+
+        // and gone once compacted
+        REQUIRE(cat.compact(loaded, cat.records()));
+        REQUIRE(cat.records() == 99);
+        cat.close();
+        REQUIRE(cat.open(filename, dir, &loaded));
+        REQUIRE(loaded.size() == 99);
+        REQUIRE(cat.deleted() == 0);
+    }
+
+    SECTION("Checking the retention manager starts from the catalog.") {
+        std::vector<pca::segment::info> written;
+        std::vector<uint8_t> frame = make_udp4_frame(1, 1000);
+        pca::retention_config config;
+        config.data_path = dir;
+        config.catalog_path = filename;
+
+        {
+            pca::retention storage(config);
+            storage.start();
+
+            pca::segment::writer seg(dir, 0, pca::LINKTYPE_ETHERNET, 1ULL << 30, 1000000000ULL);
+            seg.on_sealed([&](const pca::segment::info& info) {
+                written.push_back(info);
+                if (written.size() <= 5)
+                    storage.add(info);
+            });
+            for (uint64_t i = 0; i < 80; i++) {
+                packet pkt = { start_ts + i * 100000000ULL, 60, 60, frame.data() };
+                REQUIRE(seg.write(pkt));
+            }
+            seg.seal();
+            REQUIRE(storage.segments() == 5);
+            storage.stop();
+        }
+        REQUIRE(written.size() == 8);
+
+        // the segments that missed the catalog are found in the last hour
+        pca::retention storage(config);
+        storage.start();
+        REQUIRE(storage.segments() == 5);
+        for (int i = 0; i < 100 && storage.segments() < 8; i++) {
+            usleep(10000);
+        }
+        REQUIRE(storage.segments() == 8);
+        REQUIRE(storage.find(0, UINT64_MAX)[0].packets == 10);
+        storage.stop();
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
@@ -0,0 +1,535 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/pcap_file.hpp"
+#include "common/planner.hpp"
+#include "common/query.hpp"
+#include "common/search.hpp"
+#include "common/search_job.hpp"
+
+using pca::packet;
+using pca::query::batch;
+using pca::query::program;
+using pca::segment::index_op;
+
+static const uint64_t SEC = 1000000000ULL;
+
+static std::vector<uint8_t> make_frame(uint8_t protocol, uint8_t src, uint16_t sport, uint8_t dst, uint16_t dport,
+                                       size_t size = 60)
+{
+    std::vector<uint8_t> frame(size, 0);
+
+    frame[12] = 0x08;
+    frame[14] = 0x45;
+    frame[14 + 9] = protocol;
+    frame[14 + 12] = 10;
+    frame[14 + 15] = src;
+    frame[14 + 16] = 10;
+    frame[14 + 19] = dst;
+    frame[34] = sport >> 8;
+    frame[35] = sport & 0xff;
+    frame[36] = dport >> 8;
+    frame[37] = dport & 0xff;
+
+    return frame;
+}
+
+static std::vector<uint8_t> make_ipv6_frame(uint8_t src, uint8_t dst)
+{
+    std::vector<uint8_t> frame(14 + 40 + 8, 0);
+
+    frame[12] = 0x86;
+    frame[13] = 0xdd;
+    frame[14] = 0x60;
+    frame[14 + 6] = 17;
+    frame[14 + 8] = 0x20;
+    frame[14 + 9] = 0x01;
+    frame[14 + 23] = src;
+    frame[14 + 24] = 0x20;
+    frame[14 + 25] = 0x01;
+    frame[14 + 39] = dst;
+
+    return frame;
+}
+
+// run a query over packets and return the indexes of the matching ones
+static std::vector<size_t> run(const std::string& text, const std::vector<packet>& pkts)
+{
+    program prog;
+    batch b;
+    std::vector<size_t> matched;
+    std::string error;
+
+    REQUIRE(prog.compile(text, &error));
+    for (size_t base = 0; base < pkts.size(); base += batch::SIZE) {
+        b.clear();
+        for (size_t i = base; i < pkts.size() && i < base + batch::SIZE; i++) {
+            b.add(pkts[i]);
+        }
+        size_t n = prog.run(&b);
+        for (size_t i = 0; i < n; i++) {
+            matched.push_back(base + b.selected()[i]);
+        }
+    }
+
+    return matched;
+}
+
+static std::vector<size_t> expect(const std::vector<packet>& pkts, const std::function<bool(const pca::flow_key&,
+                                                                                           const packet&)>& fn)
+{
+    std::vector<size_t> matched;
+
+    for (size_t i = 0; i < pkts.size(); i++) {
+        pca::flow_key key;
+        memset(&key, 0, sizeof(key));
+        if (!pca::decode::flow_key_of(pkts[i], &key))
+            memset(&key, 0, sizeof(key));
+        if (fn(key, pkts[i]))
+            matched.push_back(i);
+    }
+
+    return matched;
+}
+
+TEST_CASE("common_query_test")
+{
+    std::mt19937 rng(42);
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<packet> pkts;
+
+    for (uint64_t i = 0; i < 5000; i++) {
+        if (i % 97 == 0)
+            frames.push_back(make_ipv6_frame(rng() % 4, rng() % 4));
+        else if (i % 89 == 0)
+            frames.push_back(std::vector<uint8_t>(60, 0xaa));
+        else
+            frames.push_back(make_frame(rng() % 2 ? 6 : 17, rng() % 8, rng() % 4 + 440, rng() % 8, rng() % 4 + 80,
+                                        60 + rng() % 1400));
+    }
+    for (uint64_t i = 0; i < frames.size(); i++) {
+        packet pkt = { 1500000000ULL * SEC + i * 1000000ULL, static_cast<uint32_t>(frames[i].size()),
+                       static_cast<uint32_t>(frames[i].size()), frames[i].data() };
+        pkts.push_back(pkt);
+    }
+
+    SECTION("Checking the compiled predicates against plain code.") {
+        REQUIRE(run("", pkts).size() == pkts.size());
+
+        REQUIRE(run("tcp", pkts) == expect(pkts, [](const pca::flow_key& k, const packet&) {
+            return k.protocol == 6;
+        }));
+        REQUIRE(run("host 10.0.0.3 and port 442 and not udp", pkts) == expect(pkts, [](const pca::flow_key& k,
+                                                                                       const packet&) {
+            return k.version == 4 && (k.src_addr[3] == 3 || k.dst_addr[3] == 3)
+                && (k.src_port == 442 || k.dst_port == 442) && k.protocol != 17;
+        }));
+        REQUIRE(run("(src 10.0.0.1 || dst == 10.0.0.2) && len >= 700 && dport != 81", pkts)
+                == expect(pkts, [](const pca::flow_key& k, const packet& p) {
+            return k.version == 4 && (k.src_addr[3] == 1 || k.dst_addr[3] == 2) && p.len >= 700 && k.dst_port != 81;
+        }));
+        REQUIRE(run("src 10.0.0.4/30 and !(sport < 442) and caplen < 100", pkts)
+                == expect(pkts, [](const pca::flow_key& k, const packet& p) {
+            return k.version == 4 && k.src_addr[3] >= 4 && k.src_addr[3] < 8 && k.src_port >= 442 && p.caplen < 100;
+        }));
+        REQUIRE(run("host != 10.0.0.5 and version 4", pkts) == expect(pkts, [](const pca::flow_key& k,
+                                                                               const packet&) {
+            return k.version == 4 && k.src_addr[3] != 5 && k.dst_addr[3] != 5;
+        }));
+        REQUIRE(run("host 2001::1 or dst 2001::/16 and src 2001::2", pkts) == expect(pkts, [](const pca::flow_key& k,
+                                                                                              const packet&) {
+            return k.version == 6 && (k.src_addr[15] == 1 || k.dst_addr[15] == 1 || k.src_addr[15] == 2);
+        }));
+        REQUIRE(run("version 0", pkts).size() == expect(pkts, [](const pca::flow_key& k, const packet&) {
+            return k.version == 0;
+        }).size());
+        REQUIRE(run("ts >= 1500000001 and ts < 1500000002.5", pkts).size() == 1500);
+    }
+
+    SECTION("Checking malformed queries are rejected.") {
+        program prog;
+        std::string error;
+
+        REQUIRE(!prog.compile("host", &error));
+        REQUIRE(!prog.compile("host 10.0.0.256", &error));
+        REQUIRE(!prog.compile("host < 10.0.0.1", &error));
+        REQUIRE(error == "'host' takes == or != only");
+        REQUIRE(!prog.compile("port 65536", &error));
+        REQUIRE(!prog.compile("(tcp and port 80", &error));
+        REQUIRE(error == "missing ')'");
+        REQUIRE(!prog.compile("tcp udp", &error));
+        REQUIRE(!prog.compile("colour == red", &error));
+        REQUIRE(error == "unknown field 'colour'");
+
+        std::string deep = "tcp";
+        for (int i = 0; i < 20; i++) {
+            deep = "tcp and (" + deep + " or udp)";
+        }
+        REQUIRE(!prog.compile(deep, &error));
+        REQUIRE(error == "query is too complex");
+    }
+
+    SECTION("Checking the index prefilter and the time range.") {
+        program prog;
+
+        REQUIRE(prog.compile("host 10.0.0.1 and len > 100 and (port 80 or port 443) and ts >= 10 and ts < 20"));
+        REQUIRE(prog.indexed());
+        REQUIRE(prog.prefilter().size() == 5);
+        REQUIRE(prog.prefilter()[4].code == index_op::AND);
+        REQUIRE(prog.prefilter()[3].code == index_op::OR);
+        REQUIRE(prog.begin_ts() == 10 * SEC);
+        REQUIRE(prog.end_ts() == 20 * SEC);
+        REQUIRE(pca::segment::to_string(prog.prefilter()) == "(host 10.0.0.1 and (port 80 or port 443))");
+
+        REQUIRE(prog.compile("host 10.0.0.1 or len > 100"));
+        REQUIRE(!prog.indexed());
+        REQUIRE(prog.compile("not host 10.0.0.1"));
+        REQUIRE(!prog.indexed());
+        REQUIRE(prog.compile("src 10.0.0.0/8"));
+        REQUIRE(!prog.indexed());
+        REQUIRE(prog.registers() <= 3);
+    }
+}
+
+TEST_CASE("common_search_cache_test")
+{
+    uint8_t frame[100] = {};
+    auto make_result = [&](size_t packets) {
+        std::shared_ptr<pca::search::segment_result> r(new pca::search::segment_result);
+        for (size_t i = 0; i < packets; i++) {
+            packet pkt = { i, sizeof(frame), sizeof(frame), frame };
+            r->add(pkt);
+        }
+        return r;
+    };
+
+    pca::search::cache results(64 * 1024);
+
+    SECTION("Checking the least recently used results are evicted.") {
+        // about 12KB each
+        REQUIRE(results.insert("a", make_result(100)));
+        REQUIRE(results.insert("b", make_result(100)));
+        REQUIRE(results.insert("c", make_result(100)));
+        REQUIRE(results.insert("d", make_result(100)));
+        REQUIRE(results.size() == 4);
+        REQUIRE(results.find("a"));
+        REQUIRE(results.insert("e", make_result(100)));
+        REQUIRE(results.insert("f", make_result(100)));
+        REQUIRE(results.bytes() <= results.budget());
+        REQUIRE(results.find("a"));
+        REQUIRE(!results.find("b"));
+        REQUIRE(results.find("f")->hits.size() == 100);
+        REQUIRE(results.hits() == 3);
+        REQUIRE(results.misses() == 1);
+    }
+
+    SECTION("Checking a result replaces the one of the same key.") {
+        REQUIRE(results.insert("a", make_result(100)));
+        size_t bytes = results.bytes();
+        REQUIRE(results.insert("a", make_result(10)));
+        REQUIRE(results.size() == 1);
+        REQUIRE(results.bytes() < bytes);
+        REQUIRE(results.find("a")->hits.size() == 10);
+
+        // more than a quarter of the budget
+        REQUIRE(!results.insert("b", make_result(200)));
+        results.clear();
+        REQUIRE(results.size() == 0);
+        REQUIRE(results.bytes() == 0);
+    }
+}
+
+TEST_CASE("common_search_test")
+{
+    char tmpl[] = "/tmp/utest-query.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    const uint64_t start_ts = 1500000000ULL * SEC;
+    const uint64_t ms = 1000000ULL;
+
+    pca::retention_config config;
+    config.data_path = dir;
+    pca::retention storage(config);
+
+    // 20 seconds of two workers on disk, host 9 shows up once every 2 seconds
+    {
+        std::vector<std::unique_ptr<pca::segment::writer>> writers;
+        for (unsigned w = 0; w < 2; w++) {
+            writers.push_back(std::unique_ptr<pca::segment::writer>(new pca::segment::writer(
+                dir, w, pca::LINKTYPE_ETHERNET, 1ULL << 30, 5 * SEC)));
+            writers.back()->on_sealed([&](const pca::segment::info& info) { storage.add(info); });
+        }
+        for (uint64_t i = 0; i < 20000; i++) {
+            std::vector<uint8_t> frame = make_frame(17, i % 2000 == 0 ? 9 : 1 + i % 4, 1000, 200, 53, 600);
+            packet pkt = { start_ts + i * ms, static_cast<uint32_t>(frame.size()),
+                           static_cast<uint32_t>(frame.size()), frame.data() };
+            pca::flow_key key;
+            REQUIRE(pca::decode::flow_key_of(pkt, &key));
+            REQUIRE(writers[i % 2]->write(pkt, &key));
+        }
+    }
+    REQUIRE(storage.segments() == 8);
+
+    // and the last 5 seconds in memory
+    pca::recent_buffer recent(1, 16 * 1024 * 1024);
+    for (uint64_t i = 15000; i < 25000; i++) {
+        std::vector<uint8_t> frame = make_frame(17, i % 2000 == 0 ? 9 : 1 + i % 4, 1000, 200, 53, 600);
+        packet pkt = { start_ts + i * ms, static_cast<uint32_t>(frame.size()),
+                       static_cast<uint32_t>(frame.size()), frame.data() };
+        recent.write(0, &pkt, 1);
+    }
+
+    SECTION("Checking the block index narrows the segments read.") {
+        program prog;
+        pca::search::result res;
+
+        REQUIRE(prog.compile("host 10.0.0.9"));
+        REQUIRE(pca::search::write(dir + "/out.pcap", prog, start_ts, start_ts + 30 * SEC, 100,
+                                   &storage, &recent, &res));
+        REQUIRE(res.packets == 13);
+        // the last segments are in memory as well
+        REQUIRE(res.segments == 6);
+        REQUIRE(res.indexed == 6);
+        REQUIRE(res.memory);
+        REQUIRE(!res.truncated);
+        // a few blocks of the segments, and the 10000 packets in memory
+        REQUIRE(res.scanned < 2000 + 10000);
+
+        pca::pcap::reader in;
+        packet pkt;
+        uint64_t i = 0;
+        REQUIRE(in.open(dir + "/out.pcap"));
+        while (in.next(&pkt)) {
+            REQUIRE(pkt.ts == start_ts + i * 2000 * ms);
+            REQUIRE(pkt.data[14 + 15] == 9);
+            i++;
+        }
+        REQUIRE(i == 13);
+    }
+
+    SECTION("Checking the limit keeps the earliest packets.") {
+        program prog;
+        pca::search::result res;
+
+        REQUIRE(prog.compile("src 10.0.0.2 and ts >= 1500000003"));
+        REQUIRE(pca::search::write(dir + "/out.pcap", prog, start_ts, start_ts + 30 * SEC, 500,
+                                   &storage, &recent, &res));
+        REQUIRE(res.packets == 500);
+        REQUIRE(res.truncated);
+        REQUIRE(!res.memory);
+        REQUIRE(res.segments == 2);
+
+        pca::pcap::reader in;
+        packet pkt;
+        REQUIRE(in.open(dir + "/out.pcap"));
+        REQUIRE(in.next(&pkt));
+        REQUIRE(pkt.ts == start_ts + 3001 * ms);
+    }
+
+    SECTION("Checking the matches spill to disk past the memory budget.") {
+        program prog;
+        pca::search::result res;
+
+        // 12MB of packets
+        REQUIRE(prog.compile("udp"));
+        REQUIRE(pca::search::write(dir + "/out.pcap", prog, start_ts, start_ts + 30 * SEC, 1000000,
+                                   &storage, &recent, &res));
+        REQUIRE(res.packets == 25000);
+        REQUIRE(!res.truncated);
+        REQUIRE(access((dir + "/out.pcap.spill").c_str(), F_OK) < 0);
+
+        pca::pcap::reader in;
+        packet pkt;
+        uint64_t i = 0;
+        REQUIRE(in.open(dir + "/out.pcap"));
+        while (in.next(&pkt)) {
+            REQUIRE(pkt.ts == start_ts + i * ms);
+            REQUIRE(pkt.data[14 + 15] == (i % 2000 == 0 ? 9 : 1 + i % 4));
+            i++;
+        }
+        REQUIRE(i == 25000);
+    }
+
+    SECTION("Checking a cancelled search stops and writes nothing.") {
+        program prog;
+        pca::search::result res;
+        pca::search::control ctl;
+
+        ctl.progress = [&](const pca::search::result& r) {
+            REQUIRE(r.planned == 6);
+            ctl.cancelled = true;
+        };
+        REQUIRE(prog.compile("udp"));
+        REQUIRE(!pca::search::write(dir + "/out.pcap", prog, start_ts, start_ts + 30 * SEC, 100,
+                                    &storage, &recent, &res, &ctl));
+        REQUIRE(res.cancelled);
+        REQUIRE(res.segments == 1);
+        REQUIRE(!res.memory);
+        REQUIRE(access((dir + "/out.pcap").c_str(), F_OK) < 0);
+    }
+
+    SECTION("Checking repeated searches take the sealed segments from the cache.") {
+        pca::search::cache results(64 << 20);
+        pca::search::control ctl;
+        pca::search::result res;
+        program prog;
+
+        ctl.results = &results;
+        REQUIRE(prog.compile("host 10.0.0.9 or src 10.0.0.3"));
+        REQUIRE(pca::search::write(dir + "/first.pcap", prog, start_ts, start_ts + 30 * SEC, 100000,
+                                   &storage, &recent, &res, &ctl));
+        REQUIRE(res.segments == 6);
+        REQUIRE(res.cached == 0);
+        REQUIRE(results.size() == 6);
+        uint64_t packets = res.packets;
+
+        // spelled differently, the recent buffer is read again
+        REQUIRE(prog.compile("host  10.0.0.9 || (src 10.0.0.3)"));
+        REQUIRE(!prog.normalized().empty());
+        REQUIRE(pca::search::write(dir + "/second.pcap", prog, start_ts, start_ts + 30 * SEC, 100000,
+                                   &storage, &recent, &res, &ctl));
+        REQUIRE(res.segments == 0);
+        REQUIRE(res.cached == 6);
+        REQUIRE(res.scanned == 10000);
+        REQUIRE(res.packets == packets);
+        REQUIRE(results.hits() == 6);
+
+        pca::pcap::reader a, b;
+        packet pa, pb;
+        REQUIRE(a.open(dir + "/first.pcap"));
+        REQUIRE(b.open(dir + "/second.pcap"));
+        while (a.next(&pa)) {
+            REQUIRE(b.next(&pb));
+            REQUIRE(pa.ts == pb.ts);
+            REQUIRE(pa.caplen == pb.caplen);
+            REQUIRE(memcmp(pa.data, pb.data, pa.caplen) == 0);
+        }
+        REQUIRE(!b.next(&pb));
+
+        // a range cutting into a segment is another result
+        REQUIRE(pca::search::write(dir + "/third.pcap", prog, start_ts + 2 * SEC, start_ts + 30 * SEC, 100000,
+                                   &storage, &recent, &res, &ctl));
+        REQUIRE(res.segments == 2);
+        REQUIRE(res.cached == 4);
+
+        // results too large for the budget aren't kept
+        pca::search::cache small(64 << 10);
+        ctl.results = &small;
+        REQUIRE(prog.compile("udp"));
+        REQUIRE(pca::search::write(dir + "/out.pcap", prog, start_ts, start_ts + 30 * SEC, 100000,
+                                   &storage, &recent, &res, &ctl));
+        REQUIRE(res.packets == 25000);
+        REQUIRE(small.size() == 0);
+    }
+
+    SECTION("Checking background searches are read a page at a time.") {
+        pca::search::job_manager jobs(dir, &storage, &recent, nullptr, 2, 2);
+        pca::search::job_status st;
+        program prog;
+
+        REQUIRE(prog.compile("host 10.0.0.9"));
+        int id = jobs.start(prog, start_ts, start_ts + 30 * SEC, 100);
+        REQUIRE(id > 0);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        // polled with a pause, the workers run at idle priority
+        for (;;) {
+            REQUIRE(jobs.get_status(id, &st));
+            if (st.state != pca::search::JOB_QUEUED && st.state != pca::search::JOB_RUNNING)
+                break;
+            REQUIRE(std::chrono::steady_clock::now() < deadline);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(st.state == pca::search::JOB_DONE);
+        REQUIRE(st.res.packets == 13);
+        REQUIRE(st.query == "host 10.0.0.9");
+
+        std::vector<uint64_t> ts;
+        uint64_t cursor = 0;
+        unsigned pages = 0;
+        do {
+            REQUIRE(jobs.fetch(id, cursor, 5, [&](const packet& pkt, int) { ts.push_back(pkt.ts); }, &cursor));
+            pages++;
+        } while (cursor != 0);
+        REQUIRE(pages == 3);
+        REQUIRE(ts.size() == 13);
+        for (size_t i = 0; i < ts.size(); i++) {
+            REQUIRE(ts[i] == start_ts + i * 2000 * ms);
+        }
+
+        uint64_t next;
+        REQUIRE(!jobs.fetch(id, 3, 5, [](const packet&, int) {}, &next));
+        REQUIRE(!jobs.fetch(id + 1, 0, 5, [](const packet&, int) {}, &next));
+        REQUIRE(!jobs.get_status(id + 1, &st));
+
+        // cancelling a finished search removes its result
+        REQUIRE(access(st.path.c_str(), F_OK) == 0);
+        REQUIRE(jobs.cancel(id));
+        REQUIRE(jobs.get_status(id, &st));
+        REQUIRE(st.state == pca::search::JOB_CANCELLED);
+        REQUIRE(access((dir + "/job-1.pcap").c_str(), F_OK) < 0);
+        REQUIRE(!jobs.fetch(id, 0, 5, [](const packet&, int) {}, &next));
+        REQUIRE(!jobs.cancel(id + 1));
+    }
+
+    SECTION("Checking the planner picks the cheapest access.") {
+        program prog;
+
+        // host 9 is in a block or two of the segments, if at all
+        REQUIRE(prog.compile("host 10.0.0.9"));
+        pca::search::plan plan = pca::search::make_plan(prog, start_ts, start_ts + 30 * SEC, &storage, &recent);
+        REQUIRE(plan.segments.size() == 6);
+        REQUIRE(plan.cut == recent.oldest_ts());
+        for (const auto& p : plan.segments) {
+            REQUIRE(p.access == pca::search::ACCESS_INDEX);
+            REQUIRE(p.selectivity < 0.2);
+            REQUIRE(p.cost < p.scan_cost);
+        }
+
+        // every block is udp
+        REQUIRE(prog.compile("udp"));
+        plan = pca::search::make_plan(prog, start_ts, start_ts + 30 * SEC, &storage, &recent);
+        for (const auto& p : plan.segments) {
+            REQUIRE(p.access == pca::search::ACCESS_SCAN);
+            REQUIRE(p.selectivity == 1.0);
+        }
+
+        // a tenth of a segment, host 1 is in every block of worker 0 and
+        // nowhere in worker 1
+        REQUIRE(prog.compile("host 10.0.0.1 and ts >= 1500000001 and ts < 1500000001.5"));
+        plan = pca::search::make_plan(prog, start_ts, start_ts + 30 * SEC, &storage, &recent);
+        REQUIRE(plan.segments.size() == 2);
+        for (const auto& p : plan.segments) {
+            REQUIRE(p.range < 0.2);
+            if (p.segment.worker == 0) {
+                REQUIRE(p.access == pca::search::ACCESS_RANGE);
+            } else {
+                REQUIRE(p.access == pca::search::ACCESS_INDEX);
+                REQUIRE(p.selectivity == 0.0);
+            }
+        }
+
+        // segments loaded from the catalog get their statistics from the index file
+        pca::segment::info info = plan.segments[0].segment;
+        pca::segment::filter_stats stats = info.filter;
+        memset(&info.filter, 0, sizeof(info.filter));
+        REQUIRE(prog.compile("host 10.0.0.1"));
+        pca::search::segment_plan p = pca::search::plan_segment(info, prog, start_ts, start_ts + 30 * SEC);
+        REQUIRE(memcmp(&p.segment.filter, &stats, sizeof(stats)) == 0);
+    }
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
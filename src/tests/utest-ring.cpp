@@ -0,0 +1,238 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/download.hpp"
+#include "common/packet_ring.hpp"
+#include "common/pcap_file.hpp"
+#include "common/trigger.hpp"
+
+using pca::packet;
+using pca::packet_ring;
+using pca::recent_buffer;
+
+// the payload repeats the low byte of the timestamp, to spot torn copies
+static packet make_packet(uint64_t ts, std::vector<uint8_t>* frame)
+{
+    frame->assign(60 + ts % 200, static_cast<uint8_t>(ts));
+
+    packet pkt = { ts, static_cast<uint32_t>(frame->size()), static_cast<uint32_t>(frame->size()), frame->data() };
+
+    return pkt;
+}
+
+static bool is_intact(const packet& pkt)
+{
+    if (pkt.caplen != 60 + pkt.ts % 200)
+        return false;
+
+    for (uint32_t i = 0; i < pkt.caplen; i++) {
+        if (pkt.data[i] != static_cast<uint8_t>(pkt.ts))
+            return false;
+    }
+
+    return true;
+}
+
+TEST_CASE("common_packet_ring_test")
+{
+    std::vector<uint8_t> frame;
+
+    SECTION("Checking the ring keeps the most recent packets.") {
+        recent_buffer recent(1, 64 * 1024);
+        recent_buffer::snapshot snap;
+
+        for (uint64_t ts = 1; ts <= 10000; ts++) {
+            packet pkt = make_packet(ts, &frame);
+            recent.write(0, &pkt, 1);
+        }
+
+        REQUIRE(recent.oldest_ts() > 9000);
+        REQUIRE(recent.covers(recent.oldest_ts()));
+        REQUIRE(!recent.covers(recent.oldest_ts() - 1));
+
+        REQUIRE(recent.read(0, UINT64_MAX, &snap) == 10000 - recent.oldest_ts() + 1);
+        for (size_t i = 0; i < snap.packets.size(); i++) {
+            REQUIRE(snap.packets[i].ts == recent.oldest_ts() + i);
+            REQUIRE(is_intact(snap.packets[i]));
+        }
+
+        REQUIRE(recent.read(9990, 9995, &snap) == 5);
+        REQUIRE(snap.packets[0].ts == 9990);
+    }
+
+    SECTION("Checking the workers are merged by timestamp.") {
+        recent_buffer recent(4, 4 * 1024 * 1024);
+        recent_buffer::snapshot snap;
+
+        for (uint64_t ts = 1; ts <= 4000; ts++) {
+            packet pkt = make_packet(ts, &frame);
+            recent.write(ts * 7 % 4, &pkt, 1);
+        }
+
+        REQUIRE(recent.oldest_ts() == 4);
+        REQUIRE(recent.read(100, 3000, &snap) == 2900);
+        for (size_t i = 0; i < snap.packets.size(); i++) {
+            REQUIRE(snap.packets[i].ts == 100 + i);
+            REQUIRE(is_intact(snap.packets[i]));
+        }
+    }
+
+    SECTION("Checking readers never see torn packets.") {
+        recent_buffer recent(1, 256 * 1024);
+        std::atomic<bool> done(false);
+        std::atomic<uint64_t> read(0);
+        std::atomic<uint64_t> torn(0);
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 2; i++) {
+            readers.push_back(std::thread([&]() {
+                recent_buffer::snapshot snap;
+                while (!done) {
+                    recent.read(0, UINT64_MAX, &snap);
+                    for (size_t k = 0; k < snap.packets.size(); k++) {
+                        if (!is_intact(snap.packets[k]) || (k > 0 && snap.packets[k].ts <= snap.packets[k - 1].ts))
+                            torn++;
+                    }
+                    read += snap.packets.size();
+                }
+            }));
+        }
+
+        for (uint64_t ts = 1; ts <= 2000000; ts++) {
+            packet pkt = make_packet(ts, &frame);
+            recent.write(0, &pkt, 1);
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        REQUIRE(read > 0);
+        REQUIRE(torn == 0);
+    }
+}
+
+TEST_CASE("common_download_test")
+{
+    char tmpl[] = "/tmp/utest-ring.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    std::vector<uint8_t> frame;
+
+    recent_buffer recent(2, 4 * 1024 * 1024);
+    for (uint64_t ts = 1000; ts < 3000; ts++) {
+        packet pkt = make_packet(ts, &frame);
+        recent.write(ts % 2, &pkt, 1);
+    }
+
+    pca::download::result result;
+    REQUIRE(pca::download::write(dir + "/recent.pcap", 1500, 2500, nullptr, &recent, &result));
+    REQUIRE(result.memory);
+    REQUIRE(result.segments == 0);
+    REQUIRE(result.packets == 1000);
+
+    pca::pcap::reader in;
+    REQUIRE(in.open(dir + "/recent.pcap"));
+    packet pkt;
+    uint64_t ts = 1500;
+    while (in.next(&pkt)) {
+        REQUIRE(pkt.ts == ts++);
+        REQUIRE(is_intact(pkt));
+    }
+    REQUIRE(ts == 2500);
+    in.close();
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
+
+static packet make_udp4_packet(uint64_t ts, uint8_t host, std::vector<uint8_t>* frame)
+{
+    frame->assign(14 + 20 + 8 + 18, 0);
+    (*frame)[12] = 0x08;
+    (*frame)[14] = 0x45;
+    (*frame)[14 + 9] = 17;
+    (*frame)[14 + 12] = 10;
+    (*frame)[14 + 15] = host;
+    (*frame)[14 + 16] = 10;
+    (*frame)[14 + 19] = 254;
+    (*frame)[35] = 53;
+    (*frame)[37] = 53;
+
+    packet pkt = { ts, static_cast<uint32_t>(frame->size()), static_cast<uint32_t>(frame->size()), frame->data() };
+
+    return pkt;
+}
+
+TEST_CASE("common_trigger_test")
+{
+    char tmpl[] = "/tmp/utest-ring.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    std::vector<uint8_t> frame;
+    const uint64_t ms = 1000000ULL;
+
+    recent_buffer recent(2, 4 * 1024 * 1024);
+    uint64_t ts = 1500000000ULL * 1000000000ULL;
+
+    // 1 second of packets before the trigger, a packet a millisecond
+    for (int i = 0; i < 1000; i++, ts += ms) {
+        packet pkt = make_udp4_packet(ts, i % 4, &frame);
+        recent.write(i % 2, &pkt, 1);
+    }
+
+    pca::trigger::filter f;
+    REQUIRE(!f.set_host("10.0.0"));
+    REQUIRE(f.set_host("10.0.0.1"));
+    f.port = 53;
+
+    pca::trigger::manager triggers(recent, 10);
+    int id = triggers.start(dir + "/trigger.pcap", f, 500 * ms, 300 * ms);
+    REQUIRE(id > 0);
+    uint64_t trigger_ts = ts - ms;
+
+    // 500 ms of packets after it
+    for (int i = 0; i < 500; i++, ts += ms) {
+        packet pkt = make_udp4_packet(ts, i % 4, &frame);
+        recent.write(i % 2, &pkt, 1);
+        if (i % 50 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    pca::trigger::status st;
+    for (int i = 0; i < 200; i++) {
+        REQUIRE(triggers.get_status(id, &st));
+        if (st.done)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE(st.done);
+    REQUIRE(!st.lost);
+    REQUIRE(st.trigger_ts == trigger_ts);
+    REQUIRE(!triggers.get_status(id + 1, &st));
+
+    pca::pcap::reader in;
+    REQUIRE(in.open(dir + "/trigger.pcap"));
+    packet pkt;
+    size_t n = 0;
+    while (in.next(&pkt)) {
+        REQUIRE(pkt.data[14 + 15] == 1);
+        REQUIRE(pkt.ts >= trigger_ts - 500 * ms);
+        REQUIRE(pkt.ts < trigger_ts + 300 * ms);
+        n++;
+    }
+    REQUIRE(n == 800 / 4);
+    REQUIRE(st.packets == n);
+    in.close();
+
+    REQUIRE(system(("rm -rf " + dir).c_str()) == 0);
+}
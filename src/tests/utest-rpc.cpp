@@ -0,0 +1,1518 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/arena.hpp"
+#include "common/binary_json.hpp"
+#include "common/fast_json.hpp"
+#include "common/frame_server.hpp"
+#include "common/http_compress.hpp"
+#include "common/http_server.hpp"
+#include "common/rpc_client.hpp"
+#include "common/rpc_base.hpp"
+#include "common/rpc_context.hpp"
+#include "common/rpc_method.hpp"
+#include "common/rpc_stream.hpp"
+#include "common/task_pool.hpp"
+
+using xa::method_info;
+using xa::method_table;
+
+static Json::Value parse(const std::string& text)
+{
+    Json::Value value;
+    Json::Reader reader;
+
+    REQUIRE(reader.parse(text, value));
+
+    return value;
+}
+
+TEST_CASE("common_rpc_method_test")
+{
+    method_table table;
+
+    SECTION("Checking methods are found by name, however many there are.") {
+        for (int i = 0; i < 300; i++) {
+            std::string name = "method_" + std::to_string(i);
+            REQUIRE(table.add(name, [i](const Json::Value& params, Json::Value* res, xa::request_context*) {
+                (*res)["result"] = i;
+                return true;
+            }, method_info({}, i % 2 == 0, i)));
+        }
+        REQUIRE(table.size() == 300);
+        REQUIRE_FALSE(table.add("method_7", nullptr));
+
+        for (int i = 0; i < 300; i++) {
+            const method_table::method* m = table.find("method_" + std::to_string(i));
+            Json::Value res;
+
+            REQUIRE(m != nullptr);
+            REQUIRE(m->fn(Json::Value(), &res, nullptr));
+            REQUIRE(res["result"].asInt() == i);
+            REQUIRE(m->info.idempotent == (i % 2 == 0));
+            REQUIRE(m->info.timeout_ms == static_cast<unsigned>(i));
+        }
+        REQUIRE(table.find("method_300") == nullptr);
+        REQUIRE(table.find("method_") == nullptr);
+        REQUIRE(table.find("") == nullptr);
+
+        // straight from the request, registration order kept
+        Json::Value req = parse("{\"method\": \"method_42\"}");
+        REQUIRE(table.lookup(req["method"]) == &table.methods()[42]);
+        REQUIRE(table.lookup(Json::Value(42)) == nullptr);
+        REQUIRE(table.methods().front().name == "method_0");
+    }
+
+    SECTION("Checking params are checked against the specs.") {
+        method_info info({ { "query", xa::PARAM_STRING }, { "begin", xa::PARAM_NUMBER },
+                           { "limit", xa::PARAM_INTEGER, false }, { "filter", xa::PARAM_OBJECT, false } });
+        std::string error;
+
+        REQUIRE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1.5}"), &error));
+        REQUIRE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"limit\": 10, \"other\": true}"), &error));
+        REQUIRE(info.check(parse("[1, 2]"), &error));
+
+        REQUIRE_FALSE(info.check(parse("{\"begin\": 1}"), &error));
+        REQUIRE(error == "Missing param: query");
+        REQUIRE_FALSE(info.check(Json::Value(), &error));
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": \"1\"}"), &error));
+        REQUIRE(error == "Invalid param: begin must be number");
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"limit\": 1.5}"), &error));
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": true}"), &error));
+        // integers asInt64() would throw on
+        REQUIRE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"limit\": -9223372036854775808}"), &error));
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"limit\": 18446744073709551615}"), &error));
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"limit\": true}"), &error));
+        REQUIRE_FALSE(info.check(parse("{\"query\": \"tcp\", \"begin\": 1, \"filter\": []}"), &error));
+
+        // no specs, anything goes
+        REQUIRE(method_info().check(Json::Value(), &error));
+    }
+
+    SECTION("Checking params of the fast path are checked alike.") {
+        method_info info({ { "query", xa::PARAM_STRING }, { "limit", xa::PARAM_INTEGER, false } });
+        xa::json::parser parser;
+        std::string error;
+        char ok[] = "{\"query\": \"tcp\", \"limit\": 10}";
+        char missing[] = "{\"limit\": 10}";
+        char invalid[] = "{\"query\": \"tcp\", \"limit\": 1.5}";
+
+        REQUIRE(info.check(*parser.parse(ok, strlen(ok)), &error));
+        REQUIRE_FALSE(info.check(*parser.parse(missing, strlen(missing)), &error));
+        REQUIRE(error == "Missing param: query");
+        REQUIRE_FALSE(info.check(*parser.parse(invalid, strlen(invalid)), &error));
+        REQUIRE(error == "Invalid param: limit must be integer");
+
+        char max[] = "{\"query\": \"tcp\", \"limit\": 9223372036854775807}";
+        char min[] = "{\"query\": \"tcp\", \"limit\": -9223372036854775808}";
+        char over[] = "{\"query\": \"tcp\", \"limit\": 9223372036854775808}";
+        char under[] = "{\"query\": \"tcp\", \"limit\": -9223372036854775809}";
+        REQUIRE(info.check(*parser.parse(max, strlen(max)), &error));
+        REQUIRE(info.check(*parser.parse(min, strlen(min)), &error));
+        REQUIRE_FALSE(info.check(*parser.parse(over, strlen(over)), &error));
+        REQUIRE_FALSE(info.check(*parser.parse(under, strlen(under)), &error));
+
+        REQUIRE(table.add_fast("fast", [](const xa::json::value& params, xa::json::writer* res,
+                                           xa::request_context*) {
+            res->key("result").write(params);
+            return true;
+        }));
+        REQUIRE(table.find("fast")->fast);
+        REQUIRE_FALSE(table.find("fast")->fn);
+    }
+}
+
+static std::string rewrite(const std::string& text)
+{
+    static xa::json::parser parser;
+    std::string input(text), output;
+    xa::json::writer writer(&output);
+
+    const xa::json::value* value = parser.parse(&input[0], input.size());
+    REQUIRE(value != nullptr);
+    writer.write(*value);
+
+    return output;
+}
+
+TEST_CASE("common_fast_json_test")
+{
+    xa::json::parser parser;
+
+    SECTION("Checking values are parsed in place.") {
+        char text[] = " {\"a\": [1, -2.5e3, true, false, null], \"b\": {\"c\": \"d\\\"e\\u00e9\\ud83d\\ude00\"}} ";
+        const xa::json::value* v = parser.parse(text, strlen(text));
+
+        REQUIRE(v != nullptr);
+        REQUIRE(v->is_object());
+        REQUIRE(v->size() == 2);
+        const xa::json::value* a = v->find("a");
+        REQUIRE(a != nullptr);
+        REQUIRE(a->is_array());
+        REQUIRE(a->size() == 5);
+        REQUIRE((*a)[0].is_integral());
+        REQUIRE((*a)[0].as_int64() == 1);
+        REQUIRE_FALSE((*a)[1].is_integral());
+        REQUIRE((*a)[1].as_double() == -2500.0);
+        REQUIRE((*a)[2].as_bool());
+        REQUIRE_FALSE((*a)[3].as_bool());
+        REQUIRE((*a)[4].is_null());
+        REQUIRE(v->find("b")->find("c")->as_string() == "d\"e\xc3\xa9\xf0\x9f\x98\x80");
+        REQUIRE(v->find("x") == nullptr);
+
+        // unescaped within the text itself
+        const char* c = v->find("b")->find("c")->text;
+        REQUIRE(c > text);
+        REQUIRE(c < text + sizeof(text));
+    }
+
+    SECTION("Checking invalid text is refused.") {
+        const char* invalid[] = { "", "{", "[1,]", "{\"a\" 1}", "{\"a\": 1,}", "tru", "01", "1.", "-",
+                                  "\"abc", "\"\\x\"", "\"\\ud800\"", "[1] 2", "\"\x01\"", "{1: 2}" };
+
+        for (const char* text : invalid) {
+            std::string input(text);
+            INFO(text);
+            REQUIRE(parser.parse(&input[0], input.size()) == nullptr);
+            REQUIRE_FALSE(parser.error().empty());
+        }
+
+        std::string deep(100, '[');
+        deep += std::string(100, ']');
+        REQUIRE(parser.parse(&deep[0], deep.size()) == nullptr);
+    }
+
+    SECTION("Checking the writer agrees with jsoncpp.") {
+        const char* texts[] = {
+            "{\"jsonrpc\":\"2.0\",\"id\":7,\"method\":\"ping\",\"params\":{\"a\":[1,2.5,\"x\"]}}",
+            "[\"tab\\there\",\"\\u0001\",\"\\\\\",{},[],null,-9223372036854775808,18446744073709551615]",
+            "{\"nested\":{\"deeper\":{\"deepest\":[[[true]]]}}}",
+        };
+
+        for (const char* text : texts) {
+            INFO(text);
+            std::string out = rewrite(text);
+            REQUIRE(parse(out) == parse(text));
+            REQUIRE(rewrite(out) == out);
+        }
+
+        std::string out;
+        xa::json::writer writer(&out);
+        writer.begin_object().key("a").number(1).key("b").begin_array().number(0.5).string("s").null().end_array()
+            .key("c").boolean(false).end_object();
+        REQUIRE(out == "{\"a\":1,\"b\":[0.5,\"s\",null],\"c\":false}");
+    }
+
+    SECTION("Checking a parser allocates nothing once warmed up.") {
+        std::string input;
+
+        for (int i = 0; i < 1000; i++) {
+            input = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(i)
+                + ",\"method\":\"ping\",\"params\":[1,2,3,{\"a\":\"b\"}]}";
+            REQUIRE(parser.parse(&input[0], input.size()) != nullptr);
+        }
+        size_t capacity = parser.arena().capacity();
+        size_t blocks = parser.arena().blocks();
+
+        for (int i = 0; i < 1000; i++) {
+            input = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(i)
+                + ",\"method\":\"ping\",\"params\":[1,2,3,{\"a\":\"b\"}]}";
+            REQUIRE(parser.parse(&input[0], input.size()) != nullptr);
+        }
+        REQUIRE(parser.arena().capacity() == capacity);
+        REQUIRE(parser.arena().blocks() == blocks);
+    }
+}
+
+static std::string bytes(std::initializer_list<int> list)
+{
+    std::string s;
+
+    for (int b : list) {
+        s.push_back(static_cast<char>(b));
+    }
+
+    return s;
+}
+
+// a JSON text encoded, then decoded and written back
+static std::string through(xa::json::format format, const char* text, std::string* encoded)
+{
+    xa::json::parser parser;
+    xa::json::decoder decoder;
+    std::string input(text), output;
+
+    encoded->clear();
+    const xa::json::value* v = parser.parse(&input[0], input.size());
+    REQUIRE(v != nullptr);
+    xa::json::encode(format, *v, encoded);
+
+    v = decoder.decode(format, encoded->data(), encoded->size());
+    REQUIRE(v != nullptr);
+    xa::json::writer writer(&output);
+    writer.write(*v);
+
+    return output;
+}
+
+TEST_CASE("common_binary_json_test")
+{
+    xa::json::decoder decoder;
+    xa::json::format f;
+    std::string encoded;
+
+    SECTION("Checking formats are told by media type.") {
+        REQUIRE(xa::json::format_of("application/cbor", 16, &f));
+        REQUIRE(f == xa::json::FORMAT_CBOR);
+        REQUIRE(xa::json::format_of(" Application/MsgPack; charset=x", 31, &f));
+        REQUIRE(f == xa::json::FORMAT_MSGPACK);
+        REQUIRE(xa::json::format_of("application/x-msgpack", 21, &f));
+        REQUIRE(f == xa::json::FORMAT_MSGPACK);
+        REQUIRE(xa::json::format_of("application/json;charset=utf-8", 30, &f));
+        REQUIRE(f == xa::json::FORMAT_JSON);
+        REQUIRE_FALSE(xa::json::format_of("text/plain", 10, &f));
+        REQUIRE(std::string(xa::json::media_type(xa::json::FORMAT_CBOR)) == "application/cbor");
+    }
+
+    SECTION("Checking CBOR as RFC 8949 has it.") {
+        REQUIRE(through(xa::json::FORMAT_CBOR, "1000000", &encoded) == "1000000");
+        REQUIRE(encoded == bytes({ 0x1a, 0x00, 0x0f, 0x42, 0x40 }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "-1000", &encoded) == "-1000");
+        REQUIRE(encoded == bytes({ 0x39, 0x03, 0xe7 }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "[1,[2,3]]", &encoded) == "[1,[2,3]]");
+        REQUIRE(encoded == bytes({ 0x82, 0x01, 0x82, 0x02, 0x03 }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "{\"a\":1,\"b\":[2,3]}", &encoded) == "{\"a\":1,\"b\":[2,3]}");
+        REQUIRE(encoded == bytes({ 0xa2, 0x61, 0x61, 0x01, 0x61, 0x62, 0x82, 0x02, 0x03 }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "1.1", &encoded) == "1.1");
+        REQUIRE(encoded == bytes({ 0xfb, 0x3f, 0xf1, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9a }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "100000.0", &encoded) == "100000");
+        REQUIRE(encoded == bytes({ 0xfa, 0x47, 0xc3, 0x50, 0x00 }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, "[true,false,null]", &encoded) == "[true,false,null]");
+        REQUIRE(encoded == bytes({ 0x83, 0xf5, 0xf4, 0xf6 }));
+
+        // what only comes in: half precision, tags, indefinite lengths, byte strings
+        std::string in = bytes({ 0xf9, 0x3e, 0x00 });
+        REQUIRE(decoder.decode(xa::json::FORMAT_CBOR, in.data(), in.size())->as_double() == 1.5);
+        in = bytes({ 0xc1, 0x1a, 0x51, 0x4b, 0x67, 0xb0 });
+        REQUIRE(decoder.decode(xa::json::FORMAT_CBOR, in.data(), in.size())->as_int64() == 1363896240);
+        in = bytes({ 0xbf, 0x61, 0x61, 0x9f, 0x01, 0xff, 0x7f, 0x62, 0x73, 0x74, 0x61, 0x72, 0xff, 0x42, 0x01, 0x02,
+                     0xff });
+        const xa::json::value* v = decoder.decode(xa::json::FORMAT_CBOR, in.data(), in.size());
+        REQUIRE(v != nullptr);
+        REQUIRE(v->find("a")->size() == 1);
+        REQUIRE(v->find("str")->as_string() == "\x01\x02");
+        in = bytes({ 0x3b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff });
+        REQUIRE(decoder.decode(xa::json::FORMAT_CBOR, in.data(), in.size())->as_string()
+                == "-18446744073709551616");
+    }
+
+    SECTION("Checking MessagePack as its spec has it.") {
+        REQUIRE(through(xa::json::FORMAT_MSGPACK, "{\"a\":1}", &encoded) == "{\"a\":1}");
+        REQUIRE(encoded == bytes({ 0x81, 0xa1, 0x61, 0x01 }));
+        REQUIRE(through(xa::json::FORMAT_MSGPACK, "[-1,-33,-129,300,-40000]", &encoded) == "[-1,-33,-129,300,-40000]");
+        REQUIRE(encoded == bytes({ 0x95, 0xff, 0xd0, 0xdf, 0xd1, 0xff, 0x7f, 0xcd, 0x01, 0x2c,
+                                   0xd2, 0xff, 0xff, 0x63, 0xc0 }));
+        REQUIRE(through(xa::json::FORMAT_MSGPACK, "[-128,-32768,-9223372036854775808,18446744073709551615]",
+                        &encoded) == "[-128,-32768,-9223372036854775808,18446744073709551615]");
+        REQUIRE(encoded.substr(0, 6) == bytes({ 0x94, 0xd0, 0x80, 0xd1, 0x80, 0x00 }));
+        REQUIRE(through(xa::json::FORMAT_MSGPACK, "[0.5,\"hi\",true,null]", &encoded) == "[0.5,\"hi\",true,null]");
+        REQUIRE(encoded == bytes({ 0x94, 0xca, 0x3f, 0x00, 0x00, 0x00, 0xa2, 0x68, 0x69, 0xc3, 0xc0 }));
+
+        std::string text = "\"" + std::string(300, 's') + "\"";
+        REQUIRE(through(xa::json::FORMAT_MSGPACK, text.c_str(), &encoded) == text);
+        REQUIRE(encoded.substr(0, 3) == bytes({ 0xda, 0x01, 0x2c }));
+        REQUIRE(through(xa::json::FORMAT_CBOR, text.c_str(), &encoded) == text);
+        REQUIRE(encoded.substr(0, 3) == bytes({ 0x79, 0x01, 0x2c }));
+    }
+
+    SECTION("Checking Json::Value encodes as its text does.") {
+        const char* texts[] = {
+            "{\"jsonrpc\":\"2.0\",\"id\":7,\"result\":{\"flows\":[{\"bytes\":123456789012,\"ratio\":0.25,"
+            "\"name\":\"eth0\",\"up\":true,\"tags\":[]}],\"next\":null}}",
+            "[-9223372036854775808,18446744073709551615,1e300,\"\\u0000\"]",
+        };
+
+        for (const char* text : texts) {
+            for (auto format : { xa::json::FORMAT_CBOR, xa::json::FORMAT_MSGPACK }) {
+                std::string from_value;
+                INFO(text);
+                REQUIRE(parse(through(format, text, &encoded)) == parse(text));
+                xa::json::encode(format, parse(text), &from_value);
+                REQUIRE(from_value.size() == encoded.size());
+
+                // and back into a Json::Value alike
+                Json::Value converted;
+                const xa::json::value* v = decoder.decode(format, encoded.data(), encoded.size());
+                REQUIRE(v != nullptr);
+                xa::json::convert(*v, &converted);
+                REQUIRE(converted == parse(text));
+            }
+
+            // and a Json::Value into a value, with no text in between
+            Json::Value value = parse(text), back;
+            xa::arena arena;
+            xa::json::value converted;
+            std::string written;
+            xa::json::convert(value, &converted, &arena);
+            xa::json::writer(&written).write(converted);
+            REQUIRE(parse(written) == value);
+            xa::json::convert(converted, &back);
+            REQUIRE(back == value);
+        }
+    }
+
+    SECTION("Checking invalid data is refused.") {
+        const std::string invalid[] = {
+            "",
+            bytes({ 0x82, 0x01 }),                  // an item short
+            bytes({ 0x62, 0x61 }),                  // a string short
+            bytes({ 0x01, 0x02 }),                  // trailing
+            bytes({ 0xa1, 0x01, 0x02 }),            // an integer key
+            bytes({ 0x1c }),                        // reserved
+            bytes({ 0x5f, 0x61, 0x61, 0xff }),      // a text chunk in a byte string
+            bytes({ 0x9f, 0x01 }),                  // no break
+            bytes({ 0x9b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 }),
+        };
+
+        for (const std::string& data : invalid) {
+            REQUIRE(decoder.decode(xa::json::FORMAT_CBOR, data.data(), data.size()) == nullptr);
+            REQUIRE_FALSE(decoder.error().empty());
+        }
+
+        std::string deep(100, static_cast<char>(0x81));
+        deep += bytes({ 0x01 });
+        REQUIRE(decoder.decode(xa::json::FORMAT_CBOR, deep.data(), deep.size()) == nullptr);
+        deep = std::string(100, static_cast<char>(0x91)) + bytes({ 0x01 });
+        REQUIRE(decoder.decode(xa::json::FORMAT_MSGPACK, deep.data(), deep.size()) == nullptr);
+
+        const std::string msgpack[] = { bytes({ 0xc1 }), bytes({ 0xd4, 0x01, 0x01 }), bytes({ 0xdc, 0x00 }),
+                                        bytes({ 0x81, 0x01, 0x01 }), bytes({ 0xd9, 0x05, 0x61 }) };
+        for (const std::string& data : msgpack) {
+            REQUIRE(decoder.decode(xa::json::FORMAT_MSGPACK, data.data(), data.size()) == nullptr);
+        }
+    }
+}
+
+TEST_CASE("common_arena_test")
+{
+    xa::arena arena(1024);
+
+    SECTION("Checking allocations are aligned and blocks kept on reset.") {
+        for (int i = 0; i < 100; i++) {
+            void* p = arena.allocate(i + 1, 16);
+            REQUIRE(reinterpret_cast<uintptr_t>(p) % 16 == 0);
+            memset(p, i, i + 1);
+        }
+        REQUIRE(arena.blocks() > 1);
+
+        // one bigger than any block
+        char* big = static_cast<char*>(arena.allocate(100000, 8));
+        memset(big, 0, 100000);
+
+        size_t capacity = arena.capacity();
+        arena.reset();
+        REQUIRE(arena.used() == 0);
+        for (int i = 0; i < 100; i++) {
+            arena.allocate(i + 1, 16);
+        }
+        arena.allocate(100000, 8);
+        REQUIRE(arena.capacity() == capacity);
+    }
+}
+
+TEST_CASE("common_rpc_context_test")
+{
+    SECTION("Checking the temporaries of a request go with it.") {
+        xa::arena* first;
+        size_t capacity;
+
+        {
+            xa::request_context ctx;
+            first = &ctx.arena();
+
+            xa::request_context::vector<int> v = ctx.make_vector<int>();
+            for (int i = 0; i < 1000; i++) {
+                v.push_back(i);
+            }
+            xa::request_context::string s = ctx.make_string("a string longer than fits inline");
+            s += " and some more";
+            uint64_t* n = ctx.make<uint64_t>(42);
+
+            REQUIRE(v[999] == 999);
+            REQUIRE(s == "a string longer than fits inline and some more");
+            REQUIRE(*n == 42);
+            REQUIRE(ctx.arena().used() > 4000);
+            capacity = ctx.arena().capacity();
+
+            // served from within, as a local node of a federated search is
+            xa::request_context inner;
+            REQUIRE(&inner.arena() != first);
+            inner.make<int>(1);
+        }
+        REQUIRE(first->used() == 0);
+
+        // the next request of the thread gets the same arena, grown no more
+        for (int round = 0; round < 100; round++) {
+            xa::request_context ctx;
+            REQUIRE(&ctx.arena() == first);
+
+            xa::request_context::vector<int> v = ctx.make_vector<int>();
+            for (int i = 0; i < 1000; i++) {
+                v.push_back(i);
+            }
+            ctx.make_string("a string longer than fits inline");
+            ctx.make<uint64_t>(42);
+        }
+        REQUIRE(first->capacity() == capacity);
+    }
+
+    SECTION("Checking a request runs out of time, appends to its result with it.") {
+        xa::request_context ctx;
+        Json::Value items;
+        xa::result_stream result(&items);
+
+        REQUIRE_FALSE(ctx.expired());
+        ctx.set_timeout(20);
+        result.set_deadline(ctx.deadline());
+        REQUIRE_FALSE(ctx.expired());
+        REQUIRE(result.append(Json::Value(1)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        REQUIRE(ctx.expired());
+        REQUIRE_FALSE(result.append(Json::Value(2)));
+        REQUIRE(items.size() == 1);
+
+        ctx.set_timeout(0);
+        REQUIRE_FALSE(ctx.expired());
+    }
+
+    SECTION("Checking a thread gets arenas of its own.") {
+        xa::request_context ctx;
+        xa::arena* other = nullptr;
+
+        std::thread([&other] {
+            xa::request_context ctx;
+            other = &ctx.arena();
+        }).join();
+        REQUIRE(other != &ctx.arena());
+    }
+}
+
+TEST_CASE("common_task_pool_test")
+{
+    xa::task_pool pool(4);
+
+    SECTION("Checking every call runs once, at most so many at once.") {
+        std::vector<int> calls(50, 0);
+        std::atomic<int> running(0);
+        std::atomic<int> peak(0);
+
+        auto begin = std::chrono::steady_clock::now();
+        pool.for_each(calls.size(), 3, [&](size_t i) {
+            int now = ++running;
+            int seen = peak;
+            while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            calls[i]++;
+            running--;
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        REQUIRE(std::count(calls.begin(), calls.end(), 1) == 50);
+        REQUIRE(peak <= 3);
+        REQUIRE(peak >= 2);
+        // 50 calls of 10ms, 3 at a time
+        REQUIRE(elapsed.count() < 0.4);
+    }
+
+    SECTION("Checking calls finish even when the pool is busy or calls it.") {
+        std::atomic<int> total(0);
+
+        // every thread of the pool takes a batch of its own
+        pool.for_each(8, 8, [&](size_t) {
+            pool.for_each(10, 4, [&](size_t) { total++; });
+        });
+        REQUIRE(total == 80);
+
+        pool.for_each(0, 4, [&](size_t) { total++; });
+        REQUIRE(total == 80);
+    }
+
+    SECTION("Checking tasks queued run before the pool stops.") {
+        std::atomic<int> done(0);
+
+        for (int i = 0; i < 20; i++) {
+            REQUIRE(pool.post([&done] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                done++;
+            }));
+        }
+        pool.stop();
+        REQUIRE(done == 20);
+        REQUIRE_FALSE(pool.post([] {}));
+
+        // run by the caller alone once stopped
+        std::atomic<int> calls(0);
+        pool.for_each(5, 4, [&](size_t) { calls++; });
+        REQUIRE(calls == 5);
+    }
+}
+
+static int connect_to(unsigned short port)
+{
+    struct sockaddr_in addr = {};
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    REQUIRE(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+
+    return fd;
+}
+
+static void send_all(int fd, const std::string& data)
+{
+    REQUIRE(send(fd, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.size()));
+}
+
+static bool read_more(int fd, std::string* buffer)
+{
+    char buf[65536];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+
+    if (n <= 0)
+        return false;
+    buffer->append(buf, n);
+
+    return true;
+}
+
+// a chunked body, its chunks counted; false on EOF before the last one
+static bool read_chunks(int fd, std::string* buffer, std::string* body, int* chunks)
+{
+    size_t pos = 0, end;
+
+    body->clear();
+    *chunks = 0;
+    for (;;) {
+        while ((end = buffer->find("\r\n", pos)) == std::string::npos) {
+            if (!read_more(fd, buffer))
+                return false;
+        }
+        size_t size = strtoul(buffer->c_str() + pos, nullptr, 16);
+        while (buffer->size() < end + 2 + size + 2) {
+            if (!read_more(fd, buffer))
+                return false;
+        }
+        body->append(*buffer, end + 2, size);
+        pos = end + 2 + size + 2;
+        if (size == 0)
+            break;
+        (*chunks)++;
+    }
+    buffer->erase(0, pos);
+
+    return true;
+}
+
+// the next response on a connection, its head and body; false on EOF
+static bool read_response(int fd, std::string* buffer, std::string* head, std::string* body,
+                          int* chunks = nullptr)
+{
+    size_t end;
+    int n;
+
+    while ((end = buffer->find("\r\n\r\n")) == std::string::npos) {
+        if (!read_more(fd, buffer))
+            return false;
+    }
+    *head = buffer->substr(0, end + 4);
+
+    if (head->find("Transfer-Encoding: chunked\r\n") != std::string::npos) {
+        buffer->erase(0, end + 4);
+        return read_chunks(fd, buffer, body, chunks != nullptr ? chunks : &n);
+    }
+    if (chunks != nullptr)
+        *chunks = 0;
+    // HTTP/1.0 streamed, up to the end of the connection
+    if (head->find("Content-Length: ") == std::string::npos && head->compare(0, 12, "HTTP/1.1 100") != 0) {
+        while (read_more(fd, buffer)) {
+        }
+        *body = buffer->substr(end + 4);
+        buffer->clear();
+        return true;
+    }
+
+    size_t length = 0;
+    size_t pos = head->find("Content-Length: ");
+    if (pos != std::string::npos)
+        length = strtoul(head->c_str() + pos + 16, nullptr, 10);
+    while (buffer->size() < end + 4 + length) {
+        if (!read_more(fd, buffer))
+            return false;
+    }
+    *body = buffer->substr(end + 4, length);
+    buffer->erase(0, end + 4 + length);
+
+    return true;
+}
+
+TEST_CASE("common_http_server_test")
+{
+    std::atomic<int> served(0);
+    xa::http::server server("127.0.0.1", 0, 2, [&served](const xa::http::request& req, xa::http::response* res) {
+        served++;
+        if (req.target_is("/big")) {
+            static thread_local std::string big;
+            big.assign(1024 * 1024, 'x');
+            res->set_body(big);
+            return;
+        }
+        if (!req.method_is("POST")) {
+            res->status = 404;
+            res->set_text("not found");
+            return;
+        }
+        const xa::http::header* h = req.find("x-echo");
+        if (h != nullptr)
+            res->add_header("X-Echo", h->value, h->value_len);
+        res->set_text(req.body, req.body_len);
+    });
+
+    REQUIRE(server.listen());
+    REQUIRE(server.port() != 0);
+    std::thread thread(&xa::http::server::run, &server);
+    std::string buffer, head, body;
+
+    SECTION("Checking requests are served on a kept-alive connection.") {
+        int fd = connect_to(server.port());
+
+        for (int i = 0; i < 10; i++) {
+            std::string payload = "{\"id\":" + std::to_string(i) + "}";
+            send_all(fd, "POST /rpc HTTP/1.1\r\nHost: x\r\nX-Echo:  value \r\nContent-Length: "
+                     + std::to_string(payload.size()) + "\r\n\r\n" + payload);
+            REQUIRE(read_response(fd, &buffer, &head, &body));
+            REQUIRE(head.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+            REQUIRE(head.find("X-Echo: value\r\n") != std::string::npos);
+            REQUIRE(head.find("Connection: close") == std::string::npos);
+            REQUIRE(body == payload);
+        }
+        close(fd);
+    }
+
+    SECTION("Checking pipelined requests are answered in order.") {
+        int fd = connect_to(server.port());
+        std::string requests;
+
+        for (int i = 0; i < 100; i++) {
+            std::string payload = std::to_string(i);
+            requests += "POST /rpc HTTP/1.1\r\nContent-Length: " + std::to_string(payload.size())
+                + "\r\n\r\n" + payload;
+        }
+        // split anywhere
+        send_all(fd, requests.substr(0, 1001));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        send_all(fd, requests.substr(1001));
+
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(read_response(fd, &buffer, &head, &body));
+            REQUIRE(body == std::to_string(i));
+        }
+        close(fd);
+    }
+
+    SECTION("Checking connections are closed when asked to.") {
+        int fd = connect_to(server.port());
+
+        send_all(fd, "POST /rpc HTTP/1.1\r\nConnection: close\r\nContent-Length: 2\r\n\r\nhi");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.find("Connection: close\r\n") != std::string::npos);
+        REQUIRE(body == "hi");
+        REQUIRE_FALSE(read_response(fd, &buffer, &head, &body));
+        close(fd);
+
+        // HTTP/1.0 only on request
+        fd = connect_to(server.port());
+        send_all(fd, "POST /rpc HTTP/1.0\r\nConnection: Keep-Alive\r\nContent-Length: 1\r\n\r\na");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.find("Connection: keep-alive\r\n") != std::string::npos);
+        send_all(fd, "POST /rpc HTTP/1.0\r\nContent-Length: 1\r\n\r\nb");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(body == "b");
+        REQUIRE_FALSE(read_response(fd, &buffer, &head, &body));
+        close(fd);
+    }
+
+    SECTION("Checking bodies sent after 100 Continue and big responses.") {
+        int fd = connect_to(server.port());
+
+        send_all(fd, "POST /rpc HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 5\r\n\r\n");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head == "HTTP/1.1 100 Continue\r\n\r\n");
+        send_all(fd, "hello");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(body == "hello");
+
+        // written from the handler's buffer, more than the socket takes at once
+        send_all(fd, "GET /big HTTP/1.1\r\n\r\nGET /big HTTP/1.1\r\n\r\nPOST /rpc HTTP/1.1\r\nContent-Length: 3\r\n\r\nend");
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (int i = 0; i < 2; i++) {
+            REQUIRE(read_response(fd, &buffer, &head, &body));
+            REQUIRE(body.size() == 1024 * 1024);
+            REQUIRE(body.find_first_not_of('x') == std::string::npos);
+        }
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(body == "end");
+        close(fd);
+    }
+
+    SECTION("Checking invalid requests are refused.") {
+        const char* invalid[] = {
+            "NONSENSE\r\n\r\n",
+            "GET / HTTP/2.0\r\n\r\n",
+            "POST /rpc HTTP/1.1\r\nContent-Length: x\r\n\r\n",
+            "POST /rpc HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+            "POST /rpc HTTP/1.1\r\nno colon\r\n\r\n",
+            "POST /rpc HTTP/1.1\r\nContent-Length: 99999999999\r\n\r\n",
+        };
+        const char* codes[] = { "400", "505", "400", "501", "400", "400" };
+
+        for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+            int fd = connect_to(server.port());
+            INFO(invalid[i]);
+            send_all(fd, invalid[i]);
+            REQUIRE(read_response(fd, &buffer, &head, &body));
+            REQUIRE(head.compare(9, 3, codes[i]) == 0);
+            REQUIRE_FALSE(read_response(fd, &buffer, &head, &body));
+            close(fd);
+            buffer.clear();
+        }
+
+        int fd = connect_to(server.port());
+        send_all(fd, "GET / HTTP/1.1\r\nX: " + std::string(xa::http::server::MAX_HEADER, 'a'));
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.compare(9, 3, "431") == 0);
+        close(fd);
+    }
+
+    SECTION("Checking the throughput of pipelined requests.") {
+        const int CONNECTIONS = 4;
+        const int REQUESTS = 20000;
+        std::vector<std::thread> clients;
+        std::atomic<int> answered(0);
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < CONNECTIONS; i++) {
+            clients.emplace_back([&server, &answered] {
+                int fd = connect_to(server.port());
+                std::string buffer, head, body, batch;
+
+                for (int j = 0; j < 16; j++) {
+                    batch += "POST /rpc HTTP/1.1\r\nContent-Length: 4\r\n\r\nping";
+                }
+                for (int j = 0; j < REQUESTS; j += 16) {
+                    send_all(fd, batch);
+                    for (int k = 0; k < 16; k++) {
+                        if (read_response(fd, &buffer, &head, &body) && body == "ping")
+                            answered++;
+                    }
+                }
+                close(fd);
+            });
+        }
+        for (auto& t : clients) {
+            t.join();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        REQUIRE(answered == CONNECTIONS * REQUESTS);
+        printf("served %d pipelined requests over %d connections in %.3f sec: %.0f requests/sec\n",
+               CONNECTIONS * REQUESTS, CONNECTIONS, elapsed.count(), CONNECTIONS * REQUESTS / elapsed.count());
+    }
+
+    server.stop();
+    thread.join();
+}
+
+// gzip or zlib data, all that can be decompressed of it
+static std::string inflate_all(const std::string& data)
+{
+    z_stream z = {};
+    std::string out;
+    char buf[65536];
+
+    REQUIRE(inflateInit2(&z, 15 + 32) == Z_OK);
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    z.avail_in = static_cast<uInt>(data.size());
+    int rc;
+    do {
+        z.next_out = reinterpret_cast<Bytef*>(buf);
+        z.avail_out = sizeof(buf);
+        rc = inflate(&z, Z_SYNC_FLUSH);
+        out.append(buf, sizeof(buf) - z.avail_out);
+    } while (rc == Z_OK && (z.avail_in > 0 || z.avail_out == 0));
+    inflateEnd(&z);
+
+    return out;
+}
+
+// a stream into a string
+class string_stream : public xa::http::stream {
+public:
+    std::string data;
+    int flushes = 0;
+
+    virtual bool write(const char* p, size_t n)
+    {
+        data.append(p, n);
+        return true;
+    }
+
+    virtual bool flush()
+    {
+        flushes++;
+        return true;
+    }
+};
+
+static xa::http::encoding accepted(const char* value)
+{
+    xa::http::request req;
+
+    req.headers.push_back(xa::http::header{ "accept-encoding", 15, value, strlen(value) });
+
+    return xa::http::accepted_encoding(req);
+}
+
+TEST_CASE("common_http_compress_test")
+{
+    using xa::http::ENCODING_DEFLATE;
+    using xa::http::ENCODING_GZIP;
+    using xa::http::ENCODING_IDENTITY;
+
+    std::string text;
+    for (int i = 0; i < 20000; i++) {
+        text += "{\"flow\":" + std::to_string(i) + ",\"bytes\":" + std::to_string(i * 1500 % 65536)
+            + ",\"proto\":\"tcp\"},";
+    }
+
+    SECTION("Checking the coding accepted best.") {
+        xa::http::request none;
+
+        REQUIRE(xa::http::accepted_encoding(none) == ENCODING_IDENTITY);
+        REQUIRE(accepted("gzip") == ENCODING_GZIP);
+        REQUIRE(accepted("deflate, gzip") == ENCODING_GZIP);
+        REQUIRE(accepted("gzip;q=0.5, deflate") == ENCODING_DEFLATE);
+        REQUIRE(accepted(" GZip ;q=0 , deflate; q=0.1") == ENCODING_DEFLATE);
+        REQUIRE(accepted("x-gzip") == ENCODING_GZIP);
+        REQUIRE(accepted("br, *;q=0.2") == ENCODING_GZIP);
+        REQUIRE(accepted("gzip;q=0, *") == ENCODING_DEFLATE);
+        REQUIRE(accepted("br, identity") == ENCODING_IDENTITY);
+        REQUIRE(accepted("*;q=0") == ENCODING_IDENTITY);
+        REQUIRE(accepted("") == ENCODING_IDENTITY);
+        REQUIRE(std::string(xa::http::encoding_name(ENCODING_DEFLATE)) == "deflate");
+    }
+
+    SECTION("Checking bodies come back as they were, the state of the thread reused.") {
+        for (int level = 0; level <= 9; level += 3) {
+            for (auto e : { ENCODING_GZIP, ENCODING_DEFLATE, ENCODING_GZIP }) {
+                for (size_t n : { 0, 1, 1000, 100000 }) {
+                    std::string out = "prefix";
+                    REQUIRE(xa::http::compress(e, level, text.data(), n, &out));
+                    REQUIRE(out.compare(0, 6, "prefix") == 0);
+                    out.erase(0, 6);
+                    // gzip's magic, or zlib's method and window
+                    if (e == ENCODING_GZIP)
+                        REQUIRE(out.compare(0, 2, "\x1f\x8b") == 0);
+                    else
+                        REQUIRE(out[0] == 0x78);
+                    REQUIRE(inflate_all(out) == text.substr(0, n));
+                }
+            }
+        }
+
+        xa::http::compressor z;
+        std::string out;
+        REQUIRE_FALSE(z.begin(ENCODING_IDENTITY));
+        REQUIRE_FALSE(z.write("x", 1, &out));
+        REQUIRE_FALSE(z.begin(ENCODING_GZIP, 10));
+    }
+
+    SECTION("Checking a stream can be decompressed up to every flush.") {
+        string_stream out;
+        xa::http::compressing_stream z(&out, ENCODING_DEFLATE);
+        size_t step = text.size() / 7;
+
+        for (size_t pos = 0; pos < text.size(); pos += step) {
+            size_t n = std::min(step, text.size() - pos);
+            REQUIRE(z.write(text.data() + pos, n));
+            REQUIRE(z.flush());
+            REQUIRE(inflate_all(out.data) == text.substr(0, pos + n));
+        }
+        REQUIRE(z.finish());
+        REQUIRE(out.flushes == 8);
+        REQUIRE(inflate_all(out.data) == text);
+    }
+
+    SECTION("Checking the ratio and the speed of the levels.") {
+        const int ROUNDS = 20;
+        std::string out;
+
+        for (int level : { 1, 6 }) {
+            auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < ROUNDS; i++) {
+                out.clear();
+                REQUIRE(xa::http::compress(ENCODING_GZIP, level, text.data(), text.size(), &out));
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+            printf("gzip level %d: %zu bytes to %zu (%.1f%%) in %.3f ms\n", level, text.size(), out.size(),
+                   100.0 * out.size() / text.size(), elapsed.count() / ROUNDS);
+        }
+    }
+}
+
+TEST_CASE("common_http_stream_test")
+{
+    const size_t CHUNK = xa::http::server::CHUNK_SIZE;
+    xa::http::server server("127.0.0.1", 0, 1, [](const xa::http::request& req, xa::http::response* res) {
+        int n = atoi(std::string(req.body, req.body_len).c_str());
+
+        res->add_header("Content-Type", "text/plain");
+        if (req.target_is("/lines")) {
+            res->set_stream([n](xa::http::stream* out, xa::http::response*) {
+                for (int i = 0; i < n; i++) {
+                    if (!out->write("line " + std::to_string(i) + "\n"))
+                        return false;
+                }
+                return true;
+            });
+        } else if (req.target_is("/fail")) {
+            // gives up after n bytes
+            res->set_stream([n](xa::http::stream* out, xa::http::response* res) {
+                if (!out->write(std::string(n, 'x')))
+                    return false;
+                res->status = 500;
+                res->set_text("failed");
+                return false;
+            });
+        } else if (req.target_is("/items")) {
+            // n items, all but the first slow to come
+            res->set_stream([n](xa::http::stream* out, xa::http::response*) {
+                xa::result_stream items(out);
+
+                if (!out->write("[", 1))
+                    return false;
+                for (int i = 0; i < n; i++) {
+                    if (i > 0)
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    Json::Value item(Json::objectValue);
+                    item["i"] = i;
+                    if (!items.append(item))
+                        return false;
+                }
+                return out->write("]", 1);
+            });
+        } else if (req.target_is("/gzip")) {
+            res->add_header("Content-Encoding", "gzip");
+            res->set_stream([n](xa::http::stream* out, xa::http::response*) {
+                xa::http::compressing_stream z(out, xa::http::ENCODING_GZIP);
+
+                for (int i = 0; i < n; i++) {
+                    if (!z.write("line " + std::to_string(i) + "\n"))
+                        return false;
+                }
+                return z.finish();
+            });
+        } else {
+            res->set_text("plain");
+        }
+    });
+
+    REQUIRE(server.listen());
+    std::thread thread(&xa::http::server::run, &server);
+    std::string buffer, head, body;
+    int chunks;
+
+    SECTION("Checking big bodies go in chunks, small ones as they are.") {
+        int fd = connect_to(server.port());
+        std::string expected;
+
+        for (int i = 0; i < 100000; i++) {
+            expected += "line " + std::to_string(i) + "\n";
+        }
+        send_all(fd, "POST /lines HTTP/1.1\r\nContent-Length: 6\r\n\r\n100000");
+        REQUIRE(read_response(fd, &buffer, &head, &body, &chunks));
+        REQUIRE(head.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+        REQUIRE(head.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+        REQUIRE(head.find("Content-Type: text/plain\r\n") != std::string::npos);
+        REQUIRE(head.find("Content-Length") == std::string::npos);
+        REQUIRE(body == expected);
+        REQUIRE(chunks >= static_cast<int>(expected.size() / CHUNK));
+
+        // the connection kept, pipelined requests after it in order
+        send_all(fd, "POST /lines HTTP/1.1\r\nContent-Length: 1\r\n\r\n2GET / HTTP/1.1\r\n\r\n");
+        REQUIRE(read_response(fd, &buffer, &head, &body, &chunks));
+        REQUIRE(head.find("Content-Length: 14\r\n") != std::string::npos);
+        REQUIRE(chunks == 0);
+        REQUIRE(body == "line 0\nline 1\n");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(body == "plain");
+        close(fd);
+    }
+
+    SECTION("Checking HTTP/1.0 bodies end with the connection.") {
+        int fd = connect_to(server.port());
+
+        send_all(fd, "POST /lines HTTP/1.0\r\nConnection: keep-alive\r\nContent-Length: 5\r\n\r\n10000");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.find("Connection: close\r\n") != std::string::npos);
+        REQUIRE(head.find("Transfer-Encoding") == std::string::npos);
+        REQUIRE(body.compare(0, 14, "line 0\nline 1\n") == 0);
+        REQUIRE(body.size() > CHUNK);
+        close(fd);
+
+        // one that fits in a chunk goes as it is
+        fd = connect_to(server.port());
+        send_all(fd, "POST /lines HTTP/1.0\r\nConnection: keep-alive\r\nContent-Length: 1\r\n\r\n1");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.find("Connection: keep-alive\r\n") != std::string::npos);
+        REQUIRE(body == "line 0\n");
+        close(fd);
+    }
+
+    SECTION("Checking streamers giving up before and after the first chunk.") {
+        int fd = connect_to(server.port());
+
+        // the response as the streamer left it
+        send_all(fd, "POST /fail HTTP/1.1\r\nContent-Length: 3\r\n\r\n100");
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 500") == 0);
+        REQUIRE(body == "failed");
+
+        // the last chunk left out and the connection closed
+        send_all(fd, "POST /fail HTTP/1.1\r\nContent-Length: 6\r\n\r\n100000");
+        REQUIRE_FALSE(read_response(fd, &buffer, &head, &body, &chunks));
+        REQUIRE(head.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+        close(fd);
+    }
+
+    SECTION("Checking result_stream items and the time to first byte.") {
+        const int ITEMS = 50;
+        int fd = connect_to(server.port());
+        char buf[65536];
+
+        auto begin = std::chrono::steady_clock::now();
+        send_all(fd, "POST /items HTTP/1.1\r\nContent-Length: 2\r\n\r\n50");
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        REQUIRE(n > 0);
+        std::chrono::duration<double, std::milli> first = std::chrono::steady_clock::now() - begin;
+        buffer.assign(buf, n);
+        REQUIRE(read_response(fd, &buffer, &head, &body, &chunks));
+        std::chrono::duration<double, std::milli> total = std::chrono::steady_clock::now() - begin;
+
+        Json::Value items = parse(body);
+        REQUIRE(items.size() == ITEMS);
+        for (int i = 0; i < ITEMS; i++) {
+            REQUIRE(items[i]["i"].asInt() == i);
+        }
+        // the first item at once, the others a few at a time
+        REQUIRE(chunks > 2);
+        REQUIRE(chunks < ITEMS);
+        REQUIRE(first.count() < total.count() / 4);
+        printf("streamed %d items in %d chunks: first byte in %.3f ms, all in %.3f ms\n",
+               ITEMS, chunks, first.count(), total.count());
+        close(fd);
+    }
+
+    SECTION("Checking compressed bodies in chunks.") {
+        int fd = connect_to(server.port());
+        std::string expected;
+
+        for (int i = 0; i < 200000; i++) {
+            expected += "line " + std::to_string(i) + "\n";
+        }
+        send_all(fd, "POST /gzip HTTP/1.1\r\nContent-Length: 6\r\n\r\n200000");
+        REQUIRE(read_response(fd, &buffer, &head, &body, &chunks));
+        REQUIRE(head.find("Content-Encoding: gzip\r\n") != std::string::npos);
+        REQUIRE(chunks > 1);
+        REQUIRE(inflate_all(body) == expected);
+
+        // small enough for a plain response
+        send_all(fd, "POST /gzip HTTP/1.1\r\nContent-Length: 1\r\n\r\n3");
+        REQUIRE(read_response(fd, &buffer, &head, &body, &chunks));
+        REQUIRE(chunks == 0);
+        REQUIRE(inflate_all(body) == "line 0\nline 1\nline 2\n");
+        close(fd);
+    }
+
+    SECTION("Checking a client not reading its stream holds up no other.") {
+        int fd = connect_to(server.port());
+        int ping = connect_to(server.port());
+
+        // far more than the socket buffers take, never read
+        send_all(fd, "POST /lines HTTP/1.1\r\nContent-Length: 8\r\n\r\n10000000");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        // on the same thread, the only one
+        auto begin = std::chrono::steady_clock::now();
+        send_all(ping, "GET / HTTP/1.1\r\n\r\n");
+        REQUIRE(read_response(ping, &buffer, &head, &body));
+        REQUIRE(body == "plain");
+        REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(1));
+        close(ping);
+        close(fd);
+    }
+
+    SECTION("Checking items are collected where nothing streams.") {
+        Json::Value items;
+        xa::result_stream result(&items);
+        xa::json::parser parser;
+        char text[] = "{\"a\":[1,2]}";
+
+        REQUIRE(items.isArray());
+        REQUIRE(result.append(Json::Value("x")));
+        REQUIRE(result.append(*parser.parse(text, strlen(text))));
+        result.begin_item().begin_object().key("b").boolean(true).end_object();
+        REQUIRE(result.end_item());
+        REQUIRE(result.flush());
+        REQUIRE(result.size() == 3);
+        REQUIRE(items == parse("[\"x\",{\"a\":[1,2]},{\"b\":true}]"));
+
+        REQUIRE_FALSE(result.fail(-32000, "gone"));
+        REQUIRE(result.error_code() == -32000);
+        REQUIRE(result.error_message() == "gone");
+    }
+
+    server.stop();
+    thread.join();
+}
+
+static int connect_unix(const std::string& path)
+{
+    struct sockaddr_un addr = {};
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    REQUIRE(connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+
+    return fd;
+}
+
+TEST_CASE("common_frame_server_test")
+{
+    std::string path = "/tmp/utest-rpc-" + std::to_string(getpid()) + ".sock";
+    xa::frame_server server(path, 0600, 2, [](const char* frame, size_t n, std::string* out) {
+        if (n > 0 && frame[0] == '{') {
+            // a JSON-RPC answer to any call
+            out->append("{\"jsonrpc\":\"2.0\",\"result\":\"pong\",\"id\":1}");
+            return;
+        }
+        out->append(frame, n);
+    });
+
+    REQUIRE(server.start());
+    std::string frame;
+
+    SECTION("Checking the socket file and its mode.") {
+        struct stat st;
+
+        REQUIRE(stat(path.c_str(), &st) == 0);
+        REQUIRE(S_ISSOCK(st.st_mode));
+        REQUIRE((st.st_mode & 0777) == 0600);
+
+        server.stop();
+        REQUIRE(stat(path.c_str(), &st) != 0);
+    }
+
+    SECTION("Checking frames are answered in order, however they arrive.") {
+        int fd = connect_unix(path);
+
+        for (int i = 0; i < 10; i++) {
+            REQUIRE(xa::frame_server::write_frame(fd, "frame " + std::to_string(i)));
+            REQUIRE(xa::frame_server::read_frame(fd, &frame));
+            REQUIRE(frame == "frame " + std::to_string(i));
+        }
+
+        // an empty frame, and frames split anywhere
+        REQUIRE(xa::frame_server::write_frame(fd, ""));
+        REQUIRE(xa::frame_server::read_frame(fd, &frame));
+        REQUIRE(frame.empty());
+
+        std::string frames;
+        for (int i = 0; i < 100; i++) {
+            std::string body = std::to_string(i);
+            uint32_t n = body.size();
+            frames += std::string(1, 0) + std::string(1, 0) + std::string(1, n >> 8) + std::string(1, n) + body;
+        }
+        send_all(fd, frames.substr(0, 3));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        send_all(fd, frames.substr(3, 200));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        send_all(fd, frames.substr(203));
+        for (int i = 0; i < 100; i++) {
+            REQUIRE(xa::frame_server::read_frame(fd, &frame));
+            REQUIRE(frame == std::to_string(i));
+        }
+        close(fd);
+    }
+
+    SECTION("Checking big frames, and frames over the limit closing the connection.") {
+        int fd = connect_unix(path);
+        std::string big(4 * 1024 * 1024, 'x');
+
+        // more than the socket takes at once, both ways
+        std::thread writer([fd, &big] {
+            xa::frame_server::write_frame(fd, big);
+            xa::frame_server::write_frame(fd, big);
+        });
+        for (int i = 0; i < 2; i++) {
+            REQUIRE(xa::frame_server::read_frame(fd, &frame));
+            REQUIRE(frame == big);
+        }
+        writer.join();
+
+        send_all(fd, "\xff\xff\xff\xff");
+        REQUIRE_FALSE(xa::frame_server::read_frame(fd, &frame));
+        close(fd);
+    }
+
+    SECTION("Checking rpc_client calls over the socket.") {
+        xa::rpc_client client(path);
+        Json::Value result;
+        std::string error;
+
+        REQUIRE(client.call("ping", Json::Value(), &result, &error,
+                            std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+        REQUIRE(result == "pong");
+
+        xa::rpc_client nowhere(path + ".none");
+        REQUIRE_FALSE(nowhere.call("ping", Json::Value(), &result, &error,
+                                   std::chrono::steady_clock::now() + std::chrono::seconds(1)));
+        REQUIRE(error.find("No such file") != std::string::npos);
+    }
+
+    SECTION("Checking the latency of a round trip.") {
+        const int ROUNDS = 20000;
+        int fd = connect_unix(path);
+        std::string ping = "{\"jsonrpc\":\"2.0\",\"method\":\"ping\",\"id\":1}";
+
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < ROUNDS; i++) {
+            REQUIRE(xa::frame_server::write_frame(fd, ping));
+            REQUIRE(xa::frame_server::read_frame(fd, &frame));
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        close(fd);
+
+        printf("%d round trips over a unix socket in %.3f sec: %.1f usec each\n",
+               ROUNDS, elapsed.count(), elapsed.count() * 1e6 / ROUNDS);
+    }
+
+    server.stop();
+}
+
+// a server whose handlers throw or fail, on a port of its own
+class rpc_throwing : public xa::rpc_base {
+public:
+    explicit rpc_throwing(unsigned short port) : rpc_base("127.0.0.1", port, 2)
+    {
+        add_fast_method("ping", &rpc_throwing::serve_ping);
+        add_fast_method("refuse", &rpc_throwing::serve_refuse);
+        add_fast_method("give_up", &rpc_throwing::serve_give_up);
+        // fast and stream handlers run out of dispatch(), as the engine calls them
+        add_fast_method("throw_fast", &rpc_throwing::serve_throw_fast);
+        add_stream_method("throw_stream", &rpc_throwing::serve_throw_stream);
+        add_method("throw", &rpc_throwing::serve_throw);
+        add_stream_method("forever", &rpc_throwing::serve_forever, xa::method_info({}, true, 50));
+        set_engine(ENGINE_EPOLL);
+    }
+
+    // as servers overrode it before contexts, the methods added served by the default
+    using rpc_base::serve;
+    virtual bool serve(const Json::Value& req, Json::Value* res)
+    {
+        if (req["method"] != "legacy")
+            return rpc_base::serve(req, res);
+        (*res)["result"] = "served";
+        return true;
+    }
+
+    bool serve_ping(const xa::json::value& params, xa::json::writer* res)
+    {
+        res->key("result").string("pong");
+        return true;
+    }
+
+    // an error of its own status, a ping written on the side not counting
+    bool serve_refuse(const xa::json::value& params, xa::json::writer* res)
+    {
+        std::string other;
+        xa::json::writer side(&other);
+
+        side.begin_object();
+        serve_error(ERROR_INTERNAL_ERROR, "other", &side);
+        side.end_object();
+        return serve_error(ERROR_METHOD_NOT_FOUND, "Not here", res);
+    }
+
+    // failing halfway through its result
+    bool serve_give_up(const xa::json::value& params, xa::json::writer* res)
+    {
+        res->key("result").begin_array().number(1);
+        return false;
+    }
+
+    bool serve_throw_fast(const xa::json::value& params, xa::json::writer* res)
+    {
+        res->key("result");
+        throw std::runtime_error("thrown");
+    }
+
+    // items until it is told to stop
+    bool serve_forever(const Json::Value& params, xa::result_stream* res)
+    {
+        for (int i = 0; res->append(i); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return false;
+    }
+
+    bool serve_throw_stream(const Json::Value& params, xa::result_stream* res)
+    {
+        return res->append(params["n"].asInt());
+    }
+
+    bool serve_throw(const Json::Value& params, Json::Value* res)
+    {
+        (*res)["result"] = params["n"].asInt();
+        return true;
+    }
+};
+
+TEST_CASE("common_rpc_base_test")
+{
+    const unsigned short PORT = 10181;
+    rpc_throwing server(PORT);
+    struct sockaddr_in addr = {};
+    std::string buffer, head, body;
+    int fd = -1;
+
+    server.start();
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(PORT);
+    for (int i = 0; i < 100 && fd < 0; i++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    REQUIRE(fd >= 0);
+
+    auto call = [&](const std::string& method) {
+        std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"" + method
+            + "\",\"params\":{\"n\":\"x\"}}";
+        send_all(fd, "POST /rpc HTTP/1.1\r\nHost: x\r\nContent-Length: " + std::to_string(payload.size())
+                 + "\r\n\r\n" + payload);
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+    };
+
+    SECTION("Checking a throwing handler fails its request alone.") {
+        for (const char* method : { "throw", "throw_fast", "throw_stream" }) {
+            call(method);
+            REQUIRE(head.compare(0, 12, "HTTP/1.1 500") == 0);
+            REQUIRE(parse(body)["error"]["code"].asInt() == int(xa::rpc_base::ERROR_INTERNAL_ERROR));
+
+            // the server, and the connection, go on
+            call("ping");
+            REQUIRE(head.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+            REQUIRE(parse(body)["result"] == "pong");
+        }
+    }
+
+    SECTION("Checking an override of serve() without a context is called.") {
+        call("legacy");
+        REQUIRE(head.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+        REQUIRE(parse(body)["result"] == "served");
+
+        call("no_such_method");
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 404") == 0);
+    }
+
+    SECTION("Checking fast methods answer with the status of their error, batched or not.") {
+        call("refuse");
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 404") == 0);
+        REQUIRE(parse(body)["error"]["message"] == "Not here");
+
+        std::string payload = "[{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"ping\",\"params\":[1.5,\"x\"]},"
+            "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"refuse\"}]";
+        send_all(fd, "POST /rpc HTTP/1.1\r\nHost: x\r\nContent-Length: " + std::to_string(payload.size())
+                 + "\r\n\r\n" + payload);
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 404") == 0);
+        Json::Value results = parse(body);
+        REQUIRE(results[0]["result"] == "pong");
+        REQUIRE(results[0]["id"] == 1);
+        REQUIRE(results[1]["error"]["code"].asInt() == int(xa::rpc_base::ERROR_METHOD_NOT_FOUND));
+    }
+
+    SECTION("Checking a method is given up at its timeout.") {
+        auto begin = std::chrono::steady_clock::now();
+        std::string payload = "[{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"forever\"}]";
+        send_all(fd, "POST /rpc HTTP/1.1\r\nHost: x\r\nContent-Length: " + std::to_string(payload.size())
+                 + "\r\n\r\n" + payload);
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(std::chrono::steady_clock::now() - begin < std::chrono::seconds(5));
+        REQUIRE(parse(body)[0]["error"]["message"] == "Timed out");
+    }
+
+    SECTION("Checking a fast method failing halfway answers an internal error, in any format.") {
+        call("give_up");
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 500") == 0);
+        REQUIRE(parse(body)["error"]["message"] == "Invalid Response");
+        REQUIRE(parse(body)["id"] == 1);
+
+        std::string payload;
+        xa::json::decoder decoder;
+        Json::Value res;
+        xa::json::encode(xa::json::FORMAT_CBOR,
+                         parse("{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"give_up\"}"), &payload);
+        send_all(fd, "POST /rpc HTTP/1.1\r\nHost: x\r\nContent-Type: application/cbor\r\nContent-Length: "
+                 + std::to_string(payload.size()) + "\r\n\r\n" + payload);
+        REQUIRE(read_response(fd, &buffer, &head, &body));
+        REQUIRE(head.compare(0, 12, "HTTP/1.1 500") == 0);
+        const xa::json::value* v = decoder.decode(xa::json::FORMAT_CBOR, body.data(), body.size());
+        REQUIRE(v != nullptr);
+        xa::json::convert(*v, &res);
+        REQUIRE(res["error"]["code"].asInt() == int(xa::rpc_base::ERROR_INTERNAL_ERROR));
+        REQUIRE(res["id"] == 2);
+    }
+
+    close(fd);
+    server.stop();
+    server.join();
+}
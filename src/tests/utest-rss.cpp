@@ -0,0 +1,154 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * Copyright (c) 2014 Xabyss Inc. All rights reserved.
+ */
+
+#define CATCH_CONFIG_MAIN
+#include <string.h>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "common/packet.hpp"
+#include "common/rss.hpp"
+
+using pca::flow_key;
+using pca::packet;
+using pca::rss::dispatcher;
+using pca::rss::toeplitz;
+
+// Microsoft's RSS verification key
+static const uint8_t ms_key[toeplitz::KEY_SIZE] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+static std::vector<uint8_t> make_tcp4_frame(const uint8_t (&src)[4], uint16_t sport,
+                                            const uint8_t (&dst)[4], uint16_t dport)
+{
+    std::vector<uint8_t> frame(14 + 20 + 20, 0);
+
+    frame[12] = 0x08;                   // IPv4
+    frame[14] = 0x45;
+    frame[14 + 9] = 6;                  // TCP
+    memcpy(&frame[14 + 12], src, 4);
+    memcpy(&frame[14 + 16], dst, 4);
+    frame[34] = sport >> 8;
+    frame[35] = sport & 0xff;
+    frame[36] = dport >> 8;
+    frame[37] = dport & 0xff;
+
+    return frame;
+}
+
+static packet make_packet(const std::vector<uint8_t>& frame)
+{
+    packet pkt;
+
+    pkt.ts = 0;
+    pkt.caplen = pkt.len = frame.size();
+    pkt.data = frame.data();
+
+    return pkt;
+}
+
+TEST_CASE("common_rss_test")
+{
+    const uint8_t src[4] = { 66, 9, 149, 187 };
+    const uint8_t dst[4] = { 161, 142, 100, 80 };
+
+    SECTION("Checking toeplitz hash with verification suite.") {
+        toeplitz hash(ms_key);
+        const uint8_t input[12] = { 66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6 };
+
+        REQUIRE(hash.hash(input, 8) == 0x323e8fc2);
+        REQUIRE(hash.hash(input, 12) == 0x51ccc178);
+
+        std::vector<uint8_t> frame = make_tcp4_frame(src, 2794, dst, 1766);
+        flow_key key;
+        REQUIRE(pca::decode::flow_key_of(make_packet(frame), &key));
+        REQUIRE(key.version == 4);
+        REQUIRE(key.src_port == 2794);
+        REQUIRE(key.dst_port == 1766);
+        REQUIRE(hash.hash(key) == 0x51ccc178);
+    }
+
+    SECTION("Checking symmetric hash of both directions.") {
+        toeplitz hash;
+        std::vector<uint8_t> forward = make_tcp4_frame(src, 2794, dst, 1766);
+        std::vector<uint8_t> backward = make_tcp4_frame(dst, 1766, src, 2794);
+        flow_key fkey, bkey;
+
+        REQUIRE(pca::decode::flow_key_of(make_packet(forward), &fkey));
+        REQUIRE(pca::decode::flow_key_of(make_packet(backward), &bkey));
+        REQUIRE(hash.hash(fkey) == hash.hash(bkey));
+    }
+
+    SECTION("Checking dispatcher keeps a flow on one worker.") {
+        dispatcher disp(4, 1024);
+        std::vector<std::vector<uint8_t>> frames;
+        std::vector<packet> pkts;
+
+        for (uint16_t port = 1000; port < 1100; port++) {
+            frames.push_back(make_tcp4_frame(src, port, dst, 80));
+            frames.push_back(make_tcp4_frame(dst, 80, src, port));
+        }
+        for (const auto& frame : frames) {
+            pkts.push_back(make_packet(frame));
+        }
+
+        REQUIRE(disp.dispatch(pkts.data(), pkts.size()) == pkts.size());
+        REQUIRE(disp.dropped() == 0);
+
+        size_t total = 0;
+        for (unsigned w = 0; w < disp.nworkers(); w++) {
+            packet out[512];
+            size_t n = disp.receive(w, out, 512);
+            for (size_t i = 0; i < n; i++) {
+                REQUIRE(disp.worker_of(out[i]) == w);
+            }
+            total += n;
+        }
+        REQUIRE(total == pkts.size());
+
+        for (size_t i = 0; i < pkts.size(); i += 2) {
+            REQUIRE(disp.worker_of(pkts[i]) == disp.worker_of(pkts[i + 1]));
+        }
+    }
+
+    SECTION("Checking dispatcher drops on full rings.") {
+        dispatcher disp(1, 8);
+        std::vector<uint8_t> frame = make_tcp4_frame(src, 2794, dst, 1766);
+        std::vector<packet> pkts(16, make_packet(frame));
+
+        REQUIRE(disp.dispatch(pkts.data(), pkts.size()) == 8);
+        REQUIRE(disp.dropped() == 8);
+    }
+}
+
+TEST_CASE("Benchmarking rss") {
+    const uint8_t src[4] = { 10, 0, 0, 1 };
+    const uint8_t dst[4] = { 10, 0, 0, 2 };
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<packet> pkts;
+
+    for (uint16_t port = 0; port < dispatcher::BATCH_SIZE; port++) {
+        frames.push_back(make_tcp4_frame(src, 1024 + port, dst, 443));
+    }
+    for (const auto& frame : frames) {
+        pkts.push_back(make_packet(frame));
+    }
+
+    dispatcher disp(8, 4096);
+    packet out[dispatcher::BATCH_SIZE];
+
+    BENCHMARK("dispatch and drain 256 packets over 8 workers") {
+        size_t n = disp.dispatch(pkts.data(), pkts.size());
+        for (unsigned w = 0; w < disp.nworkers(); w++) {
+            disp.receive(w, out, dispatcher::BATCH_SIZE);
+        }
+        return n;
+    };
+}